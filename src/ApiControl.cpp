@@ -0,0 +1,646 @@
+/// @file   ApiControl.cpp
+///
+/// Live control of instrumentation hooks over a local UNIX domain socket
+///
+/// The MIT License(MIT)
+/// @copyright 2014 Paul M Watt
+///
+//  ****************************************************************************
+//  Includes *******************************************************************
+#include "ApiControl.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+//  Static Data Members ********************************************************
+ApiControl::Entry           ApiControl::sm_entries[ApiControl::k_maxHooks];
+std::atomic<uint32_t>       ApiControl::sm_count(0);
+
+//  Control Plane State ********************************************************
+namespace // unnamed
+{
+
+const uint32_t  k_maxPayload      = 4096;   ///< Largest request payload.
+const uint32_t  k_minStreamPeriod = 10;     ///< Shortest stream period in ms.
+
+std::mutex      g_lock;                     ///< Serializes hook changes.
+std::thread     g_controller;
+std::string     g_path;                     ///< Path of the listening socket.
+int             g_listenFd  = -1;
+int             g_wakeFds[2] = { -1, -1 };  ///< Wakes the thread to stop.
+
+//  Forward Declarations *******************************************************
+PROC  LookupOriginal(const char* pLibName, const char* pFnName);
+bool  IsPeerAllowed(int fd);
+bool  ReadFully(int fd, void* pBuffer, size_t size);
+bool  SendResponse(int fd, uint32_t status, const std::string& payload);
+int   WaitForInput(int fd, int timeoutMs);
+uint16_t ClampNameLength(size_t length);
+
+template <typename T>
+void  AppendValue(std::string& buffer, const T& value);
+
+} // namespace anonymous
+
+//  Implementation *************************************************************
+//  ****************************************************************************
+/// Registers an instrumentation hook.  The hook is not installed until it
+/// is enabled.  The names must remain valid for the life of the process.
+///
+/// @param pLibName  Library module that exports the function.
+/// @param pFnName   The name of the function to hook.
+/// @param pfnHook   The hook function.
+/// @return          The id of the hook.
+///                  k_invalidId is returned, and reported on stderr, 
+///                  if k_maxHooks are registered, or if a name is longer 
+///                  than k_maxNameLength.
+///
+uint32_t ApiControl::Register(
+  const char* pLibName,
+  const char* pFnName,
+  PROC        pfnHook
+)
+{
+  std::lock_guard<std::mutex> lock(g_lock);
+
+  const uint32_t id = sm_count.load(std::memory_order_relaxed);
+  if (id >= k_maxHooks)
+  {
+    ::fprintf(stderr,
+              "[%4u - %s] Impossible to register %s, %u hooks are registered\n",
+              (unsigned)::getpid(),
+              program_invocation_name,
+              pFnName,
+              (unsigned)k_maxHooks
+             );
+    return k_invalidId;
+  }
+
+  // The names are sent with 16-bit lengths in each HookRecord.
+  if ( ::strlen(pLibName) > k_maxNameLength
+    || ::strlen(pFnName)  > k_maxNameLength)
+  {
+    ::fprintf(stderr,
+              "[%4u - %s] Impossible to register %.64s, the name is longer than %u bytes\n",
+              (unsigned)::getpid(),
+              program_invocation_name,
+              pFnName,
+              (unsigned)k_maxNameLength
+             );
+    return k_invalidId;
+  }
+
+  Entry& entry    = sm_entries[id];
+  entry.pLibName  = pLibName;
+  entry.pFnName   = pFnName;
+  entry.pfnHook   = pfnHook;
+  entry.pHook     = NULL;
+  entry.pfnOrig.store(LookupOriginal(pLibName, pFnName), std::memory_order_release);
+
+  sm_count.store(id + 1, std::memory_order_release);
+  return id;
+}
+
+//  ****************************************************************************
+/// Installs a registered hook in every module of the process.
+///
+/// @return  true    The hook is installed.
+/// @return false    The id is not registered, or the function was not found.
+///
+bool ApiControl::Enable(uint32_t id)
+{
+  std::lock_guard<std::mutex> lock(g_lock);
+  if (id >= sm_count.load(std::memory_order_acquire))
+  {
+    return false;
+  }
+
+  Entry& entry = sm_entries[id];
+  if (entry.pHook)
+  {
+    return true;
+  }
+
+  // The hook can be called as soon as the first slot is written,
+  // so its original address must be known before it is installed.
+  PROC pfnOrig = LookupOriginal(entry.pLibName, entry.pFnName);
+  if (!pfnOrig)
+  {
+    return false;
+  }
+
+  entry.pfnOrig.store(pfnOrig, std::memory_order_release);
+
+  ApiHook* pHook = new ApiHook(entry.pLibName, entry.pFnName, entry.pfnHook);
+  if (!(PROC)*pHook)
+  {
+    delete pHook;
+    return false;
+  }
+
+  entry.pfnOrig.store((PROC)*pHook, std::memory_order_release);
+  entry.pHook = pHook;
+  return true;
+}
+
+//  ****************************************************************************
+/// Removes a registered hook from every module of the process.
+///
+/// @return  true    The hook is not installed.
+/// @return false    The id is not registered.
+///
+bool ApiControl::Disable(uint32_t id)
+{
+  std::lock_guard<std::mutex> lock(g_lock);
+  if (id >= sm_count.load(std::memory_order_acquire))
+  {
+    return false;
+  }
+
+  // The original address is kept for calls that are still in the hook.
+  Entry& entry = sm_entries[id];
+  delete entry.pHook;
+  entry.pHook = NULL;
+  return true;
+}
+
+//  ****************************************************************************
+/// Starts the control thread, listening on a UNIX domain socket.
+/// Only the owner of the process and root may connect.
+///
+/// @param pPath     The path of the socket.  A stale socket is replaced.
+/// @return  true    The control thread is running.
+/// @return false    The socket could not be created.
+///
+bool ApiControl::Start(const char* pPath)
+{
+  std::lock_guard<std::mutex> lock(g_lock);
+  if (g_listenFd >= 0)
+  {
+    return false;
+  }
+
+  sockaddr_un addr;
+  ::memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (::strlen(pPath) >= sizeof(addr.sun_path))
+  {
+    return false;
+  }
+
+  ::strcpy(addr.sun_path, pPath);
+
+  // Only replace a socket left by an earlier run, never another file.
+  struct stat info;
+  if ( 0 == ::lstat(pPath, &info)
+    && S_ISSOCK(info.st_mode))
+  {
+    ::unlink(pPath);
+  }
+
+  int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0)
+  {
+    return false;
+  }
+
+  if (0 != ::bind(fd, (const sockaddr*)&addr, sizeof(addr)))
+  {
+    ::close(fd);
+    return false;
+  }
+
+  // The socket file now exists, and is removed if the rest fails.
+  if ( 0 != ::chmod(pPath, S_IRUSR | S_IWUSR)
+    || 0 != ::listen(fd, 4)
+    || 0 != ::pipe2(g_wakeFds, O_CLOEXEC))
+  {
+    ::close(fd);
+    ::unlink(pPath);
+    g_wakeFds[0]  = -1;
+    g_wakeFds[1]  = -1;
+    return false;
+  }
+
+  g_path      = pPath;
+  g_listenFd  = fd;
+  g_controller = std::thread(ControlThread);
+  return true;
+}
+
+//  ****************************************************************************
+/// Stops the control thread and removes the socket.
+/// Hooks that are enabled remain installed.
+///
+void ApiControl::Stop()
+{
+  // The control thread takes the lock to apply commands, so it is joined 
+  // without the lock.  Taking the thread out of g_controller makes a 
+  // concurrent Stop return, and Start fails until the socket is closed.
+  std::thread controller;
+  {
+    std::lock_guard<std::mutex> lock(g_lock);
+    if ( g_listenFd < 0
+      || !g_controller.joinable())
+    {
+      return;
+    }
+
+    const char wake = 0;
+    ssize_t written = ::write(g_wakeFds[1], &wake, 1);
+    (void)written;
+
+    controller.swap(g_controller);
+  }
+
+  controller.join();
+
+  std::lock_guard<std::mutex> lock(g_lock);
+  ::close(g_listenFd);
+  ::close(g_wakeFds[0]);
+  ::close(g_wakeFds[1]);
+  ::unlink(g_path.c_str());
+
+  g_listenFd    = -1;
+  g_wakeFds[0]  = -1;
+  g_wakeFds[1]  = -1;
+}
+
+//  ****************************************************************************
+/// Accepts clients one at a time, and serves their requests until they
+/// disconnect or time out.  The thread sleeps in poll while no client is 
+/// connected.
+///
+void ApiControl::ControlThread()
+{
+  for (;;)
+  {
+    if (WaitForInput(g_listenFd, -1) <= 0)
+    {
+      return;
+    }
+
+    int fd = ::accept4(g_listenFd, NULL, NULL, SOCK_CLOEXEC);
+    if (fd < 0)
+    {
+      continue;
+    }
+
+    // A client that stops reading or writing mid-message is dropped.
+    timeval timeout;
+    timeout.tv_sec  = k_clientTimeoutMs / 1000;
+    timeout.tv_usec = (k_clientTimeoutMs % 1000) * 1000;
+    ::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    ::setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    if (IsPeerAllowed(fd))
+    {
+      std::vector<char> payload(k_maxPayload);
+      for (;;)
+      {
+        // An idle client is dropped so the next one can connect.
+        RequestHeader request;
+        if ( WaitForInput(fd, k_clientTimeoutMs) <= 0
+          || !ReadFully(fd, &request, sizeof(request)))
+        {
+          break;
+        }
+
+        if (request.length > k_maxPayload)
+        {
+          SendResponse(fd, k_badRequest, std::string());
+          break;
+        }
+
+        if ( !ReadFully(fd, &payload[0], request.length)
+          || !ServeRequest(fd, request, &payload[0]))
+        {
+          break;
+        }
+      }
+    }
+
+    ::close(fd);
+  }
+}
+
+//  ****************************************************************************
+/// Applies a single request, and sends its response.
+///
+/// @return  true    The connection can accept another request.
+/// @return false    The client disconnected, or the thread is stopping.
+///
+bool ApiControl::ServeRequest(
+  int                   fd,
+  const RequestHeader&  request,
+  const char*           pPayload
+)
+{
+  std::string response;
+  switch (request.command)
+  {
+  case k_listImports:
+    {
+      std::vector<ApiHook::ImportEntry> imports;
+      ApiHook::ListImports(imports);
+      for (size_t index = 0; index < imports.size(); ++index)
+      {
+        const ApiHook::ImportEntry& import = imports[index];
+
+        ImportRecord record;
+        record.slot           = (uint64_t)(uintptr_t)import.ppfn;
+        record.value          = (uint64_t)(uintptr_t)import.pfn;
+        record.moduleLength   = ClampNameLength(import.module.size());
+        record.libraryLength  = ClampNameLength(import.library.size());
+        record.nameLength     = ClampNameLength(import.name.size());
+        record.flags          = ( record.moduleLength  < import.module.size()
+                               || record.libraryLength < import.library.size()
+                               || record.nameLength    < import.name.size())
+                              ? k_truncated
+                              : 0;
+
+        AppendValue(response, record);
+        response.append(import.module,  0, record.moduleLength);
+        response.append(import.library, 0, record.libraryLength);
+        response.append(import.name,    0, record.nameLength);
+      }
+
+      return SendResponse(fd, k_ok, response);
+    }
+
+  case k_listHooks:
+    {
+      std::lock_guard<std::mutex> lock(g_lock);
+      const uint32_t count = sm_count.load(std::memory_order_acquire);
+      for (uint32_t id = 0; id < count; ++id)
+      {
+        const Entry& entry = sm_entries[id];
+
+        HookRecord record;
+        record.id             = id;
+        record.isEnabled      = entry.pHook ? 1 : 0;
+        record.libraryLength  = (uint16_t)::strlen(entry.pLibName);
+        record.nameLength     = (uint16_t)::strlen(entry.pFnName);
+
+        AppendValue(response, record);
+        response.append(entry.pLibName, record.libraryLength);
+        response.append(entry.pFnName,  record.nameLength);
+      }
+
+      return SendResponse(fd, k_ok, response);
+    }
+
+  case k_enable:
+  case k_disable:
+    {
+      if (request.id >= sm_count.load(std::memory_order_acquire))
+      {
+        return SendResponse(fd, k_unknownHook, response);
+      }
+
+      const bool isSuccess = (k_enable == request.command)
+                           ? Enable(request.id)
+                           : Disable(request.id);
+      return SendResponse(fd, isSuccess ? k_ok : k_failed, response);
+    }
+
+  case k_readCounters:
+    AppendCounters(response);
+    return SendResponse(fd, k_ok, response);
+
+  case k_streamCounters:
+    {
+      uint32_t periodMs = 0;
+      if (request.length != sizeof(periodMs))
+      {
+        return SendResponse(fd, k_badRequest, response);
+      }
+
+      ::memcpy(&periodMs, pPayload, sizeof(periodMs));
+      if (periodMs < k_minStreamPeriod)
+      {
+        periodMs = k_minStreamPeriod;
+      }
+
+      for (;;)
+      {
+        response.clear();
+        AppendCounters(response);
+        if (!SendResponse(fd, k_ok, response))
+        {
+          return false;
+        }
+
+        const int result = WaitForInput(fd, (int)periodMs);
+        if (result < 0)
+        {
+          return false;
+        }
+
+        if (result > 0)
+        {
+          // Any byte from the client ends the stream.
+          char stop = 0;
+          return 1 == ::recv(fd, &stop, 1, 0);
+        }
+      }
+    }
+
+  default:
+    return SendResponse(fd, k_unknownCommand, response);
+  }
+}
+
+//  ****************************************************************************
+/// Appends a CounterRecord for every registered hook to a response.
+///
+void ApiControl::AppendCounters(std::string& response)
+{
+  const uint32_t count = sm_count.load(std::memory_order_acquire);
+  for (uint32_t id = 0; id < count; ++id)
+  {
+    const Entry& entry = sm_entries[id];
+
+    CounterRecord record;
+    record.id         = id;
+    record.isEnabled  = entry.pHook ? 1 : 0;
+    record.calls      = entry.calls.load(std::memory_order_relaxed);
+    record.elapsedNs  = entry.elapsedNs.load(std::memory_order_relaxed);
+    AppendValue(response, record);
+  }
+}
+
+namespace // unnamed
+{
+
+//  ****************************************************************************
+/// Finds the address a hook for a function would forward to.
+/// This is the same lookup ApiHook uses for its original address.
+///
+PROC LookupOriginal(
+  const char* pLibName,
+  const char* pFnName
+)
+{
+  void* hLib = ::dlopen(pLibName, RTLD_LAZY | RTLD_NOLOAD);
+  if (!hLib)
+  {
+    return NULL;
+  }
+
+  PROC pfn = (PROC)::dlsym(hLib, pFnName);
+  ::dlclose(hLib);
+  return pfn;
+}
+
+//  ****************************************************************************
+/// Indicates if the client is run by the owner of this process, or root.
+///
+bool IsPeerAllowed(int fd)
+{
+  ucred     peer;
+  socklen_t size = sizeof(peer);
+  if (0 != ::getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &peer, &size))
+  {
+    return false;
+  }
+
+  return 0 == peer.uid
+      || ::geteuid() == peer.uid;
+}
+
+//  ****************************************************************************
+/// Receives an exact number of bytes.
+///
+bool ReadFully(int fd, void* pBuffer, size_t size)
+{
+  char* pNext = (char*)pBuffer;
+  while (size)
+  {
+    ssize_t count = ::recv(fd, pNext, size, 0);
+    if (count <= 0)
+    {
+      if (count < 0 && EINTR == errno)
+      {
+        continue;
+      }
+
+      return false;
+    }
+
+    pNext += count;
+    size  -= (size_t)count;
+  }
+
+  return true;
+}
+
+//  ****************************************************************************
+/// Sends a response header and its payload.
+///
+bool SendResponse(int fd, uint32_t status, const std::string& payload)
+{
+  ApiControl::ResponseHeader header;
+  header.status = status;
+  header.length = (uint32_t)payload.size();
+
+  std::string message;
+  message.reserve(sizeof(header) + payload.size());
+  AppendValue(message, header);
+  message.append(payload);
+
+  const char* pNext = message.data();
+  size_t      size  = message.size();
+  while (size)
+  {
+    // A client that disconnects must not raise SIGPIPE in the service.
+    ssize_t count = ::send(fd, pNext, size, MSG_NOSIGNAL);
+    if (count <= 0)
+    {
+      if (count < 0 && EINTR == errno)
+      {
+        continue;
+      }
+
+      return false;
+    }
+
+    pNext += count;
+    size  -= (size_t)count;
+  }
+
+  return true;
+}
+
+//  ****************************************************************************
+/// Waits for a descriptor to be readable, or for Stop.
+///
+/// @param fd        The descriptor to wait for.
+/// @param timeoutMs The longest wait, or -1 to wait until input arrives.
+/// @return          1 if fd is readable, 0 on timeout,
+///                  -1 if the thread is stopping or poll failed.
+///
+int WaitForInput(int fd, int timeoutMs)
+{
+  for (;;)
+  {
+    pollfd fds[2] =
+    {
+      { fd,          POLLIN, 0 },
+      { g_wakeFds[0], POLLIN, 0 }
+    };
+
+    const int result = ::poll(fds, 2, timeoutMs);
+    if (result < 0)
+    {
+      if (EINTR == errno)
+      {
+        continue;
+      }
+
+      return -1;
+    }
+
+    if (fds[1].revents)
+    {
+      return -1;
+    }
+
+    return fds[0].revents ? 1 : 0;
+  }
+}
+
+//  ****************************************************************************
+/// Returns the length of a name in a record, at most k_maxNameLength.
+///
+uint16_t ClampNameLength(size_t length)
+{
+  return length < ApiControl::k_maxNameLength
+         ? (uint16_t)length
+         : ApiControl::k_maxNameLength;
+}
+
+//  ****************************************************************************
+/// Appends the bytes of a record to a buffer.
+///
+template <typename T>
+void AppendValue(std::string& buffer, const T& value)
+{
+  buffer.append((const char*)&value, sizeof(value));
+}
+
+} // namespace unnamed
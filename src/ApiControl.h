@@ -0,0 +1,248 @@
+/// @file   ApiControl.h
+///
+/// Live control of instrumentation hooks over a local UNIX domain socket
+///
+/// Instrumentation hooks are registered when the program starts, but are not
+/// installed.  A control thread listens on a UNIX domain socket, and a client
+/// can list the hookable imports of the process, install or remove the
+/// registered hooks, and read or stream their call counters, while the
+/// process keeps running.  Hooks are installed and removed through ApiHook,
+/// the same as hooks created in code.
+///
+/// The control plane costs nothing when idle.  The control thread sleeps in
+/// the kernel until a client connects, and a hook that is not enabled is not
+/// installed, so its function is called directly.
+///
+/// Example:
+///   int Hook_send(int fd, const void* pBuf, size_t len, int flags)
+///   {
+///     ApiControl::Scope scope(g_sendId);
+///     return ((pfnsend)ApiControl::GetOriginal(g_sendId))(fd, pBuf, len, flags);
+///   }
+///
+///   g_sendId = ApiControl::Register("libc.so.6", "send", (PROC)Hook_send);
+///   ApiControl::Start("/run/myservice/hooks.sock");
+///
+/// Protocol:
+///   Every request is a RequestHeader followed by length bytes of payload.
+///   Every response is a ResponseHeader followed by length bytes of payload.
+///   Clients are served one at a time.  A client that sends nothing for
+///   k_clientTimeoutMs, or stalls in the middle of a message, is
+///   disconnected so the next client can connect.
+///   Integers are in the byte order of the host.  Strings are not terminated.
+///
+///   k_listImports     Payload: none.
+///                     Response: for each import slot, an ImportRecord
+///                     followed by the module, library and function names.
+///                     A name longer than k_maxNameLength is cut to that 
+///                     length, and the record has the k_truncated flag.
+///   k_listHooks       Payload: none.
+///                     Response: for each registered hook, a HookRecord
+///                     followed by the library and function names.  Register
+///                     refuses names longer than k_maxNameLength.
+///   k_enable          Installs hook id.  Response: status only.
+///   k_disable         Removes hook id.   Response: status only.
+///   k_readCounters    Payload: none.
+///                     Response: a CounterRecord for each registered hook.
+///   k_streamCounters  Payload: uint32_t period in milliseconds.
+///                     Response: a k_readCounters response every period,
+///                     until the client sends any byte or disconnects.
+///
+/// The MIT License(MIT)
+/// @copyright 2014 Paul M Watt
+///
+//  ****************************************************************************
+#ifndef APICONTROL_H_INCLUDED
+#define APICONTROL_H_INCLUDED
+//  Includes *******************************************************************
+#include "ApiHook.h"
+
+#include <atomic>
+#include <string>
+#include <stdint.h>
+
+#ifdef WIN32
+# error "The API control plane requires a POSIX platform."
+#endif
+
+#include <time.h>
+
+//  ****************************************************************************
+/// Installs and removes registered hooks at the request of a local client.
+///
+class ApiControl
+{
+public:
+  //  Constants ****************************************************************
+  static const uint32_t k_maxHooks   = 256;       ///< Hooks that can be registered.
+  static const uint32_t k_invalidId  = 0xFFFFFFFF;
+  static const int      k_clientTimeoutMs = 30000;  ///< Idle time before a client is dropped.
+  static const uint16_t k_maxNameLength   = 0xFFFF; ///< Longest name in a record.
+  static const uint16_t k_truncated       = 1;      ///< ImportRecord flag.
+
+  //  Typedef ******************************************************************
+  enum Command
+  {
+    k_listImports     = 1,
+    k_listHooks       = 2,
+    k_enable          = 3,
+    k_disable         = 4,
+    k_readCounters    = 5,
+    k_streamCounters  = 6
+  };
+
+  enum Status
+  {
+    k_ok              = 0,
+    k_badRequest      = 1,
+    k_unknownCommand  = 2,
+    k_unknownHook     = 3,
+    k_failed          = 4
+  };
+
+  struct RequestHeader
+  {
+    uint32_t  command;                  ///< A Command value.
+    uint32_t  id;                       ///< Hook id for k_enable and k_disable.
+    uint32_t  length;                   ///< Bytes of payload that follow.
+  };
+
+  struct ResponseHeader
+  {
+    uint32_t  status;                   ///< A Status value.
+    uint32_t  length;                   ///< Bytes of payload that follow.
+  };
+
+  struct ImportRecord
+  {
+    uint64_t  slot;                     ///< Address of the import slot.
+    uint64_t  value;                    ///< Address held by the slot.
+    uint16_t  moduleLength;
+    uint16_t  libraryLength;
+    uint16_t  nameLength;
+    uint16_t  flags;                    ///< k_truncated if a name is cut to 
+                                        ///  k_maxNameLength bytes.
+  };
+
+  struct HookRecord
+  {
+    uint32_t  id;
+    uint32_t  isEnabled;
+    uint16_t  libraryLength;
+    uint16_t  nameLength;
+  };
+
+  struct CounterRecord
+  {
+    uint32_t  id;
+    uint32_t  isEnabled;
+    uint64_t  calls;                    ///< Calls counted by the hook.
+    uint64_t  elapsedNs;                ///< Time spent in the timed calls.
+  };
+
+  //  **************************************************************************
+  /// Counts a call to a hook, and the time until the scope ends.
+  ///
+  class Scope
+  {
+  public:
+    explicit Scope(uint32_t id)
+      : m_id(id)
+      , m_start(ReadClockNs())
+    { }
+
+   ~Scope()
+    {
+      Count(m_id, ReadClockNs() - m_start);
+    }
+
+  private:
+    uint32_t  m_id;
+    uint64_t  m_start;
+  };
+
+  //  Methods ******************************************************************
+  static
+    uint32_t  Register(const char* pLibName, const char* pFnName, PROC pfnHook);
+
+  static
+    bool      Enable(uint32_t id);
+
+  static
+    bool      Disable(uint32_t id);
+
+  static
+    bool      Start(const char* pPath);
+
+  static
+    void      Stop();
+
+  //  **************************************************************************
+  /// Returns the address a hook forwards its calls to.
+  /// NULL is returned if id is not registered.
+  ///
+  static
+    PROC      GetOriginal(uint32_t id)
+  {
+    return id < sm_count.load(std::memory_order_acquire)
+           ? sm_entries[id].pfnOrig.load(std::memory_order_acquire)
+           : NULL;
+  }
+
+  //  **************************************************************************
+  /// Counts a call to a hook.  A call to an id that is not registered 
+  /// is ignored.
+  ///
+  static
+    void      Count(uint32_t id, uint64_t elapsedNs = 0)
+  {
+    if (id < sm_count.load(std::memory_order_relaxed))
+    {
+      sm_entries[id].calls.fetch_add(1, std::memory_order_relaxed);
+      sm_entries[id].elapsedNs.fetch_add(elapsedNs, std::memory_order_relaxed);
+    }
+  }
+
+  //  **************************************************************************
+  static
+    uint64_t  ReadClockNs()
+  {
+    timespec now;
+    ::clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+  }
+
+private:
+  //  Typedef ******************************************************************
+  /// A registered hook.  Entries are never removed, so a hook that is still
+  /// running when it is disabled can read its original address.
+  struct Entry
+  {
+    const char*           pLibName;
+    const char*           pFnName;
+    PROC                  pfnHook;
+    ApiHook*              pHook;        ///< The installed hook, if enabled.
+    std::atomic<PROC>     pfnOrig;
+    std::atomic<uint64_t> calls;
+    std::atomic<uint64_t> elapsedNs;
+  };
+
+  //  Data Members *************************************************************
+  static
+    Entry                 sm_entries[k_maxHooks];
+
+  static
+    std::atomic<uint32_t> sm_count;     ///< Registered entries.
+
+  //  Methods ******************************************************************
+  static
+    void      ControlThread();
+
+  static
+    bool      ServeRequest(int fd, const RequestHeader& request, const char* pPayload);
+
+  static
+    void      AppendCounters(std::string& response);
+};
+
+#endif
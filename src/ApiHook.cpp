@@ -12,7 +12,10 @@
 //  ****************************************************************************
 //  Includes *******************************************************************
 #include "ApiHook.h"
+#include "SlotMatcher.h"
 #include <algorithm>
+#include <cstring>
+#include <utility>
 
 #ifdef WIN32
 # include <ImageHlp.h>
@@ -20,15 +23,48 @@
 
 # include <TlHelp32.h>
 # include <StrSafe.h>
+#elif defined(__linux__)
+# include <dlfcn.h>
+# include <elf.h>
+# include <link.h>
+# include <fcntl.h>
+# include <unistd.h>
+# include <sys/mman.h>
+# include <cctype>
+# include <cerrno>
+# include <climits>
+# include <cstdio>
+# include <cstdlib>
+# include <pthread.h>
+# include <sched.h>
 #else
 # error "An implementation to Hook API calls has not been provided for this platform."
 #endif
 
 //  Static Data Members ********************************************************
 ApiHook::ApiHookArray ApiHook::sm_hooks;          ///< Declare static instance.
+ApiHook::ApiHookArray ApiHook::sm_liveHooks;      ///< Declare static instance.
+size_t  ApiHook::sm_nextId      = 0;              ///< Hooks are numbered from 0.
 
 bool    ApiHook::sm_isExclude   = false;          ///< Exclude this module by default.
 PVOID   ApiHook::sm_pMaxAppAddr = NULL;           ///< Initialize value on startup.
+size_t  ApiHook::sm_patchThreadCount = 1;         ///< Patch serially by default.
+
+//  ****************************************************************************
+/// The modules to match for ReplaceIATEntriesEx, shared by its workers.
+///
+struct ApiHook::PatchJob
+{
+  const std::vector<HMODULE>*                   pModules;
+  const SlotMatcher*                            pMatcher;
+  const ApiHookArray*                           pHooks;
+  std::vector<std::vector<PatchRecord> >*       pResults;   ///< One list for each module.
+#ifdef WIN32
+  volatile LONG                                 next;       ///< Next module to match.
+#else
+  volatile size_t                               next;       ///< Next module to match.
+#endif
+};
 
 
 #ifdef WIN32
@@ -37,17 +73,122 @@ ApiHook ApiHook::sm_LoadLibraryW  ("Kernel32.dll", "LoadLibraryW",   (PROC)ApiHo
 ApiHook ApiHook::sm_LoadLibraryExA("Kernel32.dll", "LoadLibraryExA", (PROC)ApiHook::LoadLibraryExA);
 ApiHook ApiHook::sm_LoadLibraryExW("Kernel32.dll", "LoadLibraryExW", (PROC)ApiHook::LoadLibraryExW);
 ApiHook ApiHook::sm_GetProcAddress("Kernel32.dll", "GetProcAddress", (PROC)ApiHook::GetProcAddress);
+#else
+ApiHook ApiHook::sm_dlopen        ("libc.so.6",    "dlopen",         (PROC)ApiHook::dlopen);
+ApiHook ApiHook::sm_dlclose       ("libc.so.6",    "dlclose",        (PROC)ApiHook::dlclose);
 #endif
 
 //  Forward Declarations *******************************************************
 namespace // unnamed
 {
 
+//  ****************************************************************************
+/// Holds the lock that serializes the hook list and the module enumeration, 
+/// for the life of the object.  The lock is recursive, because a hooked 
+/// function, or a module loaded while hooks are installed, may create or 
+/// destroy a hook on the thread that already holds it.
+///
+class HookListLock
+{
+public:
+  HookListLock();
+ ~HookListLock();
+
+private:
+  // Not implemented.
+  HookListLock(const HookListLock&);
+  HookListLock& operator=(const HookListLock&);
+};
+
 HMODULE GetModuleFromAddress(PVOID pv);
 bool ReplaceFunctionAddress(PROC* ppfnOrig, PROC pfnNew);
 
+size_t GetPageSize();
+size_t GetProcessorCount();
+void GetProcessModules(std::vector<HMODULE>& modules);
+void GetImportSlots(HMODULE hMod, std::vector<ApiHook::PatchRecord>& records);
+void GetImportEntries(HMODULE hMod, std::vector<ApiHook::ImportEntry>& imports);
+void QueryPageProtection(std::vector<ApiHook::PatchPage>& pages);
+bool WritePatchPage(const ApiHook::PatchPage& page, const ApiHook::PatchRecord* pRecords);
+bool IsRecordBefore(const ApiHook::PatchRecord& lhs, const ApiHook::PatchRecord& rhs);
+bool IsSameSlot(const ApiHook::PatchRecord& lhs, const ApiHook::PatchRecord& rhs);
+void CommitPatchRecords(std::vector<ApiHook::PatchRecord>& records);
+
+/// The fewest modules worth creating another patch thread for.
+const size_t k_modulesPerThread = 16;
+
+/// The hook function and original function of each destroyed hook, oldest 
+/// first.
+typedef std::vector<std::pair<PROC, PROC> >     UnwindArray;
+
+PROC UnwindHooks(const UnwindArray& unwind, PROC pfn);
+
 #ifdef WIN32
 LONG WINAPI InvalidReadExceptionFilter(PEXCEPTION_POINTERS pep);
+PIMAGE_IMPORT_DESCRIPTOR GetImportDescriptor(HMODULE hMod);
+
+SRWLOCK g_imageHlpLock = SRWLOCK_INIT;  ///< ImageHlp is single-threaded.
+
+SRWLOCK         g_hookLock      = SRWLOCK_INIT;
+volatile DWORD  g_hookLockOwner = 0;    ///< Thread that holds g_hookLock.
+size_t          g_hookLockDepth = 0;
+#else
+pthread_mutex_t g_hookLock      = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
+
+typedef int (*pfnpthread_mutex)(pthread_mutex_t*);
+
+//  ****************************************************************************
+/// The pthread functions that HookListLock calls.
+///
+struct MutexFunctions
+{
+  pfnpthread_mutex    pfnLock;
+  pfnpthread_mutex    pfnUnlock;
+};
+
+const MutexFunctions& GetMutexFunctions();
+
+//  ****************************************************************************
+/// The dynamic linking tables of a loaded ELF module.
+///
+struct ElfImage
+{
+  ElfW(Addr)            base;           ///< Load bias of the module.
+  ElfW(Sym)*            pSymTab;        ///< Dynamic symbol table.
+  const char*           pStrTab;        ///< Dynamic string table.
+  const Elf32_Word*     pHash;          ///< SysV hash table (DT_HASH).
+  const Elf32_Word*     pGnuHash;       ///< GNU hash table (DT_GNU_HASH).
+  const ElfW(Half)*     pVerSym;        ///< Symbol version indices.
+  const unsigned char*  pJmpRel;        ///< PLT relocations.
+  size_t                jmpRelSize;     ///< Size in bytes of the PLT relocations.
+  const unsigned char*  pRel;           ///< Data relocations.
+  size_t                relSize;        ///< Size in bytes of the data relocations.
+  size_t                relEntSize;     ///< Size of a single relocation entry.
+};
+
+bool        GetElfImage(HMODULE hMod, ElfImage& image);
+PROC*       GetElfSlot(const ElfImage& image, const unsigned char* pReloc);
+const char* GetElfSymbolName(const ElfImage& image, const unsigned char* pReloc);
+ElfW(Sym)*  FindElfSymbol(const ElfImage& image, const char* pName);
+void        MatchElfSlots(const ElfImage& image,
+                          const SlotMatcher& matcher,
+                          std::vector<std::pair<PROC*, size_t> >& matches);
+void        ReplaceElfSlots(const ElfImage& image,
+                            const unsigned char* pRelocs,
+                            size_t relocSize,
+                            size_t relocEntSize,
+                            PROC pfnOrig,
+                            PROC pfnNew);
+bool        WriteSelfMemory(PVOID pDest, const void* pSrc, size_t size);
+int         QueryProtection(PVOID pv);
+int         AddModuleAddress(dl_phdr_info* pInfo, size_t size, void* pAddresses);
+
+typedef void* (*pfndlopen)(const char*, int);
+
+std::string ResolveModulePath(const char* pszModulePath, HMODULE hCaller, pfndlopen pfnDlopen);
+const char* GetElfSearchPath(HMODULE hMod, ElfW(Sxword) tag);
+bool        ExpandOrigin(HMODULE hMod, std::string& path);
+bool        FindInSearchPath(const char* pSearchPath, HMODULE hMod, const std::string& name, std::string& path);
 #endif
 
 } // namespace anonymous
@@ -61,14 +202,24 @@ ApiHook::ApiHook(
 )
   : m_libName(pLibName)
   , m_fnName(pFnName)
+  , m_hLib(NULL)
+  , m_pfnOrig(NULL)
   , m_pfnHook(pfnHook)
+  , m_id(0)
+#ifndef WIN32
+  , m_pfnExport(NULL)
+  , m_exportInfo(0)
+#endif
 {
-  sm_hooks.push_back(this);
-
 #ifdef WIN32
   // Query for the address of the original function to hook.
-  HMODULE hModule = ::GetModuleHandleA(pLibName);
-  m_pfnOrig       = GetProcAddressRaw(hModule, pFnName);
+  m_hLib    = ::GetModuleHandleA(pLibName);
+  m_pfnOrig = GetProcAddressRaw(m_hLib, pFnName);
+
+  HookListLock lock;
+  m_id = sm_nextId++;
+  sm_liveHooks.push_back(this);
+  sm_hooks.push_back(this);
 
   // If the function does not exist, exit.
   // This usually occurs because the library is not yet loaded.
@@ -90,6 +241,44 @@ ApiHook::ApiHook(
     return;
   }
 
+#else
+  // Query for the loader entry of the library without loading it.
+  void* hLib = ::dlopen(pLibName, RTLD_LAZY | RTLD_NOLOAD);
+  if (hLib)
+  {
+    ::dlinfo(hLib, RTLD_DI_LINKMAP, &m_hLib);
+    ::dlclose(hLib);
+  }
+
+  m_pfnOrig = m_hLib
+              ? GetProcAddressRaw(m_hLib, pFnName)
+              : NULL;
+
+  // The loader lock is taken above, before the hook list is locked, the same
+  // order as the dlopen and dlclose hooks.
+  HookListLock lock;
+  m_id = sm_nextId++;
+  sm_liveHooks.push_back(this);
+  sm_hooks.push_back(this);
+
+  // If the function does not exist, exit.
+  // This usually occurs because the library is not yet loaded.
+  if (!m_pfnOrig)
+  {
+    ::fprintf(stderr, 
+              "[%4u - %s] Impossible to find %s\n",
+              (unsigned)::getpid(), 
+              program_invocation_name, 
+              pFnName
+             );
+    return;
+  }
+
+  // Redirect the exported symbol as well, so later calls to dlsym and 
+  // lazy-binding lookups resolve to the hook.  The export is saved first, 
+  // the address dlsym returns for an indirect function is not the symbol.
+  GetEATEntry(m_hLib, pFnName, m_pfnExport, m_exportInfo);
+  ReplaceEATEntry(m_hLib, pFnName, m_pfnHook);
 #endif
 
   // Hook the requested function for all currently loaded modules.
@@ -99,15 +288,30 @@ ApiHook::ApiHook(
 //  ****************************************************************************
 ApiHook::~ApiHook()
 {
+  HookListLock lock;
+
+#ifndef WIN32
+  if (m_pfnExport)
+  {
+    SetEATEntry(m_hLib, m_fnName.c_str(), m_pfnExport, m_exportInfo);
+  }
+#endif
+
   // Unhook this function from all modules.
   ReplaceIATEntryEx(m_libName.c_str(), m_pfnHook, m_pfnOrig);
 
-  // Remove this object from the management container.
+  // Remove this object from the management containers.
   ApiHookArray::iterator iter = std::find(sm_hooks.begin(), sm_hooks.end(), this);
   if (iter != sm_hooks.end())
   {
     sm_hooks.erase(iter);
   }
+
+  iter = std::find(sm_liveHooks.begin(), sm_liveHooks.end(), this);
+  if (iter != sm_liveHooks.end())
+  {
+    sm_liveHooks.erase(iter);
+  }
 }
 
 //  IMPORTANT: Do not inline this function. ************************************
@@ -116,6 +320,7 @@ FARPROC WINAPI ApiHook::GetProcAddressRaw(
   const char* pProcName
 )
 {
+#ifdef WIN32
   typedef FARPROC (WINAPI *pfnGetProcAddress)(HMODULE, PCSTR);
 
   pfnGetProcAddress pfnProc = (pfnGetProcAddress)(PROC)sm_GetProcAddress;
@@ -126,13 +331,17 @@ FARPROC WINAPI ApiHook::GetProcAddressRaw(
   }
 
   return pfnProc(hMod, pProcName);
+#else
+  // The glibc dlopen handle for a module is its link_map entry.
+  return (FARPROC)::dlsym(hMod, pProcName);
+#endif
 }
 
 //  ****************************************************************************
 HMODULE ApiHook::GetExcludeModuleHandle()
 {
   return  GetModuleExclude()
-          ? GetModuleFromAddress(GetExcludeModuleHandle)
+          ? GetModuleFromAddress((PVOID)GetExcludeModuleHandle)
           : NULL;
 }
 
@@ -172,6 +381,18 @@ void WINAPI ApiHook::ReplaceIATEntryEx(
   ::CloseHandle(hModuleSnap);
   hModuleSnap = NULL;
 
+#else
+  std::vector<HMODULE> modules;
+  GetProcessModules(modules);
+  for (size_t index = 0; index < modules.size(); ++index)
+  {
+    // Don't hook functions from modules that match hThisMod;
+    if (modules[index] != hThisMod)
+    {
+      // Hook this function in the specified module.
+      ReplaceIATEntry(pLibName, pfnOrig, pfnHook, modules[index]);
+    }
+  }
 #endif
 
 }
@@ -184,6 +405,7 @@ void WINAPI ApiHook::ReplaceIATEntry(
   HMODULE     hModCaller
 )
 {
+#ifdef WIN32
   // Exceptions may occur during this call based on threading, the state of
   // library loads and unloads.  Protect with the read violation handler.
   // Get the address of the modules import section.
@@ -244,6 +466,288 @@ void WINAPI ApiHook::ReplaceIATEntry(
       return;
     }
   }
+#else
+  // ELF imports are not bound to a library name, so every GOT slot that 
+  // currently holds pfnOrig is replaced, regardless of pLibName.
+  (void)pLibName;
+
+  ElfImage image;
+  if (!GetElfImage(hModCaller, image))
+  {
+    // The module has no dynamic section.
+    return;
+  }
+
+  // Search the PLT and the data relocations for slots bound to pfnOrig.
+  ReplaceElfSlots(image, image.pJmpRel, image.jmpRelSize, image.relEntSize, pfnOrig, pfnHook);
+  ReplaceElfSlots(image, image.pRel,    image.relSize,    image.relEntSize, pfnOrig, pfnHook);
+#endif
+}
+
+//  ****************************************************************************
+/// Finds the import slots of a module for a set of hooks, 
+/// in a single pass over the module's import tables.
+/// Nothing is written, so several modules can be matched at once.
+///
+/// @param hModCaller  The module to search.
+/// @param matcher     The original address of each hook, in the same order 
+///                    as hooks.
+/// @param hooks       The hooks to install.
+/// @param records     Receives each slot to patch and the address to write.
+///
+void WINAPI ApiHook::MatchIATEntries( 
+  HMODULE                   hModCaller,
+  const SlotMatcher&        matcher,
+  const ApiHookArray&       hooks,
+  std::vector<PatchRecord>& records
+)
+{
+  std::vector<std::pair<PROC*, size_t> > matches;
+
+#ifdef WIN32
+  PIMAGE_IMPORT_DESCRIPTOR pImportDesc = GetImportDescriptor(hModCaller);
+  if (!pImportDesc)
+  {
+    // The module has no import section
+    // or is no longer loaded into memory.
+    return;
+  }
+
+  std::vector<SlotMatcher::Match> slots;
+  for (; pImportDesc->Name; pImportDesc++)
+  {
+    char*             pModName  = (char*)((PBYTE) hModCaller + pImportDesc->Name);
+    PIMAGE_THUNK_DATA pThunk    = PIMAGE_THUNK_DATA(
+      (PBYTE) hModCaller + pImportDesc->FirstThunk);
+
+    size_t count = 0;
+    while (pThunk[count].u1.Function)
+    {
+      ++count;
+    }
+
+    slots.clear();
+    matcher.Scan((const PROC*) pThunk, count, slots);
+    for (size_t index = 0; index < slots.size(); ++index)
+    {
+      // Only replace the imports of the hook's own library.
+      const ApiHook* pHook = hooks[slots[index].index];
+      if (0 == ::lstrcmpiA(pModName, pHook->m_libName.c_str()))
+      {
+        matches.push_back(std::make_pair((PROC*) &pThunk[slots[index].slot].u1.Function, 
+                                         slots[index].index));
+      }
+    }
+  }
+#else
+  ElfImage image;
+  if (!GetElfImage(hModCaller, image))
+  {
+    // The module has no dynamic section.
+    return;
+  }
+
+  MatchElfSlots(image, matcher, matches);
+#endif
+
+  for (size_t index = 0; index < matches.size(); ++index)
+  {
+    // A hook of a hooked function was created with the earlier hook as its 
+    // original address.  Follow the chain to the newest hook, the same as 
+    // installing the hooks one after another.
+    size_t  hook    = matches[index].second;
+    PROC    pfnHook = hooks[hook]->m_pfnHook;
+    for ( size_t next = matcher.Find(pfnHook);
+          SlotMatcher::k_notFound != next && next > hook;
+          next = matcher.Find(pfnHook))
+    {
+      hook    = next;
+      pfnHook = hooks[hook]->m_pfnHook;
+    }
+
+    PatchRecord record = { matches[index].first, pfnHook };
+    records.push_back(record);
+  }
+}
+
+//  ****************************************************************************
+/// Installs a set of hooks in every module of the process.
+/// Each module's import tables are scanned once for all of the hooks.
+/// The modules are matched by a pool of workers when more than one patch 
+/// thread is configured, and every slot is then written in one pass over 
+/// the pages that hold them.  The slots written do not depend on the 
+/// number of threads.
+///
+/// @param hooks     The hooks to install.
+///
+void WINAPI ApiHook::ReplaceIATEntriesEx( 
+  const ApiHookArray& hooks
+)
+{
+  SlotMatcher matcher;
+  for (size_t index = 0; index < hooks.size(); ++index)
+  {
+    matcher.Add(hooks[index]->m_pfnOrig);
+  }
+
+  if (!matcher.GetCount())
+  {
+    return;
+  }
+
+  HMODULE hThisMod = GetExcludeModuleHandle();
+
+  std::vector<HMODULE> modules;
+  GetProcessModules(modules);
+
+  // Don't hook functions from modules that match hThisMod;
+  modules.erase(std::remove(modules.begin(), modules.end(), hThisMod), modules.end());
+
+  // Each module's matches are kept apart, so the merged list is in module 
+  // order regardless of which worker matched it.
+  std::vector<std::vector<PatchRecord> > results(modules.size());
+
+  PatchJob job;
+  job.pModules  = &modules;
+  job.pMatcher  = &matcher;
+  job.pHooks    = &hooks;
+  job.pResults  = &results;
+  job.next      = 0;
+
+  // The workers are created for this call and joined before it returns.  
+  // A thread costs about as much to create as a module costs to match, so 
+  // each one is given k_modulesPerThread modules or more, and no more run 
+  // than there are processors to run them.
+  const size_t threadCount = std::min(std::min(sm_patchThreadCount, GetProcessorCount()),
+                                      modules.size() / k_modulesPerThread);
+  if (threadCount <= 1)
+  {
+    PatchThreadProc(&job);
+  }
+  else
+  {
+    // The calling thread is the first worker.
+#ifdef WIN32
+    std::vector<HANDLE> threads;
+    for (size_t index = 1; index < threadCount; ++index)
+    {
+      HANDLE hThread = ::CreateThread(NULL, 0, PatchThreadProc, &job, 0, NULL);
+      if (hThread)
+      {
+        threads.push_back(hThread);
+      }
+    }
+
+    PatchThreadProc(&job);
+
+    for (size_t index = 0; index < threads.size(); ++index)
+    {
+      ::WaitForSingleObject(threads[index], INFINITE);
+      ::CloseHandle(threads[index]);
+    }
+#else
+    std::vector<pthread_t> threads;
+    for (size_t index = 1; index < threadCount; ++index)
+    {
+      pthread_t thread;
+      if (0 == ::pthread_create(&thread, NULL, PatchThreadProc, &job))
+      {
+        threads.push_back(thread);
+      }
+    }
+
+    PatchThreadProc(&job);
+
+    for (size_t index = 0; index < threads.size(); ++index)
+    {
+      ::pthread_join(threads[index], NULL);
+    }
+#endif
+  }
+
+  std::vector<PatchRecord> records;
+  for (size_t index = 0; index < results.size(); ++index)
+  {
+    records.insert(records.end(), results[index].begin(), results[index].end());
+  }
+
+  CommitPatchRecords(records);
+}
+
+//  ****************************************************************************
+/// Matches modules from a patch job until none are left.
+/// Every worker claims the next unmatched module from the shared counter, 
+/// so a worker that finishes early takes over the remaining modules.
+///
+/// @param pJob      The PatchJob to work on.
+///
+#ifdef WIN32
+DWORD WINAPI ApiHook::PatchThreadProc(
+#else
+void* ApiHook::PatchThreadProc(
+#endif
+  PVOID pJob
+)
+{
+  PatchJob& job = *(PatchJob*)pJob;
+  for (;;)
+  {
+#ifdef WIN32
+    const size_t index = (size_t)::InterlockedIncrement(&job.next) - 1;
+#else
+    const size_t index = (size_t)__sync_fetch_and_add(&job.next, 1);
+#endif
+    if (index >= job.pModules->size())
+    {
+      break;
+    }
+
+    MatchIATEntries((*job.pModules)[index], *job.pMatcher, *job.pHooks, (*job.pResults)[index]);
+  }
+
+  return 0;
+}
+
+//  ****************************************************************************
+/// Sets the number of threads that match import tables when every hook is 
+/// installed at once, such as after a module is loaded.
+///
+/// @param count     The number of threads.  0 and 1 match on the calling 
+///                  thread alone.  Fewer threads are used when the process 
+///                  has few modules or processors.
+///
+void ApiHook::SetPatchThreadCount(size_t count)
+{
+  sm_patchThreadCount = count ? count : 1;
+}
+
+//  ****************************************************************************
+/// Installs every active hook in every module of the process again.
+/// This catches modules that were loaded without passing through a hooked 
+/// loader function.
+///
+void ApiHook::Refresh()
+{
+  HookListLock lock;
+  ReplaceIATEntriesEx(sm_hooks);
+}
+
+//  ****************************************************************************
+/// Lists every import slot in the process, with the name of the function 
+/// it imports.  Any of these functions can be hooked.
+///
+/// @param imports   Receives an entry for each import slot.
+///
+void ApiHook::ListImports(std::vector<ImportEntry>& imports)
+{
+  HookListLock lock;
+
+  std::vector<HMODULE> modules;
+  GetProcessModules(modules);
+  for (size_t index = 0; index < modules.size(); ++index)
+  {
+    GetImportEntries(modules[index], imports);
+  }
 }
 
 //  ****************************************************************************
@@ -253,6 +757,7 @@ void WINAPI ApiHook::ReplaceEATEntry(
   PROC        pfnNew
 )
 {
+#ifdef WIN32
   // Exceptions may occur during this call based on threading, the state of
   // library loads and unloads.  Protect with the read violation handler.
   // Get the address of the modules import section.
@@ -285,77 +790,346 @@ void WINAPI ApiHook::ReplaceEATEntry(
   WORD*  pNameOrdinals = (WORD*) ((BYTE*)hMod + pExportDir->AddressOfNameOrdinals);
   DWORD* pFnAddresses  = (DWORD*)((BYTE*)hMod + pExportDir->AddressOfFunctions);
 
-  // Walk the array of this modules functions.
-  for (DWORD index = 0; index < pExportDir->NumberOfNames; ++index)
+  // The name table is sorted in ascending order so the loader can binary 
+  // search it.  Do the same rather than comparing every exported name.
+  const DWORD k_count = pExportDir->NumberOfNames;
+  DWORD       found   = k_count;
+  DWORD       first   = 0;
+  DWORD       last    = k_count;
+  while (first < last)
   {
-    // Find entries that match the requested function.
+    DWORD index = first + (last - first) / 2;
     char* pName = (char*)((BYTE*) hMod + pNamesRvas[index]);
-    if (0 != ::lstrcmpiA(pName, pFnName))
-    { // This entry does not match.
-      continue;
+    int   order = ::strcmp(pName, pFnName);
+    if (order == 0)
+    {
+      found = index;
+      break;
+    }
+
+    // This entry does not match.  Narrow the search range.
+    if (order < 0)
+      first = index + 1;
+    else
+      last  = index;
+  }
+
+  // Names have always been matched without regard to case.  A name that 
+  // differs from the export only in case is found by walking the table.
+  for (DWORD index = 0; found == k_count && index < k_count; ++index)
+  {
+    char* pName = (char*)((BYTE*) hMod + pNamesRvas[index]);
+    if (0 == ::lstrcmpiA(pName, pFnName))
+    {
+      found = index;
     }
+  }
+
+  if (found == k_count)
+  {
+    return;
+  }
 
-    // Get this functions ordinal value.
-    WORD ordinal = pNameOrdinals[index];
+  // Get this functions ordinal value.
+  WORD ordinal = pNameOrdinals[found];
 
-    // Get the address for the specified function.
-    PROC* ppfn = (PROC*) &pFnAddresses[index];
+  // Get the address for the specified function.
+  PROC* ppfn = (PROC*) &pFnAddresses[ordinal];
 
-    // Turn the new address into an RVA.
-    pfnNew = (PROC) ((BYTE*) pfnNew - (BYTE*)hMod);
+  // Turn the new address into an RVA.
+  pfnNew = (PROC) ((BYTE*) pfnNew - (BYTE*)hMod);
 
-    // Update the function address.
-    ReplaceFunctionAddress(ppfn, pfnNew);
-    break;
+  // Update the function address.
+  ReplaceFunctionAddress(ppfn, pfnNew);
+#else
+  // Look up the default definition through the module's hash table.
+  PROC          pfnOld = NULL;
+  unsigned char info   = 0;
+  if (!GetEATEntry(hMod, pFnName, pfnOld, info))
+  {
+    return;
   }
+
+  // The loader calls an indirect function to resolve the real address.
+  // The new address is the function itself, so export it as a plain function.
+  SetEATEntry(hMod, pFnName, pfnNew, ELF32_ST_INFO(ELF32_ST_BIND(info), STT_FUNC));
+#endif
 }
 
+#ifndef WIN32
 //  ****************************************************************************
-void ApiHook::FixupModuleOnLoad(HMODULE hMod, DWORD flags)
+/// Reads the address and the symbol type of an exported function.  For an 
+/// indirect function the address is its resolver.
+///
+bool ApiHook::GetEATEntry(
+  HMODULE         hMod,
+  const char*     pFnName,
+  PROC&           pfn,
+  unsigned char&  info
+)
 {
-  // If a new module is loaded,
-  // hook the specified hook functions.
-  if ( hMod != NULL
-    && hMod != GetExcludeModuleHandle()
-    && 0 == (flags & LOAD_LIBRARY_AS_DATAFILE)
-    && 0 == (flags & LOAD_LIBRARY_AS_DATAFILE_EXCLUSIVE)
-    && 0 == (flags & LOAD_LIBRARY_AS_IMAGE_RESOURCE))
+  ElfImage image;
+  ElfW(Sym)* pSym = GetElfImage(hMod, image)
+                    ? FindElfSymbol(image, pFnName)
+                    : NULL;
+  if (!pSym)
   {
-    // Process every registered API Hook.
-    ApiHookArray::iterator iter = sm_hooks.begin();
-    ApiHookArray::iterator end  = sm_hooks.end();
-    for (; iter != end; ++iter)
-    {
-      ApiHook* pHook = *iter;
-      if (pHook->m_pfnOrig)
-      {
-        ReplaceIATEntryEx(pHook->m_libName.c_str(), 
-                          pHook->m_pfnOrig, 
-                          pHook->m_pfnHook
-                         );
-      }
-    }
+    return false;
   }
+
+  pfn   = (PROC) ((char*) image.base + pSym->st_value);
+  info  = pSym->st_info;
+  return true;
 }
 
-#ifdef WIN32
 //  ****************************************************************************
-HMODULE WINAPI ApiHook::LoadLibraryA(
-  PCSTR pszModulePath
+/// Writes the address and the symbol type of an exported function.
+///
+void ApiHook::SetEATEntry(
+  HMODULE         hMod,
+  const char*     pFnName,
+  PROC            pfn,
+  unsigned char   info
 )
 {
-  typedef HMODULE (WINAPI *pfnLoadLibraryA)(PCSTR);
-
-  HMODULE hMod = NULL;
-  if ((PROC)sm_LoadLibraryA)
+  ElfImage image;
+  ElfW(Sym)* pSym = GetElfImage(hMod, image)
+                    ? FindElfSymbol(image, pFnName)
+                    : NULL;
+  if (!pSym)
   {
-    pfnLoadLibraryA pfnProc = (pfnLoadLibraryA)(PROC)sm_LoadLibraryA;
-    hMod = pfnProc(pszModulePath);
+    return;
   }
-  else
+
+  if (info != pSym->st_info)
   {
-    // This function has not yet been hooked.
-    hMod = ::LoadLibraryA(pszModulePath);
+    WriteSelfMemory(&pSym->st_info, &info, sizeof(info));
+  }
+
+  // Turn the new address into a value relative to the load base.
+  pfn = (PROC) ((char*) pfn - (char*) image.base);
+
+  // Update the function address.
+  ReplaceFunctionAddress((PROC*) &pSym->st_value, pfn);
+}
+#endif
+
+//  ****************************************************************************
+void ApiHook::FixupModuleOnLoad(HMODULE hMod, DWORD flags)
+{
+#ifndef WIN32
+  // dlopen flags never describe a data-only mapping.
+  (void)flags;
+#endif
+
+  // If a new module is loaded,
+  // hook the specified hook functions.
+  if ( hMod != NULL
+    && hMod != GetExcludeModuleHandle()
+#ifdef WIN32
+    && 0 == (flags & LOAD_LIBRARY_AS_DATAFILE)
+    && 0 == (flags & LOAD_LIBRARY_AS_DATAFILE_EXCLUSIVE)
+    && 0 == (flags & LOAD_LIBRARY_AS_IMAGE_RESOURCE)
+#endif
+     )
+  {
+    // Process every registered API Hook, in a single pass of each module.
+    HookListLock lock;
+    ReplaceIATEntriesEx(sm_hooks);
+  }
+}
+
+//  ****************************************************************************
+/// Captures the address held by every import slot in the process.
+/// The state can later be passed to RestoreState to return the process to 
+/// this hook configuration.
+///
+/// @param state     Receives the import slots of every module.
+///
+void ApiHook::CaptureState(PatchState& state)
+{
+  HookListLock lock;
+
+  state.records.clear();
+  state.pages.clear();
+  state.hooks.clear();
+  for (size_t index = 0; index < sm_hooks.size(); ++index)
+  {
+    ApiHook*  pHook = sm_hooks[index];
+    PatchHook hook  = { pHook, pHook->m_id, pHook->m_pfnOrig, pHook->m_pfnHook };
+    state.hooks.push_back(hook);
+  }
+
+  HMODULE hThisMod = GetExcludeModuleHandle();
+
+  std::vector<HMODULE> modules;
+  GetProcessModules(modules);
+  for (size_t index = 0; index < modules.size(); ++index)
+  {
+    // Don't capture modules that match hThisMod, they are never patched.
+    if (modules[index] != hThisMod)
+    {
+      GetImportSlots(modules[index], state.records);
+    }
+  }
+
+  // Order the slots by address, then group them by page.
+  std::sort(state.records.begin(), state.records.end(), IsRecordBefore);
+  state.records.erase(std::unique(state.records.begin(), 
+                                  state.records.end(), 
+                                  IsSameSlot),
+                      state.records.end());
+
+  const uintptr_t pageMask = ~(uintptr_t(GetPageSize()) - 1);
+  for (size_t index = 0; index < state.records.size(); ++index)
+  {
+    PVOID pPage = (PVOID)((uintptr_t)state.records[index].ppfn & pageMask);
+    if ( state.pages.empty()
+      || state.pages.back().pPage != pPage)
+    {
+      PatchPage page = { pPage, 0, index, 0, GetModuleFromAddress(pPage) };
+      state.pages.push_back(page);
+    }
+
+    ++state.pages.back().count;
+  }
+
+  QueryPageProtection(state.pages);
+}
+
+//  ****************************************************************************
+/// Returns every import slot to the address it held when the state was 
+/// captured.  Only the pages with a modified slot are written, 
+/// and each of those pages is written in a single pass.  The slots of a 
+/// module that has been unloaded since the capture are skipped.
+///
+/// The hook list is returned to the hooks active at capture as well.  Hooks 
+/// created after the capture are no longer installed in modules loaded 
+/// later, or by Refresh, until they are destroyed or a state that holds 
+/// them is restored.  Hooks destroyed after the capture are left out of the 
+/// list, and the slots captured with their hook function are returned to 
+/// the function that hook replaced.
+///
+/// On ELF, the exports redirected by hooks created after the capture are 
+/// reverted.  The Windows export tables are never modified, the 
+/// GetProcAddress hook reports the hooks in the restored list instead.
+///
+/// @param state     The import slots captured by CaptureState.
+///
+void ApiHook::RestoreState(const PatchState& state)
+{
+  HookListLock lock;
+
+  // Only the hooks that still exist are restored.  The creation number 
+  // tells a hook apart from a newer one created at the same address.
+  ApiHookArray  hooks;
+  UnwindArray   unwind;
+  for (size_t index = 0; index < state.hooks.size(); ++index)
+  {
+    const PatchHook& hook = state.hooks[index];
+    ApiHookArray::iterator iter = std::find(sm_liveHooks.begin(), 
+                                            sm_liveHooks.end(), 
+                                            hook.pHook);
+    if ( iter != sm_liveHooks.end()
+      && (*iter)->m_id == hook.id)
+    {
+      hooks.push_back(hook.pHook);
+    }
+    else if (hook.pfnOrig)
+    {
+      unwind.push_back(std::make_pair(hook.pfnHook, hook.pfnOrig));
+    }
+  }
+
+  std::vector<PatchRecord> unwound;
+  for (size_t index = 0; index < state.pages.size(); ++index)
+  {
+    const PatchPage&   page     = state.pages[index];
+    const PatchRecord* pRecords = &state.records[page.first];
+
+    // The page may be unmapped, or hold another module, once its module 
+    // is unloaded.
+    if (GetModuleFromAddress(page.pPage) != page.hMod)
+    {
+      continue;
+    }
+
+    if (!unwind.empty())
+    {
+      unwound.assign(pRecords, pRecords + page.count);
+      for (size_t slot = 0; slot < page.count; ++slot)
+      {
+        unwound[slot].pfn = UnwindHooks(unwind, unwound[slot].pfn);
+      }
+
+      pRecords = &unwound[0];
+    }
+
+    // Skip the pages that still match the capture.
+    size_t slot = 0;
+    for (; slot < page.count; ++slot)
+    {
+      if (*pRecords[slot].ppfn != pRecords[slot].pfn)
+      {
+        break;
+      }
+    }
+
+    if (slot < page.count)
+    {
+      WritePatchPage(page, pRecords);
+    }
+  }
+
+#ifndef WIN32
+  // Hooks created after the capture have also redirected their exports.
+  // Revert them newest first, so stacked hooks unwind in order.
+  ApiHookArray::reverse_iterator iter = sm_hooks.rbegin();
+  ApiHookArray::reverse_iterator end  = sm_hooks.rend();
+  for (; iter != end; ++iter)
+  {
+    ApiHook* pHook = *iter;
+    if ( pHook->m_pfnExport
+      && hooks.end() == std::find(hooks.begin(), hooks.end(), pHook))
+    {
+      SetEATEntry(pHook->m_hLib, pHook->m_fnName.c_str(), pHook->m_pfnExport, pHook->m_exportInfo);
+    }
+  }
+
+  // Hooks removed from the list by an earlier restore are redirected again, 
+  // oldest first.
+  for (size_t index = 0; index < hooks.size(); ++index)
+  {
+    ApiHook* pHook = hooks[index];
+    if ( pHook->m_pfnOrig
+      && sm_hooks.end() == std::find(sm_hooks.begin(), sm_hooks.end(), pHook))
+    {
+      ReplaceEATEntry(pHook->m_hLib, pHook->m_fnName.c_str(), pHook->m_pfnHook);
+    }
+  }
+#endif
+
+  sm_hooks = hooks;
+}
+
+#ifdef WIN32
+//  ****************************************************************************
+HMODULE WINAPI ApiHook::LoadLibraryA(
+  PCSTR pszModulePath
+)
+{
+  typedef HMODULE (WINAPI *pfnLoadLibraryA)(PCSTR);
+
+  HMODULE hMod = NULL;
+  if ((PROC)sm_LoadLibraryA)
+  {
+    pfnLoadLibraryA pfnProc = (pfnLoadLibraryA)(PROC)sm_LoadLibraryA;
+    hMod = pfnProc(pszModulePath);
+  }
+  else
+  {
+    // This function has not yet been hooked.
+    hMod = ::LoadLibraryA(pszModulePath);
   }
 
   FixupModuleOnLoad(hMod, 0);
@@ -445,6 +1219,7 @@ FARPROC WINAPI ApiHook::GetProcAddress(
   FARPROC pfn = GetProcAddressRaw(hMod, pFnName);
 
   // Return the hook address if the requested function is hooked.
+  HookListLock lock;
   ApiHookArray::iterator iter = sm_hooks.begin();
   ApiHookArray::iterator end  = sm_hooks.end();
   for (; iter != end; ++iter)
@@ -459,11 +1234,126 @@ FARPROC WINAPI ApiHook::GetProcAddress(
 
   return pfn;
 }
+#else
+//  ****************************************************************************
+void* ApiHook::dlopen(
+  const char* pszModulePath,
+  int         flags
+)
+{
+  // Hold the hook list while the module loads, so the hooks its 
+  // constructors create take the locks in the same order as this thread.
+  HookListLock lock;
+
+  pfndlopen pfnProc = (PROC)sm_dlopen
+                      ? (pfndlopen)(PROC)sm_dlopen
+                      : &::dlopen;          // This function has not yet been hooked.
+
+  // The loader searches the RPATH or RUNPATH of the module that calls 
+  // dlopen, expands $ORIGIN to its directory, and loads into its namespace.
+  // Through this hook, the call would come from this module instead.
+  HMODULE     hCaller = GetModuleFromAddress(__builtin_return_address(0));
+  std::string path    = ResolveModulePath(pszModulePath, hCaller, pfnProc);
+  const char* pPath   = path.empty() ? pszModulePath : path.c_str();
+
+  Lmid_t namespaceId = LM_ID_BASE;
+  if (hCaller)
+  {
+    ::dlinfo(hCaller, RTLD_DI_LMID, &namespaceId);
+  }
+
+  void* hLib = pPath && LM_ID_BASE != namespaceId
+               ? ::dlmopen(namespaceId, pPath, flags)
+               : pfnProc(pPath, flags);
+
+  // A query with RTLD_NOLOAD never maps a new module.
+  HMODULE hMod = NULL;
+  if ( hLib
+    && 0 == (flags & RTLD_NOLOAD))
+  {
+    ::dlinfo(hLib, RTLD_DI_LINKMAP, &hMod);
+  }
+
+  FixupModuleOnLoad(hMod, (DWORD)flags);
+  return hLib;
+}
+
+//  ****************************************************************************
+/// Unloads a module only while no hook is installed or listing modules, 
+/// so the loader entries they walk remain valid.
+///
+int ApiHook::dlclose(
+  void* hLib
+)
+{
+  typedef int (*pfndlclose)(void*);
+
+  HookListLock lock;
+  if ((PROC)sm_dlclose)
+  {
+    pfndlclose pfnProc = (pfndlclose)(PROC)sm_dlclose;
+    return pfnProc(hLib);
+  }
+
+  // This function has not yet been hooked.
+  return ::dlclose(hLib);
+}
 #endif
 
 namespace // unnamed
 {
 
+//  ****************************************************************************
+HookListLock::HookListLock()
+{
+#ifdef WIN32
+  // Only this thread can have written its own id as the owner.
+  const DWORD threadId = ::GetCurrentThreadId();
+  if (g_hookLockOwner != threadId)
+  {
+    ::AcquireSRWLockExclusive(&g_hookLock);
+    g_hookLockOwner = threadId;
+  }
+
+  ++g_hookLockDepth;
+#else
+  GetMutexFunctions().pfnLock(&g_hookLock);
+#endif
+}
+
+//  ****************************************************************************
+HookListLock::~HookListLock()
+{
+#ifdef WIN32
+  if (0 == --g_hookLockDepth)
+  {
+    g_hookLockOwner = 0;
+    ::ReleaseSRWLockExclusive(&g_hookLock);
+  }
+#else
+  GetMutexFunctions().pfnUnlock(&g_hookLock);
+#endif
+}
+
+#ifndef WIN32
+//  ****************************************************************************
+/// Looks up the pthread functions of HookListLock, the first time the lock
+/// is taken.  No hook is installed yet at that time, and a hook of the
+/// pthread functions, such as those of PThread_hook, must not be called by
+/// the lock, since it may be called before the hook is ready.
+///
+const MutexFunctions& GetMutexFunctions()
+{
+  static const MutexFunctions k_functions =
+  {
+    (pfnpthread_mutex)::dlsym(RTLD_DEFAULT, "pthread_mutex_lock"),
+    (pfnpthread_mutex)::dlsym(RTLD_DEFAULT, "pthread_mutex_unlock")
+  };
+
+  return k_functions;
+}
+#endif
+
 //  ****************************************************************************
 /// Determines which library module a requested address lives in.
 ///
@@ -482,8 +1372,18 @@ HMODULE GetModuleFromAddress(
   return  ::VirtualQuery(pv, &mbi, sizeof(mbi))
           ? HMODULE(mbi.AllocationBase)
           : NULL;
+#elif defined(DLFO_EH_SEGMENT_TYPE)
+  // _dl_find_object does not search the symbol table, and takes no lock.
+  dl_find_object result;
+  return  0 == ::_dl_find_object(pv, &result)
+          ? result.dlfo_link_map
+          : NULL;
 #else
-  return NULL;
+  Dl_info info;
+  HMODULE hMod = NULL;
+  return  ::dladdr1(pv, &info, (void**)&hMod, RTLD_DL_LINKMAP)
+          ? hMod
+          : NULL;
 #endif
 }
 
@@ -536,27 +1436,1261 @@ bool ReplaceFunctionAddress(PROC* ppfnOrig, PROC pfnNew)
   }
 
 #else
-# error "Platform Requires implementation."
+  return WriteSelfMemory(ppfnOrig, &pfnNew, sizeof(PROC));
 #endif
 
   return false;
 }
 
+//  ****************************************************************************
+/// Reports the size of a page of virtual memory.
+///
+size_t GetPageSize()
+{
 #ifdef WIN32
+  SYSTEM_INFO info;
+  ::GetSystemInfo(&info);
+  return info.dwPageSize;
+#else
+  return (size_t)::sysconf(_SC_PAGESIZE);
+#endif
+}
+
 //  ****************************************************************************
-/// Structured Exception Handler for Win32 ReadException.
+/// Reports the number of processors this process may run on.
 ///
-/// @param pep       Pointer to the exception details.
-/// @return          
-/// 
-LONG WINAPI InvalidReadExceptionFilter(
-  PEXCEPTION_POINTERS pep
+size_t GetProcessorCount()
+{
+#ifdef WIN32
+  SYSTEM_INFO info;
+  ::GetSystemInfo(&info);
+  return info.dwNumberOfProcessors;
+#else
+  cpu_set_t set;
+  if (0 == ::sched_getaffinity(0, sizeof(set), &set))
+  {
+    return (size_t)CPU_COUNT(&set);
+  }
+
+  const long count = ::sysconf(_SC_NPROCESSORS_ONLN);
+  return count > 0 ? (size_t)count : 1;
+#endif
+}
+
+//  ****************************************************************************
+/// Lists the library modules that are loaded in this process.
+///
+/// @param modules   Receives the handle of every module.
+///
+void GetProcessModules(
+  std::vector<HMODULE>& modules
 )
 {
-  // All unexpected exceptions are handled because no module is updated 
-  // in this case.
-  LONG disposition = EXCEPTION_EXECUTE_HANDLER;
-  return disposition;
+#ifdef WIN32
+  // Request a list of library modules in this process.
+  HANDLE hModuleSnap = 
+    ::CreateToolhelp32Snapshot(TH32CS_SNAPMODULE, ::GetCurrentProcessId());
+  if (INVALID_HANDLE_VALUE == hModuleSnap) 
+  {
+    return;
+  }
+
+  MODULEENTRY32 entry;
+  entry.dwSize = sizeof(entry);
+  BOOL isContinue = TRUE;
+  for ( isContinue = ::Module32First(hModuleSnap, &entry); 
+        isContinue;
+        isContinue = ::Module32Next(hModuleSnap, &entry)) 
+  {
+    modules.push_back(entry.hModule);
+  }
+
+  ::CloseHandle(hModuleSnap);
+  hModuleSnap = NULL;
+#else
+  // The loader's list of modules may change while it is walked, so collect 
+  // an address in each module through dl_iterate_phdr, which holds the 
+  // loader's lock.  The loader entries are found once it is released.
+  std::vector<PVOID> addresses;
+  ::dl_iterate_phdr(AddModuleAddress, &addresses);
+  for (size_t index = 0; index < addresses.size(); ++index)
+  {
+    HMODULE hMod = GetModuleFromAddress(addresses[index]);
+    if (hMod)
+    {
+      modules.push_back(hMod);
+    }
+  }
+#endif
+}
+
+//  ****************************************************************************
+/// Appends every import slot of a module to a list of patch records.
+///
+/// @param hMod      The module to search.
+/// @param records   Receives the address and current value of each slot.
+///
+void GetImportSlots(
+  HMODULE                             hMod,
+  std::vector<ApiHook::PatchRecord>&  records
+)
+{
+#ifdef WIN32
+  // Exceptions may occur during this call based on threading, the state of
+  // library loads and unloads.  Protect with the read violation handler.
+  ULONG                     size            = 0;
+  PIMAGE_IMPORT_DESCRIPTOR  pImportDesc     = NULL;
+  PIMAGE_SECTION_HEADER     pSectionHeader  = NULL;
+  __try 
+  {
+    pImportDesc = PIMAGE_IMPORT_DESCRIPTOR(
+      ::ImageDirectoryEntryToDataEx(hMod,
+                                    TRUE,
+                                    IMAGE_DIRECTORY_ENTRY_IMPORT,
+                                    &size,
+                                    &pSectionHeader
+                                   ));
+  }
+  __except (InvalidReadExceptionFilter(GetExceptionInformation()))
+  {
+    // No current operations.
+  }
+
+  if (!pImportDesc)
+  {
+    // The module has no import section
+    // or is no longer loaded into memory.
+    return;
+  }
+
+  for (; pImportDesc->Name; pImportDesc++)
+  {
+    PIMAGE_THUNK_DATA pThunk = PIMAGE_THUNK_DATA(
+      (PBYTE) hMod + pImportDesc->FirstThunk);
+
+    for (; pThunk->u1.Function; pThunk++)
+    {
+      ApiHook::PatchRecord record = { (PROC*) &pThunk->u1.Function, 
+                                      (PROC) pThunk->u1.Function };
+      records.push_back(record);
+    }
+  }
+#else
+  ElfImage image;
+  if (!GetElfImage(hMod, image))
+  {
+    // The module has no dynamic section.
+    return;
+  }
+
+  const unsigned char* pTables[]  = { image.pJmpRel,    image.pRel    };
+  const size_t         sizes[]    = { image.jmpRelSize, image.relSize };
+  for (size_t table = 0; table < 2; ++table)
+  {
+    if (!pTables[table] || !image.relEntSize)
+    {
+      continue;
+    }
+
+    const unsigned char* pReloc = pTables[table];
+    const unsigned char* pEnd   = pReloc + sizes[table];
+    for (; pReloc < pEnd; pReloc += image.relEntSize)
+    {
+      PROC* ppfn = GetElfSlot(image, pReloc);
+      if (ppfn)
+      {
+        ApiHook::PatchRecord record = { ppfn, *ppfn };
+        records.push_back(record);
+      }
+    }
+  }
+#endif
+}
+
+//  ****************************************************************************
+/// Appends every import slot of a module, and the name of the function it 
+/// imports, to a list of import entries.
+///
+/// @param hMod      The module to search.
+/// @param imports   Receives an entry for each slot.
+///
+void GetImportEntries(
+  HMODULE                             hMod,
+  std::vector<ApiHook::ImportEntry>&  imports
+)
+{
+#ifdef WIN32
+  PIMAGE_IMPORT_DESCRIPTOR pImportDesc = GetImportDescriptor(hMod);
+  if (!pImportDesc)
+  {
+    // The module has no import section
+    // or is no longer loaded into memory.
+    return;
+  }
+
+  char modulePath[MAX_PATH] = "";
+  ::GetModuleFileNameA(hMod, modulePath, MAX_PATH);
+
+  for (; pImportDesc->Name; pImportDesc++)
+  {
+    PIMAGE_THUNK_DATA pThunk      = PIMAGE_THUNK_DATA(
+      (PBYTE) hMod + pImportDesc->FirstThunk);
+
+    // The bound IAT no longer holds the names, the original thunks do.
+    PIMAGE_THUNK_DATA pNameThunk  = pImportDesc->OriginalFirstThunk
+                                  ? PIMAGE_THUNK_DATA((PBYTE) hMod + pImportDesc->OriginalFirstThunk)
+                                  : NULL;
+
+    for (; pThunk->u1.Function; pThunk++)
+    {
+      ApiHook::ImportEntry entry;
+      entry.module  = modulePath;
+      entry.library = (char*)((PBYTE) hMod + pImportDesc->Name);
+      entry.ppfn    = (PROC*) &pThunk->u1.Function;
+      entry.pfn     = (PROC) pThunk->u1.Function;
+
+      if (pNameThunk)
+      {
+        if (IMAGE_SNAP_BY_ORDINAL(pNameThunk->u1.Ordinal))
+        {
+          char ordinal[16];
+          ::StringCchPrintfA(ordinal, 16, "#%u", (unsigned)IMAGE_ORDINAL(pNameThunk->u1.Ordinal));
+          entry.name = ordinal;
+        }
+        else
+        {
+          PIMAGE_IMPORT_BY_NAME pByName = PIMAGE_IMPORT_BY_NAME(
+            (PBYTE) hMod + pNameThunk->u1.AddressOfData);
+          entry.name = (char*)pByName->Name;
+        }
+
+        ++pNameThunk;
+      }
+
+      imports.push_back(entry);
+    }
+  }
+#else
+  ElfImage image;
+  if (!GetElfImage(hMod, image))
+  {
+    // The module has no dynamic section.
+    return;
+  }
+
+  // The main program is listed with an empty name.
+  const char* pModule = (hMod->l_name && *hMod->l_name) 
+                      ? hMod->l_name 
+                      : program_invocation_name;
+
+  const unsigned char* pTables[]  = { image.pJmpRel,    image.pRel    };
+  const size_t         sizes[]    = { image.jmpRelSize, image.relSize };
+  for (size_t table = 0; table < 2; ++table)
+  {
+    if (!pTables[table] || !image.relEntSize)
+    {
+      continue;
+    }
+
+    const unsigned char* pReloc = pTables[table];
+    const unsigned char* pEnd   = pReloc + sizes[table];
+    for (; pReloc < pEnd; pReloc += image.relEntSize)
+    {
+      PROC* ppfn = GetElfSlot(image, pReloc);
+      if (!ppfn)
+      {
+        continue;
+      }
+
+      ApiHook::ImportEntry entry;
+      entry.module  = pModule;
+      entry.name    = GetElfSymbolName(image, pReloc);
+      entry.ppfn    = ppfn;
+      entry.pfn     = *ppfn;
+
+      // ELF imports are not bound to a library, report the module that 
+      // holds the address in the slot.
+      Dl_info info;
+      if ( ::dladdr((void*)*ppfn, &info)
+        && info.dli_fname)
+      {
+        entry.library = info.dli_fname;
+      }
+
+      imports.push_back(entry);
+    }
+  }
+#endif
+}
+
+//  ****************************************************************************
+/// Records the current protection of each page in a patch state.
+///
+/// @param pages     The pages to query, sorted by address.
+///
+void QueryPageProtection(
+  std::vector<ApiHook::PatchPage>& pages
+)
+{
+#ifdef WIN32
+  for (size_t index = 0; index < pages.size(); ++index)
+  {
+    MEMORY_BASIC_INFORMATION mbi;
+    if (::VirtualQuery(pages[index].pPage, &mbi, sizeof(mbi)))
+    {
+      pages[index].protect = mbi.Protect;
+    }
+  }
+#else
+  FILE* pMaps = ::fopen("/proc/self/maps", "r");
+  if (!pMaps)
+  {
+    return;
+  }
+
+  // Both the mappings and the pages are in ascending order, 
+  // so a single pass matches every page to its mapping.
+  size_t index = 0;
+  char   line[512];
+  while ( index < pages.size()
+       && ::fgets(line, sizeof(line), pMaps))
+  {
+    unsigned long first = 0;
+    unsigned long last  = 0;
+    char          perms[5] = "";
+    if (3 != ::sscanf(line, "%lx-%lx %4s", &first, &last, perms))
+    {
+      continue;
+    }
+
+    const DWORD protect = ('r' == perms[0] ? PROT_READ  : 0)
+                        | ('w' == perms[1] ? PROT_WRITE : 0)
+                        | ('x' == perms[2] ? PROT_EXEC  : 0);
+    for (; index < pages.size() && (uintptr_t)pages[index].pPage < last; ++index)
+    {
+      if ((uintptr_t)pages[index].pPage >= first)
+      {
+        pages[index].protect = protect;
+      }
+    }
+  }
+
+  ::fclose(pMaps);
+#endif
+}
+
+//  ****************************************************************************
+/// Writes the captured address into every modified slot of a single page.
+/// The page is made writable once for all of its slots.
+///
+/// @param page      The page to write.
+/// @param pRecords  The first record on this page.
+/// @return  true    The slots on the page were restored.
+/// @return false    The page could not be made writable.
+///
+bool WritePatchPage(
+  const ApiHook::PatchPage&   page,
+  const ApiHook::PatchRecord* pRecords
+)
+{
+#ifdef WIN32
+  DWORD curProtect = 0;
+  if (!::VirtualProtect(page.pPage, GetPageSize(), PAGE_WRITECOPY, &curProtect))
+  {
+    return false;
+  }
+
+  for (size_t index = 0; index < page.count; ++index)
+  {
+    if (*pRecords[index].ppfn != pRecords[index].pfn)
+    {
+      *pRecords[index].ppfn = pRecords[index].pfn;
+    }
+  }
+
+  // Restore the original protection of this page.
+  ::VirtualProtect(page.pPage, GetPageSize(), curProtect, &curProtect);
+  return true;
+#else
+  const int  protect    = (int)page.protect;
+  const bool isWritable = 0 != (protect & PROT_WRITE);
+  if ( 0 == protect
+    || ( !isWritable
+      && 0 != ::mprotect(page.pPage, GetPageSize(), protect | PROT_WRITE)))
+  {
+    // The protection is unknown, or the page cannot be made writable.
+    // Fall back to writing one slot at a time.
+    bool isSuccess = true;
+    for (size_t index = 0; index < page.count; ++index)
+    {
+      if (*pRecords[index].ppfn != pRecords[index].pfn)
+      {
+        isSuccess &= ReplaceFunctionAddress(pRecords[index].ppfn, pRecords[index].pfn);
+      }
+    }
+
+    return isSuccess;
+  }
+
+  for (size_t index = 0; index < page.count; ++index)
+  {
+    if (*pRecords[index].ppfn != pRecords[index].pfn)
+    {
+      *pRecords[index].ppfn = pRecords[index].pfn;
+    }
+  }
+
+  // Restore the original protection of this page.
+  if (!isWritable)
+  {
+    ::mprotect(page.pPage, GetPageSize(), protect);
+  }
+
+  return true;
+#endif
+}
+
+//  ****************************************************************************
+/// Orders patch records by the address of their slot.
+///
+bool IsRecordBefore(
+  const ApiHook::PatchRecord& lhs,
+  const ApiHook::PatchRecord& rhs
+)
+{
+  return (uintptr_t)lhs.ppfn < (uintptr_t)rhs.ppfn;
+}
+
+//  ****************************************************************************
+/// Indicates if two patch records describe the same slot.
+///
+bool IsSameSlot(
+  const ApiHook::PatchRecord& lhs,
+  const ApiHook::PatchRecord& rhs
+)
+{
+  return lhs.ppfn == rhs.ppfn;
+}
+
+//  ****************************************************************************
+/// Follows the address held by a slot back through the destroyed hooks.
+/// The hooks are visited newest first, so a slot that held a hook stacked 
+/// on another destroyed hook reaches the function they both replaced.
+///
+/// @param unwind    The destroyed hooks, oldest first.
+/// @param pfn       The address captured in the slot.
+///
+/// @return          The address the slot should hold.
+///
+PROC UnwindHooks(
+  const UnwindArray& unwind,
+  PROC pfn
+)
+{
+  for (size_t index = unwind.size(); index > 0; --index)
+  {
+    if (pfn == unwind[index - 1].first)
+    {
+      pfn = unwind[index - 1].second;
+    }
+  }
+
+  return pfn;
+}
+
+//  ****************************************************************************
+/// Writes a list of patch records, one page at a time.
+/// Each page that holds a modified slot is made writable once.
+///
+/// @param records   The slots to write, and the address to write in each.
+///                  The list is sorted by slot address.
+///
+void CommitPatchRecords(
+  std::vector<ApiHook::PatchRecord>& records
+)
+{
+  // The sort is stable, so a slot matched twice keeps its first record.
+  std::stable_sort(records.begin(), records.end(), IsRecordBefore);
+  records.erase(std::unique(records.begin(), records.end(), IsSameSlot),
+                records.end());
+
+  std::vector<ApiHook::PatchPage> pages;
+  const uintptr_t pageMask = ~(uintptr_t(GetPageSize()) - 1);
+  for (size_t index = 0; index < records.size(); ++index)
+  {
+    PVOID pPage = (PVOID)((uintptr_t)records[index].ppfn & pageMask);
+    if ( pages.empty()
+      || pages.back().pPage != pPage)
+    {
+      ApiHook::PatchPage page = { pPage, 0, index, 0, NULL };
+      pages.push_back(page);
+    }
+
+    ++pages.back().count;
+  }
+
+  QueryPageProtection(pages);
+  for (size_t index = 0; index < pages.size(); ++index)
+  {
+    WritePatchPage(pages[index], &records[pages[index].first]);
+  }
+}
+
+#ifdef WIN32
+//  ****************************************************************************
+/// Structured Exception Handler for Win32 ReadException.
+///
+/// @param pep       Pointer to the exception details.
+/// @return          
+/// 
+LONG WINAPI InvalidReadExceptionFilter(
+  PEXCEPTION_POINTERS pep
+)
+{
+  // All unexpected exceptions are handled because no module is updated 
+  // in this case.
+  LONG disposition = EXCEPTION_EXECUTE_HANDLER;
+  return disposition;
+}
+
+//  ****************************************************************************
+/// Finds the import section of a module.  The ImageHlp library is not 
+/// thread-safe, so calls from the patch workers are serialized.
+///
+/// @param hMod      The module to search.
+/// @return          The first import descriptor of the module.
+///                  NULL is returned if the module has no import section, 
+///                  or is no longer loaded into memory.
+///
+PIMAGE_IMPORT_DESCRIPTOR GetImportDescriptor(
+  HMODULE hMod
+)
+{
+  ULONG                     size            = 0;
+  PIMAGE_IMPORT_DESCRIPTOR  pImportDesc     = NULL;
+  PIMAGE_SECTION_HEADER     pSectionHeader  = NULL;
+
+  ::AcquireSRWLockExclusive(&g_imageHlpLock);
+  __try 
+  {
+    pImportDesc = PIMAGE_IMPORT_DESCRIPTOR(
+      ::ImageDirectoryEntryToDataEx(hMod,
+                                    TRUE,
+                                    IMAGE_DIRECTORY_ENTRY_IMPORT,
+                                    &size,
+                                    &pSectionHeader
+                                   ));
+  }
+  __except (InvalidReadExceptionFilter(GetExceptionInformation()))
+  {
+    // No current operations.
+  }
+
+  ::ReleaseSRWLockExclusive(&g_imageHlpLock);
+  return pImportDesc;
+}
+#else
+
+#if defined(__LP64__)
+# define APIHOOK_R_TYPE         ELF64_R_TYPE
+# define APIHOOK_R_SYM          ELF64_R_SYM
+#else
+# define APIHOOK_R_TYPE         ELF32_R_TYPE
+# define APIHOOK_R_SYM          ELF32_R_SYM
+#endif
+
+#if defined(__x86_64__)
+# define APIHOOK_R_JUMP_SLOT    R_X86_64_JUMP_SLOT
+# define APIHOOK_R_GLOB_DAT     R_X86_64_GLOB_DAT
+#elif defined(__i386__)
+# define APIHOOK_R_JUMP_SLOT    R_386_JMP_SLOT
+# define APIHOOK_R_GLOB_DAT     R_386_GLOB_DAT
+#elif defined(__aarch64__)
+# define APIHOOK_R_JUMP_SLOT    R_AARCH64_JUMP_SLOT
+# define APIHOOK_R_GLOB_DAT     R_AARCH64_GLOB_DAT
+#elif defined(__arm__)
+# define APIHOOK_R_JUMP_SLOT    R_ARM_JUMP_SLOT
+# define APIHOOK_R_GLOB_DAT     R_ARM_GLOB_DAT
+#else
+# error "Platform Requires implementation."
+#endif
+
+//  ****************************************************************************
+/// Converts an address from a dynamic section entry into a pointer.
+/// The loader relocates most entries in place, but read-only dynamic 
+/// sections (such as the vDSO) still hold values relative to the load base.
+///
+template <typename T>
+T ElfPointer(ElfW(Addr) base, ElfW(Addr) ptr)
+{
+  return (T)(ptr < base ? base + ptr : ptr);
+}
+
+//  ****************************************************************************
+/// Collects the dynamic linking tables of a loaded module.
+///
+/// @param hMod      The loader entry of the module.
+/// @param image     Receives the location of the module's tables.
+/// @return  true    The module has a dynamic symbol table.
+/// @return false    The module cannot be patched.
+///
+bool GetElfImage(
+  HMODULE   hMod,
+  ElfImage& image
+)
+{
+  ::memset(&image, 0, sizeof(image));
+  if (!hMod || !hMod->l_ld)
+  {
+    return false;
+  }
+
+  image.base        = hMod->l_addr;
+  image.relEntSize  = sizeof(ElfW(Rela));
+
+  size_t pltRelType = DT_RELA;
+  for (const ElfW(Dyn)* pDyn = hMod->l_ld; DT_NULL != pDyn->d_tag; ++pDyn)
+  {
+    const ElfW(Addr) ptr = pDyn->d_un.d_ptr;
+    switch (pDyn->d_tag)
+    {
+    case DT_SYMTAB:   image.pSymTab   = ElfPointer<ElfW(Sym)*>(image.base, ptr);            break;
+    case DT_STRTAB:   image.pStrTab   = ElfPointer<const char*>(image.base, ptr);           break;
+    case DT_HASH:     image.pHash     = ElfPointer<const Elf32_Word*>(image.base, ptr);     break;
+    case DT_GNU_HASH: image.pGnuHash  = ElfPointer<const Elf32_Word*>(image.base, ptr);     break;
+    case DT_VERSYM:   image.pVerSym   = ElfPointer<const ElfW(Half)*>(image.base, ptr);     break;
+    case DT_JMPREL:   image.pJmpRel   = ElfPointer<const unsigned char*>(image.base, ptr);  break;
+    case DT_RELA:
+    case DT_REL:      image.pRel      = ElfPointer<const unsigned char*>(image.base, ptr);  break;
+    case DT_PLTRELSZ: image.jmpRelSize  = pDyn->d_un.d_val;                                 break;
+    case DT_RELASZ:
+    case DT_RELSZ:    image.relSize     = pDyn->d_un.d_val;                                 break;
+    case DT_RELAENT:
+    case DT_RELENT:   image.relEntSize  = pDyn->d_un.d_val;                                 break;
+    case DT_PLTREL:   pltRelType        = pDyn->d_un.d_val;                                 break;
+    }
+  }
+
+  if (DT_REL == pltRelType && image.relEntSize == sizeof(ElfW(Rela)))
+  {
+    image.relEntSize = sizeof(ElfW(Rel));
+  }
+
+  return image.pSymTab && image.pStrTab;
+}
+
+//  ****************************************************************************
+/// Finds the file a dlopen called from another module would load.
+/// The hook calls the loader from this module, which would otherwise search 
+/// this module's paths and expand $ORIGIN to its directory.  The paths the 
+/// loader shares between modules, LD_LIBRARY_PATH without a RUNPATH, the 
+/// cache and the default directories, are left to the loader.
+///
+/// @param pszModulePath The name passed to dlopen.
+/// @param hCaller       The module that called dlopen.
+/// @param pfnDlopen     The original dlopen, to find a loaded module.
+/// @return              The path to load, or an empty string to load 
+///                      pszModulePath as it is.
+///
+std::string ResolveModulePath(
+  const char* pszModulePath,
+  HMODULE     hCaller,
+  pfndlopen   pfnDlopen
+)
+{
+  std::string path;
+  if ( !pszModulePath
+    || !hCaller
+    || hCaller == GetModuleFromAddress((PVOID)ResolveModulePath))
+  {
+    return path;
+  }
+
+  std::string name(pszModulePath);
+  if (std::string::npos != name.find('/'))
+  {
+    // Only $ORIGIN depends on the caller, the loader expands the others.
+    if ( std::string::npos != name.find('$')
+      && ExpandOrigin(hCaller, name))
+    {
+      path = name;
+    }
+
+    return path;
+  }
+
+  // A module loaded under this name is used, whichever module asks for it.
+  void* hLib = pfnDlopen(pszModulePath, RTLD_LAZY | RTLD_NOLOAD);
+  if (hLib)
+  {
+    ::dlclose(hLib);
+    return path;
+  }
+
+  // A RUNPATH follows LD_LIBRARY_PATH, and disables the RPATHs.  Without 
+  // one, the RPATH of the caller is searched, then that of the program.
+  const char* pRunPath = GetElfSearchPath(hCaller, DT_RUNPATH);
+  if (pRunPath)
+  {
+    if (!FindInSearchPath(::getenv("LD_LIBRARY_PATH"), hCaller, name, path))
+    {
+      FindInSearchPath(pRunPath, hCaller, name, path);
+    }
+  }
+  else if (!FindInSearchPath(GetElfSearchPath(hCaller, DT_RPATH), hCaller, name, path))
+  {
+    HMODULE hProgram = _r_debug.r_map;
+    if ( hProgram
+      && hProgram != hCaller
+      && !GetElfSearchPath(hProgram, DT_RUNPATH))
+    {
+      FindInSearchPath(GetElfSearchPath(hProgram, DT_RPATH), hProgram, name, path);
+    }
+  }
+
+  return path;
+}
+
+//  ****************************************************************************
+/// Returns the DT_RPATH or DT_RUNPATH string of a module, or NULL.
+///
+const char* GetElfSearchPath(
+  HMODULE       hMod,
+  ElfW(Sxword)  tag
+)
+{
+  ElfImage image;
+  if (!GetElfImage(hMod, image))
+  {
+    return NULL;
+  }
+
+  for (const ElfW(Dyn)* pDyn = hMod->l_ld; DT_NULL != pDyn->d_tag; ++pDyn)
+  {
+    if (tag == pDyn->d_tag)
+    {
+      return image.pStrTab + pDyn->d_un.d_val;
+    }
+  }
+
+  return NULL;
+}
+
+//  ****************************************************************************
+/// Replaces $ORIGIN and ${ORIGIN} with the directory of a module.
+///
+/// @return  true    The path held $ORIGIN, and has been expanded.
+/// @return false    The path is unchanged.
+///
+bool ExpandOrigin(
+  HMODULE       hMod,
+  std::string&  path
+)
+{
+  std::string origin;
+  bool        isExpanded = false;
+  for (size_t offset = path.find('$'); std::string::npos != offset; offset = path.find('$', offset))
+  {
+    size_t length = 0;
+    if (0 == path.compare(offset, 9, "${ORIGIN}"))
+    {
+      length = 9;
+    }
+    else if ( 0 == path.compare(offset, 7, "$ORIGIN")
+           && ( offset + 7 == path.size()
+             || !(::isalnum((unsigned char)path[offset + 7]) || '_' == path[offset + 7])))
+    {
+      length = 7;
+    }
+
+    if (!length)
+    {
+      ++offset;
+      continue;
+    }
+
+    // RTLD_DI_ORIGIN is not used, the loader only sets the origin of a 
+    // module once it has expanded a $ORIGIN for it.
+    if (origin.empty())
+    {
+      char program[PATH_MAX];
+      const ssize_t length = *hMod->l_name
+                             ? -1
+                             : ::readlink("/proc/self/exe", program, sizeof(program) - 1);
+      origin = *hMod->l_name
+               ? hMod->l_name
+               : std::string(program, length > 0 ? (size_t)length : 0);
+      origin.erase(std::min(origin.size(), origin.rfind('/')));
+      if (origin.empty())
+      {
+        return false;
+      }
+    }
+
+    path.replace(offset, length, origin);
+    offset    += origin.size();
+    isExpanded = true;
+  }
+
+  return isExpanded;
+}
+
+//  ****************************************************************************
+/// Searches a colon-separated list of directories for a file.
+///
+/// @param pSearchPath The directories, which may use $ORIGIN, or NULL.
+/// @param hMod        The module that $ORIGIN refers to.
+/// @param name        The file name.
+/// @param path        Receives the path of the first file found.
+/// @return  true      The file was found.
+///
+bool FindInSearchPath(
+  const char*         pSearchPath,
+  HMODULE             hMod,
+  const std::string&  name,
+  std::string&        path
+)
+{
+  for (const char* pDir = pSearchPath; pDir && *pDir; )
+  {
+    const char* pEnd = ::strchr(pDir, ':');
+    std::string dir  = pEnd ? std::string(pDir, pEnd) : std::string(pDir);
+    pDir = pEnd ? pEnd + 1 : NULL;
+
+    // An empty entry is the current directory.
+    std::string candidate = (dir.empty() ? std::string(".") : dir) + "/" + name;
+    ExpandOrigin(hMod, candidate);
+    if (0 == ::access(candidate.c_str(), F_OK))
+    {
+      path = candidate;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+//  ****************************************************************************
+/// dl_iterate_phdr callback that records an address inside each module.
+/// The program headers of a module are mapped with its first segment.
+///
+int AddModuleAddress(
+  dl_phdr_info* pInfo,
+  size_t        size,
+  void*         pAddresses
+)
+{
+  (void)size;
+
+  ((std::vector<PVOID>*)pAddresses)->push_back((PVOID)pInfo->dlpi_phdr);
+  return 0;
+}
+
+//  ****************************************************************************
+/// Hash function used by DT_GNU_HASH tables.
+///
+Elf32_Word GnuHash(const char* pName)
+{
+  Elf32_Word hash = 5381;
+  for (const unsigned char* p = (const unsigned char*)pName; *p; ++p)
+  {
+    hash = (hash << 5) + hash + *p;
+  }
+
+  return hash;
+}
+
+//  ****************************************************************************
+/// Hash function used by DT_HASH tables.
+///
+Elf32_Word ElfHash(const char* pName)
+{
+  Elf32_Word hash = 0;
+  for (const unsigned char* p = (const unsigned char*)pName; *p; ++p)
+  {
+    hash = (hash << 4) + *p;
+    Elf32_Word high = hash & 0xf0000000;
+    if (high)
+    {
+      hash ^= high >> 24;
+    }
+    hash &= ~high;
+  }
+
+  return hash;
+}
+
+//  ****************************************************************************
+/// Indicates if a symbol table entry is the default definition of pName.
+///
+bool IsElfSymbolMatch(
+  const ElfImage& image,
+  Elf32_Word      index,
+  const char*     pName
+)
+{
+  const ElfW(Sym)& sym = image.pSymTab[index];
+  if ( SHN_UNDEF == sym.st_shndx
+    || 0 != ::strcmp(image.pStrTab + sym.st_name, pName))
+  {
+    return false;
+  }
+
+  // Hidden versions are only reachable through an explicit version request.
+  return !image.pVerSym
+      || 0 == (image.pVerSym[index] & 0x8000);
+}
+
+//  ****************************************************************************
+/// Finds the symbol table entry for an exported function.
+/// The module's DT_GNU_HASH table is used when present, otherwise DT_HASH.
+/// A GNU hash table without buckets or bloom words cannot be searched, 
+/// and the DT_HASH table is used in its place.
+///
+/// @param image     The dynamic tables of the module to search.
+/// @param pName     The name of the requested symbol.
+/// @return          The default definition of the symbol.
+///                  NULL is returned if the module does not export pName.
+///
+ElfW(Sym)* FindElfSymbol(
+  const ElfImage& image,
+  const char*     pName
+)
+{
+  if ( image.pGnuHash
+    && image.pGnuHash[0]
+    && image.pGnuHash[2])
+  {
+    const Elf32_Word  bucketCount = image.pGnuHash[0];
+    const Elf32_Word  symOffset   = image.pGnuHash[1];
+    const Elf32_Word  bloomSize   = image.pGnuHash[2];
+    const Elf32_Word  bloomShift  = image.pGnuHash[3];
+    const ElfW(Addr)* pBloom      = (const ElfW(Addr)*)&image.pGnuHash[4];
+    const Elf32_Word* pBuckets    = (const Elf32_Word*)&pBloom[bloomSize];
+    const Elf32_Word* pChain      = &pBuckets[bucketCount];
+
+    const Elf32_Word  hash        = GnuHash(pName);
+    const unsigned    k_wordBits  = sizeof(ElfW(Addr)) * 8;
+
+    // The bloom filter rejects most names that are not exported.
+    ElfW(Addr) word = pBloom[(hash / k_wordBits) % bloomSize];
+    ElfW(Addr) mask = (ElfW(Addr))1 << (hash % k_wordBits)
+                    | (ElfW(Addr))1 << ((hash >> bloomShift) % k_wordBits);
+    if ((word & mask) != mask)
+    {
+      return NULL;
+    }
+
+    Elf32_Word index = pBuckets[hash % bucketCount];
+    if (index < symOffset)
+    {
+      return NULL;
+    }
+
+    // Walk the chain for this bucket, the low bit marks the last entry.
+    for (;; ++index)
+    {
+      Elf32_Word chainHash = pChain[index - symOffset];
+      if ( (hash | 1) == (chainHash | 1)
+        && IsElfSymbolMatch(image, index, pName))
+      {
+        return &image.pSymTab[index];
+      }
+
+      if (chainHash & 1)
+      {
+        break;
+      }
+    }
+
+    return NULL;
+  }
+
+  if ( image.pHash
+    && image.pHash[0])
+  {
+    const Elf32_Word  bucketCount = image.pHash[0];
+    const Elf32_Word* pBuckets    = &image.pHash[2];
+    const Elf32_Word* pChain      = &pBuckets[bucketCount];
+
+    for ( Elf32_Word index = pBuckets[ElfHash(pName) % bucketCount];
+          STN_UNDEF != index;
+          index = pChain[index])
+    {
+      if (IsElfSymbolMatch(image, index, pName))
+      {
+        return &image.pSymTab[index];
+      }
+    }
+  }
+
+  return NULL;
+}
+
+//  ****************************************************************************
+/// Returns the GOT slot bound by a relocation entry.
+///
+/// @param image     The dynamic tables of the module.
+/// @param pReloc    The relocation entry.
+/// @return          The address of the slot that holds a function address.
+///                  NULL is returned if the entry does not bind a function.
+///
+PROC* GetElfSlot(
+  const ElfImage&       image,
+  const unsigned char*  pReloc
+)
+{
+  // Rel is the leading portion of Rela.
+  const ElfW(Rel)* pRel = (const ElfW(Rel)*) pReloc;
+  const unsigned   type = APIHOOK_R_TYPE(pRel->r_info);
+  if ( APIHOOK_R_JUMP_SLOT != type
+    && APIHOOK_R_GLOB_DAT  != type)
+  {
+    return NULL;
+  }
+
+  return (PROC*)(image.base + pRel->r_offset);
+}
+
+//  ****************************************************************************
+/// Returns the name of the symbol bound by a relocation entry.
+///
+const char* GetElfSymbolName(
+  const ElfImage&       image,
+  const unsigned char*  pReloc
+)
+{
+  const ElfW(Rel)* pRel = (const ElfW(Rel)*) pReloc;
+  return image.pStrTab + image.pSymTab[APIHOOK_R_SYM(pRel->r_info)].st_name;
+}
+
+//  ****************************************************************************
+/// Finds every GOT slot of a module that holds an address in a set.
+///
+/// The PLT slots are usually a contiguous array, in the same order as their 
+/// relocations, and are scanned in place.  The data slots are mixed with 
+/// other relocations, so their values are gathered into a buffer first.
+/// A match in the PLT array is kept only if its own relocation binds that 
+/// slot to a function, so slots such as IRELATIVE are never patched.
+///
+/// @param image     The dynamic tables of the module to search.
+/// @param matcher   The addresses to search for.
+/// @param matches   Receives each matching slot and the matcher's index.
+///
+void MatchElfSlots(
+  const ElfImage&                         image,
+  const SlotMatcher&                      matcher,
+  std::vector<std::pair<PROC*, size_t> >& matches
+)
+{
+  if (!image.relEntSize)
+  {
+    return;
+  }
+
+  std::vector<SlotMatcher::Match> found;
+
+  const size_t pltCount = image.pJmpRel ? image.jmpRelSize / image.relEntSize : 0;
+  PROC* const  pFirst   = pltCount ? GetElfSlot(image, image.pJmpRel) : NULL;
+  PROC* const  pLast    = pltCount ? GetElfSlot(image, image.pJmpRel + (pltCount - 1) * image.relEntSize) : NULL;
+  const bool   isArray  = pFirst 
+                       && pLast 
+                       && pLast >= pFirst
+                       && size_t(pLast - pFirst) + 1 == pltCount;
+  if (isArray)
+  {
+    matcher.Scan(pFirst, pltCount, found);
+    for (size_t index = 0; index < found.size(); ++index)
+    {
+      PROC* ppfn = pFirst + found[index].slot;
+      if (ppfn == GetElfSlot(image, image.pJmpRel + found[index].slot * image.relEntSize))
+      {
+        matches.push_back(std::make_pair(ppfn, found[index].index));
+      }
+    }
+  }
+
+  const unsigned char* pTables[]  = { isArray ? NULL : image.pJmpRel, image.pRel    };
+  const size_t         sizes[]    = { image.jmpRelSize,               image.relSize };
+
+  std::vector<PROC*> slots;
+  std::vector<PROC>  values;
+  for (size_t table = 0; table < 2; ++table)
+  {
+    if (!pTables[table])
+    {
+      continue;
+    }
+
+    const unsigned char* pReloc = pTables[table];
+    const unsigned char* pEnd   = pReloc + sizes[table];
+    for (; pReloc < pEnd; pReloc += image.relEntSize)
+    {
+      PROC* ppfn = GetElfSlot(image, pReloc);
+      if (ppfn)
+      {
+        slots.push_back(ppfn);
+        values.push_back(*ppfn);
+      }
+    }
+  }
+
+  if (values.empty())
+  {
+    return;
+  }
+
+  found.clear();
+  matcher.Scan(&values[0], values.size(), found);
+  for (size_t index = 0; index < found.size(); ++index)
+  {
+    matches.push_back(std::make_pair(slots[found[index].slot], found[index].index));
+  }
+}
+
+//  ****************************************************************************
+/// Replaces every GOT slot, described by a relocation table, that 
+/// currently holds pfnOrig.
+///
+/// @param image         The dynamic tables of the module to patch.
+/// @param pRelocs       The relocation table to search.
+/// @param relocSize     The size in bytes of the relocation table.
+/// @param relocEntSize  The size of a single relocation entry.
+/// @param pfnOrig       The address to search for.
+/// @param pfnNew        The address to write.
+///
+void ReplaceElfSlots(
+  const ElfImage&       image,
+  const unsigned char*  pRelocs,
+  size_t                relocSize,
+  size_t                relocEntSize,
+  PROC                  pfnOrig,
+  PROC                  pfnNew
+)
+{
+  if (!pRelocs || !relocEntSize)
+  {
+    return;
+  }
+
+  const unsigned char* pEnd = pRelocs + relocSize;
+  for (; pRelocs < pEnd; pRelocs += relocEntSize)
+  {
+    // Is this the function we are looking for?
+    PROC* ppfn = GetElfSlot(image, pRelocs);
+    if ( !ppfn
+      || *ppfn != pfnOrig)
+    { // This is not the correct function.  Skip to the next one.
+      continue;
+    }
+
+    // Attempt to write the new address.
+    ReplaceFunctionAddress(ppfn, pfnNew);
+  }
+}
+
+//  ****************************************************************************
+/// Reports the current page protection of an address.
+///
+/// @param pv        The address for the request.
+/// @return          The PROT_* flags of the mapping that contains pv.
+///                  -1 is returned if the address is not mapped.
+///
+int QueryProtection(
+  PVOID pv
+)
+{
+  FILE* pMaps = ::fopen("/proc/self/maps", "r");
+  if (!pMaps)
+  {
+    return -1;
+  }
+
+  int       protect = -1;
+  uintptr_t addr    = (uintptr_t)pv;
+  char      line[512];
+  while (::fgets(line, sizeof(line), pMaps))
+  {
+    unsigned long first = 0;
+    unsigned long last  = 0;
+    char          perms[5] = "";
+    if ( 3 != ::sscanf(line, "%lx-%lx %4s", &first, &last, perms)
+      || addr < first
+      || addr >= last)
+    {
+      continue;
+    }
+
+    protect = ('r' == perms[0] ? PROT_READ  : 0)
+            | ('w' == perms[1] ? PROT_WRITE : 0)
+            | ('x' == perms[2] ? PROT_EXEC  : 0);
+    break;
+  }
+
+  ::fclose(pMaps);
+  return protect;
+}
+
+//  ****************************************************************************
+/// Writes a block of memory in this process, regardless of page protection.
+///
+/// @param pDest     The address to write.
+/// @param pSrc      The data to write.
+/// @param size      The number of bytes to write.
+/// @return  true    The data was written.
+/// @return false    The memory could not be written.
+///
+bool WriteSelfMemory(
+  PVOID       pDest,
+  const void* pSrc,
+  size_t      size
+)
+{
+  // Writes through /proc/self/mem bypass page protection,
+  // the same as WriteProcessMemory.  The file refers to the process that
+  // opened it, so a forked child must open its own, or it would write into
+  // its parent.  Every write is made with the hook list locked.
+  static int    s_memFd   = -1;
+  static pid_t  s_memPid  = 0;
+  const pid_t pid = ::getpid();
+  if (s_memPid != pid)
+  {
+    if (s_memFd >= 0)
+    {
+      ::close(s_memFd);
+    }
+
+    s_memFd   = ::open("/proc/self/mem", O_RDWR | O_CLOEXEC);
+    s_memPid  = pid;
+  }
+
+  if ( s_memFd >= 0
+    && (ssize_t)size == ::pwrite64(s_memFd, pSrc, size, (off64_t)(uintptr_t)pDest))
+  {
+    return true;
+  }
+
+  // If this fails because the kernel restricts /proc/self/mem,
+  // disable write protection, and try again.
+  int curProtect = QueryProtection(pDest);
+  if (curProtect < 0)
+  {
+    return false;
+  }
+
+  const uintptr_t pageSize  = (uintptr_t)GetPageSize();
+  const uintptr_t first     = (uintptr_t)pDest & ~(pageSize - 1);
+  const uintptr_t last      = ((uintptr_t)pDest + size + pageSize - 1) & ~(pageSize - 1);
+  if (0 != ::mprotect((void*)first, last - first, curProtect | PROT_WRITE))
+  {
+    return false;
+  }
+
+  ::memcpy(pDest, pSrc, size);
+
+  // Restore the original protection at this address.
+  ::mprotect((void*)first, last - first, curProtect);
+  return true;
 }
 #endif
 
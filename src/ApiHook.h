@@ -26,8 +26,26 @@
 #ifndef APIHOOK_H_INCLUDED
 #define APIHOOK_H_INCLUDED
 //  Includes *******************************************************************
+#include <string>
 #include <vector>
-#include <windows.h>
+
+#ifdef WIN32
+# include <windows.h>
+#else
+//  The ELF implementation identifies a module by its loader link_map entry.
+//  Mirror the few Win32 names used by this interface so both platforms 
+//  share the same declarations.
+struct link_map;
+
+typedef void          (*PROC)();
+typedef PROC          FARPROC;
+typedef link_map*     HMODULE;
+typedef void*         PVOID;
+typedef unsigned int  DWORD;
+# define WINAPI
+#endif
+
+class SlotMatcher;
 
 //  ****************************************************************************
 /// Provides a simple mechanism to Hook single API calls exported from a library.
@@ -36,6 +54,61 @@
 class ApiHook
 {
 public:
+  //  Patch State **************************************************************
+  /// An import slot and the address it holds.
+  struct PatchRecord
+  {
+    PROC*   ppfn;                       ///< Address of the import slot.
+    PROC    pfn;                        ///< Address held by the slot.
+  };
+
+  /// The records of a PatchState that share a page of memory.
+  struct PatchPage
+  {
+    PVOID   pPage;                      ///< Base address of the page.
+    DWORD   protect;                    ///< Protection of the page at capture.
+    size_t  first;                      ///< Index of the first record.
+    size_t  count;                      ///< Number of records on this page.
+    HMODULE hMod;                       ///< Module that held the page at capture.
+  };
+
+  /// A hook active at capture.  The addresses are kept so RestoreState can 
+  /// unwind the slots of a hook that has been destroyed since.
+  struct PatchHook
+  {
+    ApiHook*  pHook;                    ///< The hook object.
+    size_t    id;                       ///< Creation number of the hook, 
+                                        ///  which is never reused.
+    PROC      pfnOrig;                  ///< Address to the original function.
+    PROC      pfnHook;                  ///< Address to the hook function.
+  };
+
+  /// The import slots of every module, captured by CaptureState.
+  /// Records are sorted by address and grouped into pages so RestoreState 
+  /// can write each page in a single pass.
+  ///
+  /// Restoring a state also sets the hook list to the hooks it holds.  
+  /// Hooks created after the capture are dropped from the list, so Refresh 
+  /// and modules loaded later no longer install them, until they are 
+  /// destroyed or a state that holds them is restored.  Hooks destroyed 
+  /// after the capture are never restored.
+  struct PatchState
+  {
+    std::vector<PatchRecord>  records;  ///< Every import slot in the process.
+    std::vector<PatchPage>    pages;    ///< The pages that hold the records.
+    std::vector<PatchHook>    hooks;    ///< The hooks active at capture.
+  };
+
+  /// An import slot, with the names of the function it imports.
+  struct ImportEntry
+  {
+    std::string module;                 ///< Path of the module that holds the slot.
+    std::string library;                ///< Library the function is imported from.
+    std::string name;                   ///< Name of the imported function.
+    PROC*       ppfn;                   ///< Address of the import slot.
+    PROC        pfn;                    ///< Address held by the slot.
+  };
+
   ApiHook(const char* pLibName, const char* pFnName, PROC pfnHook);
  ~ApiHook();
 
@@ -50,14 +123,40 @@ public:
   static 
     bool    GetModuleExclude()                    { return sm_isExclude;}
 
+  static
+    void    CaptureState(PatchState& state);
+
+  static
+    void    RestoreState(const PatchState& state);
+
+  static
+    void    Refresh();
+
+  static
+    void    ListImports(std::vector<ImportEntry>& imports);
+
+  static
+    void    SetPatchThreadCount(size_t count);
+
+  static
+    size_t  GetPatchThreadCount()                 { return sm_patchThreadCount;}
+
 private:
   //  Typedef ******************************************************************
   typedef std::vector<ApiHook*>                   ApiHookArray;
 
+  struct PatchJob;
+
   //  Data Members *************************************************************
   static
     ApiHookArray  sm_hooks;             ///< A static array of pointers to ApiHook 
                                         ///  objects that are currently active.                                      
+  static
+    ApiHookArray  sm_liveHooks;         ///< Every ApiHook object that exists, 
+                                        ///  including those RestoreState has 
+                                        ///  dropped from sm_hooks.
+  static
+    size_t        sm_nextId;            ///< Creation number of the next hook.
   static 
     PVOID         sm_pMaxAppAddr;       ///< The maximum private memory address 
                                         ///  for this module.
@@ -65,15 +164,31 @@ private:
     bool          sm_isExclude;         ///< Indicates if the module this object
                                         ///  instance resides in should be excluded 
                                         ///  from API Hooks.
+  static
+    size_t        sm_patchThreadCount;  ///< Number of threads that match 
+                                        ///  import tables in ReplaceIATEntriesEx.
                                         
   std::string     m_libName;            ///<  Library module that contains the 
                                         ///   function to be hooked.
 
   std::string     m_fnName;             ///< The name of the function to be hooked.  
                                         
+  HMODULE         m_hLib;               ///< Library module that exports the 
+                                        ///  hooked function.
+
   PROC            m_pfnOrig;            ///< Address to the original function.
                                         
   PROC            m_pfnHook;            ///< Address to the hook function.
+
+  size_t          m_id;                 ///< Creation number of this hook.
+
+#ifndef WIN32
+  PROC            m_pfnExport;          ///< Exported address the hook replaced, 
+                                        ///  the resolver of an indirect function.
+
+  unsigned char   m_exportInfo;         ///< Symbol type and binding of the 
+                                        ///  export the hook replaced.
+#endif
   
   //  Instantiate Hooks for these API related system calls. ********************
 #ifdef WIN32
@@ -82,6 +197,9 @@ private:
   static ApiHook sm_LoadLibraryExA;
   static ApiHook sm_LoadLibraryExW;
   static ApiHook sm_GetProcAddress;
+#else
+  static ApiHook sm_dlopen;
+  static ApiHook sm_dlclose;
 #endif
 
   //  Methods ******************************************************************
@@ -100,6 +218,31 @@ private:
       PROC        pfnHook
     );
 
+  static
+    void WINAPI MatchIATEntries(
+      HMODULE                   hModCaller,
+      const SlotMatcher&        matcher,
+      const ApiHookArray&       hooks,
+      std::vector<PatchRecord>& records
+    );
+
+  static
+    void WINAPI ReplaceIATEntriesEx(
+      const ApiHookArray& hooks
+    );
+
+#ifdef WIN32
+  static 
+    DWORD WINAPI PatchThreadProc(
+      PVOID pJob
+    );
+#else
+  static 
+    void*   PatchThreadProc(
+      PVOID pJob
+    );
+#endif
+
   static
     void WINAPI ReplaceEATEntry(
       HMODULE     hMod,
@@ -107,6 +250,24 @@ private:
       PROC        pfnNew
     );
 
+#ifndef WIN32
+  static
+    bool    GetEATEntry(
+      HMODULE         hMod,
+      const char*     pFnName,
+      PROC&           pfn,
+      unsigned char&  info
+    );
+
+  static
+    void    SetEATEntry(
+      HMODULE         hMod,
+      const char*     pFnName,
+      PROC            pfn,
+      unsigned char   info
+    );
+#endif
+
 
   static 
     void WINAPI FixupModuleOnLoad(
@@ -114,6 +275,7 @@ private:
       DWORD   flags
     );
 
+#ifdef WIN32
   static 
     HMODULE WINAPI LoadLibraryA(
       PCSTR pszModulePath
@@ -143,6 +305,18 @@ private:
       HMODULE     hMod,
       const char* pFnName
     );
+#else
+  static 
+    void*   dlopen(
+      const char* pszModulePath,
+      int         flags
+    );
+
+  static 
+    int     dlclose(
+      void*       hLib
+    );
+#endif
 
 };
 
@@ -0,0 +1,46 @@
+/// @file   ApiMock.cpp
+///
+/// Typed call expectations for hooked API functions
+///
+/// The MIT License(MIT)
+/// @copyright 2014 Paul M Watt
+///
+//  ****************************************************************************
+//  Includes *******************************************************************
+#include "ApiMock.h"
+
+#include <cstdlib>
+#include <cstring>
+
+//  Implementation *************************************************************
+//  ****************************************************************************
+/// Allocates the memory for a test.  Nothing is allocated after this.
+///
+/// @param size       Bytes for expectations and captured calls.
+///
+ApiMockArena::ApiMockArena(size_t size)
+  : m_pBuffer((char*)::malloc(size))
+  , m_size(m_pBuffer ? size : 0)
+  , m_used(0)
+{
+  // Fault the pages in now, rather than in the calls that are measured.
+  if (m_pBuffer)
+  {
+    ::memset(m_pBuffer, 0, m_size);
+  }
+}
+
+//  ****************************************************************************
+ApiMockArena::~ApiMockArena()
+{
+  ::free(m_pBuffer);
+}
+
+//  ****************************************************************************
+/// Releases everything in the arena, for the next test.  The mocks that use
+/// the arena must be destroyed first.
+///
+void ApiMockArena::Reset()
+{
+  m_used.store(0, std::memory_order_relaxed);
+}
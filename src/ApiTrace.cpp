@@ -0,0 +1,521 @@
+/// @file   ApiTrace.cpp
+///
+/// Low overhead tracing of hooked API calls
+///
+/// The MIT License(MIT)
+/// @copyright 2014 Paul M Watt
+///
+//  ****************************************************************************
+//  Includes *******************************************************************
+#include "ApiTrace.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+//  Static Data Members ********************************************************
+std::atomic<bool>           ApiTrace::sm_isEnabled(false);
+thread_local ApiTrace::Ring* ApiTrace::sm_pThreadRing = NULL;
+
+//  Trace File State ***********************************************************
+namespace // unnamed
+{
+
+//  ****************************************************************************
+/// The header at the start of a trace file.  The events follow the header,
+/// and the hook names follow the events as a length and the name's text.
+///
+struct TraceHeader
+{
+  char      magic[8];                   ///< k_traceMagic.
+  uint32_t  version;                    ///< k_traceVersion.
+  uint32_t  hookCount;                  ///< Number of hook names.
+  uint64_t  eventCount;                 ///< Number of events.
+  uint64_t  dropped;                    ///< Events lost to full rings.
+  double    ticksPerUs;                 ///< Timestamp ticks per microsecond.
+  uint32_t  pid;                        ///< Process that was traced.
+  uint32_t  reserved;
+};
+
+const char      k_traceMagic[8] = { 'A', 'P', 'I', 'T', 'R', 'A', 'C', 'E' };
+const uint32_t  k_traceVersion  = 2;
+const size_t    k_initialEvents = 1 << 16;
+const int       k_drainPeriodMs = 1;
+
+std::atomic<ApiTrace::Ring*>  g_pRings(NULL);   ///< Every thread's ring.
+std::atomic<bool>             g_isDraining(false);
+std::thread                   g_drainer;
+
+std::mutex                    g_hookLock;
+std::vector<std::string>      g_hookNames;
+
+int       g_fd          = -1;           ///< The trace file.
+char*     g_pMap        = NULL;         ///< The mapped trace file.
+size_t    g_mapSize     = 0;            ///< Size of the mapping in bytes.
+uint64_t  g_eventCount  = 0;            ///< Events written to the file.
+uint64_t  g_lostCount   = 0;            ///< Events the file could not hold.
+uint64_t  g_startTicks  = 0;
+uint64_t  g_startNs     = 0;
+
+//  Forward Declarations *******************************************************
+uint64_t  GetMonotonicNs();
+bool      ReserveTraceFile(size_t size);
+void      DrainRings();
+void      WriteJsonString(FILE* pFile, const std::string& text);
+
+//  ****************************************************************************
+/// Releases the calling thread's ring when the thread exits.
+///
+struct RingRelease
+{
+ ~RingRelease()                         { ApiTrace::DetachThread();}
+};
+
+} // namespace anonymous
+
+//  Implementation *************************************************************
+//  ****************************************************************************
+/// Starts writing traced calls to a file.
+///
+/// @param pPath     The path of the trace file to create.
+/// @return  true    The trace has started.
+/// @return false    A trace is already running, or the file could not be
+///                  created.
+///
+bool ApiTrace::Start(const char* pPath)
+{
+  if (IsEnabled() || g_isDraining)
+  {
+    return false;
+  }
+
+  g_fd = ::open(pPath, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (g_fd < 0)
+  {
+    return false;
+  }
+
+  g_eventCount = 0;
+  g_lostCount  = 0;
+  if (!ReserveTraceFile(sizeof(TraceHeader) + k_initialEvents * sizeof(Event)))
+  {
+    ::close(g_fd);
+    g_fd = -1;
+    return false;
+  }
+
+  // Discard anything left in the rings by a previous trace.
+  for (Ring* pRing = g_pRings.load(); pRing; pRing = pRing->pNext)
+  {
+    pRing->tail.store(pRing->head.load(std::memory_order_acquire),
+                      std::memory_order_release);
+    pRing->dropped.store(0, std::memory_order_relaxed);
+  }
+
+  g_startTicks = ReadTimestamp();
+  g_startNs    = GetMonotonicNs();
+
+  g_isDraining = true;
+  g_drainer    = std::thread(DrainThread);
+  sm_isEnabled.store(true, std::memory_order_release);
+  return true;
+}
+
+//  ****************************************************************************
+/// Stops the trace, and completes the trace file.
+///
+void ApiTrace::Stop()
+{
+  if (!g_isDraining)
+  {
+    return;
+  }
+
+  sm_isEnabled.store(false, std::memory_order_release);
+  g_isDraining = false;
+  g_drainer.join();
+
+  // Collect the events recorded while the drain thread was stopping.
+  DrainRings();
+
+  // Calibrate the timestamp counter against the duration of the trace.
+  const uint64_t ticks    = ReadTimestamp() - g_startTicks;
+  const uint64_t duration = GetMonotonicNs() - g_startNs;
+
+  TraceHeader header;
+  ::memcpy(header.magic, k_traceMagic, sizeof(header.magic));
+  header.version    = k_traceVersion;
+  header.pid        = (uint32_t)::getpid();
+  header.reserved   = 0;
+  header.eventCount = g_eventCount;
+  header.dropped    = GetDroppedCount();
+  header.ticksPerUs = duration
+                      ? 1000.0 * (double)ticks / (double)duration
+                      : 1000.0;
+
+  // Append the hook names after the events.
+  size_t offset = sizeof(TraceHeader) + g_eventCount * sizeof(Event);
+  {
+    std::lock_guard<std::mutex> lock(g_hookLock);
+    header.hookCount = (uint32_t)g_hookNames.size();
+
+    for (size_t index = 0; index < g_hookNames.size(); ++index)
+    {
+      const uint32_t length = (uint32_t)g_hookNames[index].size();
+      if (!ReserveTraceFile(offset + sizeof(length) + length))
+      {
+        header.hookCount = (uint32_t)index;
+        break;
+      }
+
+      ::memcpy(g_pMap + offset, &length, sizeof(length));
+      ::memcpy(g_pMap + offset + sizeof(length), g_hookNames[index].data(), length);
+      offset += sizeof(length) + length;
+    }
+  }
+
+  ::memcpy(g_pMap, &header, sizeof(header));
+
+  ::munmap(g_pMap, g_mapSize);
+  ::ftruncate(g_fd, (off_t)offset);
+  ::close(g_fd);
+
+  g_pMap    = NULL;
+  g_mapSize = 0;
+  g_fd      = -1;
+}
+
+//  ****************************************************************************
+/// Assigns an id to a hook for use with Scope.
+/// Call once for each hook, typically from a static local variable.
+///
+/// @param pName     The name reported for the hook in the trace.
+/// @return          The id of the hook.
+///
+uint32_t ApiTrace::RegisterHook(const char* pName)
+{
+  std::lock_guard<std::mutex> lock(g_hookLock);
+  g_hookNames.push_back(pName);
+  return (uint32_t)(g_hookNames.size() - 1);
+}
+
+//  ****************************************************************************
+/// Reports the number of events lost since the trace started, because a
+/// thread's ring or the trace file was full.
+///
+uint64_t ApiTrace::GetDroppedCount()
+{
+  uint64_t dropped = g_lostCount;
+  for (Ring* pRing = g_pRings.load(); pRing; pRing = pRing->pNext)
+  {
+    dropped += pRing->dropped.load(std::memory_order_relaxed);
+  }
+
+  return dropped;
+}
+
+//  ****************************************************************************
+/// Converts a trace file into the Chrome JSON trace format.
+///
+/// @param pTracePath  The trace file written by Start and Stop.
+/// @param pJsonPath   The path of the JSON file to create.
+/// @return  true      The JSON file was written.
+/// @return false      The trace file could not be read or is not valid.
+///
+bool ApiTrace::ConvertToChromeJson(
+  const char* pTracePath,
+  const char* pJsonPath
+)
+{
+  FILE* pTrace = ::fopen(pTracePath, "rb");
+  if (!pTrace)
+  {
+    return false;
+  }
+
+  std::vector<char> data;
+  char              buffer[65536];
+  size_t            count = 0;
+  while (0 < (count = ::fread(buffer, 1, sizeof(buffer), pTrace)))
+  {
+    data.insert(data.end(), buffer, buffer + count);
+  }
+
+  ::fclose(pTrace);
+
+  TraceHeader header;
+  if ( data.size() < sizeof(header)
+    || 0 != ::memcmp(data.data(), k_traceMagic, sizeof(k_traceMagic)))
+  {
+    return false;
+  }
+
+  ::memcpy(&header, data.data(), sizeof(header));
+  const size_t eventsEnd = sizeof(header) + header.eventCount * sizeof(Event);
+  if ( k_traceVersion != header.version
+    || data.size() < eventsEnd)
+  {
+    return false;
+  }
+
+  // Read the hook names.
+  std::vector<std::string> names;
+  size_t offset = eventsEnd;
+  for (uint32_t index = 0; index < header.hookCount; ++index)
+  {
+    uint32_t length = 0;
+    if (data.size() < offset + sizeof(length))
+      break;
+
+    ::memcpy(&length, &data[offset], sizeof(length));
+    offset += sizeof(length);
+    if (data.size() < offset + length)
+      break;
+
+    names.push_back(std::string(&data[offset], length));
+    offset += length;
+  }
+
+  FILE* pJson = ::fopen(pJsonPath, "w");
+  if (!pJson)
+  {
+    return false;
+  }
+
+  // Report times relative to the earliest event.
+  const Event* pEvents = (const Event*)&data[sizeof(header)];
+  uint64_t     base    = 0;
+  for (uint64_t index = 0; index < header.eventCount; ++index)
+  {
+    if (0 == index || pEvents[index].enter < base)
+    {
+      base = pEvents[index].enter;
+    }
+  }
+
+  const double ticksPerUs = header.ticksPerUs > 0 ? header.ticksPerUs : 1000.0;
+
+  ::fprintf(pJson, "{\"traceEvents\":[");
+  for (uint64_t index = 0; index < header.eventCount; ++index)
+  {
+    const Event& event = pEvents[index];
+    char hookId[16];
+    ::snprintf(hookId, sizeof(hookId), "hook %u", event.hookId);
+
+    ::fprintf(pJson, "%s\n{\"name\":", index ? "," : "");
+    WriteJsonString(pJson, event.hookId < names.size() ? names[event.hookId] : hookId);
+    ::fprintf(pJson,
+              ",\"cat\":\"ApiHook\",\"ph\":\"X\","
+              "\"pid\":%u,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f,"
+              "\"args\":{\"result\":%llu}}",
+              header.pid,
+              event.threadId,
+              (double)(event.enter - base) / ticksPerUs,
+              (double)(event.exit - event.enter) / ticksPerUs,
+              (unsigned long long)event.result);
+  }
+
+  ::fprintf(pJson,
+            "\n],\"displayTimeUnit\":\"ns\",\"otherData\":{\"droppedEvents\":%llu}}\n",
+            (unsigned long long)header.dropped);
+
+  return 0 == ::fclose(pJson);
+}
+
+//  ****************************************************************************
+/// Assigns a ring to the calling thread.  A ring released by a thread that
+/// has exited is reused, otherwise a new ring is added to the list of rings.
+/// Rings are never freed, so the drain thread can always read them.
+///
+ApiTrace::Ring* ApiTrace::AttachThread()
+{
+  // Constructed by the first call on each thread, and destroyed when the
+  // thread exits.
+  static thread_local RingRelease t_release;
+  (void)t_release;
+
+  const uint32_t threadId = (uint32_t)::syscall(SYS_gettid);
+  for (Ring* pRing = g_pRings.load(std::memory_order_acquire); pRing; pRing = pRing->pNext)
+  {
+    bool isOwned = false;
+    if ( !pRing->isOwned.load(std::memory_order_relaxed)
+      && pRing->isOwned.compare_exchange_strong(isOwned, true, std::memory_order_acquire))
+    {
+      // Events the previous owner left in the ring keep its thread id.
+      pRing->threadId = threadId;
+      sm_pThreadRing  = pRing;
+      return pRing;
+    }
+  }
+
+  Ring* pRing = new Ring;
+  pRing->head.store(0, std::memory_order_relaxed);
+  pRing->freeTail = 0;
+  pRing->tail.store(0, std::memory_order_relaxed);
+  pRing->dropped.store(0, std::memory_order_relaxed);
+  pRing->isOwned.store(true, std::memory_order_relaxed);
+  pRing->threadId = threadId;
+  pRing->pNext    = g_pRings.load(std::memory_order_relaxed);
+
+  while (!g_pRings.compare_exchange_weak(pRing->pNext, pRing,
+                                         std::memory_order_release,
+                                         std::memory_order_relaxed))
+  { }
+
+  sm_pThreadRing = pRing;
+  return pRing;
+}
+
+//  ****************************************************************************
+/// Releases the calling thread's ring, for reuse by another thread.
+/// The events already in the ring are still drained.
+///
+void ApiTrace::DetachThread()
+{
+  Ring* pRing = sm_pThreadRing;
+  if (pRing)
+  {
+    sm_pThreadRing = NULL;
+    pRing->isOwned.store(false, std::memory_order_release);
+  }
+}
+
+//  ****************************************************************************
+/// Moves events from the rings to the trace file until the trace stops.
+///
+void ApiTrace::DrainThread()
+{
+  while (g_isDraining)
+  {
+    DrainRings();
+    std::this_thread::sleep_for(std::chrono::milliseconds(k_drainPeriodMs));
+  }
+}
+
+namespace // unnamed
+{
+
+//  ****************************************************************************
+/// Reads the monotonic clock in nanoseconds.
+///
+uint64_t GetMonotonicNs()
+{
+  timespec now;
+  ::clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+//  ****************************************************************************
+/// Writes text as a JSON string, with its quotes.
+///
+void WriteJsonString(FILE* pFile, const std::string& text)
+{
+  ::fputc('"', pFile);
+  for (size_t index = 0; index < text.size(); ++index)
+  {
+    const unsigned char c = (unsigned char)text[index];
+    if ('"' == c || '\\' == c)
+    {
+      ::fputc('\\', pFile);
+      ::fputc(c, pFile);
+    }
+    else if (c < 0x20)
+    {
+      ::fprintf(pFile, "\\u%04x", c);
+    }
+    else
+    {
+      ::fputc(c, pFile);
+    }
+  }
+
+  ::fputc('"', pFile);
+}
+
+//  ****************************************************************************
+/// Grows the trace file and its mapping to hold at least size bytes.
+///
+/// @param size      The number of bytes required.
+/// @return  true    The mapping holds at least size bytes.
+/// @return false    The file could not be extended.
+///
+bool ReserveTraceFile(size_t size)
+{
+  if (size <= g_mapSize)
+  {
+    return true;
+  }
+
+  size_t newSize = g_mapSize ? g_mapSize : size;
+  while (newSize < size)
+  {
+    newSize *= 2;
+  }
+
+  if (0 != ::ftruncate(g_fd, (off_t)newSize))
+  {
+    return false;
+  }
+
+  void* pMap = g_pMap
+               ? ::mremap(g_pMap, g_mapSize, newSize, MREMAP_MAYMOVE)
+               : ::mmap(NULL, newSize, PROT_READ | PROT_WRITE, MAP_SHARED, g_fd, 0);
+  if (MAP_FAILED == pMap)
+  {
+    return false;
+  }
+
+  g_pMap    = (char*)pMap;
+  g_mapSize = newSize;
+  return true;
+}
+
+//  ****************************************************************************
+/// Moves every pending event from the rings into the trace file.
+///
+void DrainRings()
+{
+  for (ApiTrace::Ring* pRing = g_pRings.load(std::memory_order_acquire);
+       pRing;
+       pRing = pRing->pNext)
+  {
+    uint64_t       tail = pRing->tail.load(std::memory_order_relaxed);
+    const uint64_t head = pRing->head.load(std::memory_order_acquire);
+    if (tail == head)
+    {
+      continue;
+    }
+
+    const uint64_t count    = head - tail;
+    const size_t   required = sizeof(TraceHeader)
+                            + (g_eventCount + count) * sizeof(ApiTrace::Event);
+    if (!ReserveTraceFile(required))
+    {
+      g_lostCount += count;
+      pRing->tail.store(head, std::memory_order_release);
+      continue;
+    }
+
+    ApiTrace::Event* pOut = (ApiTrace::Event*)(g_pMap + sizeof(TraceHeader)) + g_eventCount;
+    for (; tail != head; ++tail, ++pOut)
+    {
+      *pOut = pRing->events[tail & (ApiTrace::k_ringSize - 1)];
+    }
+
+    // Release the slots back to the owning thread.
+    g_eventCount += count;
+    pRing->tail.store(head, std::memory_order_release);
+  }
+}
+
+} // namespace unnamed
@@ -0,0 +1,214 @@
+/// @file   ApiTrace.h
+///
+/// Low overhead tracing of hooked API calls
+///
+/// Each traced call writes a fixed-size event, with the hook id, thread,
+/// enter and exit timestamps and return value, into a lock-free ring buffer
+/// owned by the calling thread.  A background thread drains the rings into
+/// a memory mapped trace file.  When a ring is full the event is counted as
+/// dropped rather than blocking the caller.  A thread's ring is reused by
+/// another thread after it exits.
+///
+/// A traced call costs two reads of the timestamp counter and the write of
+/// the event, about 10 to 15 ns.  Where the counter is read through a
+/// virtual machine trap, each read costs about 22 ns and a traced call about
+/// 60 ns, which does not meet the target of 20 ns per call.
+///
+/// The trace file can be converted to the Chrome JSON trace format,
+/// which is also read by Perfetto.
+///
+/// Example:
+///   int Hook_send(int fd, const void* pBuf, size_t len, int flags)
+///   {
+///     static const uint32_t k_traceId = ApiTrace::RegisterHook("send");
+///     ApiTrace::Scope trace(k_traceId);
+///
+///     return trace.Return(((pfnsend)(PROC)*g_pSend)(fd, pBuf, len, flags));
+///   }
+///
+/// The MIT License(MIT)
+/// @copyright 2014 Paul M Watt
+///
+//  ****************************************************************************
+#ifndef APITRACE_H_INCLUDED
+#define APITRACE_H_INCLUDED
+//  Includes *******************************************************************
+#include <atomic>
+#include <stdint.h>
+
+#ifdef WIN32
+# error "API tracing requires a POSIX platform."
+#endif
+
+#if defined(__i386__) || defined(__x86_64__)
+# include <x86intrin.h>
+#else
+# include <time.h>
+#endif
+
+//  ****************************************************************************
+/// Records hooked API calls to a trace file.
+///
+class ApiTrace
+{
+public:
+  //  Constants ****************************************************************
+  static const uint32_t k_ringSize = 4096;  ///< Events in each thread's ring.
+
+  //  Typedef ******************************************************************
+  /// A single traced call, as stored in the trace file.
+  struct Event
+  {
+    uint64_t  enter;                    ///< Timestamp at entry to the hook.
+    uint64_t  exit;                     ///< Timestamp at exit from the hook.
+    uint64_t  result;                   ///< Return value of the hook.
+    uint32_t  hookId;                   ///< Id from RegisterHook.
+    uint32_t  threadId;                 ///< Thread that made the call.
+  };
+
+  /// The events of a single thread.  Only the owning thread writes events,
+  /// and only the drain thread consumes them.  A ring is released when its
+  /// thread exits, and is reused by the next thread that attaches.
+  struct Ring
+  {
+    std::atomic<uint64_t> head;         ///< Next event to write.
+    uint64_t              freeTail;     ///< Tail last read by the owner.
+    char                  pad0[48];
+    std::atomic<uint64_t> tail;         ///< Next event to drain.
+    char                  pad1[56];
+    std::atomic<uint64_t> dropped;      ///< Events lost to a full ring.
+    std::atomic<bool>     isOwned;      ///< A thread is attached to the ring.
+    uint32_t              threadId;     ///< Thread that owns this ring.
+    Ring*                 pNext;        ///< Next ring in the list of rings.
+    Event                 events[k_ringSize];
+  };
+
+  //  **************************************************************************
+  /// Times a single call to a hook.  The event is recorded when the scope
+  /// ends, with the value passed to Return as its result.
+  ///
+  class Scope
+  {
+  public:
+    explicit Scope(uint32_t hookId)
+      : m_hookId(hookId)
+      , m_enter(IsEnabled() ? ReadTimestamp() : 0)
+      , m_result(0)
+    { }
+
+   ~Scope()
+    {
+      if (m_enter)
+      {
+        Record(m_hookId, m_enter, ReadTimestamp(), m_result);
+      }
+    }
+
+    template <typename T>
+    T Return(T result)
+    {
+      m_result = (uint64_t)result;
+      return result;
+    }
+
+  private:
+    uint32_t  m_hookId;
+    uint64_t  m_enter;
+    uint64_t  m_result;
+  };
+
+  //  Methods ******************************************************************
+  static
+    bool      Start(const char* pPath);
+
+  static
+    void      Stop();
+
+  static
+    uint32_t  RegisterHook(const char* pName);
+
+  static
+    uint64_t  GetDroppedCount();
+
+  static
+    void      DetachThread();
+
+  static
+    bool      ConvertToChromeJson(const char* pTracePath, const char* pJsonPath);
+
+  static
+    bool      IsEnabled()                 { return sm_isEnabled.load(std::memory_order_relaxed);}
+
+  //  **************************************************************************
+  /// Reads the timestamp counter used for trace events.
+  ///
+  static
+    uint64_t  ReadTimestamp()
+  {
+#if defined(__i386__) || defined(__x86_64__)
+    return __rdtsc();
+#elif defined(__aarch64__)
+    uint64_t ticks;
+    __asm__ __volatile__("mrs %0, cntvct_el0" : "=r"(ticks));
+    return ticks;
+#else
+    timespec now;
+    ::clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+#endif
+  }
+
+  //  **************************************************************************
+  /// Writes an event into the calling thread's ring.
+  ///
+  static
+    void      Record(uint32_t hookId, uint64_t enter, uint64_t exit, uint64_t result)
+  {
+    Ring* pRing = sm_pThreadRing;
+    if (!pRing)
+    {
+      pRing = AttachThread();
+    }
+
+    // The tail shares a cache line with the drain thread, so it is only
+    // read again when the ring appears to be full.
+    const uint64_t head = pRing->head.load(std::memory_order_relaxed);
+    if (head - pRing->freeTail >= k_ringSize)
+    {
+      pRing->freeTail = pRing->tail.load(std::memory_order_acquire);
+      if (head - pRing->freeTail >= k_ringSize)
+      {
+        // Never block the caller, count the lost event instead.  Start
+        // resets the count from another thread.
+        pRing->dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+      }
+    }
+
+    Event& event   = pRing->events[head & (k_ringSize - 1)];
+    event.enter    = enter;
+    event.exit     = exit;
+    event.result   = result;
+    event.hookId   = hookId;
+    event.threadId = pRing->threadId;
+
+    pRing->head.store(head + 1, std::memory_order_release);
+  }
+
+private:
+  //  Data Members *************************************************************
+  static
+    std::atomic<bool>   sm_isEnabled;   ///< Indicates if a trace is running.
+
+  static thread_local
+    Ring*               sm_pThreadRing; ///< The ring of the calling thread.
+
+  //  Methods ******************************************************************
+  static
+    Ring*     AttachThread();
+
+  static
+    void      DrainThread();
+};
+
+#endif
@@ -0,0 +1,395 @@
+/// @file   SlotMatcher.cpp
+///
+/// Matches an array of import slots against a set of function addresses
+///
+/// The MIT License(MIT)
+/// @copyright 2014 Paul M Watt
+///
+//  ****************************************************************************
+//  Includes *******************************************************************
+#include "SlotMatcher.h"
+
+#include <algorithm>
+
+#if defined(__i386__) || defined(__x86_64__) || defined(_M_IX86) || defined(_M_X64)
+# define SLOTMATCHER_X86
+# include <immintrin.h>
+# ifdef _MSC_VER
+#   include <intrin.h>
+#   define SLOTMATCHER_TARGET(isa)
+# else
+#   define SLOTMATCHER_TARGET(isa)  __attribute__((target(isa)))
+# endif
+#endif
+
+#if defined(_WIN64) || defined(__LP64__)
+# define SLOTMATCHER_64
+#endif
+
+//  Forward Declarations *******************************************************
+namespace // unnamed
+{
+
+#ifdef SLOTMATCHER_X86
+SlotMatcher::Isa DetectIsa();
+
+void FindHitsSse2(const uintptr_t*      pSlots,
+                  size_t                count,
+                  const uintptr_t*      pValues,
+                  size_t                valueCount,
+                  std::vector<size_t>&  hits);
+
+void FindHitsAvx2(const uintptr_t*      pSlots,
+                  size_t                count,
+                  const uintptr_t*      pValues,
+                  size_t                valueCount,
+                  std::vector<size_t>&  hits);
+#endif
+
+void FindHitsScalar(const uintptr_t*      pSlots,
+                    size_t                first,
+                    size_t                last,
+                    const uintptr_t*      pValues,
+                    size_t                valueCount,
+                    std::vector<size_t>&  hits);
+
+} // namespace anonymous
+
+//  Implementation *************************************************************
+//  ****************************************************************************
+SlotMatcher::SlotMatcher()
+  : m_filter((size_t(1) << k_filterBits) / 32, 0)
+  , m_count(0)
+{ }
+
+//  ****************************************************************************
+/// Adds an address to the set.  Matches report the order addresses were
+/// added, and an address that is added twice keeps its first position.
+///
+/// @param pfn       The address to find.
+///
+void SlotMatcher::Add(PROC pfn)
+{
+  const size_t    index = m_count++;
+  const uintptr_t value = (uintptr_t)pfn;
+  if (!value)
+  {
+    return;
+  }
+
+  std::vector<uintptr_t>::iterator iter =
+    std::lower_bound(m_values.begin(), m_values.end(), value);
+  if ( iter != m_values.end()
+    && *iter == value)
+  {
+    return;
+  }
+
+  m_indices.insert(m_indices.begin() + (iter - m_values.begin()), index);
+  m_values.insert(iter, value);
+
+  const size_t hash = HashValue(value);
+  m_filter[hash / 32] |= uint32_t(1) << (hash % 32);
+}
+
+//  ****************************************************************************
+/// Searches the set for an address.
+///
+/// @param pfn       The address to find.
+/// @return          The order the address was added.
+///                  k_notFound is returned if it is not in the set.
+///
+size_t SlotMatcher::Find(PROC pfn) const
+{
+  const uintptr_t value = (uintptr_t)pfn;
+  std::vector<uintptr_t>::const_iterator iter =
+    std::lower_bound(m_values.begin(), m_values.end(), value);
+  if ( iter == m_values.end()
+    || *iter != value)
+  {
+    return k_notFound;
+  }
+
+  return m_indices[iter - m_values.begin()];
+}
+
+//  ****************************************************************************
+/// Reports every slot that holds an address in the set, in a single pass
+/// over the slots.
+///
+/// @param pSlots    The first slot of a contiguous array.
+/// @param count     The number of slots.
+/// @param matches   Receives a match for each slot, in slot order.
+///
+void SlotMatcher::Scan(
+  const PROC*           pSlots,
+  size_t                count,
+  std::vector<Match>&   matches
+) const
+{
+  if ( m_values.empty()
+    || !count)
+  {
+    return;
+  }
+
+  const uintptr_t* pValues = (const uintptr_t*)pSlots;
+  if (m_values.size() > k_simdLimit)
+  {
+    ScanHashed(pValues, count, matches);
+    return;
+  }
+
+  std::vector<size_t> hits;
+  switch (GetIsa())
+  {
+#ifdef SLOTMATCHER_X86
+  case k_avx2:
+    FindHitsAvx2(pValues, count, &m_values[0], m_values.size(), hits);
+    break;
+
+  case k_sse2:
+    FindHitsSse2(pValues, count, &m_values[0], m_values.size(), hits);
+    break;
+#endif
+
+  default:
+    FindHitsScalar(pValues, 0, count, &m_values[0], m_values.size(), hits);
+    break;
+  }
+
+  for (size_t index = 0; index < hits.size(); ++index)
+  {
+    Match match = { hits[index], Find((PROC)pValues[hits[index]]) };
+    matches.push_back(match);
+  }
+}
+
+//  ****************************************************************************
+/// Reports the instruction set used by Scan on this processor.
+///
+SlotMatcher::Isa SlotMatcher::GetIsa()
+{
+#ifdef SLOTMATCHER_X86
+  static const Isa k_isa = DetectIsa();
+  return k_isa;
+#else
+  return k_scalar;
+#endif
+}
+
+//  ****************************************************************************
+/// Hashes an address to a bit of the filter.
+///
+size_t SlotMatcher::HashValue(uintptr_t value)
+{
+  // Functions are aligned, so the low bits carry little information.
+  const uint32_t k_golden = 0x9E3779B1u;
+  return (size_t)((uint32_t)(value >> 4 ^ value >> 20) * k_golden >> (32 - k_filterBits));
+}
+
+//  ****************************************************************************
+/// Scans for a large set, which cannot be broadcast into registers.
+/// Most slots are rejected by the filter without a search.
+///
+void SlotMatcher::ScanHashed(
+  const uintptr_t*      pSlots,
+  size_t                count,
+  std::vector<Match>&   matches
+) const
+{
+  for (size_t slot = 0; slot < count; ++slot)
+  {
+    const size_t hash = HashValue(pSlots[slot]);
+    if (0 == (m_filter[hash / 32] & (uint32_t(1) << (hash % 32))))
+    {
+      continue;
+    }
+
+    const size_t index = Find((PROC)pSlots[slot]);
+    if (k_notFound != index)
+    {
+      Match match = { slot, index };
+      matches.push_back(match);
+    }
+  }
+}
+
+namespace // unnamed
+{
+
+#ifdef SLOTMATCHER_X86
+//  ****************************************************************************
+/// Chooses the widest compare the processor and operating system support.
+///
+SlotMatcher::Isa DetectIsa()
+{
+#ifdef _MSC_VER
+  int info[4] = { 0 };
+  ::__cpuid(info, 0);
+  const int maxLeaf = info[0];
+
+  ::__cpuid(info, 1);
+  const bool isSse2     = 0 != (info[3] & (1 << 26));
+  const bool isOsXsave  = 0 != (info[2] & (1 << 27));
+
+  bool isAvx2 = false;
+  if ( maxLeaf >= 7
+    && isOsXsave
+    && 6 == (::_xgetbv(0) & 6))
+  {
+    ::__cpuidex(info, 7, 0);
+    isAvx2 = 0 != (info[1] & (1 << 5));
+  }
+#else
+  __builtin_cpu_init();
+  const bool isSse2 = __builtin_cpu_supports("sse2");
+  const bool isAvx2 = __builtin_cpu_supports("avx2");
+#endif
+
+  if (isAvx2)
+  {
+    return SlotMatcher::k_avx2;
+  }
+
+  return isSse2 ? SlotMatcher::k_sse2 : SlotMatcher::k_scalar;
+}
+
+//  ****************************************************************************
+/// Compares 2 (64-bit) or 4 (32-bit) slots at a time with every value.
+///
+SLOTMATCHER_TARGET("sse2")
+void FindHitsSse2(
+  const uintptr_t*      pSlots,
+  size_t                count,
+  const uintptr_t*      pValues,
+  size_t                valueCount,
+  std::vector<size_t>&  hits
+)
+{
+  const size_t k_lanes = sizeof(__m128i) / sizeof(uintptr_t);
+
+  __m128i needles[SlotMatcher::k_simdLimit];
+  for (size_t index = 0; index < valueCount; ++index)
+  {
+#ifdef SLOTMATCHER_64
+    needles[index] = _mm_set1_epi64x((long long)pValues[index]);
+#else
+    needles[index] = _mm_set1_epi32((int)pValues[index]);
+#endif
+  }
+
+  size_t slot = 0;
+  for (; slot + k_lanes <= count; slot += k_lanes)
+  {
+    const __m128i block = _mm_loadu_si128((const __m128i*)(pSlots + slot));
+    __m128i       found = _mm_setzero_si128();
+    for (size_t index = 0; index < valueCount; ++index)
+    {
+      __m128i equal = _mm_cmpeq_epi32(block, needles[index]);
+#ifdef SLOTMATCHER_64
+      // SSE2 has no 64-bit compare, so both halves of an address must match.
+      equal = _mm_and_si128(equal, _mm_shuffle_epi32(equal, _MM_SHUFFLE(2, 3, 0, 1)));
+#endif
+      found = _mm_or_si128(found, equal);
+    }
+
+#ifdef SLOTMATCHER_64
+    const int mask = _mm_movemask_pd(_mm_castsi128_pd(found));
+#else
+    const int mask = _mm_movemask_ps(_mm_castsi128_ps(found));
+#endif
+    for (size_t lane = 0; mask && lane < k_lanes; ++lane)
+    {
+      if (mask & (1 << lane))
+      {
+        hits.push_back(slot + lane);
+      }
+    }
+  }
+
+  FindHitsScalar(pSlots, slot, count, pValues, valueCount, hits);
+}
+
+//  ****************************************************************************
+/// Compares 4 (64-bit) or 8 (32-bit) slots at a time with every value.
+///
+SLOTMATCHER_TARGET("avx2")
+void FindHitsAvx2(
+  const uintptr_t*      pSlots,
+  size_t                count,
+  const uintptr_t*      pValues,
+  size_t                valueCount,
+  std::vector<size_t>&  hits
+)
+{
+  const size_t k_lanes = sizeof(__m256i) / sizeof(uintptr_t);
+
+  __m256i needles[SlotMatcher::k_simdLimit];
+  for (size_t index = 0; index < valueCount; ++index)
+  {
+#ifdef SLOTMATCHER_64
+    needles[index] = _mm256_set1_epi64x((long long)pValues[index]);
+#else
+    needles[index] = _mm256_set1_epi32((int)pValues[index]);
+#endif
+  }
+
+  size_t slot = 0;
+  for (; slot + k_lanes <= count; slot += k_lanes)
+  {
+    const __m256i block = _mm256_loadu_si256((const __m256i*)(pSlots + slot));
+    __m256i       found = _mm256_setzero_si256();
+    for (size_t index = 0; index < valueCount; ++index)
+    {
+#ifdef SLOTMATCHER_64
+      found = _mm256_or_si256(found, _mm256_cmpeq_epi64(block, needles[index]));
+#else
+      found = _mm256_or_si256(found, _mm256_cmpeq_epi32(block, needles[index]));
+#endif
+    }
+
+#ifdef SLOTMATCHER_64
+    const int mask = _mm256_movemask_pd(_mm256_castsi256_pd(found));
+#else
+    const int mask = _mm256_movemask_ps(_mm256_castsi256_ps(found));
+#endif
+    for (size_t lane = 0; mask && lane < k_lanes; ++lane)
+    {
+      if (mask & (1 << lane))
+      {
+        hits.push_back(slot + lane);
+      }
+    }
+  }
+
+  FindHitsScalar(pSlots, slot, count, pValues, valueCount, hits);
+}
+#endif
+
+//  ****************************************************************************
+/// Compares a range of slots with every value, one slot at a time.
+///
+void FindHitsScalar(
+  const uintptr_t*      pSlots,
+  size_t                first,
+  size_t                last,
+  const uintptr_t*      pValues,
+  size_t                valueCount,
+  std::vector<size_t>&  hits
+)
+{
+  for (size_t slot = first; slot < last; ++slot)
+  {
+    for (size_t index = 0; index < valueCount; ++index)
+    {
+      if (pSlots[slot] == pValues[index])
+      {
+        hits.push_back(slot);
+        break;
+      }
+    }
+  }
+}
+
+} // namespace unnamed
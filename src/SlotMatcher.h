@@ -0,0 +1,77 @@
+/// @file   SlotMatcher.h
+///
+/// Matches an array of import slots against a set of function addresses
+///
+/// The addresses of every hooked function are loaded into one set, so an
+/// import table is swept once for all of the hooks rather than once per hook.
+/// Small sets are compared several slots at a time with AVX2 or SSE2, chosen
+/// when the process starts.  Large sets, and other processors, use a hashed
+/// filter in front of a binary search.
+///
+/// The MIT License(MIT)
+/// @copyright 2014 Paul M Watt
+///
+//  ****************************************************************************
+#ifndef SLOTMATCHER_H_INCLUDED
+#define SLOTMATCHER_H_INCLUDED
+//  Includes *******************************************************************
+#include "ApiHook.h"
+
+#include <vector>
+#include <stdint.h>
+
+//  ****************************************************************************
+/// A set of function addresses to find in import slots.
+///
+class SlotMatcher
+{
+public:
+  //  Constants ****************************************************************
+  static const size_t k_notFound  = (size_t)-1;
+  static const size_t k_simdLimit = 16;   ///< Largest set compared with SIMD.
+
+  //  Typedef ******************************************************************
+  /// A slot that holds one of the addresses in the set.
+  struct Match
+  {
+    size_t  slot;                       ///< Position of the slot in the scan.
+    size_t  index;                      ///< Order the address was added.
+  };
+
+  /// The instruction set used to compare slots.
+  enum Isa
+  {
+    k_scalar,
+    k_sse2,
+    k_avx2
+  };
+
+  SlotMatcher();
+
+  void    Add(PROC pfn);
+  size_t  Find(PROC pfn) const;
+  void    Scan(const PROC* pSlots, size_t count, std::vector<Match>& matches) const;
+
+  size_t  GetCount() const                        { return m_count;}
+
+  static
+    Isa   GetIsa();
+
+private:
+  //  Constants ****************************************************************
+  static const unsigned k_filterBits = 12;        ///< log2 of the filter size.
+
+  //  Data Members *************************************************************
+  std::vector<uintptr_t>  m_values;     ///< The addresses, in ascending order.
+  std::vector<size_t>     m_indices;    ///< The order each address was added.
+  std::vector<uint32_t>   m_filter;     ///< One bit for each address hash.
+  size_t                  m_count;      ///< Addresses passed to Add.
+
+  //  Methods ******************************************************************
+  static
+    size_t  HashValue(uintptr_t value);
+
+  void      ScanHashed(const uintptr_t* pSlots, size_t count, std::vector<Match>& matches) const;
+};
+
+#endif
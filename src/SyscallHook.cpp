@@ -0,0 +1,512 @@
+/// @file   SyscallHook.cpp
+///
+/// Interception of system calls that never pass through an import slot
+///
+/// The MIT License(MIT)
+/// @copyright 2014 Paul M Watt
+///
+//  ****************************************************************************
+//  Includes *******************************************************************
+#include "SyscallHook.h"
+
+#include <cerrno>
+#include <cstring>
+
+#include <sched.h>
+#include <stdint.h>
+#include <sys/prctl.h>
+#include <sys/syscall.h>
+#include <ucontext.h>
+
+#ifndef PR_SET_SYSCALL_USER_DISPATCH
+# define PR_SET_SYSCALL_USER_DISPATCH   59
+# define PR_SYS_DISPATCH_OFF            0
+# define PR_SYS_DISPATCH_ON             1
+# define SYSCALL_DISPATCH_FILTER_ALLOW  0
+# define SYSCALL_DISPATCH_FILTER_BLOCK  1
+#endif
+
+#ifndef SYS_USER_DISPATCH
+# define SYS_USER_DISPATCH              2
+#endif
+
+#ifndef SA_RESTORER
+# define SA_RESTORER                    0x04000000
+#endif
+
+#ifndef CLONE_VM
+# define CLONE_VM                       0x00000100
+# define CLONE_VFORK                    0x00004000
+#endif
+
+//  System Call Stubs **********************************************************
+//  The kernel never dispatches a system call made between
+//  cxxhook_SyscallStubsBegin and cxxhook_SyscallStubsEnd, whatever the
+//  selector holds.  A signal handler returns through one of these stubs
+//  after the selector is switched back to block.
+//
+//  cxxhook_SigReturn is the restorer of the SIGSYS handler.
+//  cxxhook_SigReturnAt returns from the signal frame at pFrame, for a
+//  signal handler that returned through the restorer of libc.
+extern "C" char cxxhook_SyscallStubsBegin[];
+extern "C" char cxxhook_SyscallStubsEnd[];
+extern "C" void cxxhook_SigReturn();
+extern "C" void cxxhook_SigReturnAt(uintptr_t pFrame) __attribute__((noreturn));
+
+__asm__(
+  ".text\n"
+  ".globl   cxxhook_SyscallStubsBegin\n"
+  ".hidden  cxxhook_SyscallStubsBegin\n"
+  ".globl   cxxhook_SyscallStubsEnd\n"
+  ".hidden  cxxhook_SyscallStubsEnd\n"
+  ".globl   cxxhook_SigReturn\n"
+  ".hidden  cxxhook_SigReturn\n"
+  ".globl   cxxhook_SigReturnAt\n"
+  ".hidden  cxxhook_SigReturnAt\n"
+  "cxxhook_SyscallStubsBegin:\n"
+  "cxxhook_SigReturn:\n"
+  "  movl   $15, %eax\n"
+  "  syscall\n"
+  "  ud2\n"
+  "cxxhook_SigReturnAt:\n"
+  "  movq   %rdi, %rsp\n"
+  "  movl   $15, %eax\n"
+  "  syscall\n"
+  "  ud2\n"
+  "cxxhook_SyscallStubsEnd:\n"
+);
+
+//  Makes a clone system call that gives the new thread its own stack.
+//  The parent returns the result.  The new thread loads the registers of
+//  the code that made the call from *pBlock, marks the block as taken, and
+//  returns 0 to the instruction after that call, on its new stack.
+struct CloneBlock;
+extern "C" long cxxhook_CloneResume(long number,
+                                    long a0,
+                                    long a1,
+                                    long a2,
+                                    long a3,
+                                    long a4,
+                                    CloneBlock* pBlock);
+
+__asm__(
+  ".text\n"
+  ".globl   cxxhook_CloneResume\n"
+  ".hidden  cxxhook_CloneResume\n"
+  ".type    cxxhook_CloneResume, @function\n"
+  "cxxhook_CloneResume:\n"
+  "  pushq  %r12\n"
+  "  movq   16(%rsp), %r12\n"
+  "  movq   %rdi, %rax\n"
+  "  movq   %rsi, %rdi\n"
+  "  movq   %rdx, %rsi\n"
+  "  movq   %rcx, %rdx\n"
+  "  movq   %r8, %r10\n"
+  "  movq   %r9, %r8\n"
+  "  syscall\n"
+  "  testq  %rax, %rax\n"
+  "  jz     1f\n"
+  "  popq   %r12\n"
+  "  ret\n"
+  "1:\n"
+  "  pushq  96(%r12)\n"
+  "  movq   0(%r12), %rbx\n"
+  "  movq   8(%r12), %rbp\n"
+  "  movq   16(%r12), %rdi\n"
+  "  movq   24(%r12), %rsi\n"
+  "  movq   32(%r12), %rdx\n"
+  "  movq   40(%r12), %r8\n"
+  "  movq   48(%r12), %r9\n"
+  "  movq   56(%r12), %r10\n"
+  "  movq   72(%r12), %r13\n"
+  "  movq   80(%r12), %r14\n"
+  "  movq   88(%r12), %r15\n"
+  "  movq   64(%r12), %r11\n"
+  "  movq   $1, 104(%r12)\n"
+  "  movq   %r11, %r12\n"
+  "  ret\n"
+  ".size    cxxhook_CloneResume, .-cxxhook_CloneResume\n"
+);
+
+//  ****************************************************************************
+/// The registers cxxhook_CloneResume loads in the new thread.
+/// The offsets are used by the stub, and must not change.
+///
+struct CloneBlock
+{
+  uint64_t          rbx;
+  uint64_t          rbp;
+  uint64_t          rdi;
+  uint64_t          rsi;
+  uint64_t          rdx;
+  uint64_t          r8;
+  uint64_t          r9;
+  uint64_t          r10;
+  uint64_t          r12;
+  uint64_t          r13;
+  uint64_t          r14;
+  uint64_t          r15;
+  uint64_t          rip;
+  volatile uint64_t isTaken;            ///< Set by the new thread.
+};
+
+//  Static Data Members ********************************************************
+std::atomic<SyscallHook::Handler> SyscallHook::sm_handlers[SyscallHook::k_maxSyscall];
+
+//  Forward Declarations *******************************************************
+namespace // unnamed
+{
+
+/// The selector of the calling thread.  The signal handler reads it before
+/// it may make a system call, so it must not be allocated on first use.
+__thread volatile char t_selector __attribute__((tls_model("initial-exec")))
+  = SYSCALL_DISPATCH_FILTER_ALLOW;
+
+//  Typedef ********************************************************************
+/// The sigaction structure of the kernel, which differs from the one in libc.
+struct KernelSigaction
+{
+  void*         pfnHandler;
+  unsigned long flags;
+  void*         pfnRestorer;
+  uint64_t      mask;
+};
+
+/// The start of the clone_args structure used by clone3.
+struct CloneArgs
+{
+  uint64_t  flags;
+  uint64_t  pidfd;
+  uint64_t  childTid;
+  uint64_t  parentTid;
+  uint64_t  exitSignal;
+  uint64_t  stack;
+  uint64_t  stackSize;
+};
+
+long RawSyscall(long number, long a0, long a1, long a2, long a3, long a4, long a5);
+long CloneThread(long number, long a0, long a1, long a2, long a3, long a4, bool isShared, const greg_t* pRegs);
+long Dispatch(long number, const greg_t* pRegs);
+
+} // namespace anonymous
+
+//  Implementation *************************************************************
+//  ****************************************************************************
+/// Routes a system call number to a handler, for every attached thread.
+/// The hook most recently created for a number is called, and the previous
+/// handler is restored when it is destroyed.
+///
+/// rt_sigreturn, clone, clone3 and vfork are always handled by SyscallHook,
+/// and cannot be hooked.
+///
+/// @param number     The system call number, from <sys/syscall.h>.
+/// @param pfnHandler The function called in place of the system call.
+///
+SyscallHook::SyscallHook(long number, Handler pfnHandler)
+  : m_number(number)
+  , m_pfnHandler(pfnHandler)
+  , m_pfnPrev(NULL)
+  , m_isInstalled(false)
+{
+  if ( number < 0
+    || number >= k_maxSyscall
+    || SYS_rt_sigreturn == number
+    || SYS_clone        == number
+    || SYS_clone3       == number
+    || SYS_vfork        == number)
+  {
+    return;
+  }
+
+  m_pfnPrev     = sm_handlers[number].exchange(pfnHandler, std::memory_order_acq_rel);
+  m_isInstalled = true;
+}
+
+//  ****************************************************************************
+SyscallHook::~SyscallHook()
+{
+  if (m_isInstalled)
+  {
+    sm_handlers[m_number].store(m_pfnPrev, std::memory_order_release);
+  }
+}
+
+//  ****************************************************************************
+/// Reports if the kernel supports syscall user dispatch.
+/// The kernel is probed by turning dispatch off for the calling thread, so
+/// the probe is made once, and the result is kept.  InstallSignalHandler
+/// makes the first call before any thread can be attached, so the probe
+/// never detaches a thread.
+///
+bool SyscallHook::IsSupported()
+{
+  static const bool k_isSupported =
+    0 == ::prctl(PR_SET_SYSCALL_USER_DISPATCH, PR_SYS_DISPATCH_OFF, 0, 0, 0);
+
+  return k_isSupported;
+}
+
+//  ****************************************************************************
+/// Routes the system calls of the calling thread to the registered handlers.
+/// Threads are attached one at a time; a new thread is not attached, even
+/// when its parent is.
+///
+/// @return           false if the kernel does not support syscall user
+///                   dispatch, and the thread is not attached.
+///
+bool SyscallHook::AttachThread()
+{
+  static const bool k_isSignalInstalled = InstallSignalHandler();
+  if (!k_isSignalInstalled)
+  {
+    return false;
+  }
+
+  t_selector = SYSCALL_DISPATCH_FILTER_ALLOW;
+  if (0 != ::prctl(PR_SET_SYSCALL_USER_DISPATCH,
+                   PR_SYS_DISPATCH_ON,
+                   (unsigned long)cxxhook_SyscallStubsBegin,
+                   (unsigned long)(cxxhook_SyscallStubsEnd - cxxhook_SyscallStubsBegin),
+                   &t_selector))
+  {
+    return false;
+  }
+
+  t_selector = SYSCALL_DISPATCH_FILTER_BLOCK;
+  return true;
+}
+
+//  ****************************************************************************
+/// Stops routing the system calls of the calling thread.
+///
+void SyscallHook::DetachThread()
+{
+  t_selector = SYSCALL_DISPATCH_FILTER_ALLOW;
+  ::prctl(PR_SET_SYSCALL_USER_DISPATCH, PR_SYS_DISPATCH_OFF, 0, 0, 0);
+}
+
+//  ****************************************************************************
+/// Makes a system call, without routing it to a handler.
+///
+/// @return           The result of the kernel, which is a negative errno
+///                   on failure.  errno is not changed.
+///
+long SyscallHook::CallOriginal(
+  long number,
+  long a0,
+  long a1,
+  long a2,
+  long a3,
+  long a4,
+  long a5
+)
+{
+  const char selector = t_selector;
+  t_selector = SYSCALL_DISPATCH_FILTER_ALLOW;
+
+  const long result = RawSyscall(number, a0, a1, a2, a3, a4, a5);
+
+  t_selector = selector;
+  return result;
+}
+
+//  ****************************************************************************
+/// Installs the SIGSYS handler.  It is installed with the kernel's
+/// rt_sigaction so that it returns through cxxhook_SigReturn.
+///
+bool SyscallHook::InstallSignalHandler()
+{
+  if (!IsSupported())
+  {
+    return false;
+  }
+
+  // The mask is left empty, so a thread cloned by the handler
+  // starts with the signal mask of the code that made the call.
+  KernelSigaction action = {};
+  action.pfnHandler   = (void*)OnSigSys;
+  action.flags        = SA_SIGINFO | SA_RESTORER | SA_NODEFER;
+  action.pfnRestorer  = (void*)cxxhook_SigReturn;
+
+  return 0 == RawSyscall(SYS_rt_sigaction, SIGSYS, (long)&action, 0, sizeof(action.mask), 0, 0);
+}
+
+//  ****************************************************************************
+/// Handles a system call of an attached thread.  The result is written to
+/// rax, and the thread continues after the syscall instruction.
+///
+void SyscallHook::OnSigSys(int, siginfo_t* pInfo, void* pContext)
+{
+  t_selector = SYSCALL_DISPATCH_FILTER_ALLOW;
+
+  const int savedErrno  = errno;
+  greg_t*   pRegs       = ((ucontext_t*)pContext)->uc_mcontext.gregs;
+  const long number     = pInfo->si_syscall;
+
+  if (SYS_USER_DISPATCH != pInfo->si_code)
+  {
+    // Sent by seccomp or another process; the call was not made.
+    pRegs[REG_RAX] = -ENOSYS;
+  }
+  else if (SYS_rt_sigreturn == number)
+  {
+    // A signal handler returned through the restorer of libc.
+    // The frame it returns from is at the stack pointer of that call.
+    errno      = savedErrno;
+    t_selector = SYSCALL_DISPATCH_FILTER_BLOCK;
+    cxxhook_SigReturnAt((uintptr_t)pRegs[REG_RSP]);
+  }
+  else
+  {
+    Handler pfnHandler = (number >= 0 && number < k_maxSyscall)
+                       ? sm_handlers[number].load(std::memory_order_acquire)
+                       : NULL;
+
+    pRegs[REG_RAX] = pfnHandler
+                   ? pfnHandler(pRegs[REG_RDI], pRegs[REG_RSI], pRegs[REG_RDX],
+                                pRegs[REG_R10], pRegs[REG_R8],  pRegs[REG_R9])
+                   : Dispatch(number, pRegs);
+  }
+
+  errno      = savedErrno;
+  t_selector = SYSCALL_DISPATCH_FILTER_BLOCK;
+}
+
+namespace // unnamed
+{
+
+//  ****************************************************************************
+long RawSyscall(long number, long a0, long a1, long a2, long a3, long a4, long a5)
+{
+  register long r10 __asm__("r10") = a3;
+  register long r8  __asm__("r8")  = a4;
+  register long r9  __asm__("r9")  = a5;
+
+  long result;
+  __asm__ volatile(
+    "syscall"
+    : "=a"(result)
+    : "a"(number), "D"(a0), "S"(a1), "d"(a2), "r"(r10), "r"(r8), "r"(r9)
+    : "rcx", "r11", "memory");
+
+  return result;
+}
+
+//  ****************************************************************************
+/// Makes a clone system call that gives the new thread its own stack.
+/// The new thread cannot return through the signal handler, as it runs on a
+/// different stack, so it resumes the interrupted code directly.
+///
+/// @param isShared   The new thread shares memory, so the registers must not
+///                   leave the stack until it has loaded them.
+/// @param pRegs      The registers of the code that made the call.
+///
+long CloneThread(
+  long          number,
+  long          a0,
+  long          a1,
+  long          a2,
+  long          a3,
+  long          a4,
+  bool          isShared,
+  const greg_t* pRegs
+)
+{
+  CloneBlock block;
+  block.rbx     = pRegs[REG_RBX];
+  block.rbp     = pRegs[REG_RBP];
+  block.rdi     = pRegs[REG_RDI];
+  block.rsi     = pRegs[REG_RSI];
+  block.rdx     = pRegs[REG_RDX];
+  block.r8      = pRegs[REG_R8];
+  block.r9      = pRegs[REG_R9];
+  block.r10     = pRegs[REG_R10];
+  block.r12     = pRegs[REG_R12];
+  block.r13     = pRegs[REG_R13];
+  block.r14     = pRegs[REG_R14];
+  block.r15     = pRegs[REG_R15];
+  block.rip     = pRegs[REG_RIP];
+  block.isTaken = 0;
+
+  const long result = cxxhook_CloneResume(number, a0, a1, a2, a3, a4, &block);
+  if ( result > 0
+    && isShared)
+  {
+    while (!block.isTaken)
+    {
+      ::sched_yield();
+    }
+  }
+
+  return result;
+}
+
+//  ****************************************************************************
+/// Makes a system call that has no handler.
+///
+/// Calls that create a thread on a new stack are made by CloneThread.
+/// A vfork child would run on the stack of the signal handler while the
+/// parent is suspended in it, so vfork is made as fork.
+///
+long Dispatch(long number, const greg_t* pRegs)
+{
+  const long a0 = pRegs[REG_RDI];
+  const long a1 = pRegs[REG_RSI];
+  const long a2 = pRegs[REG_RDX];
+  const long a3 = pRegs[REG_R10];
+  const long a4 = pRegs[REG_R8];
+  const long a5 = pRegs[REG_R9];
+
+  switch (number)
+  {
+  case SYS_vfork:
+    return RawSyscall(SYS_fork, 0, 0, 0, 0, 0, 0);
+
+  case SYS_clone:
+    if (a1)
+    {
+      return CloneThread(number, a0, a1, a2, a3, a4, 0 != (a0 & CLONE_VM), pRegs);
+    }
+
+    return RawSyscall(number, a0 & ~(long)(CLONE_VM | CLONE_VFORK), a1, a2, a3, a4, a5);
+
+  case SYS_clone3:
+    {
+      const CloneArgs* pArgs = (const CloneArgs*)a0;
+      if (pArgs->stack)
+      {
+        return CloneThread(number, a0, a1, 0, 0, 0, 0 != (pArgs->flags & CLONE_VM), pRegs);
+      }
+
+      if (pArgs->flags & (CLONE_VM | CLONE_VFORK))
+      {
+        unsigned char args[256] = { 0 };
+        if ((unsigned long)a1 > sizeof(args))
+        {
+          return -E2BIG;
+        }
+
+        ::memcpy(args, pArgs, a1);
+        ((CloneArgs*)args)->flags &= ~(uint64_t)(CLONE_VM | CLONE_VFORK);
+        return RawSyscall(number, (long)args, a1, 0, 0, 0, 0);
+      }
+
+      return RawSyscall(number, a0, a1, 0, 0, 0, 0);
+    }
+
+  case SYS_rt_sigaction:
+    // The SIGSYS handler is kept, but its current action can be read.
+    if ( SIGSYS == a0
+      && a1)
+    {
+      return RawSyscall(number, a0, 0, a2, a3, 0, 0);
+    }
+
+    return RawSyscall(number, a0, a1, a2, a3, a4, a5);
+
+  default:
+    return RawSyscall(number, a0, a1, a2, a3, a4, a5);
+  }
+}
+
+} // namespace unnamed
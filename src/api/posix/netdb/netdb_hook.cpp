@@ -0,0 +1,773 @@
+/// @file   netdb_hook.cpp
+///
+/// API Hook library for unit-testing with name resolution dependencies
+///
+/// The MIT License(MIT)
+/// @copyright 2014 Paul M Watt
+///
+//  ****************************************************************************
+#include "netdb_hook.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+#include <arpa/inet.h>
+#include <time.h>
+
+namespace cxxhook
+{
+
+//  Static Data Members ********************************************************
+Netdb_hook* Netdb_hook::sm_pThis = NULL;
+
+//  Forward Declarations *******************************************************
+namespace // unnamed
+{
+
+//  Typedef ********************************************************************
+typedef int       (*pfngetaddrinfo)(const char*, const char*, const addrinfo*, addrinfo**);
+typedef void      (*pfnfreeaddrinfo)(addrinfo*);
+typedef int       (*pfngetnameinfo)(const sockaddr*, socklen_t, char*, socklen_t, char*, socklen_t, int);
+typedef hostent*  (*pfngethostbyname)(const char*);
+
+/// The socket types reported when the hints do not name one.
+struct SocketType
+{
+  int   socktype;
+  int   protocol;
+};
+
+const SocketType k_socketTypes[] =
+{
+  { SOCK_STREAM,  IPPROTO_TCP },
+  { SOCK_DGRAM,   IPPROTO_UDP },
+  { SOCK_RAW,     0           }
+};
+
+/// The result of gethostbyname, which is owned by each thread.
+struct HostResult
+{
+  hostent   host;
+  char*     pAliases[1];
+  char*     pAddresses[Netdb_hook::k_maxHostAddresses + 1];
+  in_addr   addresses[Netdb_hook::k_maxHostAddresses];
+};
+
+thread_local std::string  t_key;        ///< Reused for lookups, to avoid allocations.
+thread_local HostResult   t_hostResult;
+
+const std::string& ToKey(const char* pName);
+std::string        GetAddressKey(const sockaddr* pAddr);
+int                ResolveService(const char* pService, const addrinfo* pHints, in_port_t& port);
+
+} // namespace anonymous
+
+//  Implementation *************************************************************
+//  ****************************************************************************
+/// Installs the name resolution hooks.
+///
+/// @param isPassThrough  Names that are not in the zone are resolved by the
+///                       real resolver.  Otherwise they are not found.
+///
+Netdb_hook::Netdb_hook(bool isPassThrough)
+  : m_isPassThrough(isPassThrough)
+  , m_latencyNs(0)
+  , m_pFreeNodes(NULL)
+{
+  m_poolLock.clear();
+
+  // The hooks find the zone through sm_pThis.
+  assert(!sm_pThis && "Only one Netdb_hook may exist at a time.");
+  sm_pThis = this;
+
+  m_pGetAddrInfo    = new ApiHook("libc.so.6", "getaddrinfo",    (PROC)Hook_getaddrinfo);
+  m_pFreeAddrInfo   = new ApiHook("libc.so.6", "freeaddrinfo",   (PROC)Hook_freeaddrinfo);
+  m_pGetNameInfo    = new ApiHook("libc.so.6", "getnameinfo",    (PROC)Hook_getnameinfo);
+  m_pGetHostByName  = new ApiHook("libc.so.6", "gethostbyname",  (PROC)Hook_gethostbyname);
+}
+
+//  ****************************************************************************
+Netdb_hook::~Netdb_hook()
+{
+  delete m_pGetHostByName;
+  delete m_pGetNameInfo;
+  delete m_pFreeAddrInfo;
+  delete m_pGetAddrInfo;
+
+  for (size_t index = 0; index < m_slabs.size(); ++index)
+  {
+    ::free(m_slabs[index]);
+  }
+
+  sm_pThis = NULL;
+}
+
+//  ****************************************************************************
+/// Adds the records of a file in the format of /etc/hosts.  Each line holds
+/// an address, a canonical name and any number of aliases.  Text after a #
+/// is ignored.
+///
+/// @return           false if the file cannot be read, or a line is not
+///                   valid.  The valid lines are added.
+///
+bool Netdb_hook::LoadZoneFile(const char* pPath)
+{
+  std::ifstream file(pPath);
+  if (!file)
+  {
+    return false;
+  }
+
+  bool isValid = true;
+  std::string line;
+  while (std::getline(file, line))
+  {
+    line.erase(std::find(line.begin(), line.end(), '#'), line.end());
+
+    std::istringstream fields(line);
+    std::string address;
+    std::string name;
+    if (!(fields >> address))
+    {
+      continue;
+    }
+
+    Answer answer;
+    if ( !(fields >> name)
+      || !ParseAddress(address.c_str(), answer))
+    {
+      isValid = false;
+      continue;
+    }
+
+    AddRecord(name.c_str(), address.c_str());
+
+    Host* pHost = m_hosts[ToKey(name.c_str())];
+    for (std::string alias; fields >> alias; )
+    {
+      Host*& pAlias = m_hosts[ToKey(alias.c_str())];
+      if (!pAlias)
+      {
+        pAlias = pHost;
+      }
+    }
+  }
+
+  return isValid;
+}
+
+//  ****************************************************************************
+/// Adds an address to a name.  A name may have any number of IPv4 and IPv6
+/// addresses, which are reported in the order they were added.
+///
+/// @param pName      The host name.  Names are not case sensitive.
+/// @param pAddress   A numeric IPv4 or IPv6 address.
+/// @return           false if the address is not valid.
+///
+bool Netdb_hook::AddRecord(const char* pName, const char* pAddress)
+{
+  Answer answer;
+  if ( !pName
+    || !*pName
+    || !ParseAddress(pAddress, answer))
+  {
+    return false;
+  }
+
+  Host* pHost = AddHost(pName);
+  pHost->answers.push_back(answer);
+
+  // The first name added for an address is reported by getnameinfo.
+  m_names.insert(std::make_pair(GetAddressKey(&answer.sa), pHost->canonical));
+  return true;
+}
+
+//  ****************************************************************************
+/// Removes every record from the zone.  Results that are not yet freed 
+/// still point to the names of the removed records.
+///
+void Netdb_hook::Clear()
+{
+  m_hosts.clear();
+  m_names.clear();
+  m_hostStore.clear();
+}
+
+//  ****************************************************************************
+/// Sets the time each resolution takes, before it returns.
+///
+void Netdb_hook::SetLatency(uint64_t latencyUs)
+{
+  m_latencyNs.store(latencyUs * 1000, std::memory_order_relaxed);
+}
+
+//  ****************************************************************************
+/// Parses a numeric IPv4 or IPv6 address into a sockaddr.
+///
+bool Netdb_hook::ParseAddress(const char* pAddress, Answer& answer)
+{
+  ::memset(&answer, 0, sizeof(answer));
+  if (!pAddress)
+  {
+    return false;
+  }
+
+  if (1 == ::inet_pton(AF_INET, pAddress, &answer.sin.sin_addr))
+  {
+    answer.sin.sin_family = AF_INET;
+    answer.length         = sizeof(answer.sin);
+    return true;
+  }
+
+  if (1 == ::inet_pton(AF_INET6, pAddress, &answer.sin6.sin6_addr))
+  {
+    answer.sin6.sin6_family = AF_INET6;
+    answer.length           = sizeof(answer.sin6);
+    return true;
+  }
+
+  return false;
+}
+
+//  ****************************************************************************
+const Netdb_hook::Host* Netdb_hook::FindHost(const char* pName) const
+{
+  HostMap::const_iterator iter = m_hosts.find(ToKey(pName));
+  return m_hosts.end() == iter ? NULL : iter->second;
+}
+
+//  ****************************************************************************
+/// Returns the host for a name, and creates it if it is not in the zone.
+///
+Netdb_hook::Host* Netdb_hook::AddHost(const std::string& name)
+{
+  Host*& pHost = m_hosts[ToKey(name.c_str())];
+  if (!pHost)
+  {
+    m_hostStore.push_back(Host());
+    pHost            = &m_hostStore.back();
+    pHost->canonical = name;
+  }
+
+  return pHost;
+}
+
+//  ****************************************************************************
+/// Waits for the synthetic latency.
+///
+void Netdb_hook::Delay() const
+{
+  const uint64_t latencyNs = m_latencyNs.load(std::memory_order_relaxed);
+  if (latencyNs)
+  {
+    timespec delay = { (time_t)(latencyNs / 1000000000), (long)(latencyNs % 1000000000) };
+    while (0 != ::clock_nanosleep(CLOCK_MONOTONIC, 0, &delay, &delay))
+    { }
+  }
+}
+
+//  ****************************************************************************
+/// Takes a chain of nodes from the pool.  The pool grows a slab at a time,
+/// and is only returned to the system when the hooks are destroyed.
+///
+/// @return           The first node, chained through info.ai_next.
+///                   NULL if memory could not be allocated.
+///
+Netdb_hook::Node* Netdb_hook::AllocateNodes(size_t count)
+{
+  while (m_poolLock.test_and_set(std::memory_order_acquire))
+  { }
+
+  Node*  pFirst = NULL;
+  Node** ppLast = &pFirst;
+  for (; count; --count)
+  {
+    if (!m_pFreeNodes)
+    {
+      Node* pSlab = (Node*)::malloc(sizeof(Node) * k_nodesPerSlab);
+      if (!pSlab)
+      {
+        break;
+      }
+
+      m_slabs.insert(std::upper_bound(m_slabs.begin(), m_slabs.end(), pSlab), pSlab);
+      for (size_t index = 0; index < k_nodesPerSlab; ++index)
+      {
+        pSlab[index].info.ai_next = (addrinfo*)m_pFreeNodes;
+        m_pFreeNodes              = &pSlab[index];
+      }
+    }
+
+    Node* pNode  = m_pFreeNodes;
+    m_pFreeNodes = (Node*)pNode->info.ai_next;
+
+    *ppLast = pNode;
+    ppLast  = (Node**)&pNode->info.ai_next;
+  }
+
+  *ppLast = NULL;
+  m_poolLock.clear(std::memory_order_release);
+
+  if (count)
+  {
+    ReleaseNodes((addrinfo*)pFirst);
+    return NULL;
+  }
+
+  return pFirst;
+}
+
+//  ****************************************************************************
+/// Returns a chain of nodes to the pool.
+///
+void Netdb_hook::ReleaseNodes(addrinfo* pFirst)
+{
+  if (!pFirst)
+  {
+    return;
+  }
+
+  addrinfo* pLast = pFirst;
+  while (pLast->ai_next)
+  {
+    pLast = pLast->ai_next;
+  }
+
+  while (m_poolLock.test_and_set(std::memory_order_acquire))
+  { }
+
+  pLast->ai_next  = (addrinfo*)m_pFreeNodes;
+  m_pFreeNodes    = (Node*)pFirst;
+
+  m_poolLock.clear(std::memory_order_release);
+}
+
+//  ****************************************************************************
+/// Reports if a result was taken from the pool, rather than returned by the
+/// real resolver.
+///
+bool Netdb_hook::IsPooled(const addrinfo* pInfo)
+{
+  while (m_poolLock.test_and_set(std::memory_order_acquire))
+  { }
+
+  std::vector<Node*>::const_iterator iter =
+    std::upper_bound(m_slabs.begin(), m_slabs.end(), (Node*)pInfo);
+
+  const bool isPooled = m_slabs.begin() != iter
+                     && (const Node*)pInfo < *(iter - 1) + k_nodesPerSlab;
+
+  m_poolLock.clear(std::memory_order_release);
+  return isPooled;
+}
+
+//  Hooks **********************************************************************
+//  ****************************************************************************
+int Netdb_hook::Hook_getaddrinfo(
+  const char*       pNode,
+  const char*       pService,
+  const addrinfo*   pHints,
+  addrinfo**        ppResult
+)
+{
+  Netdb_hook* pThis = sm_pThis;
+  pThis->Delay();
+
+  const int flags   = pHints ? pHints->ai_flags  : AI_V4MAPPED | AI_ADDRCONFIG;
+  const int family  = pHints ? pHints->ai_family : AF_UNSPEC;
+  if ( AF_UNSPEC != family
+    && AF_INET   != family
+    && AF_INET6  != family)
+  {
+    return EAI_FAMILY;
+  }
+
+  if ( !pNode
+    && !pService)
+  {
+    return EAI_NONAME;
+  }
+
+  in_port_t port = 0;
+  const int serviceError = ResolveService(pService, pHints, port);
+  if (serviceError)
+  {
+    return serviceError;
+  }
+
+  // Find the addresses, either in the zone or in the name itself.
+  Answer        local[2];
+  const Answer* pAnswers      = local;
+  size_t        answerCount   = 0;
+  const char*   pCanonical    = pNode;
+  if (!pNode)
+  {
+    const bool isPassive = 0 != (flags & AI_PASSIVE);
+    ParseAddress(isPassive ? "::"      : "::1",       local[0]);
+    ParseAddress(isPassive ? "0.0.0.0" : "127.0.0.1", local[1]);
+    answerCount = 2;
+  }
+  else if (ParseAddress(pNode, local[0]))
+  {
+    answerCount = 1;
+  }
+  else if (flags & AI_NUMERICHOST)
+  {
+    return EAI_NONAME;
+  }
+  else if (const Host* pHost = pThis->FindHost(pNode))
+  {
+    pAnswers    = pHost->answers.empty() ? NULL : &pHost->answers[0];
+    answerCount = pHost->answers.size();
+    pCanonical  = pHost->canonical.c_str();
+  }
+  else if (pThis->m_isPassThrough)
+  {
+    return ((pfngetaddrinfo)(PROC)*pThis->m_pGetAddrInfo)(pNode, pService, pHints, ppResult);
+  }
+  else
+  {
+    return EAI_NONAME;
+  }
+
+  // Every address is reported once for each socket type.
+  SocketType  requested     = { pHints ? pHints->ai_socktype : 0, pHints ? pHints->ai_protocol : 0 };
+  const SocketType* pTypes  = k_socketTypes;
+  size_t      typeCount     = sizeof(k_socketTypes) / sizeof(k_socketTypes[0]);
+  if (requested.socktype)
+  {
+    for (size_t type = 0; !requested.protocol && type < typeCount; ++type)
+    {
+      if (k_socketTypes[type].socktype == requested.socktype)
+      {
+        requested.protocol = k_socketTypes[type].protocol;
+      }
+    }
+
+    pTypes    = &requested;
+    typeCount = 1;
+  }
+
+  size_t count = 0;
+  for (size_t index = 0; index < answerCount; ++index)
+  {
+    if ( AF_UNSPEC == family
+      || family == pAnswers[index].sa.sa_family)
+    {
+      count += typeCount;
+    }
+  }
+
+  if (!count)
+  {
+    return EAI_NONAME;
+  }
+
+  Node* pFirst = pThis->AllocateNodes(count);
+  if (!pFirst)
+  {
+    return EAI_MEMORY;
+  }
+
+  Node* pNext = pFirst;
+  for (size_t index = 0; index < answerCount; ++index)
+  {
+    if ( AF_UNSPEC != family
+      && family != pAnswers[index].sa.sa_family)
+    {
+      continue;
+    }
+
+    for (size_t type = 0; type < typeCount; ++type)
+    {
+      Node* pCurrent = pNext;
+      pNext          = (Node*)pCurrent->info.ai_next;
+
+      pCurrent->address                 = pAnswers[index];
+      pCurrent->address.sin.sin_port    = port;
+
+      pCurrent->info.ai_flags           = flags;
+      pCurrent->info.ai_family          = pAnswers[index].sa.sa_family;
+      pCurrent->info.ai_socktype        = pTypes[type].socktype;
+      pCurrent->info.ai_protocol        = pTypes[type].protocol;
+      pCurrent->info.ai_addrlen         = pAnswers[index].length;
+      pCurrent->info.ai_addr            = &pCurrent->address.sa;
+      pCurrent->info.ai_canonname       = NULL;
+    }
+  }
+
+  if ( (flags & AI_CANONNAME)
+    && pCanonical)
+  {
+    // A zone name outlives the result; a numeric host is copied.
+    if (pCanonical == pNode)
+    {
+      ::strncpy(pFirst->canonical, pNode, sizeof(pFirst->canonical) - 1);
+      pFirst->canonical[sizeof(pFirst->canonical) - 1] = '\0';
+      pCanonical = pFirst->canonical;
+    }
+
+    pFirst->info.ai_canonname = const_cast<char*>(pCanonical);
+  }
+
+  *ppResult = &pFirst->info;
+  return 0;
+}
+
+//  ****************************************************************************
+void Netdb_hook::Hook_freeaddrinfo(addrinfo* pResult)
+{
+  Netdb_hook* pThis = sm_pThis;
+  if ( pResult
+    && !pThis->IsPooled(pResult))
+  {
+    ((pfnfreeaddrinfo)(PROC)*pThis->m_pFreeAddrInfo)(pResult);
+    return;
+  }
+
+  pThis->ReleaseNodes(pResult);
+}
+
+//  ****************************************************************************
+int Netdb_hook::Hook_getnameinfo(
+  const sockaddr*   pAddr,
+  socklen_t         addrLen,
+  char*             pHost,
+  socklen_t         hostLen,
+  char*             pServ,
+  socklen_t         servLen,
+  int               flags
+)
+{
+  Netdb_hook* pThis = sm_pThis;
+  pThis->Delay();
+
+  if (!pAddr)
+  {
+    return EAI_FAMILY;
+  }
+
+  const void* pBytes = NULL;
+  in_port_t   port   = 0;
+  switch (pAddr->sa_family)
+  {
+  case AF_INET:
+    if (addrLen < (socklen_t)sizeof(sockaddr_in))
+    {
+      return EAI_FAMILY;
+    }
+
+    pBytes = &((const sockaddr_in*)pAddr)->sin_addr;
+    port   = ((const sockaddr_in*)pAddr)->sin_port;
+    break;
+
+  case AF_INET6:
+    if (addrLen < (socklen_t)sizeof(sockaddr_in6))
+    {
+      return EAI_FAMILY;
+    }
+
+    pBytes = &((const sockaddr_in6*)pAddr)->sin6_addr;
+    port   = ((const sockaddr_in6*)pAddr)->sin6_port;
+    break;
+
+  default:
+    return EAI_FAMILY;
+  }
+
+  if ( pHost
+    && hostLen)
+  {
+    ReverseMap::const_iterator iter = pThis->m_names.end();
+    if (0 == (flags & NI_NUMERICHOST))
+    {
+      iter = pThis->m_names.find(GetAddressKey(pAddr));
+    }
+
+    if ( pThis->m_names.end() == iter
+      && pThis->m_isPassThrough
+      && 0 == (flags & NI_NUMERICHOST))
+    {
+      return ((pfngetnameinfo)(PROC)*pThis->m_pGetNameInfo)(pAddr, addrLen, pHost, hostLen, pServ, servLen, flags);
+    }
+
+    if (pThis->m_names.end() != iter)
+    {
+      if (iter->second.size() >= hostLen)
+      {
+        return EAI_OVERFLOW;
+      }
+
+      ::memcpy(pHost, iter->second.c_str(), iter->second.size() + 1);
+    }
+    else if (flags & NI_NAMEREQD)
+    {
+      return EAI_NONAME;
+    }
+    else if (!::inet_ntop(pAddr->sa_family, pBytes, pHost, hostLen))
+    {
+      return EAI_OVERFLOW;
+    }
+  }
+
+  if ( pServ
+    && servLen)
+  {
+    const int length = ::snprintf(pServ, servLen, "%u", (unsigned)ntohs(port));
+    if (length < 0 || length >= (int)servLen)
+    {
+      return EAI_OVERFLOW;
+    }
+  }
+
+  return 0;
+}
+
+//  ****************************************************************************
+hostent* Netdb_hook::Hook_gethostbyname(const char* pName)
+{
+  Netdb_hook* pThis = sm_pThis;
+  pThis->Delay();
+
+  Answer        numeric;
+  const Answer* pAnswers    = &numeric;
+  size_t        answerCount = 0;
+  const char*   pCanonical  = pName;
+  if (!pName)
+  {
+    h_errno = HOST_NOT_FOUND;
+    return NULL;
+  }
+  else if (ParseAddress(pName, numeric))
+  {
+    answerCount = 1;
+  }
+  else if (const Host* pHost = pThis->FindHost(pName))
+  {
+    pAnswers    = pHost->answers.empty() ? NULL : &pHost->answers[0];
+    answerCount = pHost->answers.size();
+    pCanonical  = pHost->canonical.c_str();
+  }
+  else if (pThis->m_isPassThrough)
+  {
+    return ((pfngethostbyname)(PROC)*pThis->m_pGetHostByName)(pName);
+  }
+  else
+  {
+    h_errno = HOST_NOT_FOUND;
+    return NULL;
+  }
+
+  HostResult& result = t_hostResult;
+  size_t      count  = 0;
+  for (size_t index = 0; index < answerCount && count < k_maxHostAddresses; ++index)
+  {
+    if (AF_INET == pAnswers[index].sa.sa_family)
+    {
+      result.addresses[count]   = pAnswers[index].sin.sin_addr;
+      result.pAddresses[count]  = (char*)&result.addresses[count];
+      ++count;
+    }
+  }
+
+  if (!count)
+  {
+    h_errno = NO_ADDRESS;
+    return NULL;
+  }
+
+  result.pAddresses[count]  = NULL;
+  result.pAliases[0]        = NULL;
+
+  result.host.h_name        = const_cast<char*>(pCanonical);
+  result.host.h_aliases     = result.pAliases;
+  result.host.h_addrtype    = AF_INET;
+  result.host.h_length      = sizeof(in_addr);
+  result.host.h_addr_list   = result.pAddresses;
+  return &result.host;
+}
+
+namespace // unnamed
+{
+
+//  ****************************************************************************
+/// Converts a name to the lower-case key of the zone.
+///
+const std::string& ToKey(const char* pName)
+{
+  t_key.assign(pName);
+  for (size_t index = 0; index < t_key.size(); ++index)
+  {
+    t_key[index] = (char)::tolower((unsigned char)t_key[index]);
+  }
+
+  return t_key;
+}
+
+//  ****************************************************************************
+/// Returns the family and address bytes of a sockaddr, for reverse lookups.
+///
+std::string GetAddressKey(const sockaddr* pAddr)
+{
+  if (AF_INET == pAddr->sa_family)
+  {
+    return std::string((const char*)&((const sockaddr_in*)pAddr)->sin_addr, sizeof(in_addr));
+  }
+
+  return std::string((const char*)&((const sockaddr_in6*)pAddr)->sin6_addr, sizeof(in6_addr));
+}
+
+//  ****************************************************************************
+/// Converts a service name or number to a port, in network byte order.
+///
+int ResolveService(const char* pService, const addrinfo* pHints, in_port_t& port)
+{
+  port = 0;
+  if (!pService)
+  {
+    return 0;
+  }
+
+  char* pEnd = NULL;
+  const unsigned long number = ::strtoul(pService, &pEnd, 10);
+  if ( *pService
+    && !*pEnd)
+  {
+    if (number > 0xFFFF)
+    {
+      return EAI_SERVICE;
+    }
+
+    port = htons((in_port_t)number);
+    return 0;
+  }
+
+  if ( pHints
+    && (pHints->ai_flags & AI_NUMERICSERV))
+  {
+    return EAI_NONAME;
+  }
+
+  const bool isDatagram = pHints && SOCK_DGRAM == pHints->ai_socktype;
+  servent    entry;
+  servent*   pEntry = NULL;
+  char       buffer[1024];
+  ::getservbyname_r(pService, isDatagram ? "udp" : "tcp", &entry, buffer, sizeof(buffer), &pEntry);
+  if (!pEntry)
+  {
+    return EAI_SERVICE;
+  }
+
+  port = (in_port_t)pEntry->s_port;
+  return 0;
+}
+
+} // namespace unnamed
+
+} // namespace cxxhook
@@ -0,0 +1,142 @@
+/// @file   netdb_hook.h
+///
+/// API Hook library for unit-testing with name resolution dependencies
+///
+/// getaddrinfo, freeaddrinfo, getnameinfo and gethostbyname are answered
+/// from an in-memory zone table, so a test never reads resolv.conf or
+/// waits for a name server.  The table is filled once, from a file in the
+/// format of /etc/hosts or with AddRecord, and is looked up through hash
+/// maps.  The sockaddr of every record is built when it is added, and the
+/// addrinfo results are taken from a pool rather than allocated per call.
+///
+/// A synthetic latency can be added to each resolution, to measure how code
+/// behaves with a slow resolver without depending on one.
+///
+/// Limitations:
+///   Only one Netdb_hook may exist at a time.
+///   The table must not change while another thread resolves a name.
+///   Results must be released with freeaddrinfo before the hooks are
+///   destroyed.  Services are resolved with getservbyname, and
+///   getnameinfo always reports a numeric service.
+///   ai_canonname and the names of a gethostbyname result point into the
+///   table, so results must be freed, and no longer used, before Clear.
+///
+/// The MIT License(MIT)
+/// @copyright 2014 Paul M Watt
+///
+//  ****************************************************************************
+#ifndef CXXHOOK_NETDB_H_INCLUDED
+#define CXXHOOK_NETDB_H_INCLUDED
+//  Includes *******************************************************************
+#include "../../../ApiHook.h"
+
+#include <atomic>
+#include <deque>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <stdint.h>
+
+namespace cxxhook
+{
+
+//  ****************************************************************************
+/// Resolves names from an in-memory zone table.
+/// Only one instance may exist at a time.
+///
+class Netdb_hook
+{
+public:
+  //  Constants ****************************************************************
+  static const size_t k_maxHostAddresses  = 16;   ///< Addresses gethostbyname reports.
+  static const size_t k_nodesPerSlab      = 64;   ///< Results the pool grows by.
+
+  explicit Netdb_hook(bool isPassThrough = false);
+ ~Netdb_hook();
+
+  bool    LoadZoneFile(const char* pPath);
+  bool    AddRecord(const char* pName, const char* pAddress);
+  void    Clear();
+
+  void    SetLatency(uint64_t latencyUs);
+
+private:
+  //  Typedef ******************************************************************
+  /// A resolved address, with the port left at 0.
+  struct Answer
+  {
+    union
+    {
+      sockaddr          sa;
+      sockaddr_in       sin;
+      sockaddr_in6      sin6;
+    };
+    socklen_t           length;
+  };
+
+  /// A name in the zone, and its addresses in the order they were added.
+  struct Host
+  {
+    std::string         canonical;
+    std::vector<Answer> answers;
+  };
+
+  /// A pooled result.  Released nodes are chained through info.ai_next.
+  struct Node
+  {
+    addrinfo            info;
+    Answer              address;
+    char                canonical[INET6_ADDRSTRLEN];  ///< Name of a numeric host.
+  };
+
+  typedef std::unordered_map<std::string, Host*>        HostMap;
+  typedef std::unordered_map<std::string, std::string>  ReverseMap;
+
+  //  Data Members *************************************************************
+  static
+    Netdb_hook*     sm_pThis;           ///< The active instance.
+
+  bool              m_isPassThrough;    ///< Names not in the zone use the real resolver.
+  std::atomic<uint64_t> m_latencyNs;
+
+  std::deque<Host>  m_hostStore;
+  HostMap           m_hosts;            ///< Lower-case names and aliases.
+  ReverseMap        m_names;            ///< Address bytes to canonical name.
+
+  std::atomic_flag  m_poolLock;
+  Node*             m_pFreeNodes;
+  std::vector<Node*> m_slabs;           ///< Every slab, in ascending order.
+
+  ApiHook*          m_pGetAddrInfo;
+  ApiHook*          m_pFreeAddrInfo;
+  ApiHook*          m_pGetNameInfo;
+  ApiHook*          m_pGetHostByName;
+
+  //  Methods ******************************************************************
+  static bool       ParseAddress(const char* pAddress, Answer& answer);
+
+  const Host*       FindHost(const char* pName) const;
+  Host*             AddHost(const std::string& name);
+  void              Delay() const;
+
+  Node*             AllocateNodes(size_t count);
+  void              ReleaseNodes(addrinfo* pFirst);
+  bool              IsPooled(const addrinfo* pInfo);
+
+  //  Hooks ********************************************************************
+  static int        Hook_getaddrinfo(const char* pNode, const char* pService, const addrinfo* pHints, addrinfo** ppResult);
+  static void       Hook_freeaddrinfo(addrinfo* pResult);
+  static int        Hook_getnameinfo(const sockaddr* pAddr, socklen_t addrLen, char* pHost, socklen_t hostLen, char* pServ, socklen_t servLen, int flags);
+  static hostent*   Hook_gethostbyname(const char* pName);
+
+  // Not implemented.
+  Netdb_hook(const Netdb_hook&);
+  Netdb_hook& operator=(const Netdb_hook&);
+};
+
+} // namespace cxxhook
+
+#endif
@@ -0,0 +1,1687 @@
+/// @file   pthread_hook.cpp
+///
+/// API Hook library for unit-testing with POSIX thread dependencies
+///
+/// The MIT License(MIT)
+/// @copyright 2014 Paul M Watt
+///
+//  ****************************************************************************
+#include "pthread_hook.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#include <sched.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(__x86_64__)
+# define CXXHOOK_FIBER_SWITCH_ASM
+#else
+# include <ucontext.h>
+#endif
+
+//  Context Switch *************************************************************
+#ifdef CXXHOOK_FIBER_SWITCH_ASM
+//  Saves the callee-saved registers on the current stack, stores the stack
+//  pointer in *ppSaveSp, then restores the registers saved on pNewSp.
+extern "C" void cxxhook_SwitchStack(void** ppSaveSp, void* pNewSp);
+
+__asm__(
+  ".text\n"
+  ".globl   cxxhook_SwitchStack\n"
+  ".hidden  cxxhook_SwitchStack\n"
+  ".type    cxxhook_SwitchStack, @function\n"
+  "cxxhook_SwitchStack:\n"
+  "  pushq  %rbp\n"
+  "  pushq  %rbx\n"
+  "  pushq  %r12\n"
+  "  pushq  %r13\n"
+  "  pushq  %r14\n"
+  "  pushq  %r15\n"
+  "  movq   %rsp, (%rdi)\n"
+  "  movq   %rsi, %rsp\n"
+  "  popq   %r15\n"
+  "  popq   %r14\n"
+  "  popq   %r13\n"
+  "  popq   %r12\n"
+  "  popq   %rbx\n"
+  "  popq   %rbp\n"
+  "  ret\n"
+  ".size    cxxhook_SwitchStack, .-cxxhook_SwitchStack\n"
+);
+#endif
+
+namespace cxxhook
+{
+
+//  Static Data Members ********************************************************
+PThread_hook* PThread_hook::sm_pThis = NULL;
+
+//  Forward Declarations *******************************************************
+namespace // unnamed
+{
+
+thread_local bool t_isSchedulerThread = false;  ///< Run is active on this thread.
+
+//  Typedef ********************************************************************
+typedef int       (*pfnpthread_create)(pthread_t*, const pthread_attr_t*, void* (*)(void*), void*);
+typedef int       (*pfnpthread_join)(pthread_t, void**);
+typedef int       (*pfnpthread_detach)(pthread_t);
+typedef void      (*pfnpthread_exit)(void*);
+typedef pthread_t (*pfnpthread_self)();
+typedef int       (*pfnsched_yield)();
+typedef int       (*pfnpthread_mutex)(pthread_mutex_t*);
+typedef int       (*pfnpthread_cond_wait)(pthread_cond_t*, pthread_mutex_t*);
+typedef int       (*pfnpthread_cond_timedwait)(pthread_cond_t*, pthread_mutex_t*, const timespec*);
+typedef int       (*pfnpthread_cond)(pthread_cond_t*);
+typedef int       (*pfnpthread_mutex_init)(pthread_mutex_t*, const pthread_mutexattr_t*);
+typedef int       (*pfnpthread_mutex_timedlock)(pthread_mutex_t*, const timespec*);
+typedef int       (*pfnpthread_mutex_clocklock)(pthread_mutex_t*, clockid_t, const timespec*);
+typedef int       (*pfnpthread_cond_init)(pthread_cond_t*, const pthread_condattr_t*);
+typedef int       (*pfnpthread_cond_clockwait)(pthread_cond_t*, pthread_mutex_t*, clockid_t, const timespec*);
+typedef int       (*pfnpthread_rwlock)(pthread_rwlock_t*);
+typedef int       (*pfnpthread_rwlock_timed)(pthread_rwlock_t*, const timespec*);
+typedef int       (*pfnpthread_rwlock_clock)(pthread_rwlock_t*, clockid_t, const timespec*);
+typedef int       (*pfnsem)(sem_t*);
+typedef int       (*pfnsem_timedwait)(sem_t*, const timespec*);
+typedef int       (*pfnsem_clockwait)(sem_t*, clockid_t, const timespec*);
+typedef int       (*pfnpthread_barrier_init)(pthread_barrier_t*, const pthread_barrierattr_t*, unsigned);
+typedef int       (*pfnpthread_barrier)(pthread_barrier_t*);
+typedef int       (*pfnpthread_spin)(pthread_spinlock_t*);
+typedef int       (*pfnpthread_setname_np)(pthread_t, const char*);
+typedef int       (*pfnpthread_getname_np)(pthread_t, char*, size_t);
+typedef int       (*pfnpthread_getattr_np)(pthread_t, pthread_attr_t*);
+typedef int       (*pfnpthread_kill)(pthread_t, int);
+typedef int       (*pfnpthread_cancel)(pthread_t);
+typedef int       (*pfnpthread_setschedparam)(pthread_t, int, const sched_param*);
+typedef int       (*pfnpthread_getschedparam)(pthread_t, int*, sched_param*);
+
+uint64_t GetClockNs(clockid_t clock);
+uint64_t GetDeadlineNs(clockid_t clock, const timespec* pAbsTime);
+size_t   GetGuardSize();
+
+} // namespace anonymous
+
+//  Implementation *************************************************************
+//  ****************************************************************************
+/// Installs the hooks for the thread and synchronization functions.
+///
+/// @param stackSize The usable stack size of each fiber.
+///
+PThread_hook::PThread_hook(size_t stackSize)
+  : m_stackSize(stackSize)
+  , m_pSchedulerSp(NULL)
+  , m_pSchedulerContext(NULL)
+  , m_pCurrent(NULL)
+  , m_liveCount(0)
+{
+  m_attributeLock.clear();
+  sm_pThis = this;
+
+#ifndef CXXHOOK_FIBER_SWITCH_ASM
+  m_pSchedulerContext = new ucontext_t;
+#endif
+
+  m_pCreate            = new ApiHook("libc.so.6", "pthread_create",              (PROC)Hook_pthread_create);
+  m_pJoin              = new ApiHook("libc.so.6", "pthread_join",                (PROC)Hook_pthread_join);
+  m_pDetach            = new ApiHook("libc.so.6", "pthread_detach",              (PROC)Hook_pthread_detach);
+  m_pExit              = new ApiHook("libc.so.6", "pthread_exit",                (PROC)Hook_pthread_exit);
+  m_pSelf              = new ApiHook("libc.so.6", "pthread_self",                (PROC)Hook_pthread_self);
+  m_pYield             = new ApiHook("libc.so.6", "sched_yield",                 (PROC)Hook_sched_yield);
+  m_pMutexLock         = new ApiHook("libc.so.6", "pthread_mutex_lock",          (PROC)Hook_pthread_mutex_lock);
+  m_pMutexTryLock      = new ApiHook("libc.so.6", "pthread_mutex_trylock",       (PROC)Hook_pthread_mutex_trylock);
+  m_pMutexUnlock       = new ApiHook("libc.so.6", "pthread_mutex_unlock",        (PROC)Hook_pthread_mutex_unlock);
+  m_pMutexDestroy      = new ApiHook("libc.so.6", "pthread_mutex_destroy",       (PROC)Hook_pthread_mutex_destroy);
+  m_pCondWait          = new ApiHook("libc.so.6", "pthread_cond_wait",           (PROC)Hook_pthread_cond_wait);
+  m_pCondTimedWait     = new ApiHook("libc.so.6", "pthread_cond_timedwait",      (PROC)Hook_pthread_cond_timedwait);
+  m_pCondSignal        = new ApiHook("libc.so.6", "pthread_cond_signal",         (PROC)Hook_pthread_cond_signal);
+  m_pCondBroadcast     = new ApiHook("libc.so.6", "pthread_cond_broadcast",      (PROC)Hook_pthread_cond_broadcast);
+  m_pCondDestroy       = new ApiHook("libc.so.6", "pthread_cond_destroy",        (PROC)Hook_pthread_cond_destroy);
+  m_pMutexInit         = new ApiHook("libc.so.6", "pthread_mutex_init",          (PROC)Hook_pthread_mutex_init);
+  m_pMutexTimedLock    = new ApiHook("libc.so.6", "pthread_mutex_timedlock",     (PROC)Hook_pthread_mutex_timedlock);
+  m_pMutexClockLock    = new ApiHook("libc.so.6", "pthread_mutex_clocklock",     (PROC)Hook_pthread_mutex_clocklock);
+  m_pCondInit          = new ApiHook("libc.so.6", "pthread_cond_init",           (PROC)Hook_pthread_cond_init);
+  m_pCondClockWait     = new ApiHook("libc.so.6", "pthread_cond_clockwait",      (PROC)Hook_pthread_cond_clockwait);
+  m_pRwLockRdLock      = new ApiHook("libc.so.6", "pthread_rwlock_rdlock",       (PROC)Hook_pthread_rwlock_rdlock);
+  m_pRwLockTryRdLock   = new ApiHook("libc.so.6", "pthread_rwlock_tryrdlock",    (PROC)Hook_pthread_rwlock_tryrdlock);
+  m_pRwLockTimedRdLock = new ApiHook("libc.so.6", "pthread_rwlock_timedrdlock",  (PROC)Hook_pthread_rwlock_timedrdlock);
+  m_pRwLockClockRdLock = new ApiHook("libc.so.6", "pthread_rwlock_clockrdlock",  (PROC)Hook_pthread_rwlock_clockrdlock);
+  m_pRwLockWrLock      = new ApiHook("libc.so.6", "pthread_rwlock_wrlock",       (PROC)Hook_pthread_rwlock_wrlock);
+  m_pRwLockTryWrLock   = new ApiHook("libc.so.6", "pthread_rwlock_trywrlock",    (PROC)Hook_pthread_rwlock_trywrlock);
+  m_pRwLockTimedWrLock = new ApiHook("libc.so.6", "pthread_rwlock_timedwrlock",  (PROC)Hook_pthread_rwlock_timedwrlock);
+  m_pRwLockClockWrLock = new ApiHook("libc.so.6", "pthread_rwlock_clockwrlock",  (PROC)Hook_pthread_rwlock_clockwrlock);
+  m_pRwLockUnlock      = new ApiHook("libc.so.6", "pthread_rwlock_unlock",       (PROC)Hook_pthread_rwlock_unlock);
+  m_pRwLockDestroy     = new ApiHook("libc.so.6", "pthread_rwlock_destroy",      (PROC)Hook_pthread_rwlock_destroy);
+  m_pSemWait           = new ApiHook("libc.so.6", "sem_wait",                    (PROC)Hook_sem_wait);
+  m_pSemTimedWait      = new ApiHook("libc.so.6", "sem_timedwait",               (PROC)Hook_sem_timedwait);
+  m_pSemClockWait      = new ApiHook("libc.so.6", "sem_clockwait",               (PROC)Hook_sem_clockwait);
+  m_pSemPost           = new ApiHook("libc.so.6", "sem_post",                    (PROC)Hook_sem_post);
+  m_pSemDestroy        = new ApiHook("libc.so.6", "sem_destroy",                 (PROC)Hook_sem_destroy);
+  m_pBarrierInit       = new ApiHook("libc.so.6", "pthread_barrier_init",        (PROC)Hook_pthread_barrier_init);
+  m_pBarrierWait       = new ApiHook("libc.so.6", "pthread_barrier_wait",        (PROC)Hook_pthread_barrier_wait);
+  m_pBarrierDestroy    = new ApiHook("libc.so.6", "pthread_barrier_destroy",     (PROC)Hook_pthread_barrier_destroy);
+  m_pSpinLock          = new ApiHook("libc.so.6", "pthread_spin_lock",           (PROC)Hook_pthread_spin_lock);
+  m_pSetName           = new ApiHook("libc.so.6", "pthread_setname_np",          (PROC)Hook_pthread_setname_np);
+  m_pGetName           = new ApiHook("libc.so.6", "pthread_getname_np",          (PROC)Hook_pthread_getname_np);
+  m_pGetAttr           = new ApiHook("libc.so.6", "pthread_getattr_np",          (PROC)Hook_pthread_getattr_np);
+  m_pKill              = new ApiHook("libc.so.6", "pthread_kill",                (PROC)Hook_pthread_kill);
+  m_pCancel            = new ApiHook("libc.so.6", "pthread_cancel",              (PROC)Hook_pthread_cancel);
+  m_pSetSchedParam     = new ApiHook("libc.so.6", "pthread_setschedparam",       (PROC)Hook_pthread_setschedparam);
+  m_pGetSchedParam     = new ApiHook("libc.so.6", "pthread_getschedparam",       (PROC)Hook_pthread_getschedparam);
+}
+
+//  ****************************************************************************
+PThread_hook::~PThread_hook()
+{
+  delete m_pGetSchedParam;
+  delete m_pSetSchedParam;
+  delete m_pCancel;
+  delete m_pKill;
+  delete m_pGetAttr;
+  delete m_pGetName;
+  delete m_pSetName;
+  delete m_pSpinLock;
+  delete m_pBarrierDestroy;
+  delete m_pBarrierWait;
+  delete m_pBarrierInit;
+  delete m_pSemDestroy;
+  delete m_pSemPost;
+  delete m_pSemClockWait;
+  delete m_pSemTimedWait;
+  delete m_pSemWait;
+  delete m_pRwLockDestroy;
+  delete m_pRwLockUnlock;
+  delete m_pRwLockClockWrLock;
+  delete m_pRwLockTimedWrLock;
+  delete m_pRwLockTryWrLock;
+  delete m_pRwLockWrLock;
+  delete m_pRwLockClockRdLock;
+  delete m_pRwLockTimedRdLock;
+  delete m_pRwLockTryRdLock;
+  delete m_pRwLockRdLock;
+  delete m_pCondClockWait;
+  delete m_pCondInit;
+  delete m_pMutexClockLock;
+  delete m_pMutexTimedLock;
+  delete m_pMutexInit;
+  delete m_pCondDestroy;
+  delete m_pCondBroadcast;
+  delete m_pCondSignal;
+  delete m_pCondTimedWait;
+  delete m_pCondWait;
+  delete m_pMutexDestroy;
+  delete m_pMutexUnlock;
+  delete m_pMutexTryLock;
+  delete m_pMutexLock;
+  delete m_pYield;
+  delete m_pSelf;
+  delete m_pExit;
+  delete m_pDetach;
+  delete m_pJoin;
+  delete m_pCreate;
+
+  const size_t guardSize = GetGuardSize();
+  for (size_t index = 0; index < m_stackPool.size(); ++index)
+  {
+    ::munmap(m_stackPool[index], guardSize + m_stackSize);
+  }
+
+#ifndef CXXHOOK_FIBER_SWITCH_ASM
+  delete (ucontext_t*)m_pSchedulerContext;
+#endif
+
+  sm_pThis = NULL;
+}
+
+//  ****************************************************************************
+/// Runs a function as the first fiber of the scheduler, and continues to
+/// run fibers until every fiber has finished.
+///
+/// @param pfnMain   The entry point of the first fiber.
+/// @param pArg      The argument passed to pfnMain.
+/// @param ppResult  Receives the value returned by pfnMain.
+/// @return 0        Every fiber finished.
+/// @return EDEADLK  Every remaining fiber is blocked and none can wake.
+/// @return EBUSY    The scheduler is already running.
+/// @return ENOMEM   The first fiber could not be created.
+///
+int PThread_hook::Run(void* (*pfnMain)(void*), void* pArg, void** ppResult)
+{
+  if (t_isSchedulerThread)
+  {
+    return EBUSY;
+  }
+
+  Fiber* pMain = CreateFiber(pfnMain, pArg);
+  if (!pMain)
+  {
+    return ENOMEM;
+  }
+
+  t_isSchedulerThread = true;
+
+  int result = 0;
+  for (;;)
+  {
+    if (!m_sleepers.empty())
+    {
+      WakeExpiredSleepers(GetClockNs(CLOCK_MONOTONIC));
+    }
+
+    if (m_ready.empty())
+    {
+      if (!m_sleepers.empty())
+      {
+        // Nothing can run until the earliest timed wait expires.
+        const uint64_t deadline = m_sleepers.begin()->first;
+        timespec       wakeTime = { (time_t)(deadline / 1000000000), (long)(deadline % 1000000000) };
+        ::clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wakeTime, NULL);
+        continue;
+      }
+
+      if (m_liveCount)
+      {
+        result = EDEADLK;
+      }
+
+      break;
+    }
+
+    Fiber* pFiber = m_ready.front();
+    m_ready.pop_front();
+
+    SwitchToFiber(pFiber);
+
+    if (k_finished == pFiber->state)
+    {
+      --m_liveCount;
+      if (pFiber->pJoiner)
+      {
+        // The joiner collects the result and releases the fiber.
+        Wake(pFiber->pJoiner);
+      }
+      else if (pFiber->isDetached)
+      {
+        ReleaseFiber(pFiber);
+      }
+    }
+  }
+
+  if ( ppResult
+    && k_finished == pMain->state)
+  {
+    *ppResult = pMain->pResult;
+  }
+
+  // Release the fibers that were never joined, or are deadlocked.
+  while (!m_fibers.empty())
+  {
+    ReleaseFiber(*m_fibers.begin());
+  }
+
+  m_ready.clear();
+  m_sleepers.clear();
+  m_mutexes.clear();
+  m_conds.clear();
+  m_rwlocks.clear();
+  m_sems.clear();
+  m_barriers.clear();
+  m_liveCount = 0;
+
+  t_isSchedulerThread = false;
+  return result;
+}
+
+//  ****************************************************************************
+/// Indicates if the calling thread is a fiber of the scheduler.
+///
+bool PThread_hook::IsActive()
+{
+  return t_isSchedulerThread
+      && sm_pThis
+      && sm_pThis->m_pCurrent;
+}
+
+//  ****************************************************************************
+/// Returns the fiber a pthread_t refers to, or NULL if it is not a fiber of 
+/// the scheduler that runs on this thread.
+///
+PThread_hook::Fiber* PThread_hook::GetFiber(pthread_t thread)
+{
+  Fiber* pFiber = (Fiber*)thread;
+  return IsActive() && sm_pThis->m_fibers.count(pFiber)
+         ? pFiber
+         : NULL;
+}
+
+//  ****************************************************************************
+/// Creates a fiber, with a stack from the pool, and queues it to run.
+///
+PThread_hook::Fiber* PThread_hook::CreateFiber(void* (*pfnStart)(void*), void* pArg)
+{
+  const size_t guardSize = GetGuardSize();
+
+  void* pStack = NULL;
+  if (!m_stackPool.empty())
+  {
+    pStack = m_stackPool.back();
+    m_stackPool.pop_back();
+  }
+  else
+  {
+    pStack = ::mmap(NULL,
+                    guardSize + m_stackSize,
+                    PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK,
+                    -1,
+                    0);
+    if (MAP_FAILED == pStack)
+    {
+      return NULL;
+    }
+
+    // The lowest page catches a stack overflow.
+    ::mprotect(pStack, guardSize, PROT_NONE);
+  }
+
+  Fiber* pFiber       = new Fiber;
+  pFiber->pSp         = NULL;
+  pFiber->pContext    = NULL;
+  pFiber->pStack      = pStack;
+  pFiber->pfnStart    = pfnStart;
+  pFiber->pArg        = pArg;
+  pFiber->pResult     = NULL;
+  pFiber->state       = k_ready;
+  pFiber->isDetached  = false;
+  pFiber->isTimedOut  = false;
+  pFiber->pJoiner     = NULL;
+  pFiber->pWaitQueue  = NULL;
+  pFiber->sleeper     = m_sleepers.end();
+  pFiber->name[0]     = '\0';
+  pFiber->policy      = SCHED_OTHER;
+  pFiber->schedParam  = sched_param();
+
+#ifdef CXXHOOK_FIBER_SWITCH_ASM
+  // Build the frame that cxxhook_SwitchStack restores,
+  // so the first switch returns into FiberStart.
+  uintptr_t top     = ((uintptr_t)pStack + guardSize + m_stackSize) & ~(uintptr_t)15;
+  void**    pFrame  = (void**)top;
+  *--pFrame = NULL;                     // FiberStart never returns.
+  *--pFrame = (void*)&FiberStart;
+  for (int reg = 0; reg < 6; ++reg)
+  {
+    *--pFrame = NULL;                   // rbp, rbx, r12 - r15
+  }
+
+  pFiber->pSp = pFrame;
+#else
+  ucontext_t* pContext = new ucontext_t;
+  ::getcontext(pContext);
+  pContext->uc_stack.ss_sp    = (char*)pStack + guardSize;
+  pContext->uc_stack.ss_size  = m_stackSize;
+  pContext->uc_link           = NULL;
+  ::makecontext(pContext, FiberStart, 0);
+
+  pFiber->pContext = pContext;
+#endif
+
+  m_fibers.insert(pFiber);
+  m_ready.push_back(pFiber);
+  ++m_liveCount;
+  return pFiber;
+}
+
+//  ****************************************************************************
+/// Returns a fiber's stack to the pool, and destroys the fiber.
+///
+void PThread_hook::ReleaseFiber(Fiber* pFiber)
+{
+  m_fibers.erase(pFiber);
+  m_stackPool.push_back(pFiber->pStack);
+
+#ifndef CXXHOOK_FIBER_SWITCH_ASM
+  delete (ucontext_t*)pFiber->pContext;
+#endif
+
+  delete pFiber;
+}
+
+//  ****************************************************************************
+/// Suspends the current fiber and resumes the scheduler loop.
+///
+void PThread_hook::SwitchToScheduler()
+{
+  // errno belongs to the OS thread, which every fiber shares.
+  Fiber* pFiber     = m_pCurrent;
+  int    savedErrno = errno;
+
+#ifdef CXXHOOK_FIBER_SWITCH_ASM
+  cxxhook_SwitchStack(&pFiber->pSp, m_pSchedulerSp);
+#else
+  ::swapcontext((ucontext_t*)pFiber->pContext, (ucontext_t*)m_pSchedulerContext);
+#endif
+
+  errno = savedErrno;
+}
+
+//  ****************************************************************************
+/// Runs a fiber from the scheduler loop, until it blocks, yields or finishes.
+///
+void PThread_hook::SwitchToFiber(Fiber* pFiber)
+{
+  m_pCurrent      = pFiber;
+  pFiber->state   = k_running;
+
+#ifdef CXXHOOK_FIBER_SWITCH_ASM
+  cxxhook_SwitchStack(&m_pSchedulerSp, pFiber->pSp);
+#else
+  ::swapcontext((ucontext_t*)m_pSchedulerContext, (ucontext_t*)pFiber->pContext);
+#endif
+
+  m_pCurrent      = NULL;
+}
+
+//  ****************************************************************************
+/// Blocks the current fiber until another fiber wakes it, or until its
+/// deadline passes.
+///
+/// @param pQueue    The wait queue to join, or NULL.
+/// @param clock     The clock of the deadline.
+/// @param pAbsTime  The deadline of the wait, or NULL to wait without one.
+/// @return  true    Another fiber woke this fiber.
+/// @return false    The deadline passed.
+///
+bool PThread_hook::Block(WaitQueue* pQueue, clockid_t clock, const timespec* pAbsTime)
+{
+  Fiber* pFiber       = m_pCurrent;
+  pFiber->state       = k_blocked;
+  pFiber->isTimedOut  = false;
+  pFiber->pWaitQueue  = pQueue;
+  if (pQueue)
+  {
+    pQueue->push_back(pFiber);
+  }
+
+  if (pAbsTime)
+  {
+    pFiber->sleeper = m_sleepers.insert(std::make_pair(GetDeadlineNs(clock, pAbsTime), pFiber));
+  }
+
+  SwitchToScheduler();
+  return !pFiber->isTimedOut;
+}
+
+//  ****************************************************************************
+/// Makes a blocked fiber ready to run.
+///
+void PThread_hook::Wake(Fiber* pFiber)
+{
+  if (pFiber->sleeper != m_sleepers.end())
+  {
+    m_sleepers.erase(pFiber->sleeper);
+    pFiber->sleeper = m_sleepers.end();
+  }
+
+  pFiber->pWaitQueue  = NULL;
+  pFiber->state       = k_ready;
+  m_ready.push_back(pFiber);
+}
+
+//  ****************************************************************************
+/// Wakes every fiber whose timed wait has expired.
+///
+void PThread_hook::WakeExpiredSleepers(uint64_t now)
+{
+  while ( !m_sleepers.empty()
+       && m_sleepers.begin()->first <= now)
+  {
+    Fiber* pFiber = m_sleepers.begin()->second;
+    m_sleepers.erase(m_sleepers.begin());
+    pFiber->sleeper = m_sleepers.end();
+
+    if (pFiber->pWaitQueue)
+    {
+      WaitQueue& queue = *pFiber->pWaitQueue;
+      queue.erase(std::find(queue.begin(), queue.end(), pFiber));
+    }
+
+    pFiber->isTimedOut = true;
+    Wake(pFiber);
+  }
+}
+
+//  ****************************************************************************
+/// Records a property of a synchronization object when it is initialized.
+/// Objects are initialized from any thread, so the table has its own lock.
+///
+void PThread_hook::SetAttribute(const void* pObject, int value)
+{
+  while (m_attributeLock.test_and_set(std::memory_order_acquire))
+  { }
+
+  m_attributes[pObject] = value;
+  m_attributeLock.clear(std::memory_order_release);
+}
+
+//  ****************************************************************************
+/// Reports the property recorded for an object, or defaultValue if the
+/// object was not initialized through the hooks.
+///
+int PThread_hook::GetAttribute(const void* pObject, int defaultValue)
+{
+  while (m_attributeLock.test_and_set(std::memory_order_acquire))
+  { }
+
+  AttributeMap::const_iterator iter = m_attributes.find(pObject);
+  const int value = m_attributes.end() != iter
+                    ? iter->second
+                    : defaultValue;
+
+  m_attributeLock.clear(std::memory_order_release);
+  return value;
+}
+
+//  ****************************************************************************
+void PThread_hook::RemoveAttribute(const void* pObject)
+{
+  while (m_attributeLock.test_and_set(std::memory_order_acquire))
+  { }
+
+  m_attributes.erase(pObject);
+  m_attributeLock.clear(std::memory_order_release);
+}
+
+//  ****************************************************************************
+/// Acquires a mutex for the current fiber.  Ownership is handed directly
+/// to the first waiter when the mutex is unlocked.
+///
+/// @param pAbsTime  The deadline of the wait, or NULL to wait without one.
+///
+int PThread_hook::LockMutex(
+  pthread_mutex_t*  pMutex,
+  bool              isTry,
+  clockid_t         clock,
+  const timespec*   pAbsTime
+)
+{
+  MutexState& state = m_mutexes[pMutex];
+  if (!state.pOwner)
+  {
+    state.pOwner  = m_pCurrent;
+    state.count   = 1;
+    return 0;
+  }
+
+  if (state.pOwner == m_pCurrent)
+  {
+    const int type = GetAttribute(pMutex, PTHREAD_MUTEX_DEFAULT);
+    if (PTHREAD_MUTEX_RECURSIVE == type)
+    {
+      ++state.count;
+      return 0;
+    }
+
+    if ( !isTry
+      && PTHREAD_MUTEX_ERRORCHECK == type)
+    {
+      return EDEADLK;
+    }
+  }
+
+  if (isTry)
+  {
+    return EBUSY;
+  }
+
+  // A normal mutex locked twice by its owner blocks forever, as it would
+  // with real threads, and Run reports the deadlock.
+  return Block(&state.waiters, clock, pAbsTime) ? 0 : ETIMEDOUT;
+}
+
+//  ****************************************************************************
+int PThread_hook::UnlockMutex(pthread_mutex_t* pMutex)
+{
+  MutexMap::iterator iter = m_mutexes.find(pMutex);
+  if ( m_mutexes.end() == iter
+    || iter->second.pOwner != m_pCurrent)
+  {
+    return EPERM;
+  }
+
+  MutexState& state = iter->second;
+  if (--state.count)
+  {
+    return 0;
+  }
+
+  if (state.waiters.empty())
+  {
+    state.pOwner = NULL;
+    return 0;
+  }
+
+  Fiber* pNext = state.waiters.front();
+  state.waiters.pop_front();
+  state.pOwner  = pNext;
+  state.count   = 1;
+  Wake(pNext);
+  return 0;
+}
+
+//  ****************************************************************************
+/// Waits on a condition variable for the current fiber.
+///
+/// @param clock     The clock of the deadline.
+/// @param pAbsTime  The deadline of the wait, or NULL to wait without one.
+///
+int PThread_hook::WaitCondition(
+  pthread_cond_t*   pCond,
+  pthread_mutex_t*  pMutex,
+  clockid_t         clock,
+  const timespec*   pAbsTime
+)
+{
+  const int result = UnlockMutex(pMutex);
+  if (result)
+  {
+    return result;
+  }
+
+  CondState& state      = m_conds[pCond];
+  const bool isSignaled = Block(&state.waiters, clock, pAbsTime);
+
+  LockMutex(pMutex, false);
+  return isSignaled ? 0 : ETIMEDOUT;
+}
+
+//  ****************************************************************************
+/// Acquires a read lock for the current fiber.  A read lock is granted
+/// whenever no fiber holds the write lock.
+///
+int PThread_hook::LockRead(
+  pthread_rwlock_t* pLock,
+  bool              isTry,
+  clockid_t         clock,
+  const timespec*   pAbsTime
+)
+{
+  RwLockState& state = m_rwlocks[pLock];
+  if (!state.pWriter)
+  {
+    ++state.readers;
+    return 0;
+  }
+
+  if (isTry)
+  {
+    return EBUSY;
+  }
+
+  if (state.pWriter == m_pCurrent)
+  {
+    return EDEADLK;
+  }
+
+  // The read lock is granted by the unlock that wakes this fiber.
+  return Block(&state.readWaiters, clock, pAbsTime) ? 0 : ETIMEDOUT;
+}
+
+//  ****************************************************************************
+/// Acquires the write lock for the current fiber.
+///
+int PThread_hook::LockWrite(
+  pthread_rwlock_t* pLock,
+  bool              isTry,
+  clockid_t         clock,
+  const timespec*   pAbsTime
+)
+{
+  RwLockState& state = m_rwlocks[pLock];
+  if ( !state.pWriter
+    && !state.readers)
+  {
+    state.pWriter = m_pCurrent;
+    return 0;
+  }
+
+  if (isTry)
+  {
+    return EBUSY;
+  }
+
+  if (state.pWriter == m_pCurrent)
+  {
+    return EDEADLK;
+  }
+
+  // The write lock is granted by the unlock that wakes this fiber.
+  return Block(&state.writeWaiters, clock, pAbsTime) ? 0 : ETIMEDOUT;
+}
+
+//  ****************************************************************************
+/// Releases a read or write lock.  When the lock becomes free, it is handed
+/// to every waiting reader, or else to the first waiting writer.
+///
+int PThread_hook::UnlockRwLock(pthread_rwlock_t* pLock)
+{
+  RwLockMap::iterator iter = m_rwlocks.find(pLock);
+  if (m_rwlocks.end() == iter)
+  {
+    return EPERM;
+  }
+
+  RwLockState& state = iter->second;
+  if (state.pWriter == m_pCurrent)
+  {
+    state.pWriter = NULL;
+  }
+  else if (state.readers)
+  {
+    if (--state.readers)
+    {
+      return 0;
+    }
+  }
+  else
+  {
+    return EPERM;
+  }
+
+  if (!state.readWaiters.empty())
+  {
+    while (!state.readWaiters.empty())
+    {
+      Fiber* pFiber = state.readWaiters.front();
+      state.readWaiters.pop_front();
+      ++state.readers;
+      Wake(pFiber);
+    }
+  }
+  else if (!state.writeWaiters.empty())
+  {
+    Fiber* pFiber = state.writeWaiters.front();
+    state.writeWaiters.pop_front();
+    state.pWriter = pFiber;
+    Wake(pFiber);
+  }
+
+  return 0;
+}
+
+//  ****************************************************************************
+/// Decrements a semaphore for the current fiber.  The count stays in the
+/// sem_t, so it is taken with sem_trywait, and the fiber waits for a
+/// sem_post while the count is zero.
+///
+/// @return 0        The semaphore was decremented.
+/// @return -1       The deadline passed, and errno is ETIMEDOUT.
+///
+int PThread_hook::WaitSemaphore(sem_t* pSem, clockid_t clock, const timespec* pAbsTime)
+{
+  const int savedErrno = errno;
+  SemState& state      = m_sems[pSem];
+  while (0 != ::sem_trywait(pSem))
+  {
+    if (EAGAIN != errno)
+    {
+      return -1;
+    }
+
+    if (!Block(&state.waiters, clock, pAbsTime))
+    {
+      errno = ETIMEDOUT;
+      return -1;
+    }
+  }
+
+  errno = savedErrno;
+  return 0;
+}
+
+//  ****************************************************************************
+/// The first function to run on a new fiber's stack.
+///
+void PThread_hook::FiberStart()
+{
+  PThread_hook* pThis  = sm_pThis;
+  Fiber*        pFiber = pThis->m_pCurrent;
+
+  pFiber->pResult = pFiber->pfnStart(pFiber->pArg);
+  pFiber->state   = k_finished;
+
+  // The scheduler never resumes a finished fiber.
+  pThis->SwitchToScheduler();
+}
+
+//  Hooks **********************************************************************
+//  ****************************************************************************
+int PThread_hook::Hook_pthread_create(
+  pthread_t*            pThread,
+  const pthread_attr_t* pAttr,
+  void*               (*pfnStart)(void*),
+  void*                 pArg
+)
+{
+  if (!IsActive())
+  {
+    return ((pfnpthread_create)(PROC)*sm_pThis->m_pCreate)(pThread, pAttr, pfnStart, pArg);
+  }
+
+  Fiber* pFiber = sm_pThis->CreateFiber(pfnStart, pArg);
+  if (!pFiber)
+  {
+    return EAGAIN;
+  }
+
+  int detachState = PTHREAD_CREATE_JOINABLE;
+  if (pAttr)
+  {
+    ::pthread_attr_getdetachstate(pAttr, &detachState);
+  }
+
+  pFiber->isDetached = (PTHREAD_CREATE_DETACHED == detachState);
+  *pThread = (pthread_t)pFiber;
+  return 0;
+}
+
+//  ****************************************************************************
+int PThread_hook::Hook_pthread_join(pthread_t thread, void** ppResult)
+{
+  Fiber* pFiber = (Fiber*)thread;
+  if ( !IsActive()
+    || !sm_pThis->m_fibers.count(pFiber))
+  {
+    return ((pfnpthread_join)(PROC)*sm_pThis->m_pJoin)(thread, ppResult);
+  }
+
+  if (pFiber == sm_pThis->m_pCurrent)
+  {
+    return EDEADLK;
+  }
+
+  if ( pFiber->isDetached
+    || pFiber->pJoiner)
+  {
+    return EINVAL;
+  }
+
+  if (k_finished != pFiber->state)
+  {
+    pFiber->pJoiner = sm_pThis->m_pCurrent;
+    sm_pThis->Block(NULL);
+  }
+
+  if (ppResult)
+  {
+    *ppResult = pFiber->pResult;
+  }
+
+  sm_pThis->ReleaseFiber(pFiber);
+  return 0;
+}
+
+//  ****************************************************************************
+int PThread_hook::Hook_pthread_detach(pthread_t thread)
+{
+  Fiber* pFiber = (Fiber*)thread;
+  if ( !IsActive()
+    || !sm_pThis->m_fibers.count(pFiber))
+  {
+    return ((pfnpthread_detach)(PROC)*sm_pThis->m_pDetach)(thread);
+  }
+
+  if ( pFiber->isDetached
+    || pFiber->pJoiner)
+  {
+    return EINVAL;
+  }
+
+  if (k_finished == pFiber->state)
+  {
+    sm_pThis->ReleaseFiber(pFiber);
+    return 0;
+  }
+
+  pFiber->isDetached = true;
+  return 0;
+}
+
+//  ****************************************************************************
+void PThread_hook::Hook_pthread_exit(void* pResult)
+{
+  if (!IsActive())
+  {
+    ((pfnpthread_exit)(PROC)*sm_pThis->m_pExit)(pResult);
+  }
+
+  Fiber* pFiber   = sm_pThis->m_pCurrent;
+  pFiber->pResult = pResult;
+  pFiber->state   = k_finished;
+
+  // The scheduler never resumes a finished fiber.
+  sm_pThis->SwitchToScheduler();
+  ::abort();
+}
+
+//  ****************************************************************************
+pthread_t PThread_hook::Hook_pthread_self()
+{
+  if (!IsActive())
+  {
+    return ((pfnpthread_self)(PROC)*sm_pThis->m_pSelf)();
+  }
+
+  return (pthread_t)sm_pThis->m_pCurrent;
+}
+
+//  ****************************************************************************
+int PThread_hook::Hook_sched_yield()
+{
+  if (!IsActive())
+  {
+    return ((pfnsched_yield)(PROC)*sm_pThis->m_pYield)();
+  }
+
+  Fiber* pFiber = sm_pThis->m_pCurrent;
+  pFiber->state = k_ready;
+  sm_pThis->m_ready.push_back(pFiber);
+  sm_pThis->SwitchToScheduler();
+  return 0;
+}
+
+//  ****************************************************************************
+int PThread_hook::Hook_pthread_mutex_lock(pthread_mutex_t* pMutex)
+{
+  if (!IsActive())
+  {
+    return ((pfnpthread_mutex)(PROC)*sm_pThis->m_pMutexLock)(pMutex);
+  }
+
+  return sm_pThis->LockMutex(pMutex, false);
+}
+
+//  ****************************************************************************
+int PThread_hook::Hook_pthread_mutex_trylock(pthread_mutex_t* pMutex)
+{
+  if (!IsActive())
+  {
+    return ((pfnpthread_mutex)(PROC)*sm_pThis->m_pMutexTryLock)(pMutex);
+  }
+
+  return sm_pThis->LockMutex(pMutex, true);
+}
+
+//  ****************************************************************************
+int PThread_hook::Hook_pthread_mutex_timedlock(pthread_mutex_t* pMutex, const timespec* pAbsTime)
+{
+  if (!IsActive())
+  {
+    return ((pfnpthread_mutex_timedlock)(PROC)*sm_pThis->m_pMutexTimedLock)(pMutex, pAbsTime);
+  }
+
+  return sm_pThis->LockMutex(pMutex, false, CLOCK_REALTIME, pAbsTime);
+}
+
+//  ****************************************************************************
+int PThread_hook::Hook_pthread_mutex_clocklock(
+  pthread_mutex_t*  pMutex,
+  clockid_t         clock,
+  const timespec*   pAbsTime
+)
+{
+  if (!IsActive())
+  {
+    return ((pfnpthread_mutex_clocklock)(PROC)*sm_pThis->m_pMutexClockLock)(pMutex, clock, pAbsTime);
+  }
+
+  return sm_pThis->LockMutex(pMutex, false, clock, pAbsTime);
+}
+
+//  ****************************************************************************
+int PThread_hook::Hook_pthread_mutex_unlock(pthread_mutex_t* pMutex)
+{
+  if (!IsActive())
+  {
+    return ((pfnpthread_mutex)(PROC)*sm_pThis->m_pMutexUnlock)(pMutex);
+  }
+
+  return sm_pThis->UnlockMutex(pMutex);
+}
+
+//  ****************************************************************************
+/// Records the type of every mutex, including those created before Run.
+///
+int PThread_hook::Hook_pthread_mutex_init(pthread_mutex_t* pMutex, const pthread_mutexattr_t* pAttr)
+{
+  int type = PTHREAD_MUTEX_DEFAULT;
+  if (pAttr)
+  {
+    ::pthread_mutexattr_gettype(pAttr, &type);
+  }
+
+  sm_pThis->SetAttribute(pMutex, type);
+  return ((pfnpthread_mutex_init)(PROC)*sm_pThis->m_pMutexInit)(pMutex, pAttr);
+}
+
+//  ****************************************************************************
+int PThread_hook::Hook_pthread_mutex_destroy(pthread_mutex_t* pMutex)
+{
+  if (IsActive())
+  {
+    MutexMap::iterator iter = sm_pThis->m_mutexes.find(pMutex);
+    if (sm_pThis->m_mutexes.end() != iter)
+    {
+      if (iter->second.pOwner)
+      {
+        return EBUSY;
+      }
+
+      sm_pThis->m_mutexes.erase(iter);
+    }
+  }
+
+  sm_pThis->RemoveAttribute(pMutex);
+  return ((pfnpthread_mutex)(PROC)*sm_pThis->m_pMutexDestroy)(pMutex);
+}
+
+//  ****************************************************************************
+int PThread_hook::Hook_pthread_cond_wait(pthread_cond_t* pCond, pthread_mutex_t* pMutex)
+{
+  if (!IsActive())
+  {
+    return ((pfnpthread_cond_wait)(PROC)*sm_pThis->m_pCondWait)(pCond, pMutex);
+  }
+
+  return sm_pThis->WaitCondition(pCond, pMutex, CLOCK_REALTIME, NULL);
+}
+
+//  ****************************************************************************
+int PThread_hook::Hook_pthread_cond_timedwait(
+  pthread_cond_t*   pCond,
+  pthread_mutex_t*  pMutex,
+  const timespec*   pAbsTime
+)
+{
+  if (!IsActive())
+  {
+    return ((pfnpthread_cond_timedwait)(PROC)*sm_pThis->m_pCondTimedWait)(pCond, pMutex, pAbsTime);
+  }
+
+  // The deadline is measured with the clock set by pthread_condattr_setclock.
+  const clockid_t clock = (clockid_t)sm_pThis->GetAttribute(pCond, CLOCK_REALTIME);
+  return sm_pThis->WaitCondition(pCond, pMutex, clock, pAbsTime);
+}
+
+//  ****************************************************************************
+int PThread_hook::Hook_pthread_cond_clockwait(
+  pthread_cond_t*   pCond,
+  pthread_mutex_t*  pMutex,
+  clockid_t         clock,
+  const timespec*   pAbsTime
+)
+{
+  if (!IsActive())
+  {
+    return ((pfnpthread_cond_clockwait)(PROC)*sm_pThis->m_pCondClockWait)(pCond, pMutex, clock, pAbsTime);
+  }
+
+  return sm_pThis->WaitCondition(pCond, pMutex, clock, pAbsTime);
+}
+
+//  ****************************************************************************
+/// Records the clock of every condition variable, including those created
+/// before Run.
+///
+int PThread_hook::Hook_pthread_cond_init(pthread_cond_t* pCond, const pthread_condattr_t* pAttr)
+{
+  clockid_t clock = CLOCK_REALTIME;
+  if (pAttr)
+  {
+    ::pthread_condattr_getclock(pAttr, &clock);
+  }
+
+  sm_pThis->SetAttribute(pCond, (int)clock);
+  return ((pfnpthread_cond_init)(PROC)*sm_pThis->m_pCondInit)(pCond, pAttr);
+}
+
+//  ****************************************************************************
+int PThread_hook::Hook_pthread_cond_signal(pthread_cond_t* pCond)
+{
+  if (!IsActive())
+  {
+    return ((pfnpthread_cond)(PROC)*sm_pThis->m_pCondSignal)(pCond);
+  }
+
+  CondMap::iterator iter = sm_pThis->m_conds.find(pCond);
+  if ( sm_pThis->m_conds.end() != iter
+    && !iter->second.waiters.empty())
+  {
+    Fiber* pFiber = iter->second.waiters.front();
+    iter->second.waiters.pop_front();
+    sm_pThis->Wake(pFiber);
+  }
+
+  return 0;
+}
+
+//  ****************************************************************************
+int PThread_hook::Hook_pthread_cond_broadcast(pthread_cond_t* pCond)
+{
+  if (!IsActive())
+  {
+    return ((pfnpthread_cond)(PROC)*sm_pThis->m_pCondBroadcast)(pCond);
+  }
+
+  CondMap::iterator iter = sm_pThis->m_conds.find(pCond);
+  if (sm_pThis->m_conds.end() != iter)
+  {
+    WaitQueue& waiters = iter->second.waiters;
+    while (!waiters.empty())
+    {
+      Fiber* pFiber = waiters.front();
+      waiters.pop_front();
+      sm_pThis->Wake(pFiber);
+    }
+  }
+
+  return 0;
+}
+
+//  ****************************************************************************
+int PThread_hook::Hook_pthread_cond_destroy(pthread_cond_t* pCond)
+{
+  if (IsActive())
+  {
+    CondMap::iterator iter = sm_pThis->m_conds.find(pCond);
+    if (sm_pThis->m_conds.end() != iter)
+    {
+      if (!iter->second.waiters.empty())
+      {
+        return EBUSY;
+      }
+
+      sm_pThis->m_conds.erase(iter);
+    }
+  }
+
+  sm_pThis->RemoveAttribute(pCond);
+  return ((pfnpthread_cond)(PROC)*sm_pThis->m_pCondDestroy)(pCond);
+}
+
+//  ****************************************************************************
+int PThread_hook::Hook_pthread_rwlock_rdlock(pthread_rwlock_t* pLock)
+{
+  if (!IsActive())
+  {
+    return ((pfnpthread_rwlock)(PROC)*sm_pThis->m_pRwLockRdLock)(pLock);
+  }
+
+  return sm_pThis->LockRead(pLock, false);
+}
+
+//  ****************************************************************************
+int PThread_hook::Hook_pthread_rwlock_tryrdlock(pthread_rwlock_t* pLock)
+{
+  if (!IsActive())
+  {
+    return ((pfnpthread_rwlock)(PROC)*sm_pThis->m_pRwLockTryRdLock)(pLock);
+  }
+
+  return sm_pThis->LockRead(pLock, true);
+}
+
+//  ****************************************************************************
+int PThread_hook::Hook_pthread_rwlock_timedrdlock(pthread_rwlock_t* pLock, const timespec* pAbsTime)
+{
+  if (!IsActive())
+  {
+    return ((pfnpthread_rwlock_timed)(PROC)*sm_pThis->m_pRwLockTimedRdLock)(pLock, pAbsTime);
+  }
+
+  return sm_pThis->LockRead(pLock, false, CLOCK_REALTIME, pAbsTime);
+}
+
+//  ****************************************************************************
+int PThread_hook::Hook_pthread_rwlock_clockrdlock(
+  pthread_rwlock_t* pLock,
+  clockid_t         clock,
+  const timespec*   pAbsTime
+)
+{
+  if (!IsActive())
+  {
+    return ((pfnpthread_rwlock_clock)(PROC)*sm_pThis->m_pRwLockClockRdLock)(pLock, clock, pAbsTime);
+  }
+
+  return sm_pThis->LockRead(pLock, false, clock, pAbsTime);
+}
+
+//  ****************************************************************************
+int PThread_hook::Hook_pthread_rwlock_wrlock(pthread_rwlock_t* pLock)
+{
+  if (!IsActive())
+  {
+    return ((pfnpthread_rwlock)(PROC)*sm_pThis->m_pRwLockWrLock)(pLock);
+  }
+
+  return sm_pThis->LockWrite(pLock, false);
+}
+
+//  ****************************************************************************
+int PThread_hook::Hook_pthread_rwlock_trywrlock(pthread_rwlock_t* pLock)
+{
+  if (!IsActive())
+  {
+    return ((pfnpthread_rwlock)(PROC)*sm_pThis->m_pRwLockTryWrLock)(pLock);
+  }
+
+  return sm_pThis->LockWrite(pLock, true);
+}
+
+//  ****************************************************************************
+int PThread_hook::Hook_pthread_rwlock_timedwrlock(pthread_rwlock_t* pLock, const timespec* pAbsTime)
+{
+  if (!IsActive())
+  {
+    return ((pfnpthread_rwlock_timed)(PROC)*sm_pThis->m_pRwLockTimedWrLock)(pLock, pAbsTime);
+  }
+
+  return sm_pThis->LockWrite(pLock, false, CLOCK_REALTIME, pAbsTime);
+}
+
+//  ****************************************************************************
+int PThread_hook::Hook_pthread_rwlock_clockwrlock(
+  pthread_rwlock_t* pLock,
+  clockid_t         clock,
+  const timespec*   pAbsTime
+)
+{
+  if (!IsActive())
+  {
+    return ((pfnpthread_rwlock_clock)(PROC)*sm_pThis->m_pRwLockClockWrLock)(pLock, clock, pAbsTime);
+  }
+
+  return sm_pThis->LockWrite(pLock, false, clock, pAbsTime);
+}
+
+//  ****************************************************************************
+int PThread_hook::Hook_pthread_rwlock_unlock(pthread_rwlock_t* pLock)
+{
+  if (!IsActive())
+  {
+    return ((pfnpthread_rwlock)(PROC)*sm_pThis->m_pRwLockUnlock)(pLock);
+  }
+
+  return sm_pThis->UnlockRwLock(pLock);
+}
+
+//  ****************************************************************************
+int PThread_hook::Hook_pthread_rwlock_destroy(pthread_rwlock_t* pLock)
+{
+  if (IsActive())
+  {
+    RwLockMap::iterator iter = sm_pThis->m_rwlocks.find(pLock);
+    if (sm_pThis->m_rwlocks.end() != iter)
+    {
+      const RwLockState& state = iter->second;
+      if ( state.pWriter
+        || state.readers
+        || !state.readWaiters.empty()
+        || !state.writeWaiters.empty())
+      {
+        return EBUSY;
+      }
+
+      sm_pThis->m_rwlocks.erase(iter);
+    }
+  }
+
+  return ((pfnpthread_rwlock)(PROC)*sm_pThis->m_pRwLockDestroy)(pLock);
+}
+
+//  ****************************************************************************
+int PThread_hook::Hook_sem_wait(sem_t* pSem)
+{
+  if (!IsActive())
+  {
+    return ((pfnsem)(PROC)*sm_pThis->m_pSemWait)(pSem);
+  }
+
+  return sm_pThis->WaitSemaphore(pSem, CLOCK_REALTIME, NULL);
+}
+
+//  ****************************************************************************
+int PThread_hook::Hook_sem_timedwait(sem_t* pSem, const timespec* pAbsTime)
+{
+  if (!IsActive())
+  {
+    return ((pfnsem_timedwait)(PROC)*sm_pThis->m_pSemTimedWait)(pSem, pAbsTime);
+  }
+
+  return sm_pThis->WaitSemaphore(pSem, CLOCK_REALTIME, pAbsTime);
+}
+
+//  ****************************************************************************
+int PThread_hook::Hook_sem_clockwait(sem_t* pSem, clockid_t clock, const timespec* pAbsTime)
+{
+  if (!IsActive())
+  {
+    return ((pfnsem_clockwait)(PROC)*sm_pThis->m_pSemClockWait)(pSem, clock, pAbsTime);
+  }
+
+  return sm_pThis->WaitSemaphore(pSem, clock, pAbsTime);
+}
+
+//  ****************************************************************************
+int PThread_hook::Hook_sem_post(sem_t* pSem)
+{
+  const int result = ((pfnsem)(PROC)*sm_pThis->m_pSemPost)(pSem);
+  if ( 0 != result
+    || !IsActive())
+  {
+    return result;
+  }
+
+  // The woken fiber takes the count with sem_trywait when it runs.
+  SemMap::iterator iter = sm_pThis->m_sems.find(pSem);
+  if ( sm_pThis->m_sems.end() != iter
+    && !iter->second.waiters.empty())
+  {
+    Fiber* pFiber = iter->second.waiters.front();
+    iter->second.waiters.pop_front();
+    sm_pThis->Wake(pFiber);
+  }
+
+  return 0;
+}
+
+//  ****************************************************************************
+int PThread_hook::Hook_sem_destroy(sem_t* pSem)
+{
+  if (IsActive())
+  {
+    SemMap::iterator iter = sm_pThis->m_sems.find(pSem);
+    if (sm_pThis->m_sems.end() != iter)
+    {
+      if (!iter->second.waiters.empty())
+      {
+        errno = EBUSY;
+        return -1;
+      }
+
+      sm_pThis->m_sems.erase(iter);
+    }
+  }
+
+  return ((pfnsem)(PROC)*sm_pThis->m_pSemDestroy)(pSem);
+}
+
+//  ****************************************************************************
+/// Records the count of every barrier, including those created before Run.
+///
+int PThread_hook::Hook_pthread_barrier_init(
+  pthread_barrier_t*            pBarrier,
+  const pthread_barrierattr_t*  pAttr,
+  unsigned                      count
+)
+{
+  const int result = ((pfnpthread_barrier_init)(PROC)*sm_pThis->m_pBarrierInit)(pBarrier, pAttr, count);
+  if (0 == result)
+  {
+    sm_pThis->SetAttribute(pBarrier, (int)count);
+  }
+
+  return result;
+}
+
+//  ****************************************************************************
+int PThread_hook::Hook_pthread_barrier_wait(pthread_barrier_t* pBarrier)
+{
+  if (!IsActive())
+  {
+    return ((pfnpthread_barrier)(PROC)*sm_pThis->m_pBarrierWait)(pBarrier);
+  }
+
+  const int count = sm_pThis->GetAttribute(pBarrier, 0);
+  if (!count)
+  {
+    // Waiting on the real barrier would block every fiber.
+    ::fprintf(stderr,
+              "[%4u - %s] Impossible to wait on barrier %p, it was not initialized through the hooks\n",
+              (unsigned)::getpid(),
+              program_invocation_name,
+              (void*)pBarrier
+             );
+    return EINVAL;
+  }
+
+  WaitQueue& waiters = sm_pThis->m_barriers[pBarrier].waiters;
+  if (waiters.size() + 1 < (size_t)count)
+  {
+    sm_pThis->Block(&waiters);
+    return 0;
+  }
+
+  // The last fiber to arrive releases the others.
+  while (!waiters.empty())
+  {
+    Fiber* pFiber = waiters.front();
+    waiters.pop_front();
+    sm_pThis->Wake(pFiber);
+  }
+
+  return PTHREAD_BARRIER_SERIAL_THREAD;
+}
+
+//  ****************************************************************************
+int PThread_hook::Hook_pthread_barrier_destroy(pthread_barrier_t* pBarrier)
+{
+  if (IsActive())
+  {
+    BarrierMap::iterator iter = sm_pThis->m_barriers.find(pBarrier);
+    if (sm_pThis->m_barriers.end() != iter)
+    {
+      if (!iter->second.waiters.empty())
+      {
+        return EBUSY;
+      }
+
+      sm_pThis->m_barriers.erase(iter);
+    }
+  }
+
+  sm_pThis->RemoveAttribute(pBarrier);
+  return ((pfnpthread_barrier)(PROC)*sm_pThis->m_pBarrierDestroy)(pBarrier);
+}
+
+//  ****************************************************************************
+/// Only another fiber can hold the lock, so the current fiber yields until
+/// the holder releases it.
+///
+int PThread_hook::Hook_pthread_spin_lock(pthread_spinlock_t* pLock)
+{
+  if (!IsActive())
+  {
+    return ((pfnpthread_spin)(PROC)*sm_pThis->m_pSpinLock)(pLock);
+  }
+
+  while (EBUSY == ::pthread_spin_trylock(pLock))
+  {
+    Hook_sched_yield();
+  }
+
+  return 0;
+}
+
+//  ****************************************************************************
+int PThread_hook::Hook_pthread_setname_np(pthread_t thread, const char* pName)
+{
+  Fiber* pFiber = GetFiber(thread);
+  if (!pFiber)
+  {
+    return ((pfnpthread_setname_np)(PROC)*sm_pThis->m_pSetName)(thread, pName);
+  }
+
+  const size_t length = ::strlen(pName);
+  if (length >= sizeof(pFiber->name))
+  {
+    return ERANGE;
+  }
+
+  ::memcpy(pFiber->name, pName, length + 1);
+  return 0;
+}
+
+//  ****************************************************************************
+int PThread_hook::Hook_pthread_getname_np(pthread_t thread, char* pName, size_t length)
+{
+  Fiber* pFiber = GetFiber(thread);
+  if (!pFiber)
+  {
+    return ((pfnpthread_getname_np)(PROC)*sm_pThis->m_pGetName)(thread, pName, length);
+  }
+
+  const size_t nameLength = ::strlen(pFiber->name);
+  if (length <= nameLength)
+  {
+    return ERANGE;
+  }
+
+  ::memcpy(pName, pFiber->name, nameLength + 1);
+  return 0;
+}
+
+//  ****************************************************************************
+/// Reports the stack and detach state of a fiber.
+///
+int PThread_hook::Hook_pthread_getattr_np(pthread_t thread, pthread_attr_t* pAttr)
+{
+  Fiber* pFiber = GetFiber(thread);
+  if (!pFiber)
+  {
+    return ((pfnpthread_getattr_np)(PROC)*sm_pThis->m_pGetAttr)(thread, pAttr);
+  }
+
+  const size_t guardSize = GetGuardSize();
+  ::pthread_attr_init(pAttr);
+  ::pthread_attr_setstack(pAttr, (char*)pFiber->pStack + guardSize, sm_pThis->m_stackSize);
+  ::pthread_attr_setguardsize(pAttr, guardSize);
+  ::pthread_attr_setdetachstate(pAttr, pFiber->isDetached ? PTHREAD_CREATE_DETACHED
+                                                          : PTHREAD_CREATE_JOINABLE);
+  return 0;
+}
+
+//  ****************************************************************************
+/// Sends a signal to the OS thread of the scheduler.  The fibers share that
+/// thread, so the handler runs on the fiber that is running.
+///
+int PThread_hook::Hook_pthread_kill(pthread_t thread, int signal)
+{
+  Fiber* pFiber = GetFiber(thread);
+  if (!pFiber)
+  {
+    return ((pfnpthread_kill)(PROC)*sm_pThis->m_pKill)(thread, signal);
+  }
+
+  if (k_finished == pFiber->state)
+  {
+    return ESRCH;
+  }
+
+  const pthread_t self = ((pfnpthread_self)(PROC)*sm_pThis->m_pSelf)();
+  return ((pfnpthread_kill)(PROC)*sm_pThis->m_pKill)(self, signal);
+}
+
+//  ****************************************************************************
+int PThread_hook::Hook_pthread_cancel(pthread_t thread)
+{
+  Fiber* pFiber = GetFiber(thread);
+  if (!pFiber)
+  {
+    return ((pfnpthread_cancel)(PROC)*sm_pThis->m_pCancel)(thread);
+  }
+
+  // Cancellation would have to unwind the fiber's stack.
+  return k_finished == pFiber->state
+         ? ESRCH
+         : ENOTSUP;
+}
+
+//  ****************************************************************************
+int PThread_hook::Hook_pthread_setschedparam(
+  pthread_t           thread,
+  int                 policy,
+  const sched_param*  pParam
+)
+{
+  Fiber* pFiber = GetFiber(thread);
+  if (!pFiber)
+  {
+    return ((pfnpthread_setschedparam)(PROC)*sm_pThis->m_pSetSchedParam)(thread, policy, pParam);
+  }
+
+  // The fibers run in the order they become ready, so the parameters are 
+  // only recorded.
+  pFiber->policy      = policy;
+  pFiber->schedParam  = *pParam;
+  return 0;
+}
+
+//  ****************************************************************************
+int PThread_hook::Hook_pthread_getschedparam(
+  pthread_t     thread,
+  int*          pPolicy,
+  sched_param*  pParam
+)
+{
+  Fiber* pFiber = GetFiber(thread);
+  if (!pFiber)
+  {
+    return ((pfnpthread_getschedparam)(PROC)*sm_pThis->m_pGetSchedParam)(thread, pPolicy, pParam);
+  }
+
+  *pPolicy  = pFiber->policy;
+  *pParam   = pFiber->schedParam;
+  return 0;
+}
+
+namespace // unnamed
+{
+
+//  ****************************************************************************
+/// Reads a clock in nanoseconds.
+///
+uint64_t GetClockNs(clockid_t clock)
+{
+  timespec now;
+  ::clock_gettime(clock, &now);
+  return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+//  ****************************************************************************
+/// Converts a deadline on any clock to the monotonic clock used by the
+/// scheduler.
+///
+uint64_t GetDeadlineNs(clockid_t clock, const timespec* pAbsTime)
+{
+  const int64_t absTime = (int64_t)pAbsTime->tv_sec * 1000000000 + pAbsTime->tv_nsec;
+  const int64_t remain  = absTime - (int64_t)GetClockNs(clock);
+  return GetClockNs(CLOCK_MONOTONIC) + (remain > 0 ? remain : 0);
+}
+
+//  ****************************************************************************
+/// Reports the size of the guard region below each fiber stack.
+///
+size_t GetGuardSize()
+{
+  static const size_t k_guardSize = (size_t)::sysconf(_SC_PAGESIZE);
+  return k_guardSize;
+}
+
+} // namespace unnamed
+
+} // namespace cxxhook
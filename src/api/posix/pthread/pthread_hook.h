@@ -0,0 +1,311 @@
+/// @file   pthread_hook.h
+///
+/// API Hook library for unit-testing with POSIX thread dependencies
+///
+/// While a test runs inside PThread_hook::Run, every thread it creates with
+/// pthread_create becomes a fiber on a cooperative scheduler, which runs on
+/// the calling OS thread.  Mutexes, condition variables, read-write locks,
+/// semaphores, barriers, spin locks, joins and yields switch between fibers
+/// in user-space, so thousands of threads can run in one process, in a
+/// repeatable order, without the kernel scheduler.  The timed and clock
+/// variants of each wait are supported.
+///
+/// The type of a mutex, the clock of a condition variable and the count of
+/// a barrier are recorded by the hooks of their init functions, so create
+/// these objects after the hooks are installed.  A statically initialized
+/// mutex is a normal mutex, and a statically initialized condition variable
+/// uses CLOCK_REALTIME.  A fiber that waits on a barrier the hooks did not
+/// see initialized fails with EINVAL, and reports it on stderr.
+///
+/// Calls made outside of Run, or from other OS threads, are passed through
+/// to the real functions.
+///
+/// pthread_self returns the fiber that calls it.  The functions that read
+/// a pthread_t are hooked as well, and answer for a fiber: the name and
+/// scheduling parameters are recorded without effect on the scheduler,
+/// pthread_getattr_np reports the fiber's stack, and pthread_kill sends the
+/// signal to the scheduler's OS thread, where it interrupts the fiber that
+/// is running.
+///
+/// Limitations:
+///   Fibers share the thread-local storage of the scheduler's OS thread.
+///   A fiber cannot be cancelled, pthread_cancel fails with ENOTSUP.
+///   Other functions that take a pthread_t, such as pthread_sigqueue or
+///   pthread_setaffinity_np, are not hooked and must not be given a fiber.
+///   A fiber only yields inside a hooked call, so a fiber that spins on its
+///   own or blocks in the kernel, for instance on a futex or a pipe,
+///   stalls every other fiber.
+///   pthread_exit does not unwind the fiber's stack.
+///
+/// The MIT License(MIT)
+/// @copyright 2014 Paul M Watt
+///
+//  ****************************************************************************
+#ifndef CXXHOOK_PTHREAD_H_INCLUDED
+#define CXXHOOK_PTHREAD_H_INCLUDED
+//  Includes *******************************************************************
+#include "../../../ApiHook.h"
+
+#include <atomic>
+#include <deque>
+#include <map>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdint.h>
+#include <time.h>
+
+namespace cxxhook
+{
+
+//  ****************************************************************************
+/// Runs the threads of a test as fibers on a cooperative scheduler.
+/// Only one instance may exist at a time.  Construct it while the process
+/// has a single thread, since the hooks are installed by the constructor.
+///
+class PThread_hook
+{
+public:
+  //  Constants ****************************************************************
+  static const size_t k_defaultStackSize = 64 * 1024;
+
+  explicit PThread_hook(size_t stackSize = k_defaultStackSize);
+ ~PThread_hook();
+
+  int Run(void* (*pfnMain)(void*), void* pArg, void** ppResult = NULL);
+
+private:
+  //  Typedef ******************************************************************
+  struct  Fiber;
+  typedef std::deque<Fiber*>                      WaitQueue;
+  typedef std::multimap<uint64_t, Fiber*>         SleepMap;
+
+  enum FiberState
+  {
+    k_ready,
+    k_running,
+    k_blocked,
+    k_finished
+  };
+
+  /// A thread created by the test, and its stack.
+  struct Fiber
+  {
+    void*               pSp;            ///< Saved stack pointer.
+    void*               pContext;       ///< Saved ucontext, if not hand-rolled.
+    void*               pStack;         ///< Base of the stack mapping.
+    void*             (*pfnStart)(void*);
+    void*               pArg;
+    void*               pResult;        ///< Value returned by pfnStart.
+    FiberState          state;
+    bool                isDetached;
+    bool                isTimedOut;     ///< A timed wait expired.
+    Fiber*              pJoiner;        ///< The fiber waiting in pthread_join.
+    WaitQueue*          pWaitQueue;     ///< The queue this fiber is blocked on.
+    SleepMap::iterator  sleeper;        ///< Entry in m_sleepers, if timed.
+    char                name[16];       ///< Set by pthread_setname_np.
+    int                 policy;         ///< Set by pthread_setschedparam.
+    sched_param         schedParam;
+  };
+
+  /// The scheduler's view of a pthread_mutex_t.
+  struct MutexState
+  {
+    Fiber*      pOwner;
+    unsigned    count;                  ///< Recursive lock count.
+    WaitQueue   waiters;
+  };
+
+  /// The scheduler's view of a pthread_cond_t.
+  struct CondState
+  {
+    WaitQueue   waiters;
+  };
+
+  /// The scheduler's view of a pthread_rwlock_t.  Readers are preferred,
+  /// the same as the default kind of a glibc read-write lock.
+  struct RwLockState
+  {
+    Fiber*      pWriter;
+    unsigned    readers;                ///< Read locks that are held.
+    WaitQueue   readWaiters;
+    WaitQueue   writeWaiters;
+  };
+
+  /// The fibers waiting on a sem_t.  The count is kept by the sem_t.
+  struct SemState
+  {
+    WaitQueue   waiters;
+  };
+
+  /// The fibers waiting on a pthread_barrier_t.
+  struct BarrierState
+  {
+    WaitQueue   waiters;
+  };
+
+  typedef std::unordered_map<pthread_mutex_t*,   MutexState>   MutexMap;
+  typedef std::unordered_map<pthread_cond_t*,    CondState>    CondMap;
+  typedef std::unordered_map<pthread_rwlock_t*,  RwLockState>  RwLockMap;
+  typedef std::unordered_map<sem_t*,             SemState>     SemMap;
+  typedef std::unordered_map<pthread_barrier_t*, BarrierState> BarrierMap;
+  typedef std::unordered_map<const void*, int>                 AttributeMap;
+  typedef std::unordered_set<Fiber*>                           FiberSet;
+
+  //  Data Members *************************************************************
+  static
+    PThread_hook* sm_pThis;             ///< The active instance.
+
+  size_t          m_stackSize;          ///< Usable size of each fiber stack.
+  std::vector<void*> m_stackPool;       ///< Stacks released by finished fibers.
+
+  void*           m_pSchedulerSp;       ///< Saved stack of the scheduler loop.
+  void*           m_pSchedulerContext;  ///< Saved ucontext of the scheduler.
+  Fiber*          m_pCurrent;           ///< The fiber that is running.
+  WaitQueue       m_ready;              ///< Fibers ready to run, in order.
+  SleepMap        m_sleepers;           ///< Timed waits, by deadline.
+  size_t          m_liveCount;          ///< Fibers that have not finished.
+  FiberSet        m_fibers;             ///< Fibers that have not been released.
+
+  MutexMap        m_mutexes;
+  CondMap         m_conds;
+  RwLockMap       m_rwlocks;
+  SemMap          m_sems;
+  BarrierMap      m_barriers;
+
+  std::atomic_flag m_attributeLock;
+  AttributeMap    m_attributes;         ///< Mutex types, condition clocks and
+                                        ///  barrier counts, by object address.
+
+  ApiHook*        m_pCreate;
+  ApiHook*        m_pJoin;
+  ApiHook*        m_pDetach;
+  ApiHook*        m_pExit;
+  ApiHook*        m_pSelf;
+  ApiHook*        m_pYield;
+  ApiHook*        m_pMutexLock;
+  ApiHook*        m_pMutexTryLock;
+  ApiHook*        m_pMutexUnlock;
+  ApiHook*        m_pMutexDestroy;
+  ApiHook*        m_pCondWait;
+  ApiHook*        m_pCondTimedWait;
+  ApiHook*        m_pCondSignal;
+  ApiHook*        m_pCondBroadcast;
+  ApiHook*        m_pCondDestroy;
+  ApiHook*        m_pMutexInit;
+  ApiHook*        m_pMutexTimedLock;
+  ApiHook*        m_pMutexClockLock;
+  ApiHook*        m_pCondInit;
+  ApiHook*        m_pCondClockWait;
+  ApiHook*        m_pRwLockRdLock;
+  ApiHook*        m_pRwLockTryRdLock;
+  ApiHook*        m_pRwLockTimedRdLock;
+  ApiHook*        m_pRwLockClockRdLock;
+  ApiHook*        m_pRwLockWrLock;
+  ApiHook*        m_pRwLockTryWrLock;
+  ApiHook*        m_pRwLockTimedWrLock;
+  ApiHook*        m_pRwLockClockWrLock;
+  ApiHook*        m_pRwLockUnlock;
+  ApiHook*        m_pRwLockDestroy;
+  ApiHook*        m_pSemWait;
+  ApiHook*        m_pSemTimedWait;
+  ApiHook*        m_pSemClockWait;
+  ApiHook*        m_pSemPost;
+  ApiHook*        m_pSemDestroy;
+  ApiHook*        m_pBarrierInit;
+  ApiHook*        m_pBarrierWait;
+  ApiHook*        m_pBarrierDestroy;
+  ApiHook*        m_pSpinLock;
+  ApiHook*        m_pSetName;
+  ApiHook*        m_pGetName;
+  ApiHook*        m_pGetAttr;
+  ApiHook*        m_pKill;
+  ApiHook*        m_pCancel;
+  ApiHook*        m_pSetSchedParam;
+  ApiHook*        m_pGetSchedParam;
+
+  //  Methods ******************************************************************
+  static bool     IsActive();
+  static Fiber*   GetFiber(pthread_t thread);
+
+  Fiber*          CreateFiber(void* (*pfnStart)(void*), void* pArg);
+  void            ReleaseFiber(Fiber* pFiber);
+  void            SwitchToScheduler();
+  void            SwitchToFiber(Fiber* pFiber);
+  bool            Block(WaitQueue* pQueue, clockid_t clock = CLOCK_REALTIME, const timespec* pAbsTime = NULL);
+  void            Wake(Fiber* pFiber);
+  void            WakeExpiredSleepers(uint64_t now);
+
+  void            SetAttribute(const void* pObject, int value);
+  int             GetAttribute(const void* pObject, int defaultValue);
+  void            RemoveAttribute(const void* pObject);
+
+  int             LockMutex(pthread_mutex_t* pMutex, bool isTry, clockid_t clock = CLOCK_REALTIME, const timespec* pAbsTime = NULL);
+  int             UnlockMutex(pthread_mutex_t* pMutex);
+  int             WaitCondition(pthread_cond_t* pCond, pthread_mutex_t* pMutex, clockid_t clock, const timespec* pAbsTime);
+  int             LockRead(pthread_rwlock_t* pLock, bool isTry, clockid_t clock = CLOCK_REALTIME, const timespec* pAbsTime = NULL);
+  int             LockWrite(pthread_rwlock_t* pLock, bool isTry, clockid_t clock = CLOCK_REALTIME, const timespec* pAbsTime = NULL);
+  int             UnlockRwLock(pthread_rwlock_t* pLock);
+  int             WaitSemaphore(sem_t* pSem, clockid_t clock, const timespec* pAbsTime);
+
+  static void     FiberStart();
+
+  //  Hooks ********************************************************************
+  static int        Hook_pthread_create(pthread_t* pThread, const pthread_attr_t* pAttr, void* (*pfnStart)(void*), void* pArg);
+  static int        Hook_pthread_join(pthread_t thread, void** ppResult);
+  static int        Hook_pthread_detach(pthread_t thread);
+  static void       Hook_pthread_exit(void* pResult);
+  static pthread_t  Hook_pthread_self();
+  static int        Hook_sched_yield();
+  static int        Hook_pthread_mutex_lock(pthread_mutex_t* pMutex);
+  static int        Hook_pthread_mutex_trylock(pthread_mutex_t* pMutex);
+  static int        Hook_pthread_mutex_unlock(pthread_mutex_t* pMutex);
+  static int        Hook_pthread_mutex_destroy(pthread_mutex_t* pMutex);
+  static int        Hook_pthread_cond_wait(pthread_cond_t* pCond, pthread_mutex_t* pMutex);
+  static int        Hook_pthread_cond_timedwait(pthread_cond_t* pCond, pthread_mutex_t* pMutex, const timespec* pAbsTime);
+  static int        Hook_pthread_cond_signal(pthread_cond_t* pCond);
+  static int        Hook_pthread_cond_broadcast(pthread_cond_t* pCond);
+  static int        Hook_pthread_cond_destroy(pthread_cond_t* pCond);
+  static int        Hook_pthread_mutex_init(pthread_mutex_t* pMutex, const pthread_mutexattr_t* pAttr);
+  static int        Hook_pthread_mutex_timedlock(pthread_mutex_t* pMutex, const timespec* pAbsTime);
+  static int        Hook_pthread_mutex_clocklock(pthread_mutex_t* pMutex, clockid_t clock, const timespec* pAbsTime);
+  static int        Hook_pthread_cond_init(pthread_cond_t* pCond, const pthread_condattr_t* pAttr);
+  static int        Hook_pthread_cond_clockwait(pthread_cond_t* pCond, pthread_mutex_t* pMutex, clockid_t clock, const timespec* pAbsTime);
+  static int        Hook_pthread_rwlock_rdlock(pthread_rwlock_t* pLock);
+  static int        Hook_pthread_rwlock_tryrdlock(pthread_rwlock_t* pLock);
+  static int        Hook_pthread_rwlock_timedrdlock(pthread_rwlock_t* pLock, const timespec* pAbsTime);
+  static int        Hook_pthread_rwlock_clockrdlock(pthread_rwlock_t* pLock, clockid_t clock, const timespec* pAbsTime);
+  static int        Hook_pthread_rwlock_wrlock(pthread_rwlock_t* pLock);
+  static int        Hook_pthread_rwlock_trywrlock(pthread_rwlock_t* pLock);
+  static int        Hook_pthread_rwlock_timedwrlock(pthread_rwlock_t* pLock, const timespec* pAbsTime);
+  static int        Hook_pthread_rwlock_clockwrlock(pthread_rwlock_t* pLock, clockid_t clock, const timespec* pAbsTime);
+  static int        Hook_pthread_rwlock_unlock(pthread_rwlock_t* pLock);
+  static int        Hook_pthread_rwlock_destroy(pthread_rwlock_t* pLock);
+  static int        Hook_sem_wait(sem_t* pSem);
+  static int        Hook_sem_timedwait(sem_t* pSem, const timespec* pAbsTime);
+  static int        Hook_sem_clockwait(sem_t* pSem, clockid_t clock, const timespec* pAbsTime);
+  static int        Hook_sem_post(sem_t* pSem);
+  static int        Hook_sem_destroy(sem_t* pSem);
+  static int        Hook_pthread_barrier_init(pthread_barrier_t* pBarrier, const pthread_barrierattr_t* pAttr, unsigned count);
+  static int        Hook_pthread_barrier_wait(pthread_barrier_t* pBarrier);
+  static int        Hook_pthread_barrier_destroy(pthread_barrier_t* pBarrier);
+  static int        Hook_pthread_spin_lock(pthread_spinlock_t* pLock);
+  static int        Hook_pthread_setname_np(pthread_t thread, const char* pName);
+  static int        Hook_pthread_getname_np(pthread_t thread, char* pName, size_t length);
+  static int        Hook_pthread_getattr_np(pthread_t thread, pthread_attr_t* pAttr);
+  static int        Hook_pthread_kill(pthread_t thread, int signal);
+  static int        Hook_pthread_cancel(pthread_t thread);
+  static int        Hook_pthread_setschedparam(pthread_t thread, int policy, const sched_param* pParam);
+  static int        Hook_pthread_getschedparam(pthread_t thread, int* pPolicy, sched_param* pParam);
+
+  // Not implemented.
+  PThread_hook(const PThread_hook&);
+  PThread_hook& operator=(const PThread_hook&);
+};
+
+} // namespace cxxhook
+
+#endif
@@ -0,0 +1,239 @@
+/// @file   FiberBenchmark.cpp
+///
+/// Measures the cost of a switch between the fibers of PThread_hook,
+/// and compares it with the same operations on OS threads
+///
+/// Each scenario runs once on OS threads, before the hooks are installed,
+/// and once as fibers inside PThread_hook::Run:
+///   yield        Two threads call sched_yield in turn.
+///   condition    Two threads pass a token through a mutex and a
+///                condition variable.
+///   create       A thread is created and joined.
+///
+/// The time reported is for each yield, each pass of the token, or each
+/// create and join.
+///
+/// Build:
+///   g++ -O2 -Isrc test/FiberBenchmark.cpp src/api/posix/pthread/pthread_hook.cpp src/ApiHook.cpp src/SlotMatcher.cpp -ldl -pthread
+///
+/// Command line:
+///   -n <count>     Iterations of each scenario (200000).
+///   -r <count>     Runs of each scenario, the fastest is reported (5).
+///
+/// The MIT License(MIT)
+/// @copyright 2014 Paul M Watt
+///
+//  ****************************************************************************
+//  Includes *******************************************************************
+#include "../src/api/posix/pthread/pthread_hook.h"
+
+#include <cstdlib>
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+namespace // unnamed
+{
+
+//  ****************************************************************************
+/// The state shared by the threads of a scenario.
+///
+struct Scenario
+{
+  size_t            iterations;
+  pthread_mutex_t   lock;
+  pthread_cond_t    changed;
+  size_t            token;              ///< Number of times the token passed.
+};
+
+Scenario g_scenario;
+
+//  ****************************************************************************
+double GetSeconds()
+{
+  timespec now;
+  ::clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+//  ****************************************************************************
+void* YieldThread(void*)
+{
+  for (size_t index = 0; index < g_scenario.iterations; ++index)
+  {
+    ::sched_yield();
+  }
+
+  return NULL;
+}
+
+//  ****************************************************************************
+/// Takes the token when it is this thread's turn, and passes it on.
+///
+/// @param pTurn     0 or 1, the parity of the passes this thread makes.
+///
+void* ConditionThread(void* pTurn)
+{
+  const size_t turn = (size_t)pTurn;
+
+  ::pthread_mutex_lock(&g_scenario.lock);
+  while (g_scenario.token < g_scenario.iterations)
+  {
+    if (turn == (g_scenario.token & 1))
+    {
+      ++g_scenario.token;
+      ::pthread_cond_signal(&g_scenario.changed);
+    }
+    else
+    {
+      ::pthread_cond_wait(&g_scenario.changed, &g_scenario.lock);
+    }
+  }
+
+  ::pthread_cond_signal(&g_scenario.changed);
+  ::pthread_mutex_unlock(&g_scenario.lock);
+  return NULL;
+}
+
+//  ****************************************************************************
+void* EmptyThread(void*)
+{
+  return NULL;
+}
+
+//  ****************************************************************************
+/// Runs two threads on the same function, and waits for both.
+///
+void* RunPair(void* pfnThread)
+{
+  void* (*pfnStart)(void*) = (void* (*)(void*))pfnThread;
+
+  pthread_t threads[2];
+  ::pthread_create(&threads[0], NULL, pfnStart, (void*)0);
+  ::pthread_create(&threads[1], NULL, pfnStart, (void*)1);
+  ::pthread_join(threads[0], NULL);
+  ::pthread_join(threads[1], NULL);
+  return NULL;
+}
+
+//  ****************************************************************************
+void* YieldScenario(void*)
+{
+  return RunPair((void*)YieldThread);
+}
+
+//  ****************************************************************************
+void* ConditionScenario(void*)
+{
+  g_scenario.token = 0;
+  return RunPair((void*)ConditionThread);
+}
+
+//  ****************************************************************************
+void* CreateScenario(void*)
+{
+  for (size_t index = 0; index < g_scenario.iterations; ++index)
+  {
+    pthread_t thread;
+    ::pthread_create(&thread, NULL, EmptyThread, NULL);
+    ::pthread_join(thread, NULL);
+  }
+
+  return NULL;
+}
+
+//  ****************************************************************************
+/// Times a scenario, on OS threads or as fibers.
+///
+/// @param pfnScenario  The scenario to run.
+/// @param pHook        The scheduler to run the scenario on, or NULL to
+///                     use OS threads.
+/// @param operations   The number of operations the scenario performs.
+/// @param runs         The number of runs, the fastest is reported.
+/// @return             The time of each operation, in nanoseconds.
+///
+double TimeScenario(
+  void*                 (*pfnScenario)(void*),
+  cxxhook::PThread_hook*  pHook,
+  size_t                  operations,
+  size_t                  runs
+)
+{
+  double best = 0;
+  for (size_t run = 0; run < runs; ++run)
+  {
+    const double start = GetSeconds();
+    if (pHook)
+    {
+      pHook->Run(pfnScenario, NULL);
+    }
+    else
+    {
+      pfnScenario(NULL);
+    }
+
+    const double elapsed = GetSeconds() - start;
+    if (0 == run || elapsed < best)
+    {
+      best = elapsed;
+    }
+  }
+
+  return best * 1e9 / operations;
+}
+
+} // namespace unnamed
+
+//  ****************************************************************************
+int main(int argc, char* argv[])
+{
+  size_t iterations = 200000;
+  size_t runs       = 5;
+
+  int option = 0;
+  while (-1 != (option = ::getopt(argc, argv, "n:r:")))
+  {
+    switch (option)
+    {
+    case 'n': iterations = (size_t)::atoi(optarg);        break;
+    case 'r': runs       = (size_t)::atoi(optarg);        break;
+    default:
+      ::fprintf(stderr, "usage: %s [-n iterations] [-r runs]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  g_scenario.iterations = iterations;
+  g_scenario.token      = 0;
+  ::pthread_mutex_init(&g_scenario.lock, NULL);
+  ::pthread_cond_init(&g_scenario.changed, NULL);
+
+  // The OS threads run first, since the hooks must be installed while the
+  // process has a single thread.
+  const double threadYield      = TimeScenario(YieldScenario,     NULL, 2 * iterations, runs);
+  const double threadCondition  = TimeScenario(ConditionScenario, NULL, iterations,     runs);
+  const double threadCreate     = TimeScenario(CreateScenario,    NULL, iterations,     runs);
+
+  double fiberYield     = 0;
+  double fiberCondition = 0;
+  double fiberCreate    = 0;
+  {
+    cxxhook::PThread_hook hook;
+    fiberYield      = TimeScenario(YieldScenario,     &hook, 2 * iterations, runs);
+    fiberCondition  = TimeScenario(ConditionScenario, &hook, iterations,     runs);
+    fiberCreate     = TimeScenario(CreateScenario,    &hook, iterations,     runs);
+  }
+
+  ::printf("iterations: %u, CPUs: %ld\n", (unsigned)iterations, ::sysconf(_SC_NPROCESSORS_ONLN));
+  ::printf("%-10s %12s %12s %8s\n", "scenario", "thread(ns)", "fiber(ns)", "speedup");
+  ::printf("%-10s %12.1f %12.1f %7.1fx\n", "yield",     threadYield,     fiberYield,     threadYield     / fiberYield);
+  ::printf("%-10s %12.1f %12.1f %7.1fx\n", "condition", threadCondition, fiberCondition, threadCondition / fiberCondition);
+  ::printf("%-10s %12.1f %12.1f %7.1fx\n", "create",    threadCreate,    fiberCreate,    threadCreate    / fiberCreate);
+
+  ::pthread_cond_destroy(&g_scenario.changed);
+  ::pthread_mutex_destroy(&g_scenario.lock);
+  return 0;
+}
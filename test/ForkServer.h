@@ -0,0 +1,842 @@
+/// @file   ForkServer.h
+///
+/// Fork-server test runner for CxxTest
+///
+/// The parent process sets up the test world once.  The global fixtures
+/// install the base set of ApiHook objects at this point, and the patch
+/// state is captured, which also faults in every import slot page.
+/// Each test, or shard of tests, then runs in a child forked from the
+/// parent.  The child inherits the patched import tables copy-on-write,
+/// so every test has its own process for roughly the cost of a fork.
+///
+/// Children stream their results back to the parent over a pipe, as one
+/// record for each listener callback, with all of its arguments.  The
+/// parent replays each record through the same callback, in the order the
+/// tests are declared, so the output is identical to the serial runner.
+///
+/// Use this file as the runner template for cxxtestgen:
+///   cxxtestgen --template=ForkServer.tpl -o Runner.cpp Tests.h
+///
+/// Command line:
+///   -j <count>     Number of child processes to keep running.
+///                  The default is the number of online processors.
+///   -s <count>     Number of tests each child runs before it exits.
+///                  The default is one test per child.
+///
+/// The MIT License(MIT)
+/// @copyright 2014 Paul M Watt
+///
+//  ****************************************************************************
+#ifndef CXXHOOK_FORKSERVER_H_INCLUDED
+#define CXXHOOK_FORKSERVER_H_INCLUDED
+//  Includes *******************************************************************
+#include <cxxtest/TestListener.h>
+#include <cxxtest/TestTracker.h>
+#include <cxxtest/RealDescriptions.h>
+#include "../src/ApiHook.h"
+
+#ifdef WIN32
+# error "The fork server requires a POSIX platform."
+#endif
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace cxxhook
+{
+
+//  ****************************************************************************
+/// Runs every active test of the CxxTest world in a pool of forked children.
+///
+class ForkServer
+{
+public:
+  //  **************************************************************************
+  /// Runs all of the tests and reports the results to a listener.
+  ///
+  /// @param listener  Receives the results, in declaration order.
+  /// @param argc      Number of command line arguments.
+  /// @param argv      The command line arguments, see the file description.
+  /// @return          The number of tests that failed.
+  ///
+  static int runAllTests(CxxTest::TestListener& listener, int argc, char* argv[])
+  {
+    ForkServer server(listener, argc, argv);
+    return server.run();
+  }
+
+private:
+  //  Protocol *****************************************************************
+  /// The kind of each record a child writes to its pipe.  Each kind is the
+  /// TestListener callback of the same name.
+  enum RecordKind
+  {
+    k_trace                       = 1,
+    k_warning                     = 2,
+    k_skippedTest                 = 3,
+    k_failedTest                  = 4,
+    k_failedAssert                = 5,
+    k_failedAssertEquals          = 6,
+    k_failedAssertSameData        = 7,
+    k_failedAssertDelta           = 8,
+    k_failedAssertDiffers         = 9,
+    k_failedAssertLessThan        = 10,
+    k_failedAssertLessThanEquals  = 11,
+    k_failedAssertPredicate       = 12,
+    k_failedAssertRelation        = 13,
+    k_failedAssertThrows          = 14,
+    k_failedAssertThrowsNot       = 15,
+    k_failedAssertSameFiles       = 16,
+    k_done                        = 17  ///< The test has completed.
+  };
+
+  /// A record header, followed by fileSize bytes of file name, then
+  /// argCount arguments.  Each argument is its length, as a uint32_t,
+  /// followed by its bytes.
+  struct RecordHeader
+  {
+    uint32_t  kind;                     ///< One of RecordKind.
+    uint32_t  test;                     ///< Index of the test in the world.
+    uint32_t  line;                     ///< Source line of the event.
+    uint32_t  fileSize;                 ///< Length of the file name.
+    uint32_t  argCount;                 ///< Number of arguments.
+  };
+
+  //  Typedef ******************************************************************
+  typedef std::vector<std::string>      ArgArray;
+
+  /// An event reported by a child, held until its test is replayed.
+  struct Event
+  {
+    uint32_t      kind;
+    int           line;
+    std::string   file;
+    ArgArray      args;                 ///< The callback's arguments after line.
+  };
+
+  /// A single test of the world.
+  struct TestEntry
+  {
+    CxxTest::SuiteDescription*  pSuite;
+    CxxTest::TestDescription*   pTest;
+    std::vector<Event>          events;
+    bool                        isDone;
+  };
+
+  /// A running child process and the range of tests assigned to it.
+  struct Child
+  {
+    pid_t         pid;                  ///< Process id of the child.
+    int           fd;                   ///< Read end of the child's pipe.
+    size_t        next;                 ///< The first test not yet completed.
+    size_t        last;                 ///< One past the last test of the shard.
+    std::string   buffer;               ///< Bytes not yet parsed into records.
+  };
+
+  typedef std::vector<TestEntry>        TestArray;
+  typedef std::vector<Child>            ChildArray;
+  typedef std::pair<size_t, size_t>     Shard;
+  typedef std::deque<Shard>             ShardQueue;
+
+  //  **************************************************************************
+  /// Reports the events of the test that runs in a child to its pipe.
+  ///
+  class ChildListener : public CxxTest::TestListener
+  {
+  public:
+    explicit ChildListener(int fd)
+      : m_fd(fd)
+      , m_test(0)
+    { }
+
+    void setTest(size_t test)                     { m_test = (uint32_t)test;}
+
+    void done()
+    {
+      send(k_done, "", 0, ArgArray());
+    }
+
+    virtual void trace(const char* file, int line, const char* expression)
+    {
+      send(k_trace, file, line, makeArgs(1, expression));
+    }
+
+    virtual void warning(const char* file, int line, const char* expression)
+    {
+      send(k_warning, file, line, makeArgs(1, expression));
+    }
+
+    virtual void skippedTest(const char* file, int line, const char* expression)
+    {
+      send(k_skippedTest, file, line, makeArgs(1, expression));
+    }
+
+    virtual void failedTest(const char* file, int line, const char* expression)
+    {
+      send(k_failedTest, file, line, makeArgs(1, expression));
+    }
+
+    virtual void failedAssert(const char* file, int line, const char* expression)
+    {
+      send(k_failedAssert, file, line, makeArgs(1, expression));
+    }
+
+    virtual void failedAssertEquals(const char* file, int line,
+                                    const char* xStr, const char* yStr,
+                                    const char* x,    const char* y)
+    {
+      send(k_failedAssertEquals, file, line, makeArgs(4, xStr, yStr, x, y));
+    }
+
+    virtual void failedAssertSameData(const char* file, int line,
+                                      const char* xStr, const char* yStr,
+                                      const char* sizeStr,
+                                      const void* x,    const void* y,
+                                      unsigned size)
+    {
+      // The data is sent with the record, the size is its length.
+      ArgArray args = makeArgs(3, xStr, yStr, sizeStr);
+      args.push_back(x ? std::string((const char*)x, size) : std::string());
+      args.push_back(y ? std::string((const char*)y, size) : std::string());
+      args.push_back(format("%u", size));
+      send(k_failedAssertSameData, file, line, args);
+    }
+
+    virtual void failedAssertDelta(const char* file, int line,
+                                   const char* xStr, const char* yStr, const char* dStr,
+                                   const char* x,    const char* y,    const char* d)
+    {
+      send(k_failedAssertDelta, file, line, makeArgs(6, xStr, yStr, dStr, x, y, d));
+    }
+
+    virtual void failedAssertDiffers(const char* file, int line,
+                                     const char* xStr, const char* yStr,
+                                     const char* value)
+    {
+      send(k_failedAssertDiffers, file, line, makeArgs(3, xStr, yStr, value));
+    }
+
+    virtual void failedAssertLessThan(const char* file, int line,
+                                      const char* xStr, const char* yStr,
+                                      const char* x,    const char* y)
+    {
+      send(k_failedAssertLessThan, file, line, makeArgs(4, xStr, yStr, x, y));
+    }
+
+    virtual void failedAssertLessThanEquals(const char* file, int line,
+                                            const char* xStr, const char* yStr,
+                                            const char* x,    const char* y)
+    {
+      send(k_failedAssertLessThanEquals, file, line, makeArgs(4, xStr, yStr, x, y));
+    }
+
+    virtual void failedAssertPredicate(const char* file, int line,
+                                       const char* predicate,
+                                       const char* xStr, const char* x)
+    {
+      send(k_failedAssertPredicate, file, line, makeArgs(3, predicate, xStr, x));
+    }
+
+    virtual void failedAssertRelation(const char* file, int line,
+                                      const char* relation,
+                                      const char* xStr, const char* yStr,
+                                      const char* x,    const char* y)
+    {
+      send(k_failedAssertRelation, file, line, makeArgs(5, relation, xStr, yStr, x, y));
+    }
+
+    virtual void failedAssertThrows(const char* file, int line,
+                                    const char* expression, const char* type,
+                                    bool otherThrown)
+    {
+      send(k_failedAssertThrows, file, line,
+           makeArgs(3, expression, type, otherThrown ? "1" : "0"));
+    }
+
+    virtual void failedAssertThrowsNot(const char* file, int line,
+                                       const char* expression)
+    {
+      send(k_failedAssertThrowsNot, file, line, makeArgs(1, expression));
+    }
+
+    virtual void failedAssertSameFiles(const char* file, int line,
+                                       const char* file1, const char* file2,
+                                       const char* explanation)
+    {
+      send(k_failedAssertSameFiles, file, line, makeArgs(3, file1, file2, explanation));
+    }
+
+  private:
+    int       m_fd;                     ///< Write end of the pipe to the parent.
+    uint32_t  m_test;                   ///< Index of the test that is running.
+
+    static std::string format(const char* pFormat, ...)
+    {
+      char text[1024];
+      va_list args;
+      va_start(args, pFormat);
+      ::vsnprintf(text, sizeof(text), pFormat, args);
+      va_end(args);
+      return text;
+    }
+
+    /// Collects count string arguments.  A NULL argument is sent as empty.
+    static ArgArray makeArgs(size_t count, ...)
+    {
+      ArgArray result;
+      va_list  args;
+      va_start(args, count);
+      for (size_t index = 0; index < count; ++index)
+      {
+        const char* pArg = va_arg(args, const char*);
+        result.push_back(pArg ? pArg : "");
+      }
+
+      va_end(args);
+      return result;
+    }
+
+    void send(uint32_t kind, const char* file, int line, const ArgArray& args)
+    {
+      RecordHeader header;
+      header.kind     = kind;
+      header.test     = m_test;
+      header.line     = (uint32_t)line;
+      header.fileSize = (uint32_t)::strlen(file);
+      header.argCount = (uint32_t)args.size();
+
+      std::string record((const char*)&header, sizeof(header));
+      record.append(file, header.fileSize);
+      for (size_t index = 0; index < args.size(); ++index)
+      {
+        const uint32_t length = (uint32_t)args[index].size();
+        record.append((const char*)&length, sizeof(length));
+        record.append(args[index]);
+      }
+
+      // A single writer owns this pipe, so partial writes can simply resume.
+      const char* pData = record.data();
+      size_t      size  = record.size();
+      while (size > 0)
+      {
+        ssize_t count = ::write(m_fd, pData, size);
+        if (count < 0)
+        {
+          if (EINTR == errno)
+            continue;
+
+          ::_exit(EXIT_FAILURE);
+        }
+
+        pData += count;
+        size  -= (size_t)count;
+      }
+    }
+  };
+
+  //  Data Members *************************************************************
+  CxxTest::TestListener&  m_listener;   ///< Receives the replayed results.
+  TestArray               m_tests;      ///< Every active test of the world.
+  ChildArray              m_children;   ///< The children that are running.
+  ShardQueue              m_queue;      ///< Tests that have not been started.
+  ApiHook::PatchState     m_baseState;  ///< The hooks installed by the world.
+  size_t                  m_jobCount;   ///< Number of children to keep running.
+  size_t                  m_shardSize;  ///< Number of tests for each child.
+  size_t                  m_nextReport; ///< The next test to replay.
+  CxxTest::SuiteDescription* m_pSuite;  ///< The suite that is being replayed.
+
+  //  Methods ******************************************************************
+  ForkServer(CxxTest::TestListener& listener, int argc, char* argv[])
+    : m_listener(listener)
+    , m_jobCount(0)
+    , m_shardSize(1)
+    , m_nextReport(0)
+    , m_pSuite(NULL)
+  {
+    long processors = ::sysconf(_SC_NPROCESSORS_ONLN);
+    m_jobCount = processors > 0 ? (size_t)processors : 1;
+
+    for (int index = 1; index + 1 < argc; ++index)
+    {
+      int value = ::atoi(argv[index + 1]);
+      if (value <= 0)
+      {
+        continue;
+      }
+
+      if (0 == ::strcmp(argv[index], "-j"))
+      {
+        m_jobCount  = (size_t)value;
+      }
+      else if (0 == ::strcmp(argv[index], "-s"))
+      {
+        m_shardSize = (size_t)value;
+      }
+    }
+  }
+
+  //  **************************************************************************
+  int run()
+  {
+    CxxTest::tracker().setListener(&m_listener);
+
+    CxxTest::RealWorldDescription wd;
+    CxxTest::tracker().enterWorld(wd);
+    if (wd.setUp())
+    {
+      // Capture the hooks installed by the world's global fixtures.
+      // This also faults in every import slot before the first fork.
+      ApiHook::CaptureState(m_baseState);
+
+      for ( CxxTest::SuiteDescription* pSuite = wd.firstSuite();
+            pSuite;
+            pSuite = pSuite->next())
+      {
+        if (!pSuite->active())
+          continue;
+
+        for ( CxxTest::TestDescription* pTest = pSuite->firstTest();
+              pTest;
+              pTest = pTest->next())
+        {
+          if (pTest->active())
+          {
+            TestEntry entry = { pSuite, pTest, std::vector<Event>(), false };
+            m_tests.push_back(entry);
+          }
+        }
+      }
+
+      for (size_t first = 0; first < m_tests.size(); first += m_shardSize)
+      {
+        m_queue.push_back(Shard(first, std::min(first + m_shardSize, m_tests.size())));
+      }
+
+      ::signal(SIGPIPE, SIG_IGN);
+      while (!m_queue.empty() || !m_children.empty())
+      {
+        while (!m_queue.empty() && m_children.size() < m_jobCount)
+        {
+          Shard shard = m_queue.front();
+          m_queue.pop_front();
+          startChild(shard);
+        }
+
+        waitForChildren();
+      }
+
+      if (m_pSuite)
+      {
+        CxxTest::tracker().leaveSuite(*m_pSuite);
+      }
+
+      wd.tearDown();
+    }
+
+    CxxTest::tracker().leaveWorld(wd);
+    CxxTest::tracker().setListener(0);
+
+    return (int)CxxTest::tracker().failedTests();
+  }
+
+  //  **************************************************************************
+  /// Forks a child to run a shard of tests.
+  ///
+  void startChild(const Shard& shard)
+  {
+    int fds[2];
+    if (0 != ::pipe(fds))
+    {
+      failShard(shard, "Unable to create a pipe for the test process");
+      return;
+    }
+
+    // Flush buffered output so it is not written again by the child.
+    ::fflush(NULL);
+
+    pid_t pid = ::fork();
+    if (pid < 0)
+    {
+      ::close(fds[0]);
+      ::close(fds[1]);
+      failShard(shard, "Unable to fork the test process");
+      return;
+    }
+
+    if (0 == pid)
+    {
+      // The child only needs the write end of its own pipe.
+      ::close(fds[0]);
+      for (size_t index = 0; index < m_children.size(); ++index)
+      {
+        ::close(m_children[index].fd);
+      }
+
+      runShard(fds[1], shard);
+    }
+
+    ::close(fds[1]);
+
+    Child child;
+    child.pid   = pid;
+    child.fd    = fds[0];
+    child.next  = shard.first;
+    child.last  = shard.second;
+    m_children.push_back(child);
+  }
+
+  //  **************************************************************************
+  /// Runs a shard of tests inside the child process, then exits.
+  ///
+  void runShard(int fd, const Shard& shard)
+  {
+    ChildListener listener(fd);
+    CxxTest::tracker().setListener(&listener);
+
+    CxxTest::SuiteDescription* pSuite = NULL;
+    bool isSuiteReady = false;
+    for (size_t index = shard.first; index < shard.second; ++index)
+    {
+      TestEntry& entry = m_tests[index];
+      listener.setTest(index);
+
+      if (index > shard.first)
+      {
+        // Roll back any hooks the previous test left behind.
+        ApiHook::RestoreState(m_baseState);
+      }
+
+      if (entry.pSuite != pSuite)
+      {
+        if (pSuite && isSuiteReady)
+        {
+          pSuite->tearDown();
+        }
+
+        pSuite = entry.pSuite;
+        CxxTest::tracker().enterSuite(*pSuite);
+        isSuiteReady = pSuite->setUp();
+      }
+
+      if (isSuiteReady)
+      {
+        CxxTest::tracker().enterTest(*entry.pTest);
+        if (entry.pTest->setUp())
+        {
+          entry.pTest->run();
+          entry.pTest->tearDown();
+        }
+
+        CxxTest::tracker().leaveTest(*entry.pTest);
+      }
+
+      listener.done();
+    }
+
+    if (pSuite && isSuiteReady)
+    {
+      pSuite->tearDown();
+    }
+
+    // Skip the static destructors of the parent's process image.
+    ::fflush(NULL);
+    ::_exit(EXIT_SUCCESS);
+  }
+
+  //  **************************************************************************
+  /// Waits for output from any running child, and collects the children
+  /// that have exited.
+  ///
+  void waitForChildren()
+  {
+    std::vector<pollfd> fds(m_children.size());
+    for (size_t index = 0; index < m_children.size(); ++index)
+    {
+      fds[index].fd       = m_children[index].fd;
+      fds[index].events   = POLLIN;
+      fds[index].revents  = 0;
+    }
+
+    if (::poll(&fds[0], fds.size(), -1) < 0)
+    {
+      return;
+    }
+
+    // Walk backwards so finished children can be removed in place.
+    for (size_t index = fds.size(); index-- > 0; )
+    {
+      if (0 == fds[index].revents)
+        continue;
+
+      Child& child = m_children[index];
+
+      char    data[4096];
+      ssize_t count = ::read(child.fd, data, sizeof(data));
+      if (count < 0 && EINTR == errno)
+        continue;
+
+      if (count > 0)
+      {
+        child.buffer.append(data, (size_t)count);
+        parseRecords(child);
+        continue;
+      }
+
+      finishChild(child);
+      m_children.erase(m_children.begin() + index);
+    }
+
+    replayResults();
+  }
+
+  //  **************************************************************************
+  /// Converts the complete records in a child's buffer into test events.
+  ///
+  void parseRecords(Child& child)
+  {
+    size_t offset = 0;
+    while (child.buffer.size() - offset >= sizeof(RecordHeader))
+    {
+      RecordHeader header;
+      ::memcpy(&header, child.buffer.data() + offset, sizeof(header));
+
+      // Find the end of the record, once every argument length has arrived.
+      const size_t available = child.buffer.size() - offset;
+      size_t       size      = sizeof(header) + header.fileSize;
+      uint32_t     arg       = 0;
+      for (; arg < header.argCount && size + sizeof(uint32_t) <= available; ++arg)
+      {
+        uint32_t length = 0;
+        ::memcpy(&length, child.buffer.data() + offset + size, sizeof(length));
+        size += sizeof(length) + length;
+      }
+
+      if ( arg < header.argCount
+        || available < size)
+        break;
+
+      if (header.test < m_tests.size())
+      {
+        TestEntry& entry = m_tests[header.test];
+        if (k_done == header.kind)
+        {
+          entry.isDone  = true;
+          child.next    = header.test + 1;
+        }
+        else
+        {
+          const char* pData = child.buffer.data() + offset + sizeof(header);
+          Event event;
+          event.kind  = header.kind;
+          event.line  = (int)header.line;
+          event.file.assign(pData, header.fileSize);
+          pData += header.fileSize;
+
+          for (arg = 0; arg < header.argCount; ++arg)
+          {
+            uint32_t length = 0;
+            ::memcpy(&length, pData, sizeof(length));
+            event.args.push_back(std::string(pData + sizeof(length), length));
+            pData += sizeof(length) + length;
+          }
+
+          entry.events.push_back(event);
+        }
+      }
+
+      offset += size;
+    }
+
+    child.buffer.erase(0, offset);
+  }
+
+  //  **************************************************************************
+  /// Collects a child that has closed its pipe.  If the child did not
+  /// complete its shard, the test that was running is reported as a failure
+  /// and the rest of the shard is returned to the queue.
+  ///
+  void finishChild(Child& child)
+  {
+    ::close(child.fd);
+
+    int status = 0;
+    while (::waitpid(child.pid, &status, 0) < 0 && EINTR == errno)
+    { }
+
+    if (child.next >= child.last)
+      return;
+
+    char text[128];
+    if (WIFSIGNALED(status))
+    {
+      ::snprintf(text, sizeof(text),
+                 "Test process terminated by signal %d", WTERMSIG(status));
+    }
+    else
+    {
+      ::snprintf(text, sizeof(text),
+                 "Test process exited with status %d", WEXITSTATUS(status));
+    }
+
+    TestEntry& entry = m_tests[child.next];
+    entry.events.push_back(makeFailure(entry, text));
+    entry.isDone = true;
+
+    if (child.next + 1 < child.last)
+    {
+      m_queue.push_front(Shard(child.next + 1, child.last));
+    }
+  }
+
+  //  **************************************************************************
+  /// Reports a failure for every test in a shard that could not be started.
+  ///
+  void failShard(const Shard& shard, const char* pText)
+  {
+    for (size_t index = shard.first; index < shard.second; ++index)
+    {
+      TestEntry& entry = m_tests[index];
+      entry.events.push_back(makeFailure(entry, pText));
+      entry.isDone = true;
+    }
+  }
+
+  //  **************************************************************************
+  /// Creates a failedTest event at the declaration of a test.
+  ///
+  static Event makeFailure(const TestEntry& entry, const char* pText)
+  {
+    Event event;
+    event.kind  = k_failedTest;
+    event.line  = entry.pTest->line();
+    event.file  = entry.pTest->file();
+    event.args.push_back(pText);
+    return event;
+  }
+
+  //  **************************************************************************
+  /// Passes an event to the listener callback that reported it in the child.
+  ///
+  static void replayEvent(const Event& event)
+  {
+    // A malformed record is missing arguments, which are replayed as empty.
+    ArgArray args = event.args;
+    args.resize(std::max(args.size(), (size_t)8));
+
+    const char*   file  = event.file.c_str();
+    const int     line  = event.line;
+    CxxTest::TestTracker& tracker = CxxTest::tracker();
+
+    switch (event.kind)
+    {
+    case k_trace:
+      tracker.trace(file, line, args[0].c_str());
+      break;
+    case k_warning:
+      tracker.warning(file, line, args[0].c_str());
+      break;
+    case k_skippedTest:
+      tracker.skippedTest(file, line, args[0].c_str());
+      break;
+    case k_failedAssert:
+      tracker.failedAssert(file, line, args[0].c_str());
+      break;
+    case k_failedAssertEquals:
+      tracker.failedAssertEquals(file, line, args[0].c_str(), args[1].c_str(),
+                                 args[2].c_str(), args[3].c_str());
+      break;
+    case k_failedAssertSameData:
+    {
+      // Data the child could not read is replayed as NULL.
+      const unsigned size = (unsigned)::strtoul(args[5].c_str(), NULL, 10);
+      tracker.failedAssertSameData(file, line, args[0].c_str(), args[1].c_str(), args[2].c_str(),
+                                   size == args[3].size() ? args[3].data() : NULL,
+                                   size == args[4].size() ? args[4].data() : NULL,
+                                   size);
+      break;
+    }
+    case k_failedAssertDelta:
+      tracker.failedAssertDelta(file, line, args[0].c_str(), args[1].c_str(), args[2].c_str(),
+                                args[3].c_str(), args[4].c_str(), args[5].c_str());
+      break;
+    case k_failedAssertDiffers:
+      tracker.failedAssertDiffers(file, line, args[0].c_str(), args[1].c_str(), args[2].c_str());
+      break;
+    case k_failedAssertLessThan:
+      tracker.failedAssertLessThan(file, line, args[0].c_str(), args[1].c_str(),
+                                   args[2].c_str(), args[3].c_str());
+      break;
+    case k_failedAssertLessThanEquals:
+      tracker.failedAssertLessThanEquals(file, line, args[0].c_str(), args[1].c_str(),
+                                         args[2].c_str(), args[3].c_str());
+      break;
+    case k_failedAssertPredicate:
+      tracker.failedAssertPredicate(file, line, args[0].c_str(), args[1].c_str(), args[2].c_str());
+      break;
+    case k_failedAssertRelation:
+      tracker.failedAssertRelation(file, line, args[0].c_str(), args[1].c_str(), args[2].c_str(),
+                                   args[3].c_str(), args[4].c_str());
+      break;
+    case k_failedAssertThrows:
+      tracker.failedAssertThrows(file, line, args[0].c_str(), args[1].c_str(), "1" == args[2]);
+      break;
+    case k_failedAssertThrowsNot:
+      tracker.failedAssertThrowsNot(file, line, args[0].c_str());
+      break;
+    case k_failedAssertSameFiles:
+      tracker.failedAssertSameFiles(file, line, args[0].c_str(), args[1].c_str(), args[2].c_str());
+      break;
+    default:
+      tracker.failedTest(file, line, args[0].c_str());
+      break;
+    }
+  }
+
+  //  **************************************************************************
+  /// Replays the completed tests to the listener, in declaration order.
+  ///
+  void replayResults()
+  {
+    for (; m_nextReport < m_tests.size() && m_tests[m_nextReport].isDone; ++m_nextReport)
+    {
+      TestEntry& entry = m_tests[m_nextReport];
+      if (entry.pSuite != m_pSuite)
+      {
+        if (m_pSuite)
+        {
+          CxxTest::tracker().leaveSuite(*m_pSuite);
+        }
+
+        m_pSuite = entry.pSuite;
+        CxxTest::tracker().enterSuite(*m_pSuite);
+      }
+
+      CxxTest::tracker().enterTest(*entry.pTest);
+      for (size_t index = 0; index < entry.events.size(); ++index)
+      {
+        replayEvent(entry.events[index]);
+      }
+
+      CxxTest::tracker().leaveTest(*entry.pTest);
+      entry.events.clear();
+    }
+  }
+};
+
+} // namespace cxxhook
+
+#endif
@@ -0,0 +1,15 @@
+// Runner template for cxxtestgen that runs each test in a forked child.
+// See ForkServer.h for the command line options.
+#define _CXXTEST_HAVE_STD
+#define _CXXTEST_HAVE_EH
+#include <cxxtest/ErrorPrinter.h>
+#include "ForkServer.h"
+
+int main(int argc, char* argv[])
+{
+  CxxTest::ErrorPrinter printer;
+  return cxxhook::ForkServer::runAllTests(printer, argc, argv);
+}
+
+// The CxxTest "world"
+<CxxTest world>
@@ -0,0 +1,227 @@
+/// @file   PatchBenchmark.cpp
+///
+/// Measures how the time to install every hook scales with the number
+/// of patch threads
+///
+/// The benchmark loads the shared objects found in a directory, installs a
+/// set of hooks, then times ApiHook::Refresh from an unhooked state with
+/// 1 to 16 patch threads.  After each run the import slots are compared to
+/// the slots written by the serial install, to confirm the parallel path
+/// writes exactly the same result.  ApiHook runs no more threads than there
+/// are processors, so the counts above that repeat the last parallel time.
+///
+/// Build:
+///   g++ -O2 -Isrc test/PatchBenchmark.cpp src/ApiHook.cpp src/SlotMatcher.cpp -ldl -pthread
+///
+/// Command line:
+///   -d <path>      Directory of shared objects to load.
+///                  The default is /usr/lib/x86_64-linux-gnu.
+///   -m <count>     Maximum number of shared objects to load (300).
+///   -t <count>     Maximum number of patch threads (16).
+///   -r <count>     Runs for each thread count, the fastest is reported (5).
+///
+/// The MIT License(MIT)
+/// @copyright 2014 Paul M Watt
+///
+//  ****************************************************************************
+//  Includes *******************************************************************
+#include "../src/ApiHook.h"
+
+#ifdef WIN32
+# error "The patch benchmark requires a POSIX platform."
+#endif
+
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <dirent.h>
+#include <dlfcn.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+namespace // unnamed
+{
+
+//  ****************************************************************************
+/// Functions that neither the benchmark nor ApiHook calls while it runs.
+///
+const char* k_hookNames[] =
+{
+  "qsort",    "strdup",   "strstr",   "fdopen",   "freopen",  "fputs",
+  "fputc",    "putchar",  "puts",     "strtol",   "strtoul",  "time",
+  "strrchr",  "memchr",   "getenv",   "setlocale","qsort_r",  "bsearch",
+  "strncpy",  "strcat",   "strncat",  "strspn",   "strcspn",  "strpbrk",
+  "strtok_r", "toupper",  "tolower",  "isatty",   "fileno",   "fseek",
+  "ftell",    "rewind"
+};
+
+//  ****************************************************************************
+/// The target of every hook.  It is never called.
+///
+void UnexpectedCall()
+{
+  ::abort();
+}
+
+//  ****************************************************************************
+double GetSeconds()
+{
+  timespec now;
+  ::clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+//  ****************************************************************************
+/// Loads up to maxCount shared objects from a directory.
+///
+size_t LoadModules(const char* pPath, size_t maxCount)
+{
+  DIR* pDir = ::opendir(pPath);
+  if (!pDir)
+  {
+    return 0;
+  }
+
+  std::vector<std::string> names;
+  for (dirent* pEntry = ::readdir(pDir); pEntry; pEntry = ::readdir(pDir))
+  {
+    // The sanitizer runtimes abort unless they are loaded first.
+    if ( ::strstr(pEntry->d_name, ".so")
+      && !::strstr(pEntry->d_name, "san.so"))
+    {
+      names.push_back(std::string(pPath) + "/" + pEntry->d_name);
+    }
+  }
+
+  ::closedir(pDir);
+
+  size_t count = 0;
+  for (size_t index = 0; index < names.size() && count < maxCount; ++index)
+  {
+    if (::dlopen(names[index].c_str(), RTLD_LAZY | RTLD_LOCAL))
+    {
+      ++count;
+    }
+  }
+
+  return count;
+}
+
+//  ****************************************************************************
+/// Counts the slots that are hooked in one state but not the other.
+/// Other slots may change as lazy bindings are resolved, so only the slots
+/// that hold the hook are compared.
+///
+size_t CountMismatches(const ApiHook::PatchState& state)
+{
+  const PROC pfnHook = (PROC)UnexpectedCall;
+
+  size_t count = 0;
+  for (size_t index = 0; index < state.records.size(); ++index)
+  {
+    if ( (pfnHook == *state.records[index].ppfn)
+      != (pfnHook == state.records[index].pfn))
+    {
+      ++count;
+    }
+  }
+
+  return count;
+}
+
+} // namespace unnamed
+
+//  ****************************************************************************
+int main(int argc, char* argv[])
+{
+  const char* pPath       = "/usr/lib/x86_64-linux-gnu";
+  size_t      maxModules  = 300;
+  size_t      maxThreads  = 16;
+  size_t      runs        = 5;
+
+  int option = 0;
+  while (-1 != (option = ::getopt(argc, argv, "d:m:t:r:")))
+  {
+    switch (option)
+    {
+    case 'd': pPath      = optarg;                        break;
+    case 'm': maxModules = (size_t)::atoi(optarg);        break;
+    case 't': maxThreads = (size_t)::atoi(optarg);        break;
+    case 'r': runs       = (size_t)::atoi(optarg);        break;
+    default:
+      ::fprintf(stderr, "usage: %s [-d path] [-m modules] [-t threads] [-r runs]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  const size_t loaded = LoadModules(pPath, maxModules);
+
+  ApiHook::PatchState unhooked;
+  ApiHook::CaptureState(unhooked);
+
+  // Install the hooks serially, the result every other run must match.
+  std::vector<ApiHook*> hooks;
+  for (size_t index = 0; index < sizeof(k_hookNames) / sizeof(k_hookNames[0]); ++index)
+  {
+    hooks.push_back(new ApiHook("libc.so.6", k_hookNames[index], (PROC)UnexpectedCall));
+  }
+
+  ApiHook::PatchState expected;
+  ApiHook::CaptureState(expected);
+
+  // Restoring the unhooked slots would also remove the hooks from the hook 
+  // list, so keep every hook in the restored state for Refresh to install.
+  unhooked.hooks = expected.hooks;
+
+  ::printf("modules loaded: %u, import slots: %u, hooks: %u, processors: %ld\n",
+           (unsigned)loaded,
+           (unsigned)expected.records.size(),
+           (unsigned)hooks.size(),
+           ::sysconf(_SC_NPROCESSORS_ONLN));
+  ::printf("%8s %12s %8s %11s\n", "threads", "refresh(us)", "speedup", "mismatches");
+
+  double serial = 0;
+  for (size_t threads = 1; threads <= maxThreads; threads *= 2)
+  {
+    ApiHook::SetPatchThreadCount(threads);
+
+    double best       = 0;
+    size_t mismatches = 0;
+    for (size_t run = 0; run < runs; ++run)
+    {
+      ApiHook::RestoreState(unhooked);
+
+      const double start = GetSeconds();
+      ApiHook::Refresh();
+      const double elapsed = GetSeconds() - start;
+
+      if (0 == run || elapsed < best)
+      {
+        best = elapsed;
+      }
+
+      mismatches += CountMismatches(expected);
+    }
+
+    if (1 == threads)
+    {
+      serial = best;
+    }
+
+    ::printf("%8u %12.0f %7.2fx %11u\n",
+             (unsigned)threads,
+             best * 1e6,
+             serial / best,
+             (unsigned)mismatches);
+  }
+
+  // Leave without running the exit handlers.  The hooks are still installed
+  // and point at UnexpectedCall, and the destructors of the modules loaded
+  // above call hooked functions such as getenv and fputs, which would abort
+  // the process after the results are printed.
+  ::fflush(stdout);
+  ::_exit(0);
+}
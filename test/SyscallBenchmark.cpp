@@ -0,0 +1,179 @@
+/// @file   SyscallBenchmark.cpp
+///
+/// Measures the cost of a system call routed by SyscallHook, and compares
+/// it with the system call alone and with a GOT hook from ApiHook
+///
+/// Each scenario calls getppid in a loop:
+///   syscall      The system call instruction, through syscall(2).
+///   libc         The libc function, which is not hooked.
+///   got hook     The libc function, hooked by ApiHook.  The hook calls
+///                the original function.
+///   trap         The libc function, on an attached thread with no handler
+///                for getppid.  The signal handler makes the call.
+///   trap hook    The libc function, on an attached thread with a handler
+///                that calls SyscallHook::CallOriginal.
+///
+/// The time reported is for each call.  The figures in SyscallHook.h are
+/// the trap hook, syscall and got hook less libc results.
+///
+/// Build:
+///   g++ -O2 -Isrc test/SyscallBenchmark.cpp src/SyscallHook.cpp src/ApiHook.cpp src/SlotMatcher.cpp -ldl -pthread
+///
+/// Command line:
+///   -n <count>     Calls in each scenario (200000).
+///   -r <count>     Runs of each scenario, the fastest is reported (5).
+///
+/// The MIT License(MIT)
+/// @copyright 2014 Paul M Watt
+///
+//  ****************************************************************************
+//  Includes *******************************************************************
+#include "../src/ApiHook.h"
+#include "../src/SyscallHook.h"
+
+#include <cstdlib>
+
+#include <stdio.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+namespace // unnamed
+{
+
+typedef pid_t (*pfngetppid)();
+
+ApiHook*  g_pGetPpid = NULL;            ///< The GOT hook, while it exists.
+size_t    g_calls    = 0;
+
+//  ****************************************************************************
+double GetSeconds()
+{
+  timespec now;
+  ::clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+//  ****************************************************************************
+pid_t Hook_getppid()
+{
+  return ((pfngetppid)(PROC)*g_pGetPpid)();
+}
+
+//  ****************************************************************************
+long Handle_getppid(long, long, long, long, long, long)
+{
+  return SyscallHook::CallOriginal(SYS_getppid);
+}
+
+//  ****************************************************************************
+void SyscallScenario()
+{
+  for (size_t index = 0; index < g_calls; ++index)
+  {
+    ::syscall(SYS_getppid);
+  }
+}
+
+//  ****************************************************************************
+void LibcScenario()
+{
+  for (size_t index = 0; index < g_calls; ++index)
+  {
+    ::getppid();
+  }
+}
+
+//  ****************************************************************************
+/// Times a scenario.
+///
+/// @param pfnScenario  The scenario to run.
+/// @param runs         The number of runs, the fastest is reported.
+/// @return             The time of each call, in nanoseconds.
+///
+double TimeScenario(
+  void  (*pfnScenario)(),
+  size_t  runs
+)
+{
+  double best = 0;
+  for (size_t run = 0; run < runs; ++run)
+  {
+    const double start = GetSeconds();
+    pfnScenario();
+
+    const double elapsed = GetSeconds() - start;
+    if (0 == run || elapsed < best)
+    {
+      best = elapsed;
+    }
+  }
+
+  return best * 1e9 / g_calls;
+}
+
+} // namespace unnamed
+
+//  ****************************************************************************
+int main(int argc, char* argv[])
+{
+  size_t runs = 5;
+  g_calls     = 200000;
+
+  int option = 0;
+  while (-1 != (option = ::getopt(argc, argv, "n:r:")))
+  {
+    switch (option)
+    {
+    case 'n': g_calls = (size_t)::atoi(optarg);           break;
+    case 'r': runs    = (size_t)::atoi(optarg);           break;
+    default:
+      ::fprintf(stderr, "usage: %s [-n calls] [-r runs]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  if (!g_calls)
+  {
+    g_calls = 1;
+  }
+
+  const double syscallNs  = TimeScenario(SyscallScenario, runs);
+  const double libcNs     = TimeScenario(LibcScenario,    runs);
+
+  g_pGetPpid = new ApiHook("libc.so.6", "getppid", (PROC)Hook_getppid);
+  const double gotHookNs  = TimeScenario(LibcScenario,    runs);
+  delete g_pGetPpid;
+  g_pGetPpid = NULL;
+
+  ::printf("calls: %u\n", (unsigned)g_calls);
+  ::printf("%-10s %12s %12s\n", "scenario", "call(ns)", "added(ns)");
+  ::printf("%-10s %12.1f %12s\n",   "syscall",  syscallNs, "");
+  ::printf("%-10s %12.1f %12.1f\n", "libc",     libcNs,    libcNs    - syscallNs);
+  ::printf("%-10s %12.1f %12.1f\n", "got hook", gotHookNs, gotHookNs - libcNs);
+
+  // The trap scenarios run last, since every system call of the attached
+  // thread traps, including those printf makes.
+  if (!SyscallHook::IsSupported())
+  {
+    ::printf("%-10s %12s\n", "trap", "unsupported, syscall user dispatch requires Linux 5.11");
+    return 0;
+  }
+
+  double trapNs     = 0;
+  double trapHookNs = 0;
+  if (SyscallHook::AttachThread())
+  {
+    trapNs = TimeScenario(LibcScenario, runs);
+    {
+      SyscallHook hook(SYS_getppid, Handle_getppid);
+      trapHookNs = TimeScenario(LibcScenario, runs);
+    }
+
+    SyscallHook::DetachThread();
+  }
+
+  ::printf("%-10s %12.1f %12.1f\n", "trap",      trapNs,     trapNs     - libcNs);
+  ::printf("%-10s %12.1f %12.1f\n", "trap hook", trapHookNs, trapHookNs - libcNs);
+  return 0;
+}
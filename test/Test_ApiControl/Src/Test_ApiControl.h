@@ -0,0 +1,531 @@
+/** Test_ApiControl
+ *
+ * @file Test_ApiControl.h
+ *
+ * Verifies the control plane of the instrumentation hooks: a client on the
+ * UNIX domain socket lists the imports and the registered hooks, enables
+ * and disables hooks, and reads or streams their call counters.
+ *
+ * Hooks cannot be unregistered, so the suite registers its hooks once for
+ * the process, and disables them after each test.
+ *
+ * Build:
+ *   cxxtestgen --template=../ForkServer.tpl -o Runner.cpp Src/Test_ApiControl.h
+ *   g++ -std=c++11 -I../cxxtest -I.. Runner.cpp ../../src/ApiControl.cpp ../../src/ApiHook.cpp ../../src/SlotMatcher.cpp -ldl -pthread
+ *
+ * The MIT License(MIT)
+ * @copyright 2014 Paul M Watt
+ *
+ */
+#ifndef Test_ApiControl_H_INCLUDED
+#define Test_ApiControl_H_INCLUDED
+
+#include <cxxtest/TestSuite.h>
+#include "../../../src/ApiControl.h"
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/** Test_ApiControl
+ * @brief Test_ApiControl Test Suite class.
+ *****************************************************************************/
+class Test_ApiControl : public CxxTest::TestSuite
+{
+public:
+
+  Test_ApiControl()
+    : m_client(-1)
+  {
+    m_path[0] = '\0';
+  }
+
+  /* Fixture Management ******************************************************/
+  // setUp will be called before each test case in order to setup common fixtures.
+  virtual void setUp()
+  {
+    ::snprintf(m_path, sizeof(m_path), "/tmp/Test_ApiControl.%u.sock", (unsigned)::getpid());
+    TS_ASSERT(ApiControl::Start(m_path));
+    m_client = Connect(m_path);
+  }
+
+  // tearDown will be called after each test case to clean up common resources.
+  virtual void tearDown()
+  {
+    if (m_client >= 0)
+    {
+      ::close(m_client);
+      m_client = -1;
+    }
+
+    ApiControl::Stop();
+    ApiControl::Disable(GetParentId());
+    ApiControl::Disable(GetGroupId());
+  }
+
+protected:
+  /* Test Suite Data *********************************************************/
+  char  m_path[64];
+  int   m_client;
+
+  static const pid_t    k_hookedPid   = 4321;
+  static const uint32_t k_unknownCode = 99;
+
+  /* Creator Methods *********************************************************/
+  static pid_t Hook_getppid()
+  {
+    ApiControl::Scope scope(GetParentId());
+    return k_hookedPid;
+  }
+
+  /// Forwards to the original function.
+  static pid_t Hook_getpgrp()
+  {
+    typedef pid_t (*pfngetpgrp)();
+
+    ApiControl::Scope scope(GetGroupId());
+    return ((pfngetpgrp)ApiControl::GetOriginal(GetGroupId()))();
+  }
+
+  static uint32_t GetParentId()
+  {
+    static const uint32_t k_id = ApiControl::Register("libc.so.6", "getppid", (PROC)Hook_getppid);
+    return k_id;
+  }
+
+  static uint32_t GetGroupId()
+  {
+    static const uint32_t k_id = ApiControl::Register("libc.so.6", "getpgrp", (PROC)Hook_getpgrp);
+    return k_id;
+  }
+
+  static uint32_t GetMissingId()
+  {
+    static const uint32_t k_id = ApiControl::Register("libc.so.6", "no_such_function", (PROC)Hook_getppid);
+    return k_id;
+  }
+
+  static int Connect(const char* pPath)
+  {
+    // Every hook is registered before the first client connects.
+    GetParentId();
+    GetGroupId();
+    GetMissingId();
+
+    sockaddr_un addr;
+    ::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    ::strcpy(addr.sun_path, pPath);
+
+    int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    TS_ASSERT_EQUALS(0, ::connect(fd, (const sockaddr*)&addr, sizeof(addr)));
+
+    // A broken server fails the test rather than hang it.
+    timeval timeout = { 5, 0 };
+    ::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    return fd;
+  }
+
+  static bool ReadFully(int fd, void* pBuffer, size_t size)
+  {
+    char* pNext = (char*)pBuffer;
+    while (size)
+    {
+      const ssize_t count = ::recv(fd, pNext, size, 0);
+      if (count <= 0)
+      {
+        return false;
+      }
+
+      pNext += count;
+      size  -= (size_t)count;
+    }
+
+    return true;
+  }
+
+  static void SendRequest(int fd, uint32_t command, uint32_t id = 0, const std::string& payload = std::string())
+  {
+    ApiControl::RequestHeader request;
+    request.command = command;
+    request.id      = id;
+    request.length  = (uint32_t)payload.size();
+
+    std::string message((const char*)&request, sizeof(request));
+    message += payload;
+    TS_ASSERT_EQUALS((ssize_t)message.size(), ::send(fd, message.data(), message.size(), MSG_NOSIGNAL));
+  }
+
+  /// Reads a response, and returns its status.
+  static uint32_t ReadResponse(int fd, std::string& payload)
+  {
+    ApiControl::ResponseHeader header;
+    if (!ReadFully(fd, &header, sizeof(header)))
+    {
+      TS_FAIL("The response header was not received");
+      return (uint32_t)-1;
+    }
+
+    payload.resize(header.length);
+    if ( header.length
+      && !ReadFully(fd, &payload[0], header.length))
+    {
+      TS_FAIL("The response payload was not received");
+      return (uint32_t)-1;
+    }
+
+    return header.status;
+  }
+
+  uint32_t Request(uint32_t command, uint32_t id, std::string& payload)
+  {
+    SendRequest(m_client, command, id);
+    return ReadResponse(m_client, payload);
+  }
+
+  /// Returns the counter record of a hook in a k_readCounters response.
+  static ApiControl::CounterRecord GetCounter(const std::string& payload, uint32_t id)
+  {
+    ApiControl::CounterRecord record;
+    ::memset(&record, 0, sizeof(record));
+
+    TS_ASSERT_EQUALS(0u, payload.size() % sizeof(record));
+    TS_ASSERT_LESS_THAN(id, payload.size() / sizeof(record));
+    if (id < payload.size() / sizeof(record))
+    {
+      ::memcpy(&record, payload.data() + id * sizeof(record), sizeof(record));
+    }
+
+    return record;
+  }
+
+  ApiControl::CounterRecord ReadCounter(uint32_t id)
+  {
+    std::string payload;
+    TS_ASSERT_EQUALS((uint32_t)ApiControl::k_ok, Request(ApiControl::k_readCounters, 0, payload));
+    return GetCounter(payload, id);
+  }
+
+public:
+  /* Test Cases **************************************************************/
+  void TestStart(void);
+  void TestStartFailure(void);
+  void TestListHooks(void);
+  void TestListImports(void);
+  void TestEnableDisable(void);
+  void TestCounters(void);
+  void TestErrors(void);
+  void TestBadRequest(void);
+  void TestStream(void);
+  void TestStopWithClient(void);
+
+};
+
+/*****************************************************************************/
+void Test_ApiControl::TestStart(void)
+{
+  TS_ASSERT(!ApiControl::Start(m_path));
+  ApiControl::Stop();
+  TS_ASSERT_EQUALS(-1, ::access(m_path, F_OK));
+
+  // The path of a socket is limited, and another kind of file is never
+  // replaced.
+  std::string longPath(200, 'x');
+  TS_ASSERT(!ApiControl::Start(longPath.c_str()));
+
+  const int file = ::open(m_path, O_CREAT | O_WRONLY | O_CLOEXEC, 0600);
+  ::close(file);
+  TS_ASSERT(!ApiControl::Start(m_path));
+  TS_ASSERT_EQUALS(0, ::access(m_path, F_OK));
+  ::unlink(m_path);
+
+  // A stale socket is replaced.
+  TS_ASSERT(ApiControl::Start(m_path));
+  ApiControl::Stop();
+
+  const int stale = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  sockaddr_un addr;
+  ::memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  ::strcpy(addr.sun_path, m_path);
+  TS_ASSERT_EQUALS(0, ::bind(stale, (const sockaddr*)&addr, sizeof(addr)));
+  ::close(stale);
+
+  TS_ASSERT(ApiControl::Start(m_path));
+}
+
+/*****************************************************************************/
+void Test_ApiControl::TestStartFailure(void)
+{
+  ::close(m_client);
+  m_client = -1;
+  ApiControl::Stop();
+
+  // Only the socket fits under the descriptor limit, so the wake pipe 
+  // cannot be created after the socket file is bound.
+  const int lowest = ::dup(0);
+  TS_ASSERT_LESS_THAN_EQUALS(0, lowest);
+  ::close(lowest);
+
+  rlimit limit;
+  TS_ASSERT_EQUALS(0, ::getrlimit(RLIMIT_NOFILE, &limit));
+  rlimit reduced  = limit;
+  reduced.rlim_cur = (rlim_t)lowest + 1;
+  TS_ASSERT_EQUALS(0, ::setrlimit(RLIMIT_NOFILE, &reduced));
+
+  const bool isStarted = ApiControl::Start(m_path);
+  ::setrlimit(RLIMIT_NOFILE, &limit);
+
+  TS_ASSERT(!isStarted);
+  TS_ASSERT_EQUALS(-1, ::access(m_path, F_OK));
+
+  // Nothing is left to close, and the next start succeeds.
+  ApiControl::Stop();
+  TS_ASSERT(ApiControl::Start(m_path));
+  m_client = Connect(m_path);
+
+  std::string payload;
+  TS_ASSERT_EQUALS((uint32_t)ApiControl::k_ok, Request(ApiControl::k_readCounters, 0, payload));
+}
+
+/*****************************************************************************/
+void Test_ApiControl::TestListHooks(void)
+{
+  TS_ASSERT(ApiControl::Enable(GetGroupId()));
+
+  std::string payload;
+  TS_ASSERT_EQUALS((uint32_t)ApiControl::k_ok, Request(ApiControl::k_listHooks, 0, payload));
+
+  bool isParentFound  = false;
+  bool isGroupFound   = false;
+  for (size_t offset = 0; offset < payload.size(); )
+  {
+    ApiControl::HookRecord record;
+    TS_ASSERT_LESS_THAN_EQUALS(offset + sizeof(record), payload.size());
+    ::memcpy(&record, payload.data() + offset, sizeof(record));
+    offset += sizeof(record);
+
+    const std::string library(payload, offset, record.libraryLength);
+    offset += record.libraryLength;
+    const std::string name(payload, offset, record.nameLength);
+    offset += record.nameLength;
+
+    if (GetParentId() == record.id)
+    {
+      isParentFound = true;
+      TS_ASSERT_EQUALS(std::string("libc.so.6"), library);
+      TS_ASSERT_EQUALS(std::string("getppid"),   name);
+      TS_ASSERT_EQUALS(0u, record.isEnabled);
+    }
+    else if (GetGroupId() == record.id)
+    {
+      isGroupFound = true;
+      TS_ASSERT_EQUALS(std::string("getpgrp"), name);
+      TS_ASSERT_EQUALS(1u, record.isEnabled);
+    }
+  }
+
+  TS_ASSERT(isParentFound);
+  TS_ASSERT(isGroupFound);
+}
+
+/*****************************************************************************/
+void Test_ApiControl::TestListImports(void)
+{
+  std::string payload;
+  TS_ASSERT_EQUALS((uint32_t)ApiControl::k_ok, Request(ApiControl::k_listImports, 0, payload));
+
+  // The slot of getppid in this program holds the address it calls.
+  bool isFound = false;
+  for (size_t offset = 0; offset < payload.size(); )
+  {
+    ApiControl::ImportRecord record;
+    TS_ASSERT_LESS_THAN_EQUALS(offset + sizeof(record), payload.size());
+    ::memcpy(&record, payload.data() + offset, sizeof(record));
+    offset += sizeof(record) + record.moduleLength + record.libraryLength;
+
+    const std::string name(payload, offset, record.nameLength);
+    offset += record.nameLength;
+
+    if ("getppid" == name)
+    {
+      isFound = true;
+      TS_ASSERT_EQUALS(0u, record.flags);
+      TS_ASSERT_DIFFERS(0u, record.slot);
+      TS_ASSERT_EQUALS(record.value, (uint64_t)(uintptr_t)*(PROC*)(uintptr_t)record.slot);
+    }
+  }
+
+  TS_ASSERT(isFound);
+}
+
+/*****************************************************************************/
+void Test_ApiControl::TestEnableDisable(void)
+{
+  const pid_t parent = ::getppid();
+
+  std::string payload;
+  TS_ASSERT_EQUALS((uint32_t)ApiControl::k_ok, Request(ApiControl::k_enable, GetParentId(), payload));
+  TS_ASSERT(payload.empty());
+  TS_ASSERT_EQUALS(k_hookedPid, ::getppid());
+
+  // Enabling an installed hook changes nothing.
+  TS_ASSERT_EQUALS((uint32_t)ApiControl::k_ok, Request(ApiControl::k_enable, GetParentId(), payload));
+  TS_ASSERT_EQUALS(k_hookedPid, ::getppid());
+  TS_ASSERT_EQUALS(1u, ReadCounter(GetParentId()).isEnabled);
+
+  TS_ASSERT_EQUALS((uint32_t)ApiControl::k_ok, Request(ApiControl::k_disable, GetParentId(), payload));
+  TS_ASSERT_EQUALS(parent, ::getppid());
+  TS_ASSERT_EQUALS(0u, ReadCounter(GetParentId()).isEnabled);
+
+  TS_ASSERT_EQUALS((uint32_t)ApiControl::k_ok, Request(ApiControl::k_disable, GetParentId(), payload));
+}
+
+/*****************************************************************************/
+void Test_ApiControl::TestCounters(void)
+{
+  const uint64_t calls = ReadCounter(GetGroupId()).calls;
+
+  std::string payload;
+  TS_ASSERT_EQUALS((uint32_t)ApiControl::k_ok, Request(ApiControl::k_enable, GetGroupId(), payload));
+
+  // The hook forwards to the original function, and counts each call.
+  for (size_t index = 0; index < 10; ++index)
+  {
+    TS_ASSERT_EQUALS(::getpgid(0), ::getpgrp());
+  }
+
+  ApiControl::CounterRecord record = ReadCounter(GetGroupId());
+  TS_ASSERT_EQUALS(GetGroupId(), record.id);
+  TS_ASSERT_EQUALS(1u, record.isEnabled);
+  TS_ASSERT_EQUALS(calls + 10, record.calls);
+
+  // A disabled hook is not called, so it counts nothing.
+  TS_ASSERT_EQUALS((uint32_t)ApiControl::k_ok, Request(ApiControl::k_disable, GetGroupId(), payload));
+  ::getpgrp();
+  TS_ASSERT_EQUALS(calls + 10, ReadCounter(GetGroupId()).calls);
+
+  // A call to an unregistered id is ignored.
+  ApiControl::Count(ApiControl::k_invalidId);
+  ApiControl::Count(ApiControl::k_maxHooks);
+}
+
+/*****************************************************************************/
+void Test_ApiControl::TestErrors(void)
+{
+  std::string payload;
+  TS_ASSERT_EQUALS((uint32_t)ApiControl::k_unknownHook,    Request(ApiControl::k_enable,  ApiControl::k_invalidId, payload));
+  TS_ASSERT_EQUALS((uint32_t)ApiControl::k_unknownHook,    Request(ApiControl::k_disable, ApiControl::k_maxHooks,  payload));
+  TS_ASSERT_EQUALS((uint32_t)ApiControl::k_failed,         Request(ApiControl::k_enable,  GetMissingId(),          payload));
+  TS_ASSERT_EQUALS((uint32_t)ApiControl::k_unknownCommand, Request(k_unknownCode,         0,                       payload));
+
+  // A stream needs its period.
+  TS_ASSERT_EQUALS((uint32_t)ApiControl::k_badRequest,     Request(ApiControl::k_streamCounters, 0,                payload));
+
+  // The connection is still served after each error.
+  TS_ASSERT_EQUALS((uint32_t)ApiControl::k_ok,             Request(ApiControl::k_readCounters, 0,                  payload));
+
+  TS_ASSERT(!ApiControl::Enable(ApiControl::k_invalidId));
+  TS_ASSERT(!ApiControl::Disable(ApiControl::k_invalidId));
+  TS_ASSERT(!ApiControl::GetOriginal(ApiControl::k_invalidId));
+  TS_ASSERT(!ApiControl::GetOriginal(GetMissingId()));
+
+  // A name too long for the 16-bit length of a HookRecord is refused.
+  const std::string longName(ApiControl::k_maxNameLength + 1u, 'x');
+  TS_ASSERT_EQUALS(ApiControl::k_invalidId, ApiControl::Register("libc.so.6", longName.c_str(), (PROC)Hook_getppid));
+  TS_ASSERT_EQUALS(ApiControl::k_invalidId, ApiControl::Register(longName.c_str(), "getppid", (PROC)Hook_getppid));
+}
+
+/*****************************************************************************/
+void Test_ApiControl::TestBadRequest(void)
+{
+  // A payload larger than the server accepts closes the connection.
+  ApiControl::RequestHeader request;
+  request.command = ApiControl::k_readCounters;
+  request.id      = 0;
+  request.length  = 1 << 20;
+  TS_ASSERT_EQUALS((ssize_t)sizeof(request), ::send(m_client, &request, sizeof(request), MSG_NOSIGNAL));
+
+  std::string payload;
+  TS_ASSERT_EQUALS((uint32_t)ApiControl::k_badRequest, ReadResponse(m_client, payload));
+
+  char byte = 0;
+  TS_ASSERT_EQUALS(0, ::recv(m_client, &byte, 1, 0));
+
+  // The next client is served.
+  ::close(m_client);
+  m_client = Connect(m_path);
+  TS_ASSERT_EQUALS((uint32_t)ApiControl::k_ok, Request(ApiControl::k_readCounters, 0, payload));
+}
+
+/*****************************************************************************/
+void Test_ApiControl::TestStream(void)
+{
+  std::string payload;
+  TS_ASSERT_EQUALS((uint32_t)ApiControl::k_ok, Request(ApiControl::k_enable, GetGroupId(), payload));
+
+  const uint32_t period = 10;
+  SendRequest(m_client, ApiControl::k_streamCounters, 0, std::string((const char*)&period, sizeof(period)));
+
+  // Each response reports the calls made before it was sent.
+  uint64_t calls = 0;
+  for (size_t index = 0; index < 3; ++index)
+  {
+    TS_ASSERT_EQUALS((uint32_t)ApiControl::k_ok, ReadResponse(m_client, payload));
+    const ApiControl::CounterRecord record = GetCounter(payload, GetGroupId());
+    TS_ASSERT_LESS_THAN_EQUALS(calls, record.calls);
+    calls = record.calls + 1;
+    ::getpgrp();
+  }
+
+  // Any byte ends the stream.  Responses sent before it arrived are
+  // skipped until the reply to the next request.
+  const char stop = 0;
+  TS_ASSERT_EQUALS(1, ::send(m_client, &stop, 1, MSG_NOSIGNAL));
+  SendRequest(m_client, k_unknownCode);
+
+  uint32_t status = ApiControl::k_ok;
+  for (size_t index = 0; index < 100 && ApiControl::k_ok == status; ++index)
+  {
+    status = ReadResponse(m_client, payload);
+  }
+
+  TS_ASSERT_EQUALS((uint32_t)ApiControl::k_unknownCommand, status);
+  TS_ASSERT_EQUALS(calls, ReadCounter(GetGroupId()).calls);
+}
+
+/*****************************************************************************/
+void Test_ApiControl::TestStopWithClient(void)
+{
+  const uint32_t period = 10;
+  SendRequest(m_client, ApiControl::k_streamCounters, 0, std::string((const char*)&period, sizeof(period)));
+
+  std::string payload;
+  TS_ASSERT_EQUALS((uint32_t)ApiControl::k_ok, ReadResponse(m_client, payload));
+
+  // Stop ends the stream, and closes the client and the socket.
+  ApiControl::Stop();
+  TS_ASSERT_EQUALS(-1, ::access(m_path, F_OK));
+
+  ssize_t count = 0;
+  char    buffer[256];
+  while (0 < (count = ::recv(m_client, buffer, sizeof(buffer), 0)))
+  { }
+
+  TS_ASSERT_EQUALS(0, count);
+
+  // The control plane can be started again.
+  TS_ASSERT(ApiControl::Start(m_path));
+  ::close(m_client);
+  m_client = Connect(m_path);
+  TS_ASSERT_EQUALS((uint32_t)ApiControl::k_ok, Request(ApiControl::k_readCounters, 0, payload));
+}
+
+#endif
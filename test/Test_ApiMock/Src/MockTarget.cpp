@@ -0,0 +1,28 @@
+/// @file   MockTarget.cpp
+///
+/// The module of functions that Test_ApiMock mocks.
+///
+/// The MIT License(MIT)
+/// @copyright 2014 Paul M Watt
+///
+//  ****************************************************************************
+#include "MockTarget.h"
+
+namespace // unnamed
+{
+
+int g_value = 7;
+
+} // namespace unnamed
+
+//  ****************************************************************************
+int& MockTargetRef()
+{
+  return g_value;
+}
+
+//  ****************************************************************************
+MockValue MockTargetValue(int value)
+{
+  return MockValue(value);
+}
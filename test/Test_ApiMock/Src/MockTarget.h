@@ -0,0 +1,27 @@
+/// @file   MockTarget.h
+///
+/// Functions for Test_ApiMock to mock, whose results are a reference and a
+/// type without a default constructor.  They are built into a module, so
+/// the runner calls them through its import table.
+///
+/// The MIT License(MIT)
+/// @copyright 2014 Paul M Watt
+///
+//  ****************************************************************************
+#ifndef MOCKTARGET_H_INCLUDED
+#define MOCKTARGET_H_INCLUDED
+
+//  ****************************************************************************
+/// A value that can only be constructed from an int.
+///
+struct MockValue
+{
+  explicit MockValue(int value) : value(value) { }
+
+  int value;
+};
+
+extern "C" int&       MockTargetRef();
+extern "C" MockValue  MockTargetValue(int value);
+
+#endif
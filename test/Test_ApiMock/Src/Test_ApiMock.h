@@ -0,0 +1,430 @@
+/** Test_ApiMock
+ *
+ * @file Test_ApiMock.h
+ *
+ * Verifies the typed call expectations of ApiMock, on the hooked send
+ * function of libc, and on the functions of MockTarget.cpp for the results
+ * that are not plain values.
+ *
+ * Build:
+ *   g++ -shared -fPIC -o libMockTarget.so Src/MockTarget.cpp
+ *   cxxtestgen --template=../ForkServer.tpl -o Runner.cpp Src/Test_ApiMock.h
+ *   g++ -std=c++11 -I../cxxtest -I.. Runner.cpp ../../src/ApiMock.cpp ../../src/ApiHook.cpp ../../src/SlotMatcher.cpp -L. -lMockTarget -Wl,-rpath,'$ORIGIN' -ldl -pthread
+ *
+ * The MIT License(MIT)
+ * @copyright 2014 Paul M Watt
+ *
+ */
+#ifndef Test_ApiMock_H_INCLUDED
+#define Test_ApiMock_H_INCLUDED
+
+#include <cxxtest/TestSuite.h>
+#include "../../../src/ApiMock.h"
+#include "MockTarget.h"
+
+#include <cerrno>
+#include <cstring>
+#include <string>
+
+#include <pthread.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+/// The data every test sends.
+const char k_data[] = "payload";
+
+/** Test_ApiMock
+ * @brief Test_ApiMock Test Suite class.
+ *****************************************************************************/
+class Test_ApiMock : public CxxTest::TestSuite
+{
+public:
+
+  typedef ApiMock<decltype(::send)>   SendMock;
+
+  Test_ApiMock()
+    : m_pArena(NULL)
+    , m_pSend(NULL)
+  { }
+
+  /* Fixture Management ******************************************************/
+  // setUp will be called before each test case in order to setup common fixtures.
+  virtual void setUp()
+  {
+    m_pArena  = new ApiMockArena;
+    m_pSend   = new SendMock(*m_pArena, "libc.so.6", "send");
+  }
+
+  // tearDown will be called after each test case to clean up common resources.
+  virtual void tearDown()
+  {
+    delete m_pSend;
+    m_pSend = NULL;
+
+    delete m_pArena;
+    m_pArena = NULL;
+  }
+
+protected:
+  /* Test Suite Data *********************************************************/
+  ApiMockArena*         m_pArena;
+  SendMock*             m_pSend;
+
+  /* Creator Methods *********************************************************/
+  /// Answers send with twice the length, for Invoke.
+  static ssize_t DoubleLength(int, const void*, size_t length, int)
+  {
+    return (ssize_t)(length * 2);
+  }
+
+  static bool IsLong(size_t length)
+  {
+    return length > 3;
+  }
+
+  /// Sends from several threads at once.
+  static void* SendThread(void*)
+  {
+    for (int index = 0; index < 1000; ++index)
+    {
+      ::send(9, k_data, sizeof(k_data), 0);
+    }
+
+    return NULL;
+  }
+
+  static size_t CountCaptured(const SendMock& mock)
+  {
+    size_t count = 0;
+    for (const SendMock::Call* pCall = mock.GetFirstCall(); pCall; pCall = pCall->pNext.load())
+    {
+      ++count;
+    }
+
+    return count;
+  }
+
+public:
+  /* Test Cases **************************************************************/
+  void TestValues(void);
+  void TestMatchers(void);
+  void TestCounts(void);
+  void TestNewestFirst(void);
+  void TestInvoke(void);
+  void TestCallOriginal(void);
+  void TestUnexpected(void);
+  void TestCaptureOrder(void);
+  void TestCaptureDisabled(void);
+  void TestConcurrentCalls(void);
+  void TestArenaFull(void);
+  void TestReferenceResult(void);
+  void TestNoDefaultResult(void);
+
+};
+
+/*****************************************************************************/
+void Test_ApiMock::TestValues(void)
+{
+  m_pSend->Expect(5, mock::Any(), sizeof(k_data), 0)
+          .Return(100);
+
+  TS_ASSERT_EQUALS(100, ::send(5, k_data, sizeof(k_data), 0));
+  TS_ASSERT(m_pSend->Verify());
+}
+
+/*****************************************************************************/
+void Test_ApiMock::TestMatchers(void)
+{
+  m_pSend->Expect(mock::Ge(3) && mock::Lt(10), mock::NotNull(), mock::Where(IsLong), !mock::Eq(MSG_OOB))
+          .AnyNumber()
+          .Return(1);
+  m_pSend->Expect(mock::Eq(20) || mock::Eq(30), mock::IsNull(), mock::Any(), mock::Any())
+          .AnyNumber()
+          .Return(2);
+
+  TS_ASSERT_EQUALS(1, ::send(3, k_data, 4, 0));
+  TS_ASSERT_EQUALS(1, ::send(9, k_data, 4, MSG_NOSIGNAL));
+  TS_ASSERT_EQUALS(2, ::send(20, NULL, 0, 0));
+  TS_ASSERT_EQUALS(2, ::send(30, NULL, 1, MSG_OOB));
+  TS_ASSERT_EQUALS(0u, m_pSend->GetUnexpectedCount());
+
+  // Each of these fails one matcher, and goes to the real send.
+  ::send(-1, k_data, 4, 0);
+  ::send(10, k_data, 4, 0);
+  ::send(3,  NULL,   4, 0);
+  ::send(3,  k_data, 3, 0);
+  ::send(3,  k_data, 4, MSG_OOB);
+  ::send(25, NULL,   0, 0);
+  TS_ASSERT_EQUALS(6u, m_pSend->GetUnexpectedCount());
+  TS_ASSERT_EQUALS(10u, m_pSend->GetCallCount());
+}
+
+/*****************************************************************************/
+void Test_ApiMock::TestCounts(void)
+{
+  SendMock::Expectation& twice  = m_pSend->Expect(1, mock::Any(), mock::Any(), mock::Any()).Times(2).Return(1);
+  SendMock::Expectation& range  = m_pSend->Expect(2, mock::Any(), mock::Any(), mock::Any()).Times(1, 3).Return(2);
+  SendMock::Expectation& any    = m_pSend->Expect(3, mock::Any(), mock::Any(), mock::Any()).AnyNumber().Return(3);
+  SendMock::Expectation& once   = m_pSend->Expect(4, mock::Any(), mock::Any(), mock::Any()).Return(4);
+
+  TS_ASSERT(!twice.IsSatisfied());
+  TS_ASSERT(!range.IsSatisfied());
+  TS_ASSERT(any.IsSatisfied());
+  TS_ASSERT(!once.IsSatisfied());
+
+  ::send(1, k_data, 1, 0);
+  TS_ASSERT(!twice.IsSatisfied());
+  ::send(1, k_data, 1, 0);
+  TS_ASSERT(twice.IsSatisfied());
+
+  ::send(2, k_data, 1, 0);
+  TS_ASSERT(range.IsSatisfied());
+
+  std::string report;
+  TS_ASSERT(!m_pSend->Verify(&report));
+  TS_ASSERT_DIFFERS(std::string::npos, report.find("send: expectation 0 (newest first) called 0 times, expected 1 to 1"));
+
+  ::send(4, k_data, 1, 0);
+  TS_ASSERT(m_pSend->Verify());
+
+  // A call past the maximum is unexpected.
+  ::send(-1, k_data, 1, 0);
+  TS_ASSERT_EQUALS(1u, once.GetCount());
+  ::send(1, k_data, 1, 0);
+  TS_ASSERT_EQUALS(2u, twice.GetCount());
+
+  report.clear();
+  TS_ASSERT(!m_pSend->Verify(&report));
+  TS_ASSERT_EQUALS(std::string("send: 2 unexpected calls\n"), report);
+}
+
+/*****************************************************************************/
+void Test_ApiMock::TestNewestFirst(void)
+{
+  m_pSend->Expect().AnyNumber().Return(1);
+  m_pSend->Expect(7, mock::Any(), mock::Any(), mock::Any()).Return(2);
+
+  // The newer expectation answers until it reaches its maximum count.
+  TS_ASSERT_EQUALS(2, ::send(7, k_data, 1, 0));
+  TS_ASSERT_EQUALS(1, ::send(7, k_data, 1, 0));
+  TS_ASSERT_EQUALS(1, ::send(8, k_data, 1, 0));
+  TS_ASSERT(m_pSend->Verify());
+}
+
+/*****************************************************************************/
+void Test_ApiMock::TestInvoke(void)
+{
+  m_pSend->Expect().Times(2).Invoke(DoubleLength);
+
+  TS_ASSERT_EQUALS(8, ::send(1, k_data, 4, 0));
+  TS_ASSERT_EQUALS(16, ::send(1, k_data, 8, 0));
+
+  // A later Return replaces the function.
+  m_pSend->Expect(2, mock::Any(), mock::Any(), mock::Any()).Invoke(DoubleLength).Return(5);
+  TS_ASSERT_EQUALS(5, ::send(2, k_data, 4, 0));
+  TS_ASSERT(m_pSend->Verify());
+}
+
+/*****************************************************************************/
+void Test_ApiMock::TestCallOriginal(void)
+{
+  int fds[2] = { -1, -1 };
+  TS_ASSERT_EQUALS(0, ::socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+
+  m_pSend->Expect(fds[0], mock::Any(), mock::Any(), mock::Any()).CallOriginal();
+  TS_ASSERT_EQUALS((ssize_t)sizeof(k_data), ::send(fds[0], k_data, sizeof(k_data), 0));
+
+  char buffer[sizeof(k_data)] = "";
+  TS_ASSERT_EQUALS((ssize_t)sizeof(k_data), ::recv(fds[1], buffer, sizeof(buffer), 0));
+  TS_ASSERT_SAME_DATA(k_data, buffer, sizeof(k_data));
+  TS_ASSERT(m_pSend->Verify());
+
+  ::close(fds[0]);
+  ::close(fds[1]);
+}
+
+/*****************************************************************************/
+void Test_ApiMock::TestUnexpected(void)
+{
+  // A call no expectation answers reaches the real function.
+  errno = 0;
+  TS_ASSERT_EQUALS(-1, ::send(-1, k_data, sizeof(k_data), 0));
+  TS_ASSERT_EQUALS(EBADF, errno);
+  TS_ASSERT_EQUALS(1u, m_pSend->GetUnexpectedCount());
+  TS_ASSERT(!m_pSend->Verify());
+
+  const SendMock::Call* pCall = m_pSend->GetFirstCall();
+  TS_ASSERT(pCall && !pCall->pExpectation);
+}
+
+/*****************************************************************************/
+void Test_ApiMock::TestCaptureOrder(void)
+{
+  SendMock::Expectation& expected = m_pSend->Expect(mock::Gt(0), mock::Any(), mock::Any(), mock::Any()).AnyNumber();
+
+  for (int index = 1; index <= 5; ++index)
+  {
+    ::send(index, k_data + index, (size_t)(10 * index), index);
+  }
+
+  ::send(-1, k_data, 0, 0);
+
+  TS_ASSERT_EQUALS(6u, CountCaptured(*m_pSend));
+  for (int index = 1; index <= 5; ++index)
+  {
+    const SendMock::ArgTuple& call = m_pSend->GetCall((size_t)(index - 1));
+    TS_ASSERT_EQUALS(index,                 std::get<0>(call));
+    TS_ASSERT_EQUALS(k_data + index,        std::get<1>(call));
+    TS_ASSERT_EQUALS((size_t)(10 * index),  std::get<2>(call));
+    TS_ASSERT_EQUALS(index,                 std::get<3>(call));
+  }
+
+  const SendMock::Call* pCall = m_pSend->GetFirstCall();
+  TS_ASSERT_EQUALS(&expected, pCall->pExpectation);
+  TS_ASSERT_EQUALS(-1, std::get<0>(m_pSend->GetCall(5)));
+
+  for (int index = 0; index < 5; ++index)
+  {
+    pCall = pCall->pNext.load();
+  }
+
+  TS_ASSERT(!pCall->pExpectation);
+  TS_ASSERT(!pCall->pNext.load());
+}
+
+/*****************************************************************************/
+void Test_ApiMock::TestCaptureDisabled(void)
+{
+  m_pSend->Expect().AnyNumber().Return(0);
+  m_pSend->SetCapture(false);
+
+  const size_t used = m_pArena->GetUsed();
+  for (int index = 0; index < 100; ++index)
+  {
+    ::send(index, k_data, 1, 0);
+  }
+
+  // The calls are counted, but nothing is written to the arena.
+  TS_ASSERT_EQUALS(100u, m_pSend->GetCallCount());
+  TS_ASSERT_EQUALS(used, m_pArena->GetUsed());
+  TS_ASSERT(!m_pSend->GetFirstCall());
+
+  m_pSend->SetCapture(true);
+  ::send(1, k_data, 1, 0);
+  TS_ASSERT_EQUALS(1u, CountCaptured(*m_pSend));
+}
+
+/*****************************************************************************/
+void Test_ApiMock::TestConcurrentCalls(void)
+{
+  SendMock::Expectation& expected = m_pSend->Expect(9, mock::Any(), mock::Any(), mock::Any()).Times(2500).Return(1);
+
+  pthread_t threads[4];
+  for (size_t index = 0; index < 4; ++index)
+  {
+    ::pthread_create(&threads[index], NULL, SendThread, NULL);
+  }
+
+  for (size_t index = 0; index < 4; ++index)
+  {
+    ::pthread_join(threads[index], NULL);
+  }
+
+  // Exactly the maximum count is claimed, and every call is captured once.
+  TS_ASSERT_EQUALS(2500u, expected.GetCount());
+  TS_ASSERT_EQUALS(1500u, m_pSend->GetUnexpectedCount());
+  TS_ASSERT_EQUALS(4000u, CountCaptured(*m_pSend));
+}
+
+/*****************************************************************************/
+void Test_ApiMock::TestArenaFull(void)
+{
+  // Only one mock of a signature may exist at a time.
+  delete m_pSend;
+  m_pSend = NULL;
+
+  ApiMockArena  tiny(8);
+  {
+    SendMock    lost(tiny, "libc.so.6", "send");
+
+    // The lost expectation never answers a call.
+    lost.Expect(-1, mock::Any(), mock::Any(), mock::Any()).Return(42);
+    TS_ASSERT_EQUALS(-1, ::send(-1, k_data, 1, 0));
+    TS_ASSERT_EQUALS(1u, lost.GetUnexpectedCount());
+    TS_ASSERT(!lost.GetFirstCall());
+
+    std::string report;
+    TS_ASSERT(!lost.Verify(&report));
+    TS_ASSERT_DIFFERS(std::string::npos, report.find("send: 1 expectations were not added, the arena is full"));
+    TS_ASSERT_DIFFERS(std::string::npos, report.find("send: 1 unexpected calls"));
+  }
+
+  // Calls made once the arena is full are counted, but not captured.
+  ApiMockArena  small(1024);
+  {
+    SendMock    other(small, "libc.so.6", "send");
+    other.Expect().AnyNumber().Return(0);
+    for (int index = 0; index < 100; ++index)
+    {
+      ::send(index, k_data, 1, 0);
+    }
+
+    size_t captured = 0;
+    for (const SendMock::Call* pCall = other.GetFirstCall(); pCall; pCall = pCall->pNext.load())
+    {
+      TS_ASSERT_EQUALS((int)captured, std::get<0>(pCall->args));
+      ++captured;
+    }
+
+    TS_ASSERT_EQUALS(100u, other.GetCallCount());
+    TS_ASSERT_LESS_THAN(0u, captured);
+    TS_ASSERT_LESS_THAN(captured, 100u);
+    TS_ASSERT_EQUALS(small.GetSize(), small.GetUsed());
+    TS_ASSERT(other.Verify());
+  }
+
+  small.Reset();
+  TS_ASSERT_EQUALS(0u, small.GetUsed());
+}
+
+/*****************************************************************************/
+void Test_ApiMock::TestReferenceResult(void)
+{
+  ApiMock<decltype(MockTargetRef)> mock(*m_pArena, "libMockTarget.so", "MockTargetRef");
+
+  // The call returns the object passed to Return, not a copy.
+  int value = 3;
+  mock.Expect().Return(value);
+  TS_ASSERT_EQUALS(&value, &MockTargetRef());
+
+  value = 4;
+  mock.Expect().Times(2).Return(value);
+  MockTargetRef() = 5;
+  TS_ASSERT_EQUALS(5, value);
+  TS_ASSERT_EQUALS(5, MockTargetRef());
+
+  // Without Return, the original function answers.
+  mock.Expect();
+  TS_ASSERT_EQUALS(7, MockTargetRef());
+  TS_ASSERT(mock.Verify());
+}
+
+/*****************************************************************************/
+void Test_ApiMock::TestNoDefaultResult(void)
+{
+  ApiMock<decltype(MockTargetValue)> mock(*m_pArena, "libMockTarget.so", "MockTargetValue");
+
+  mock.Expect(1).Return(MockValue(10));
+  mock.Expect(2).Times(2).Return(MockValue(20)).Return(MockValue(21));
+  TS_ASSERT_EQUALS(10, MockTargetValue(1).value);
+  TS_ASSERT_EQUALS(21, MockTargetValue(2).value);
+  TS_ASSERT_EQUALS(21, MockTargetValue(2).value);
+
+  // Without Return, the original function answers.
+  mock.Expect(3);
+  TS_ASSERT_EQUALS(3, MockTargetValue(3).value);
+  TS_ASSERT(mock.Verify());
+  TS_ASSERT_EQUALS(4u, mock.GetCallCount());
+}
+
+#endif
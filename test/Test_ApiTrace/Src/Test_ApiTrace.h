@@ -0,0 +1,306 @@
+/** Test_ApiTrace
+ *
+ * @file Test_ApiTrace.h
+ *
+ * Verifies the tracer of hooked calls: events written through Scope reach
+ * the trace file or are counted as dropped, the file converts to the Chrome
+ * JSON format, and the rings of exited threads are reused.
+ *
+ * Build:
+ *   cxxtestgen --template=../ForkServer.tpl -o Runner.cpp Src/Test_ApiTrace.h
+ *   g++ -std=c++11 -I../cxxtest -I.. Runner.cpp ../../src/ApiTrace.cpp ../../src/ApiHook.cpp ../../src/SlotMatcher.cpp -ldl -pthread
+ *
+ * The MIT License(MIT)
+ * @copyright 2014 Paul M Watt
+ *
+ */
+#ifndef Test_ApiTrace_H_INCLUDED
+#define Test_ApiTrace_H_INCLUDED
+
+#include <cxxtest/TestSuite.h>
+#include "../../../src/ApiTrace.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/** Test_ApiTrace
+ * @brief Test_ApiTrace Test Suite class.
+ *****************************************************************************/
+class Test_ApiTrace : public CxxTest::TestSuite
+{
+public:
+
+  /* Fixture Management ******************************************************/
+  // setUp will be called before each test case in order to setup common fixtures.
+  virtual void setUp()
+  {
+    ::strcpy(m_tracePath, "/tmp/Test_ApiTrace.XXXXXX");
+    ::close(::mkstemp(m_tracePath));
+
+    ::strcpy(m_jsonPath, m_tracePath);
+    ::strcat(m_jsonPath, ".json");
+  }
+
+  // tearDown will be called after each test case to clean up common resources.
+  virtual void tearDown()
+  {
+    ApiTrace::Stop();
+    ::unlink(m_tracePath);
+    ::unlink(m_jsonPath);
+  }
+
+protected:
+  /* Test Suite Data *********************************************************/
+  char          m_tracePath[64];
+  char          m_jsonPath[80];
+
+  static const size_t k_threadEvents = 20000;
+
+  /* Creator Methods *********************************************************/
+  /// Records a number of calls through Scope, with their index as result.
+  static void* RecordThread(void* pCount)
+  {
+    static const uint32_t k_traceId = ApiTrace::RegisterHook("thread");
+
+    const size_t count = (size_t)pCount;
+    for (size_t index = 0; index < count; ++index)
+    {
+      ApiTrace::Scope trace(k_traceId);
+      trace.Return(index);
+    }
+
+    return NULL;
+  }
+
+  static void RunThreads(size_t threadCount, size_t eventCount)
+  {
+    pthread_t threads[16];
+    for (size_t index = 0; index < threadCount; ++index)
+    {
+      ::pthread_create(&threads[index], NULL, RecordThread, (void*)eventCount);
+    }
+
+    for (size_t index = 0; index < threadCount; ++index)
+    {
+      ::pthread_join(threads[index], NULL);
+    }
+  }
+
+  /// Converts the trace, and returns the JSON text.
+  std::string ReadJson()
+  {
+    TS_ASSERT(ApiTrace::ConvertToChromeJson(m_tracePath, m_jsonPath));
+
+    std::string text;
+    FILE* pFile = ::fopen(m_jsonPath, "r");
+    if (pFile)
+    {
+      char buffer[65536];
+      for (size_t count; 0 < (count = ::fread(buffer, 1, sizeof(buffer), pFile)); )
+      {
+        text.append(buffer, count);
+      }
+
+      ::fclose(pFile);
+    }
+
+    return text;
+  }
+
+  static size_t CountOf(const std::string& text, const std::string& pattern)
+  {
+    size_t count = 0;
+    for (size_t offset = text.find(pattern); std::string::npos != offset; offset = text.find(pattern, offset + 1))
+    {
+      ++count;
+    }
+
+    return count;
+  }
+
+  static uint64_t GetDropped(const std::string& json)
+  {
+    const char   k_key[] = "\"droppedEvents\":";
+    const size_t offset  = json.find(k_key);
+    return std::string::npos == offset
+           ? (uint64_t)-1
+           : ::strtoull(json.c_str() + offset + sizeof(k_key) - 1, NULL, 10);
+  }
+
+  /// Reports the resident anonymous memory of the process in kilobytes,
+  /// which leaves out the mapping of the trace file.
+  static size_t GetResidentKb()
+  {
+    size_t resident = 0;
+    FILE* pFile = ::fopen("/proc/self/status", "r");
+    if (pFile)
+    {
+      char line[256];
+      while (::fgets(line, sizeof(line), pFile))
+      {
+        if (1 == ::sscanf(line, "RssAnon: %zu", &resident))
+        {
+          break;
+        }
+      }
+
+      ::fclose(pFile);
+    }
+
+    return resident;
+  }
+
+public:
+  /* Test Cases **************************************************************/
+  void TestStart(void);
+  void TestDisabled(void);
+  void TestRecord(void);
+  void TestEscapedNames(void);
+  void TestThreads(void);
+  void TestRingReuse(void);
+  void TestInvalidTrace(void);
+
+};
+
+/*****************************************************************************/
+void Test_ApiTrace::TestStart(void)
+{
+  TS_ASSERT(!ApiTrace::IsEnabled());
+  TS_ASSERT(!ApiTrace::Start("/nonexistent/trace"));
+
+  TS_ASSERT(ApiTrace::Start(m_tracePath));
+  TS_ASSERT(ApiTrace::IsEnabled());
+  TS_ASSERT(!ApiTrace::Start(m_tracePath));
+
+  ApiTrace::Stop();
+  TS_ASSERT(!ApiTrace::IsEnabled());
+
+  // Stopping again has no effect.
+  ApiTrace::Stop();
+}
+
+/*****************************************************************************/
+void Test_ApiTrace::TestDisabled(void)
+{
+  const uint32_t id = ApiTrace::RegisterHook("disabled");
+  {
+    ApiTrace::Scope trace(id);
+  }
+
+  TS_ASSERT(ApiTrace::Start(m_tracePath));
+  ApiTrace::Stop();
+
+  // The call made before the trace started is not in the trace.
+  const std::string json = ReadJson();
+  TS_ASSERT_EQUALS(0u, CountOf(json, "\"ph\":\"X\""));
+  TS_ASSERT_EQUALS(0u, GetDropped(json));
+}
+
+/*****************************************************************************/
+void Test_ApiTrace::TestRecord(void)
+{
+  const uint32_t sendId = ApiTrace::RegisterHook("send");
+  const uint32_t recvId = ApiTrace::RegisterHook("recv");
+
+  TS_ASSERT(ApiTrace::Start(m_tracePath));
+  {
+    ApiTrace::Scope trace(sendId);
+    TS_ASSERT_EQUALS(123, trace.Return(123));
+  }
+  {
+    ApiTrace::Scope trace(recvId);
+    trace.Return(-1);
+  }
+  ApiTrace::Stop();
+
+  const std::string json = ReadJson();
+  TS_ASSERT_EQUALS(2u, CountOf(json, "\"ph\":\"X\""));
+  TS_ASSERT_EQUALS(0u, GetDropped(json));
+
+  char text[128];
+  ::snprintf(text, sizeof(text), "\"pid\":%u,\"tid\":%u,", (unsigned)::getpid(), (unsigned)::syscall(SYS_gettid));
+  TS_ASSERT_EQUALS(2u, CountOf(json, text));
+
+  // The events are in the order of the calls, with their results.
+  const size_t sendAt = json.find("{\"name\":\"send\"");
+  const size_t recvAt = json.find("{\"name\":\"recv\"");
+  TS_ASSERT_DIFFERS(std::string::npos, sendAt);
+  TS_ASSERT_DIFFERS(std::string::npos, recvAt);
+  TS_ASSERT_LESS_THAN(sendAt, recvAt);
+  TS_ASSERT_DIFFERS(std::string::npos, json.find("\"result\":123}"));
+  TS_ASSERT_DIFFERS(std::string::npos, json.find("\"result\":18446744073709551615}"));
+}
+
+/*****************************************************************************/
+void Test_ApiTrace::TestEscapedNames(void)
+{
+  const uint32_t id = ApiTrace::RegisterHook("say \"hi\"\\\n");
+
+  TS_ASSERT(ApiTrace::Start(m_tracePath));
+  {
+    ApiTrace::Scope trace(id);
+  }
+  ApiTrace::Stop();
+
+  const std::string json = ReadJson();
+  TS_ASSERT_DIFFERS(std::string::npos, json.find("{\"name\":\"say \\\"hi\\\"\\\\\\u000a\""));
+}
+
+/*****************************************************************************/
+void Test_ApiTrace::TestThreads(void)
+{
+  TS_ASSERT(ApiTrace::Start(m_tracePath));
+  RunThreads(4, k_threadEvents);
+  ApiTrace::Stop();
+
+  // Every call is either in the trace or counted as dropped.
+  const std::string json    = ReadJson();
+  const size_t      events  = CountOf(json, "\"ph\":\"X\"");
+  const uint64_t    dropped = GetDropped(json);
+  TS_ASSERT_EQUALS(4 * k_threadEvents, events + dropped);
+  TS_ASSERT_LESS_THAN(0u, events);
+}
+
+/*****************************************************************************/
+void Test_ApiTrace::TestRingReuse(void)
+{
+  TS_ASSERT(ApiTrace::Start(m_tracePath));
+  RunThreads(1, ApiTrace::k_ringSize);
+
+  // Each thread writes to every slot of its ring, 128 KB.  Without reuse,
+  // 400 threads would add 50 MB.
+  const size_t before = GetResidentKb();
+  for (size_t index = 0; index < 400; ++index)
+  {
+    RunThreads(1, ApiTrace::k_ringSize);
+  }
+
+  TS_ASSERT_LESS_THAN(GetResidentKb(), before + 16 * 1024);
+  ApiTrace::Stop();
+
+  // The events of every thread are still drained.
+  const std::string json = ReadJson();
+  TS_ASSERT_EQUALS(401u * ApiTrace::k_ringSize, CountOf(json, "\"ph\":\"X\"") + GetDropped(json));
+}
+
+/*****************************************************************************/
+void Test_ApiTrace::TestInvalidTrace(void)
+{
+  TS_ASSERT(!ApiTrace::ConvertToChromeJson("/nonexistent/trace", m_jsonPath));
+
+  // The empty file created by setUp has no header.
+  TS_ASSERT(!ApiTrace::ConvertToChromeJson(m_tracePath, m_jsonPath));
+
+  FILE* pFile = ::fopen(m_tracePath, "w");
+  ::fprintf(pFile, "NOTATRACE and some more text to fill a header");
+  ::fclose(pFile);
+  TS_ASSERT(!ApiTrace::ConvertToChromeJson(m_tracePath, m_jsonPath));
+}
+
+#endif
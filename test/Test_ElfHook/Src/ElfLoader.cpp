@@ -0,0 +1,16 @@
+/// @file   ElfLoader.cpp
+///
+/// A module for Test_ElfHook that loads other modules, the same as a
+/// plugin loader.  It is built twice, with a RUNPATH and with an RPATH of
+/// $ORIGIN/sub.
+///
+/// The MIT License(MIT)
+/// @copyright 2014 Paul M Watt
+///
+//  ****************************************************************************
+#include <dlfcn.h>
+
+extern "C" void* ElfLoaderOpen(const char* pName)
+{
+  return ::dlopen(pName, RTLD_NOW | RTLD_LOCAL);
+}
@@ -0,0 +1,14 @@
+/// @file   ElfTarget.cpp
+///
+/// A module for Test_ElfHook to load by name.  It is built into the sub
+/// directory, where only the RPATH or RUNPATH of ElfLoader finds it, and
+/// beside the runner with only a DT_HASH table.
+///
+/// The MIT License(MIT)
+/// @copyright 2014 Paul M Watt
+///
+//  ****************************************************************************
+extern "C" int ElfTargetValue()
+{
+  return 42;
+}
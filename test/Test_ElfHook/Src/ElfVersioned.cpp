@@ -0,0 +1,28 @@
+/// @file   ElfVersioned.cpp
+///
+/// A module for Test_ElfHook with versioned exports.  ElfVersioned has a
+/// hidden ELF_1 definition and a default ELF_2 definition, ElfHiddenOnly 
+/// only has the hidden ELF_1 definition.  Built with ElfVersioned.map.
+///
+/// The MIT License(MIT)
+/// @copyright 2014 Paul M Watt
+///
+//  ****************************************************************************
+extern "C" int ElfVersionedOld()
+{
+  return 1;
+}
+
+extern "C" int ElfVersionedNew()
+{
+  return 2;
+}
+
+extern "C" int ElfHiddenOnlyOld()
+{
+  return 3;
+}
+
+__asm__(".symver ElfVersionedOld,ElfVersioned@ELF_1");
+__asm__(".symver ElfVersionedNew,ElfVersioned@@ELF_2");
+__asm__(".symver ElfHiddenOnlyOld,ElfHiddenOnly@ELF_1");
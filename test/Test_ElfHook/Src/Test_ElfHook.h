@@ -0,0 +1,398 @@
+/** Test_ElfHook
+ *
+ * @file Test_ElfHook.h
+ *
+ * Verifies the ELF side of ApiHook: modules loaded through the dlopen hook
+ * are found with the search path of the module that calls dlopen, exports
+ * are found through either hash table, and the exports that hooks replace 
+ * are restored with their symbol type.
+ *
+ * ApiHook.cpp is compiled into the suite, so the helpers in its unnamed
+ * namespace can be called directly.  The modules the tests load are built
+ * beside the runner.
+ *
+ * Build:
+ *   mkdir -p sub
+ *   g++ -shared -fPIC -o sub/libElfTarget.so Src/ElfTarget.cpp
+ *   g++ -shared -fPIC -Wl,--enable-new-dtags,-rpath,'$ORIGIN/sub' -o libElfRunPath.so Src/ElfLoader.cpp -ldl
+ *   g++ -shared -fPIC -Wl,--disable-new-dtags,-rpath,'$ORIGIN/sub' -o libElfRPath.so Src/ElfLoader.cpp -ldl
+ *   g++ -shared -fPIC -Wl,--hash-style=sysv -o libElfSysvHash.so Src/ElfTarget.cpp
+ *   g++ -shared -fPIC -Wl,--version-script=Src/ElfVersioned.map -o libElfVersioned.so Src/ElfVersioned.cpp
+ *   cxxtestgen --template=../ForkServer.tpl -o Runner.cpp Src/Test_ElfHook.h
+ *   g++ -I../cxxtest -I.. Runner.cpp ../../src/SlotMatcher.cpp -ldl -pthread
+ *
+ * The MIT License(MIT)
+ * @copyright 2014 Paul M Watt
+ *
+ */
+#ifndef Test_ElfHook_H_INCLUDED
+#define Test_ElfHook_H_INCLUDED
+
+#include <cxxtest/TestSuite.h>
+#include "../../../src/ApiHook.cpp"
+
+#include <climits>
+#include <cstring>
+#include <string>
+
+#include <dlfcn.h>
+#include <link.h>
+#include <unistd.h>
+
+/** Test_ElfHook
+ * @brief Test_ElfHook Test Suite class.
+ *****************************************************************************/
+class Test_ElfHook : public CxxTest::TestSuite
+{
+public:
+
+  Test_ElfHook()
+    : m_hLoader(NULL)
+  { }
+
+  /* Fixture Management ******************************************************/
+  // setUp will be called before each test case in order to setup common fixtures.
+  virtual void setUp()
+  {
+    m_hLoader = NULL;
+  }
+
+  // tearDown will be called after each test case to clean up common resources.
+  virtual void tearDown()
+  {
+    if (m_hLoader)
+    {
+      ::dlclose(m_hLoader);
+      m_hLoader = NULL;
+    }
+  }
+
+protected:
+  /* Test Suite Data *********************************************************/
+  void*         m_hLoader;
+
+  typedef void* (*pfnElfLoaderOpen)(const char*);
+
+  /* Creator Methods *********************************************************/
+  /// Returns the directory of the runner, where the test modules are built.
+  static std::string GetRunnerDir()
+  {
+    char path[PATH_MAX] = "";
+    const ssize_t length = ::readlink("/proc/self/exe", path, sizeof(path) - 1);
+    std::string dir(path, length > 0 ? (size_t)length : 0);
+    return dir.substr(0, dir.rfind('/'));
+  }
+
+  /// Loads one of the loader modules by path, and returns its open function.
+  pfnElfLoaderOpen LoadLoader(const char* pName)
+  {
+    m_hLoader = ::dlopen((GetRunnerDir() + "/" + pName).c_str(), RTLD_NOW | RTLD_LOCAL);
+    TSM_ASSERT(pName, m_hLoader);
+    return m_hLoader
+           ? (pfnElfLoaderOpen)::dlsym(m_hLoader, "ElfLoaderOpen")
+           : NULL;
+  }
+
+  /// A GNU hash table with a single bucket and bloom word, for one symbol.
+  struct GnuHashTable
+  {
+    Elf32_Word  header[4];
+    ElfW(Addr)  bloom[1];
+    Elf32_Word  buckets[1];
+    Elf32_Word  chain[1];
+  };
+
+  /// Loads a module built beside the runner, and reads its dynamic tables.
+  bool LoadImage(const char* pName, ElfImage& image)
+  {
+    m_hLoader = ::dlopen((GetRunnerDir() + "/" + pName).c_str(), RTLD_NOW | RTLD_LOCAL);
+    TSM_ASSERT(pName, m_hLoader);
+
+    HMODULE hMod = NULL;
+    return m_hLoader
+        && 0 == ::dlinfo(m_hLoader, RTLD_DI_LINKMAP, &hMod)
+        && GetElfImage(hMod, image);
+  }
+
+  /// Checks that a symbol found in a module is the one the loader exports.
+  void CheckSymbol(const ElfImage& image, const char* pName, int value)
+  {
+    typedef int (*pfnValue)();
+    ElfW(Sym)* pSym = FindElfSymbol(image, pName);
+    TSM_ASSERT(pName, pSym);
+    if (pSym)
+    {
+      pfnValue pfn = (pfnValue)(image.base + pSym->st_value);
+      TS_ASSERT_EQUALS((void*)pfn, ::dlsym(m_hLoader, pName));
+      TS_ASSERT_EQUALS(value, pfn());
+    }
+  }
+
+  /// Returns the libc export of a function.
+  static ElfW(Sym) GetLibcSymbol(const char* pName)
+  {
+    ElfW(Sym) sym;
+    ::memset(&sym, 0, sizeof(sym));
+
+    void*   hLib = ::dlopen("libc.so.6", RTLD_LAZY | RTLD_NOLOAD);
+    HMODULE hMod = NULL;
+    ElfImage image;
+    if ( hLib
+      && 0 == ::dlinfo(hLib, RTLD_DI_LINKMAP, &hMod)
+      && GetElfImage(hMod, image))
+    {
+      ElfW(Sym)* pSym = FindElfSymbol(image, pName);
+      TSM_ASSERT(pName, pSym);
+      if (pSym)
+      {
+        sym = *pSym;
+      }
+    }
+
+    if (hLib)
+    {
+      ::dlclose(hLib);
+    }
+
+    return sym;
+  }
+
+  /// Opens a module through the loader, and checks that it is the target.
+  static void CheckTarget(pfnElfLoaderOpen pfnOpen, const char* pName)
+  {
+    TS_ASSERT(pfnOpen);
+    void* hLib = pfnOpen ? pfnOpen(pName) : NULL;
+    TSM_ASSERT(pName, hLib);
+    if (hLib)
+    {
+      typedef int (*pfnElfTargetValue)();
+      pfnElfTargetValue pfnValue = (pfnElfTargetValue)::dlsym(hLib, "ElfTargetValue");
+      TS_ASSERT(pfnValue);
+      TS_ASSERT_EQUALS(42, pfnValue ? pfnValue() : 0);
+      ::dlclose(hLib);
+    }
+  }
+
+public:
+  /* Test Cases **************************************************************/
+  void TestExpandOrigin(void);
+  void TestRunPath(void);
+  void TestRPath(void);
+  void TestOriginName(void);
+  void TestLoadedModule(void);
+  void TestMissingModule(void);
+  void TestIndirectExport(void);
+  void TestIndirectExportRestore(void);
+  void TestGnuHash(void);
+  void TestBloomReject(void);
+  void TestSysvHash(void);
+  void TestHiddenVersion(void);
+
+};
+
+/*****************************************************************************/
+void Test_ElfHook::TestExpandOrigin(void)
+{
+  const std::string dir = GetRunnerDir();
+  HMODULE hProgram = _r_debug.r_map;
+
+  std::string path = "$ORIGIN/a:${ORIGIN}/b";
+  TS_ASSERT(ExpandOrigin(hProgram, path));
+  TS_ASSERT_EQUALS(dir + "/a:" + dir + "/b", path);
+
+  // Other names that start with $ORIGIN, and the other tokens, are left
+  // to the loader.
+  path = "$ORIGINAL/c:/lib/$LIB";
+  TS_ASSERT(!ExpandOrigin(hProgram, path));
+  TS_ASSERT_EQUALS(std::string("$ORIGINAL/c:/lib/$LIB"), path);
+}
+
+/*****************************************************************************/
+void Test_ElfHook::TestRunPath(void)
+{
+  // The target is only on the RUNPATH of the loader, not of the runner.
+  TS_ASSERT(!::dlopen("libElfTarget.so", RTLD_NOW | RTLD_NOLOAD));
+  CheckTarget(LoadLoader("libElfRunPath.so"), "libElfTarget.so");
+}
+
+/*****************************************************************************/
+void Test_ElfHook::TestRPath(void)
+{
+  CheckTarget(LoadLoader("libElfRPath.so"), "libElfTarget.so");
+}
+
+/*****************************************************************************/
+void Test_ElfHook::TestOriginName(void)
+{
+  // $ORIGIN in the name is the directory of the loader.
+  CheckTarget(LoadLoader("libElfRunPath.so"), "$ORIGIN/sub/libElfTarget.so");
+}
+
+/*****************************************************************************/
+void Test_ElfHook::TestLoadedModule(void)
+{
+  // A module that is already loaded is found by its name.
+  pfnElfLoaderOpen pfnOpen = LoadLoader("libElfRunPath.so");
+  TS_ASSERT(pfnOpen);
+  if (pfnOpen)
+  {
+    void* hLoaded = ::dlopen("libc.so.6", RTLD_NOW | RTLD_NOLOAD);
+    void* hLib    = pfnOpen("libc.so.6");
+    TS_ASSERT(hLoaded);
+    TS_ASSERT_EQUALS(hLoaded, hLib);
+    ::dlclose(hLib);
+    ::dlclose(hLoaded);
+  }
+}
+
+/*****************************************************************************/
+void Test_ElfHook::TestMissingModule(void)
+{
+  pfnElfLoaderOpen pfnOpen = LoadLoader("libElfRunPath.so");
+  TS_ASSERT(pfnOpen);
+  if (pfnOpen)
+  {
+    TS_ASSERT(!pfnOpen("libElfMissing.so"));
+    TS_ASSERT(::dlerror());
+  }
+}
+
+/*****************************************************************************/
+void* Hook_rawmemchr(const void* pBuffer, int c)
+{
+  const unsigned char* pByte = (const unsigned char*)pBuffer;
+  while (*pByte != (unsigned char)c)
+  {
+    ++pByte;
+  }
+
+  return (void*)pByte;
+}
+
+/*****************************************************************************/
+void Test_ElfHook::TestIndirectExport(void)
+{
+  // rawmemchr is an indirect function in glibc, the hook exports a plain 
+  // function in its place.
+  const ElfW(Sym) original = GetLibcSymbol("rawmemchr");
+  TS_ASSERT_EQUALS(STT_GNU_IFUNC, ELF32_ST_TYPE(original.st_info));
+
+  ApiHook* pHook = new ApiHook("libc.so.6", "rawmemchr", (PROC)Hook_rawmemchr);
+  ElfW(Sym) hooked = GetLibcSymbol("rawmemchr");
+  TS_ASSERT_EQUALS(STT_FUNC, ELF32_ST_TYPE(hooked.st_info));
+  TS_ASSERT_EQUALS(ELF32_ST_BIND(original.st_info), ELF32_ST_BIND(hooked.st_info));
+
+  // The resolver and its type are exported again once the hook is gone.
+  delete pHook;
+  const ElfW(Sym) restored = GetLibcSymbol("rawmemchr");
+  TS_ASSERT_EQUALS(original.st_info,  restored.st_info);
+  TS_ASSERT_EQUALS(original.st_value, restored.st_value);
+}
+
+/*****************************************************************************/
+void Test_ElfHook::TestIndirectExportRestore(void)
+{
+  const ElfW(Sym) original = GetLibcSymbol("rawmemchr");
+
+  ApiHook::PatchState state;
+  ApiHook::CaptureState(state);
+
+  ApiHook* pHook = new ApiHook("libc.so.6", "rawmemchr", (PROC)Hook_rawmemchr);
+  TS_ASSERT_EQUALS(STT_FUNC, ELF32_ST_TYPE(GetLibcSymbol("rawmemchr").st_info));
+
+  // A restore reverts the export of a hook created after the capture.
+  ApiHook::RestoreState(state);
+  const ElfW(Sym) restored = GetLibcSymbol("rawmemchr");
+  TS_ASSERT_EQUALS(original.st_info,  restored.st_info);
+  TS_ASSERT_EQUALS(original.st_value, restored.st_value);
+
+  delete pHook;
+  TS_ASSERT_EQUALS(original.st_info, GetLibcSymbol("rawmemchr").st_info);
+}
+
+/*****************************************************************************/
+void Test_ElfHook::TestGnuHash(void)
+{
+  ElfImage image;
+  TS_ASSERT(LoadImage("sub/libElfTarget.so", image));
+  TS_ASSERT(image.pGnuHash);
+
+  CheckSymbol(image, "ElfTargetValue", 42);
+  TS_ASSERT(!FindElfSymbol(image, "ElfTargetMissing"));
+  TS_ASSERT(!FindElfSymbol(image, ""));
+}
+
+/*****************************************************************************/
+void Test_ElfHook::TestBloomReject(void)
+{
+  // One symbol in a table made by hand, so the bloom filter can be cleared
+  // while its bucket and chain still match the name.
+  const char        k_strTab[]  = "\0ElfBloom";
+  const Elf32_Word  k_hash      = GnuHash("ElfBloom");
+  const unsigned    k_wordBits  = sizeof(ElfW(Addr)) * 8;
+  const unsigned    k_shift     = 5;
+
+  ElfW(Sym) symTab[2];
+  ::memset(symTab, 0, sizeof(symTab));
+  symTab[1].st_name   = 1;
+  symTab[1].st_info   = ELF32_ST_INFO(STB_GLOBAL, STT_FUNC);
+  symTab[1].st_shndx  = 1;
+  symTab[1].st_value  = 0x1000;
+
+  GnuHashTable table  = { { 1, 1, 1, k_shift }, { 0 }, { 1 }, { k_hash | 1 } };
+  table.bloom[0]      = (ElfW(Addr))1 << (k_hash % k_wordBits)
+                      | (ElfW(Addr))1 << ((k_hash >> k_shift) % k_wordBits);
+
+  ElfImage image;
+  ::memset(&image, 0, sizeof(image));
+  image.pSymTab   = symTab;
+  image.pStrTab   = k_strTab;
+  image.pGnuHash  = table.header;
+
+  TS_ASSERT_EQUALS(&symTab[1], FindElfSymbol(image, "ElfBloom"));
+
+  // Either bit missing from the filter rejects the name.
+  const ElfW(Addr) k_bloom = table.bloom[0];
+  table.bloom[0] = k_bloom & ~((ElfW(Addr))1 << (k_hash % k_wordBits));
+  TS_ASSERT(!FindElfSymbol(image, "ElfBloom"));
+
+  TS_ASSERT_DIFFERS(k_hash % k_wordBits, (k_hash >> k_shift) % k_wordBits);
+  table.bloom[0] = k_bloom & ~((ElfW(Addr))1 << ((k_hash >> k_shift) % k_wordBits));
+  TS_ASSERT(!FindElfSymbol(image, "ElfBloom"));
+
+  // A name in the same bucket with another hash is not a match.
+  table.bloom[0] = ~(ElfW(Addr))0;
+  TS_ASSERT(!FindElfSymbol(image, "ElfBloom2"));
+}
+
+/*****************************************************************************/
+void Test_ElfHook::TestSysvHash(void)
+{
+  ElfImage image;
+  TS_ASSERT(LoadImage("libElfSysvHash.so", image));
+  TS_ASSERT(!image.pGnuHash);
+  TS_ASSERT(image.pHash);
+
+  CheckSymbol(image, "ElfTargetValue", 42);
+  TS_ASSERT(!FindElfSymbol(image, "ElfTargetMissing"));
+
+  // A GNU hash table without bloom words is passed over for DT_HASH.
+  GnuHashTable table = { { 1, 1, 0, 5 }, { 0 }, { 0 }, { 0 } };
+  image.pGnuHash = table.header;
+  CheckSymbol(image, "ElfTargetValue", 42);
+}
+
+/*****************************************************************************/
+void Test_ElfHook::TestHiddenVersion(void)
+{
+  ElfImage image;
+  TS_ASSERT(LoadImage("libElfVersioned.so", image));
+  TS_ASSERT(image.pVerSym);
+
+  // The default version is found, never the hidden ELF_1 definitions.
+  CheckSymbol(image, "ElfVersioned", 2);
+  TS_ASSERT(!FindElfSymbol(image, "ElfHiddenOnly"));
+  TS_ASSERT(::dlvsym(m_hLoader, "ElfHiddenOnly", "ELF_1"));
+}
+
+#endif
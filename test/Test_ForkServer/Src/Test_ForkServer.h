@@ -0,0 +1,168 @@
+/** Test_ForkServer
+ *
+ * @file Test_ForkServer.h
+ *
+ * Verifies the fork-server runner: each test runs in a child of the runner,
+ * the hooks of the global fixtures are installed in every child, and the
+ * hooks a test leaves behind are rolled back before the next test.
+ *
+ * The suite only passes when it is run by the fork server, with any number
+ * of jobs and any shard size:
+ *   cxxtestgen --template=../ForkServer.tpl -o Runner.cpp Src/Test_ForkServer.h
+ *   g++ -I../cxxtest -I.. Runner.cpp ../../src/ApiHook.cpp ../../src/SlotMatcher.cpp -ldl -pthread
+ *   ./a.out -j 4 -s 2
+ *
+ * The MIT License(MIT)
+ * @copyright 2014 Paul M Watt
+ *
+ */
+#ifndef Test_ForkServer_H_INCLUDED
+#define Test_ForkServer_H_INCLUDED
+
+#include <cxxtest/TestSuite.h>
+#include <cxxtest/GlobalFixture.h>
+#include "../../../src/ApiHook.h"
+
+#include <unistd.h>
+
+/** WorldHook
+ * @brief Installs a hook once, in the runner, before any test is forked.
+ *****************************************************************************/
+class WorldHook : public CxxTest::GlobalFixture
+{
+public:
+  static const pid_t k_hookedPid = 4242;
+
+  WorldHook()
+    : m_pHook(NULL)
+    , m_runnerPid(0)
+  { }
+
+  virtual bool setUpWorld()
+  {
+    m_runnerPid = ::getpid();
+    m_pHook     = new ApiHook("libc.so.6", "getppid", (PROC)Hook_getppid);
+    return true;
+  }
+
+  virtual bool tearDownWorld()
+  {
+    delete m_pHook;
+    m_pHook = NULL;
+    return true;
+  }
+
+  pid_t GetRunnerPid() const
+  {
+    return m_runnerPid;
+  }
+
+private:
+  ApiHook*  m_pHook;
+  pid_t     m_runnerPid;
+
+  static pid_t Hook_getppid()
+  {
+    return k_hookedPid;
+  }
+};
+
+static WorldHook g_worldHook;
+
+/** Test_ForkServer
+ * @brief Test_ForkServer Test Suite class.
+ *****************************************************************************/
+class Test_ForkServer : public CxxTest::TestSuite
+{
+public:
+
+  /* Fixture Management ******************************************************/
+  // setUp will be called before each test case in order to setup common fixtures.
+  virtual void setUp()
+  { }
+
+  // tearDown will be called after each test case to clean up common resources.
+  virtual void tearDown()
+  { }
+
+protected:
+  /* Creator Methods *********************************************************/
+  static pid_t Hook_getpgrp()
+  {
+    return 0;
+  }
+
+  /// Leaves a hook installed, for the next test to find removed.
+  static void LeakHook()
+  {
+    new ApiHook("libc.so.6", "getpgrp", (PROC)Hook_getpgrp);
+    TS_ASSERT_EQUALS(0, ::getpgrp());
+  }
+
+  /// getpgid is never hooked, so it reports the real process group.
+  static void CheckNotHooked()
+  {
+    TS_ASSERT_EQUALS(::getpgid(0), ::getpgrp());
+  }
+
+public:
+  /* Test Cases **************************************************************/
+  void TestRunsInChild(void);
+  void TestWorldHook(void);
+  void TestLeaveHook(void);
+  void TestHookRemoved(void);
+  void TestLeaveHookAgain(void);
+  void TestHookRemovedAgain(void);
+  void TestTrace(void);
+
+};
+
+/*****************************************************************************/
+void Test_ForkServer::TestRunsInChild(void)
+{
+  TS_ASSERT_DIFFERS(0, g_worldHook.GetRunnerPid());
+  TS_ASSERT_DIFFERS(g_worldHook.GetRunnerPid(), ::getpid());
+}
+
+/*****************************************************************************/
+void Test_ForkServer::TestWorldHook(void)
+{
+  TS_ASSERT_EQUALS(WorldHook::k_hookedPid, ::getppid());
+}
+
+/*****************************************************************************/
+void Test_ForkServer::TestLeaveHook(void)
+{
+  CheckNotHooked();
+  LeakHook();
+}
+
+/*****************************************************************************/
+void Test_ForkServer::TestHookRemoved(void)
+{
+  CheckNotHooked();
+  TS_ASSERT_EQUALS(WorldHook::k_hookedPid, ::getppid());
+}
+
+/*****************************************************************************/
+void Test_ForkServer::TestLeaveHookAgain(void)
+{
+  CheckNotHooked();
+  LeakHook();
+}
+
+/*****************************************************************************/
+void Test_ForkServer::TestHookRemovedAgain(void)
+{
+  CheckNotHooked();
+  TS_ASSERT_EQUALS(WorldHook::k_hookedPid, ::getppid());
+}
+
+/*****************************************************************************/
+void Test_ForkServer::TestTrace(void)
+{
+  // The trace is replayed by the runner, and does not fail the test.
+  TS_TRACE("traced from the child");
+}
+
+#endif
@@ -0,0 +1,385 @@
+/** Test_PatchState
+ *
+ * @file Test_PatchState.h
+ *
+ * Verifies that ApiHook::CaptureState and ApiHook::RestoreState return the
+ * import slots, the exports and the hook list to a captured configuration.
+ *
+ * Build:
+ *   cxxtestgen --template=../ForkServer.tpl -o Runner.cpp Src/Test_PatchState.h
+ *   g++ -I../cxxtest -I.. Runner.cpp ../../src/ApiHook.cpp ../../src/SlotMatcher.cpp -ldl -pthread
+ *
+ * The MIT License(MIT)
+ * @copyright 2014 Paul M Watt
+ *
+ */
+#ifndef Test_PatchState_H_INCLUDED
+#define Test_PatchState_H_INCLUDED
+
+#include <cxxtest/TestSuite.h>
+#include "../../../src/ApiHook.h"
+
+#include <new>
+
+#include <dlfcn.h>
+#include <unistd.h>
+
+/** Test_PatchState
+ * @brief Test_PatchState Test Suite class.
+ *****************************************************************************/
+class Test_PatchState : public CxxTest::TestSuite
+{
+public:
+
+  Test_PatchState()
+    : m_parent(0)
+  { }
+
+  /* Fixture Management ******************************************************/
+  // setUp will be called before each test case in order to setup common fixtures.
+  virtual void setUp()
+  {
+    // This also binds the import slot, so it holds the function rather than
+    // the lazy-binding stub.
+    m_parent = ::getppid();
+    ApiHook::CaptureState(m_unhooked);
+  }
+
+  // tearDown will be called after each test case to clean up common resources.
+  virtual void tearDown()
+  {
+    ApiHook::RestoreState(m_unhooked);
+  }
+
+protected:
+  /* Test Suite Data *********************************************************/
+  pid_t                   m_parent;
+  ApiHook::PatchState     m_unhooked;
+
+  static const pid_t      k_firstPid  = 1111;
+  static const pid_t      k_secondPid = 2222;
+
+  /* Creator Methods *********************************************************/
+  static pid_t Hook_getppidFirst()
+  {
+    return k_firstPid;
+  }
+
+  static pid_t Hook_getppidSecond()
+  {
+    return k_secondPid;
+  }
+
+  static PROC GetExport()
+  {
+    return (PROC)::dlsym(RTLD_DEFAULT, "getppid");
+  }
+
+  /// Returns the record of a slot in a state, or NULL.
+  static const ApiHook::PatchRecord* FindRecord(const ApiHook::PatchState& state, PROC* ppfn)
+  {
+    for (size_t index = 0; index < state.records.size(); ++index)
+    {
+      if (ppfn == state.records[index].ppfn)
+      {
+        return &state.records[index];
+      }
+    }
+
+    return NULL;
+  }
+
+  /// Counts the import slots that hold a function.
+  static size_t CountSlots(PROC pfn)
+  {
+    std::vector<ApiHook::ImportEntry> imports;
+    ApiHook::ListImports(imports);
+
+    size_t count = 0;
+    for (size_t index = 0; index < imports.size(); ++index)
+    {
+      if (pfn == imports[index].pfn)
+      {
+        ++count;
+      }
+    }
+
+    return count;
+  }
+
+  /// Returns the import slot of getppid in this program.
+  static PROC* GetSlot()
+  {
+    std::vector<ApiHook::ImportEntry> imports;
+    ApiHook::ListImports(imports);
+    for (size_t index = 0; index < imports.size(); ++index)
+    {
+      if ("getppid" == imports[index].name)
+      {
+        return imports[index].ppfn;
+      }
+    }
+
+    return NULL;
+  }
+
+public:
+  /* Test Cases **************************************************************/
+  void TestCaptureLayout(void);
+  void TestRestoreSlots(void);
+  void TestRestoreExports(void);
+  void TestRestoreHookList(void);
+  void TestRestoreRemovedHook(void);
+  void TestStackedHooks(void);
+  void TestDestroyedHook(void);
+  void TestDestroyedStackedHooks(void);
+  void TestReusedAddress(void);
+  void TestUnloadedModule(void);
+
+};
+
+/*****************************************************************************/
+void Test_PatchState::TestCaptureLayout(void)
+{
+  TS_ASSERT_LESS_THAN(0u, m_unhooked.records.size());
+  TS_ASSERT_LESS_THAN(0u, m_unhooked.pages.size());
+
+  // The records are sorted and unique, and each page holds a run of them.
+  for (size_t index = 1; index < m_unhooked.records.size(); ++index)
+  {
+    TS_ASSERT_LESS_THAN(m_unhooked.records[index - 1].ppfn, m_unhooked.records[index].ppfn);
+  }
+
+  const uintptr_t pageMask = ~(uintptr_t(::sysconf(_SC_PAGESIZE)) - 1);
+  size_t next = 0;
+  for (size_t index = 0; index < m_unhooked.pages.size(); ++index)
+  {
+    const ApiHook::PatchPage& page = m_unhooked.pages[index];
+    TS_ASSERT_EQUALS(next, page.first);
+    TS_ASSERT_LESS_THAN(0u, page.count);
+    TS_ASSERT_DIFFERS((HMODULE)NULL, page.hMod);
+    for (size_t record = page.first; record < page.first + page.count; ++record)
+    {
+      TS_ASSERT_EQUALS((uintptr_t)page.pPage, (uintptr_t)m_unhooked.records[record].ppfn & pageMask);
+    }
+
+    next = page.first + page.count;
+  }
+
+  TS_ASSERT_EQUALS(m_unhooked.records.size(), next);
+
+  PROC* ppfn = GetSlot();
+  TS_ASSERT(ppfn);
+  TS_ASSERT(FindRecord(m_unhooked, ppfn));
+}
+
+/*****************************************************************************/
+void Test_PatchState::TestRestoreSlots(void)
+{
+  PROC* ppfn = GetSlot();
+  const PROC pfnOrig = *ppfn;
+
+  ApiHook* pHook = new ApiHook("libc.so.6", "getppid", (PROC)Hook_getppidFirst);
+  TS_ASSERT_EQUALS(k_firstPid, ::getppid());
+  TS_ASSERT_EQUALS((PROC)Hook_getppidFirst, *ppfn);
+
+  ApiHook::PatchState hooked;
+  ApiHook::CaptureState(hooked);
+  TS_ASSERT_EQUALS((PROC)Hook_getppidFirst, FindRecord(hooked, ppfn)->pfn);
+
+  ApiHook::RestoreState(m_unhooked);
+  TS_ASSERT_EQUALS(pfnOrig, *ppfn);
+  TS_ASSERT_EQUALS(m_parent, ::getppid());
+
+  // Restoring the same state again changes nothing.
+  ApiHook::RestoreState(m_unhooked);
+  TS_ASSERT_EQUALS(pfnOrig, *ppfn);
+
+  ApiHook::RestoreState(hooked);
+  TS_ASSERT_EQUALS(k_firstPid, ::getppid());
+
+  delete pHook;
+  TS_ASSERT_EQUALS(m_parent, ::getppid());
+}
+
+/*****************************************************************************/
+void Test_PatchState::TestRestoreExports(void)
+{
+  const PROC pfnExport = GetExport();
+
+  ApiHook* pHook = new ApiHook("libc.so.6", "getppid", (PROC)Hook_getppidFirst);
+  TS_ASSERT_EQUALS((PROC)Hook_getppidFirst, GetExport());
+
+  // The export redirected by a hook created after the capture is reverted.
+  ApiHook::RestoreState(m_unhooked);
+  TS_ASSERT_EQUALS(pfnExport, GetExport());
+
+  delete pHook;
+  TS_ASSERT_EQUALS(pfnExport, GetExport());
+}
+
+/*****************************************************************************/
+void Test_PatchState::TestRestoreHookList(void)
+{
+  ApiHook* pHook = new ApiHook("libc.so.6", "getppid", (PROC)Hook_getppidFirst);
+  ApiHook::RestoreState(m_unhooked);
+
+  // A hook created after the capture is no longer in the list, so Refresh
+  // does not install it again.
+  ApiHook::Refresh();
+  TS_ASSERT_EQUALS(m_parent, ::getppid());
+  TS_ASSERT_EQUALS(0u, CountSlots((PROC)Hook_getppidFirst));
+
+  delete pHook;
+  TS_ASSERT_EQUALS(m_parent, ::getppid());
+}
+
+/*****************************************************************************/
+void Test_PatchState::TestRestoreRemovedHook(void)
+{
+  ApiHook* pHook = new ApiHook("libc.so.6", "getppid", (PROC)Hook_getppidFirst);
+
+  ApiHook::PatchState hooked;
+  ApiHook::CaptureState(hooked);
+
+  ApiHook::RestoreState(m_unhooked);
+  TS_ASSERT_EQUALS(m_parent, ::getppid());
+
+  // A hook removed by the first restore is installed again, with its export.
+  ApiHook::RestoreState(hooked);
+  TS_ASSERT_EQUALS(k_firstPid, ::getppid());
+  TS_ASSERT_EQUALS((PROC)Hook_getppidFirst, GetExport());
+
+  ApiHook::Refresh();
+  TS_ASSERT_EQUALS(k_firstPid, ::getppid());
+
+  delete pHook;
+  TS_ASSERT_EQUALS(m_parent, ::getppid());
+}
+
+/*****************************************************************************/
+void Test_PatchState::TestStackedHooks(void)
+{
+  ApiHook* pFirst = new ApiHook("libc.so.6", "getppid", (PROC)Hook_getppidFirst);
+
+  ApiHook::PatchState first;
+  ApiHook::CaptureState(first);
+
+  ApiHook* pSecond = new ApiHook("libc.so.6", "getppid", (PROC)Hook_getppidSecond);
+  TS_ASSERT_EQUALS(k_secondPid, ::getppid());
+  TS_ASSERT_EQUALS((PROC)Hook_getppidSecond, GetExport());
+
+  // Only the newer hook is unwound.
+  ApiHook::RestoreState(first);
+  TS_ASSERT_EQUALS(k_firstPid, ::getppid());
+  TS_ASSERT_EQUALS((PROC)Hook_getppidFirst, GetExport());
+
+  ApiHook::RestoreState(m_unhooked);
+  TS_ASSERT_EQUALS(m_parent, ::getppid());
+
+  delete pSecond;
+  delete pFirst;
+  TS_ASSERT_EQUALS(m_parent, ::getppid());
+}
+
+/*****************************************************************************/
+void Test_PatchState::TestDestroyedHook(void)
+{
+  const PROC pfnExport = GetExport();
+
+  ApiHook* pHook = new ApiHook("libc.so.6", "getppid", (PROC)Hook_getppidFirst);
+
+  ApiHook::PatchState hooked;
+  ApiHook::CaptureState(hooked);
+  delete pHook;
+
+  // The destroyed hook is not restored.  The slots captured with it return
+  // to the original function, and Refresh has nothing to install.
+  ApiHook::RestoreState(hooked);
+  TS_ASSERT_EQUALS(m_parent, ::getppid());
+  TS_ASSERT_EQUALS(pfnExport, GetExport());
+  TS_ASSERT_EQUALS(0u, CountSlots((PROC)Hook_getppidFirst));
+
+  ApiHook::Refresh();
+  TS_ASSERT_EQUALS(m_parent, ::getppid());
+  TS_ASSERT_EQUALS(0u, CountSlots((PROC)Hook_getppidFirst));
+}
+
+/*****************************************************************************/
+void Test_PatchState::TestDestroyedStackedHooks(void)
+{
+  ApiHook* pFirst  = new ApiHook("libc.so.6", "getppid", (PROC)Hook_getppidFirst);
+  ApiHook* pSecond = new ApiHook("libc.so.6", "getppid", (PROC)Hook_getppidSecond);
+
+  ApiHook::PatchState hooked;
+  ApiHook::CaptureState(hooked);
+
+  // Only the newer hook is destroyed, so its slots return to the older one.
+  delete pSecond;
+  ApiHook::RestoreState(m_unhooked);
+  ApiHook::RestoreState(hooked);
+  TS_ASSERT_EQUALS(k_firstPid, ::getppid());
+  TS_ASSERT_EQUALS((PROC)Hook_getppidFirst, GetExport());
+  TS_ASSERT_EQUALS(0u, CountSlots((PROC)Hook_getppidSecond));
+
+  // Both destroyed, the slots return to the function.
+  delete pFirst;
+  ApiHook::RestoreState(hooked);
+  TS_ASSERT_EQUALS(m_parent, ::getppid());
+  TS_ASSERT_EQUALS(0u, CountSlots((PROC)Hook_getppidFirst));
+}
+
+/*****************************************************************************/
+void Test_PatchState::TestReusedAddress(void)
+{
+  // Both hooks are built in the same memory, so the second one has the
+  // address of the destroyed one.
+  static char buffer[sizeof(ApiHook)] __attribute__((aligned(16)));
+
+  ApiHook* pFirst = new (buffer) ApiHook("libc.so.6", "getppid", (PROC)Hook_getppidFirst);
+
+  ApiHook::PatchState hooked;
+  ApiHook::CaptureState(hooked);
+  pFirst->~ApiHook();
+
+  ApiHook* pSecond = new (buffer) ApiHook("libc.so.6", "getppid", (PROC)Hook_getppidSecond);
+  TS_ASSERT_EQUALS((void*)pFirst, (void*)pSecond);
+
+  // The new hook at that address is not the captured one, so the restore
+  // drops it from the list, as any hook created after the capture.
+  ApiHook::RestoreState(hooked);
+  TS_ASSERT_EQUALS(m_parent, ::getppid());
+
+  ApiHook::Refresh();
+  TS_ASSERT_EQUALS(m_parent, ::getppid());
+  TS_ASSERT_EQUALS(0u, CountSlots((PROC)Hook_getppidSecond));
+
+  pSecond->~ApiHook();
+  TS_ASSERT_EQUALS(m_parent, ::getppid());
+}
+
+/*****************************************************************************/
+void Test_PatchState::TestUnloadedModule(void)
+{
+  void* hLib = ::dlopen("libz.so.1", RTLD_NOW | RTLD_LOCAL);
+  if (!hLib)
+  {
+    TS_SKIP("libz.so.1 is not available");
+    return;
+  }
+
+  ApiHook::PatchState loaded;
+  ApiHook::CaptureState(loaded);
+  TS_ASSERT_LESS_THAN(m_unhooked.records.size(), loaded.records.size());
+
+  ApiHook* pHook = new ApiHook("libc.so.6", "getppid", (PROC)Hook_getppidFirst);
+  ::dlclose(hLib);
+
+  // The pages of the unloaded module are skipped, and the rest restored.
+  ApiHook::RestoreState(loaded);
+  TS_ASSERT_EQUALS(m_parent, ::getppid());
+
+  delete pHook;
+}
+
+#endif
@@ -0,0 +1,321 @@
+/** Test_SlotMatcher
+ *
+ * @file Test_SlotMatcher.h
+ *
+ * Verifies that SlotMatcher::Scan reports the same matches as a plain loop
+ * over the slots, with the instruction set chosen for this processor, for
+ * sets small enough to compare with SIMD and for the hashed sets above the
+ * limit.
+ *
+ * Build:
+ *   cxxtestgen --template=../ForkServer.tpl -o Runner.cpp Src/Test_SlotMatcher.h
+ *   g++ -I../cxxtest -I.. Runner.cpp ../../src/ApiHook.cpp ../../src/SlotMatcher.cpp -ldl -pthread
+ *
+ * The MIT License(MIT)
+ * @copyright 2014 Paul M Watt
+ *
+ */
+#ifndef Test_SlotMatcher_H_INCLUDED
+#define Test_SlotMatcher_H_INCLUDED
+
+#include <cxxtest/TestSuite.h>
+#include "../../../src/SlotMatcher.h"
+
+#include <vector>
+
+#include <stdint.h>
+
+/** Test_SlotMatcher
+ * @brief Test_SlotMatcher Test Suite class.
+ *****************************************************************************/
+class Test_SlotMatcher : public CxxTest::TestSuite
+{
+public:
+
+  Test_SlotMatcher()
+    : m_seed(0)
+  { }
+
+  /* Fixture Management ******************************************************/
+  // setUp will be called before each test case in order to setup common fixtures.
+  virtual void setUp()
+  {
+    // Every run draws the same addresses.
+    m_seed = 0x2545F4914F6CDD1Dull;
+  }
+
+  // tearDown will be called after each test case to clean up common resources.
+  virtual void tearDown()
+  { }
+
+protected:
+  /* Test Suite Data *********************************************************/
+  uint64_t  m_seed;
+
+  typedef std::vector<SlotMatcher::Match> MatchList;
+
+  /* Creator Methods *********************************************************/
+  /// Draws an aligned address, the same as a function entry point.
+  PROC NextAddress()
+  {
+    m_seed ^= m_seed << 13;
+    m_seed ^= m_seed >> 7;
+    m_seed ^= m_seed << 17;
+    return (PROC)(uintptr_t)(m_seed & ~uint64_t(0xF));
+  }
+
+  /// Finds the matches one slot and one address at a time.
+  static void ScanScalar(const std::vector<PROC>& addresses,
+                         const std::vector<PROC>& slots,
+                         MatchList&               matches)
+  {
+    for (size_t slot = 0; slot < slots.size(); ++slot)
+    {
+      for (size_t index = 0; index < addresses.size(); ++index)
+      {
+        if ( slots[slot]
+          && slots[slot] == addresses[index])
+        {
+          SlotMatcher::Match match = { slot, index };
+          matches.push_back(match);
+          break;
+        }
+      }
+    }
+  }
+
+  /// Scans the slots with a matcher and with the plain loop, and compares
+  /// the matches.
+  static void CheckScan(const std::vector<PROC>& addresses,
+                        const std::vector<PROC>& slots)
+  {
+    SlotMatcher matcher;
+    for (size_t index = 0; index < addresses.size(); ++index)
+    {
+      matcher.Add(addresses[index]);
+    }
+
+    TS_ASSERT_EQUALS(addresses.size(), matcher.GetCount());
+
+    MatchList expected;
+    ScanScalar(addresses, slots, expected);
+
+    MatchList matches;
+    matcher.Scan(slots.empty() ? NULL : &slots[0], slots.size(), matches);
+
+    TS_ASSERT_EQUALS(expected.size(), matches.size());
+    for (size_t index = 0; index < expected.size() && index < matches.size(); ++index)
+    {
+      TS_ASSERT_EQUALS(expected[index].slot,  matches[index].slot);
+      TS_ASSERT_EQUALS(expected[index].index, matches[index].index);
+    }
+  }
+
+  /// Fills slots with addresses outside the set, and places every address
+  /// of the set in some of them.
+  void FillSlots(const std::vector<PROC>& addresses, size_t count, std::vector<PROC>& slots)
+  {
+    slots.resize(count);
+    for (size_t slot = 0; slot < count; ++slot)
+    {
+      slots[slot] = NextAddress();
+    }
+
+    for (size_t index = 0; index < addresses.size() && count; ++index)
+    {
+      slots[(size_t)NextAddress() % count]  = addresses[index];
+      slots[(index * 7) % count]            = addresses[index];
+    }
+  }
+
+public:
+  /* Test Cases **************************************************************/
+  void TestIsa(void);
+  void TestEmpty(void);
+  void TestFind(void);
+  void TestSizes(void);
+  void TestTails(void);
+  void TestHalfMatches(void);
+  void TestDuplicates(void);
+  void TestImports(void);
+
+};
+
+/*****************************************************************************/
+void Test_SlotMatcher::TestIsa(void)
+{
+  const SlotMatcher::Isa isa = SlotMatcher::GetIsa();
+  TS_ASSERT( SlotMatcher::k_scalar == isa
+          || SlotMatcher::k_sse2   == isa
+          || SlotMatcher::k_avx2   == isa);
+
+  // The choice is made once.
+  TS_ASSERT_EQUALS(isa, SlotMatcher::GetIsa());
+  TS_TRACE(SlotMatcher::k_avx2 == isa ? "avx2" : SlotMatcher::k_sse2 == isa ? "sse2" : "scalar");
+}
+
+/*****************************************************************************/
+void Test_SlotMatcher::TestEmpty(void)
+{
+  SlotMatcher         matcher;
+  std::vector<PROC>   slots(32, NextAddress());
+  MatchList           matches;
+
+  matcher.Scan(&slots[0], slots.size(), matches);
+  TS_ASSERT(matches.empty());
+
+  // A null address is counted, but never matches an empty slot.
+  matcher.Add(NULL);
+  TS_ASSERT_EQUALS(1u, matcher.GetCount());
+  TS_ASSERT_EQUALS(SlotMatcher::k_notFound, matcher.Find(NULL));
+
+  slots.assign(32, (PROC)NULL);
+  matcher.Scan(&slots[0], slots.size(), matches);
+  TS_ASSERT(matches.empty());
+
+  matcher.Add(NextAddress());
+  matcher.Scan(&slots[0], 0, matches);
+  TS_ASSERT(matches.empty());
+}
+
+/*****************************************************************************/
+void Test_SlotMatcher::TestFind(void)
+{
+  std::vector<PROC> addresses;
+  SlotMatcher       matcher;
+  for (size_t index = 0; index < 100; ++index)
+  {
+    addresses.push_back(NextAddress());
+    matcher.Add(addresses.back());
+  }
+
+  for (size_t index = 0; index < addresses.size(); ++index)
+  {
+    TS_ASSERT_EQUALS(index, matcher.Find(addresses[index]));
+  }
+
+  TS_ASSERT_EQUALS(SlotMatcher::k_notFound, matcher.Find(NextAddress()));
+}
+
+/*****************************************************************************/
+void Test_SlotMatcher::TestSizes(void)
+{
+  // Every set size up to the SIMD limit, and the hashed sets above it.
+  for (size_t size = 1; size <= 4 * SlotMatcher::k_simdLimit; ++size)
+  {
+    std::vector<PROC> addresses;
+    for (size_t index = 0; index < size; ++index)
+    {
+      addresses.push_back(NextAddress());
+    }
+
+    std::vector<PROC> slots;
+    FillSlots(addresses, 509, slots);
+    CheckScan(addresses, slots);
+  }
+}
+
+/*****************************************************************************/
+void Test_SlotMatcher::TestTails(void)
+{
+  // Counts that leave each possible remainder after the widest blocks, with
+  // a match in the last slot, which only the scalar tail compares.
+  std::vector<PROC> addresses;
+  for (size_t index = 0; index < 5; ++index)
+  {
+    addresses.push_back(NextAddress());
+  }
+
+  for (size_t count = 1; count <= 24; ++count)
+  {
+    std::vector<PROC> slots;
+    FillSlots(addresses, count, slots);
+    slots[count - 1] = addresses[count % addresses.size()];
+    CheckScan(addresses, slots);
+  }
+}
+
+/*****************************************************************************/
+void Test_SlotMatcher::TestHalfMatches(void)
+{
+  // SSE2 compares 32 bits at a time.  A slot that shares only one half of
+  // an address with the set is not a match.
+  const uintptr_t k_value = (uintptr_t)NextAddress();
+  std::vector<PROC> addresses;
+  addresses.push_back((PROC)k_value);
+
+  std::vector<PROC> slots;
+  for (size_t index = 0; index < 64; ++index)
+  {
+    const uintptr_t bit = (uintptr_t)1 << (4 + index % (sizeof(uintptr_t) * 8 - 4));
+    slots.push_back((PROC)(k_value ^ bit));
+  }
+
+  slots[17] = (PROC)k_value;
+  slots[62] = (PROC)k_value;
+
+  CheckScan(addresses, slots);
+
+  SlotMatcher matcher;
+  matcher.Add((PROC)k_value);
+
+  MatchList matches;
+  matcher.Scan(&slots[0], slots.size(), matches);
+  TS_ASSERT_EQUALS(2u, matches.size());
+}
+
+/*****************************************************************************/
+void Test_SlotMatcher::TestDuplicates(void)
+{
+  // An address added twice keeps the position of its first Add.
+  std::vector<PROC> addresses;
+  for (size_t index = 0; index < 6; ++index)
+  {
+    addresses.push_back(NextAddress());
+  }
+
+  addresses.push_back(addresses[2]);
+  addresses.push_back(addresses[0]);
+
+  std::vector<PROC> slots;
+  FillSlots(addresses, 97, slots);
+  CheckScan(addresses, slots);
+
+  for (size_t index = 0; index < 2 * SlotMatcher::k_simdLimit; ++index)
+  {
+    addresses.push_back(NextAddress());
+  }
+
+  addresses.push_back(addresses[1]);
+  FillSlots(addresses, 97, slots);
+  CheckScan(addresses, slots);
+}
+
+/*****************************************************************************/
+void Test_SlotMatcher::TestImports(void)
+{
+  // The import slots of this program, against sets of the functions that
+  // they hold.
+  std::vector<ApiHook::ImportEntry> imports;
+  ApiHook::ListImports(imports);
+  TS_ASSERT_LESS_THAN(0u, imports.size());
+
+  std::vector<PROC> slots;
+  for (size_t index = 0; index < imports.size(); ++index)
+  {
+    slots.push_back(imports[index].pfn);
+  }
+
+  for (size_t size = 1; size <= 2 * SlotMatcher::k_simdLimit && size <= slots.size(); size *= 2)
+  {
+    std::vector<PROC> addresses;
+    for (size_t index = 0; index < size; ++index)
+    {
+      addresses.push_back(slots[(index * 13) % slots.size()]);
+    }
+
+    CheckScan(addresses, slots);
+  }
+}
+
+#endif
@@ -0,0 +1,455 @@
+/** Test_SyscallHook
+ *
+ * @file Test_SyscallHook.h
+ *
+ * Verifies the syscall user dispatch fallback: the system calls of an
+ * attached thread reach the registered handlers, including calls made with
+ * the syscall instruction itself, and every other call, thread creation,
+ * fork and signal delivery behave as they do on a thread that is not
+ * attached.
+ *
+ * The tests are skipped on a kernel older than 5.11.
+ *
+ * Build:
+ *   cxxtestgen --template=../ForkServer.tpl -o Runner.cpp Src/Test_SyscallHook.h
+ *   g++ -I../cxxtest -I.. Runner.cpp ../../src/SyscallHook.cpp ../../src/ApiHook.cpp ../../src/SlotMatcher.cpp -ldl -pthread
+ *
+ * The MIT License(MIT)
+ * @copyright 2014 Paul M Watt
+ *
+ */
+#ifndef Test_SyscallHook_H_INCLUDED
+#define Test_SyscallHook_H_INCLUDED
+
+#include <cxxtest/TestSuite.h>
+#include "../../../src/SyscallHook.h"
+
+#include <cerrno>
+#include <cstring>
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/** Test_SyscallHook
+ * @brief Test_SyscallHook Test Suite class.
+ *****************************************************************************/
+class Test_SyscallHook : public CxxTest::TestSuite
+{
+public:
+
+  Test_SyscallHook()
+    : m_parent(0)
+  { }
+
+  /* Fixture Management ******************************************************/
+  // setUp will be called before each test case in order to setup common fixtures.
+  virtual void setUp()
+  {
+    m_parent      = ::getppid();
+    sm_calls      = 0;
+    sm_signals    = 0;
+    sm_isSpinning = false;
+  }
+
+  // tearDown will be called after each test case to clean up common resources.
+  virtual void tearDown()
+  {
+    SyscallHook::DetachThread();
+  }
+
+protected:
+  /* Test Suite Data *********************************************************/
+  pid_t   m_parent;
+
+  static const long     k_hookedPid = 4242;
+  static volatile long  sm_calls;
+  static volatile long  sm_signals;
+  static volatile bool  sm_isSpinning;
+
+  /* Creator Methods *********************************************************/
+  /// Attaches the calling thread, or skips the test on an older kernel.
+  static bool Attach()
+  {
+    if (!SyscallHook::IsSupported())
+    {
+      TS_SKIP("The kernel does not support syscall user dispatch");
+      return false;
+    }
+
+    TS_ASSERT(SyscallHook::AttachThread());
+    return true;
+  }
+
+  /// Calls getppid with the syscall instruction, as statically linked code
+  /// does, so no import slot is involved.
+  static long RawGetParent()
+  {
+    long result;
+    __asm__ volatile("syscall" : "=a"(result) : "a"((long)SYS_getppid) : "rcx", "r11", "memory");
+    return result;
+  }
+
+  static long Hook_getppid(long, long, long, long, long, long)
+  {
+    ++sm_calls;
+    return k_hookedPid;
+  }
+
+  static long Hook_getppidOther(long, long, long, long, long, long)
+  {
+    return k_hookedPid + 1;
+  }
+
+  static long Hook_dup(long, long, long, long, long, long)
+  {
+    return -EMFILE;
+  }
+
+  /// Counts the call, and lets the kernel make it.
+  static long Hook_getpid(long, long, long, long, long, long)
+  {
+    ++sm_calls;
+    return SyscallHook::CallOriginal(SYS_getpid);
+  }
+
+  static void* ThreadGetParent(void*)
+  {
+    return (void*)::syscall(SYS_getppid);
+  }
+
+  static void OnSignal(int)
+  {
+    ++sm_signals;
+    RawGetParent();
+  }
+
+  /// Signals a thread once it runs code that makes no system calls.
+  static void* ThreadSignal(void* pThread)
+  {
+    while (!sm_isSpinning)
+    {
+      ::sched_yield();
+    }
+
+    ::pthread_kill(*(pthread_t*)pThread, SIGUSR1);
+    return NULL;
+  }
+
+  static void SetSignalHandler(struct sigaction& previous)
+  {
+    struct sigaction action;
+    ::memset(&action, 0, sizeof(action));
+    action.sa_handler = OnSignal;
+    ::sigemptyset(&action.sa_mask);
+    TS_ASSERT_EQUALS(0, ::sigaction(SIGUSR1, &action, &previous));
+  }
+
+public:
+  /* Test Cases **************************************************************/
+  void TestInstall(void);
+  void TestRawSyscall(void);
+  void TestDetach(void);
+  void TestStackedHooks(void);
+  void TestErrors(void);
+  void TestCallOriginal(void);
+  void TestPassThrough(void);
+  void TestThread(void);
+  void TestFork(void);
+  void TestSignal(void);
+  void TestAsyncSignal(void);
+  void TestSigaction(void);
+
+};
+
+volatile long Test_SyscallHook::sm_calls    = 0;
+volatile long Test_SyscallHook::sm_signals  = 0;
+volatile bool Test_SyscallHook::sm_isSpinning = false;
+
+/*****************************************************************************/
+void Test_SyscallHook::TestInstall(void)
+{
+  SyscallHook hook(SYS_getppid, Hook_getppid);
+  TS_ASSERT(hook.IsInstalled());
+
+  // The numbers SyscallHook handles itself, and those out of range, are
+  // refused.
+  const long k_refused[] =
+  {
+    -1, SyscallHook::k_maxSyscall, SYS_rt_sigreturn, SYS_clone, SYS_clone3, SYS_vfork
+  };
+
+  for (size_t index = 0; index < sizeof(k_refused) / sizeof(k_refused[0]); ++index)
+  {
+    SyscallHook refused(k_refused[index], Hook_getppid);
+    TS_ASSERT(!refused.IsInstalled());
+  }
+
+  // A thread that is not attached is not routed.
+  TS_ASSERT_EQUALS((long)m_parent, RawGetParent());
+  TS_ASSERT_EQUALS(0, sm_calls);
+}
+
+/*****************************************************************************/
+void Test_SyscallHook::TestRawSyscall(void)
+{
+  SyscallHook hook(SYS_getppid, Hook_getppid);
+  if (!Attach())
+  {
+    return;
+  }
+
+  TS_ASSERT_EQUALS(k_hookedPid, RawGetParent());
+  TS_ASSERT_EQUALS(k_hookedPid, ::syscall(SYS_getppid));
+  TS_ASSERT_EQUALS(2, sm_calls);
+}
+
+/*****************************************************************************/
+void Test_SyscallHook::TestDetach(void)
+{
+  SyscallHook hook(SYS_getppid, Hook_getppid);
+  if (!Attach())
+  {
+    return;
+  }
+
+  TS_ASSERT_EQUALS(k_hookedPid, RawGetParent());
+
+  SyscallHook::DetachThread();
+  TS_ASSERT_EQUALS((long)m_parent, RawGetParent());
+
+  // A thread can be attached again.
+  TS_ASSERT(SyscallHook::AttachThread());
+  TS_ASSERT_EQUALS(k_hookedPid, RawGetParent());
+}
+
+/*****************************************************************************/
+void Test_SyscallHook::TestStackedHooks(void)
+{
+  if (!Attach())
+  {
+    return;
+  }
+
+  SyscallHook* pFirst = new SyscallHook(SYS_getppid, Hook_getppid);
+  SyscallHook* pSecond = new SyscallHook(SYS_getppid, Hook_getppidOther);
+  TS_ASSERT_EQUALS(k_hookedPid + 1, RawGetParent());
+
+  delete pSecond;
+  TS_ASSERT_EQUALS(k_hookedPid, RawGetParent());
+
+  // A number without a handler is made by the signal handler.
+  delete pFirst;
+  TS_ASSERT_EQUALS((long)m_parent, RawGetParent());
+}
+
+/*****************************************************************************/
+void Test_SyscallHook::TestErrors(void)
+{
+  SyscallHook hook(SYS_dup, Hook_dup);
+  if (!Attach())
+  {
+    return;
+  }
+
+  // A negative result is an errno, which libc reports.
+  errno = 0;
+  TS_ASSERT_EQUALS(-1, ::dup(STDIN_FILENO));
+  TS_ASSERT_EQUALS(EMFILE, errno);
+
+  // The errno of the interrupted code is kept across a call that is
+  // passed through.
+  errno = ERANGE;
+  TS_ASSERT_LESS_THAN(0, SyscallHook::CallOriginal(SYS_getppid));
+  ::syscall(SYS_getuid);
+  TS_ASSERT_EQUALS(ERANGE, errno);
+}
+
+/*****************************************************************************/
+void Test_SyscallHook::TestCallOriginal(void)
+{
+  const long pid = ::syscall(SYS_getpid);
+
+  SyscallHook hook(SYS_getpid, Hook_getpid);
+  if (!Attach())
+  {
+    return;
+  }
+
+  TS_ASSERT_EQUALS(pid, ::syscall(SYS_getpid));
+  TS_ASSERT_EQUALS(pid, ::syscall(SYS_getpid));
+  TS_ASSERT_EQUALS(2, sm_calls);
+
+  // CallOriginal is not routed, even from an attached thread.
+  TS_ASSERT_EQUALS(pid, SyscallHook::CallOriginal(SYS_getpid));
+  TS_ASSERT_EQUALS(2, sm_calls);
+}
+
+/*****************************************************************************/
+void Test_SyscallHook::TestPassThrough(void)
+{
+  SyscallHook hook(SYS_getppid, Hook_getppid);
+  if (!Attach())
+  {
+    return;
+  }
+
+  // Calls without a handler behave the same as on a thread that is not
+  // attached.
+  int fds[2] = { -1, -1 };
+  TS_ASSERT_EQUALS(0, ::pipe2(fds, O_CLOEXEC));
+
+  const char k_text[] = "through the dispatcher";
+  char       buffer[sizeof(k_text)] = { 0 };
+  TS_ASSERT_EQUALS((ssize_t)sizeof(k_text), ::write(fds[1], k_text, sizeof(k_text)));
+  TS_ASSERT_EQUALS((ssize_t)sizeof(k_text), ::read(fds[0], buffer, sizeof(buffer)));
+  TS_ASSERT_SAME_DATA(k_text, buffer, sizeof(k_text));
+
+  TS_ASSERT_EQUALS(0, ::close(fds[0]));
+  TS_ASSERT_EQUALS(0, ::close(fds[1]));
+  TS_ASSERT_EQUALS(-1, ::close(fds[1]));
+  TS_ASSERT_EQUALS(EBADF, errno);
+
+  void* pMemory = ::mmap(NULL, 65536, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  TS_ASSERT_DIFFERS(MAP_FAILED, pMemory);
+  ::memset(pMemory, 0xA5, 65536);
+  TS_ASSERT_EQUALS(0, ::munmap(pMemory, 65536));
+
+  TS_ASSERT_EQUALS(0, sm_calls);
+}
+
+/*****************************************************************************/
+void Test_SyscallHook::TestThread(void)
+{
+  SyscallHook hook(SYS_getppid, Hook_getppid);
+  if (!Attach())
+  {
+    return;
+  }
+
+  // The thread is created on its own stack, and is not attached.
+  for (size_t index = 0; index < 8; ++index)
+  {
+    pthread_t thread;
+    void*     pResult = NULL;
+    TS_ASSERT_EQUALS(0, ::pthread_create(&thread, NULL, ThreadGetParent, NULL));
+    TS_ASSERT_EQUALS(0, ::pthread_join(thread, &pResult));
+    TS_ASSERT_EQUALS((long)m_parent, (long)pResult);
+  }
+
+  // The creating thread is still attached.
+  TS_ASSERT_EQUALS(k_hookedPid, RawGetParent());
+}
+
+/*****************************************************************************/
+void Test_SyscallHook::TestFork(void)
+{
+  SyscallHook hook(SYS_getppid, Hook_getppid);
+  if (!Attach())
+  {
+    return;
+  }
+
+  const long pid = SyscallHook::CallOriginal(SYS_getpid);
+
+  // The child is not attached, so it sees its real parent.
+  const pid_t child = ::fork();
+  if (0 == child)
+  {
+    ::_exit(pid == RawGetParent() ? 0 : 1);
+  }
+
+  TS_ASSERT_LESS_THAN(0, child);
+
+  int status = -1;
+  TS_ASSERT_EQUALS(child, ::waitpid(child, &status, 0));
+  TS_ASSERT(WIFEXITED(status));
+  TS_ASSERT_EQUALS(0, WEXITSTATUS(status));
+
+  TS_ASSERT_EQUALS(k_hookedPid, RawGetParent());
+}
+
+/*****************************************************************************/
+void Test_SyscallHook::TestSignal(void)
+{
+  struct sigaction previous;
+  SetSignalHandler(previous);
+
+  SyscallHook hook(SYS_getppid, Hook_getppid);
+  if (Attach())
+  {
+    // raise unblocks the signal in a system call that the dispatcher makes,
+    // so the handler runs with the calls allowed.
+    for (size_t index = 0; index < 4; ++index)
+    {
+      TS_ASSERT_EQUALS(0, ::raise(SIGUSR1));
+    }
+
+    TS_ASSERT_EQUALS(4, sm_signals);
+    TS_ASSERT_EQUALS(k_hookedPid, RawGetParent());
+  }
+
+  SyscallHook::DetachThread();
+  ::sigaction(SIGUSR1, &previous, NULL);
+}
+
+/*****************************************************************************/
+void Test_SyscallHook::TestAsyncSignal(void)
+{
+  struct sigaction previous;
+  SetSignalHandler(previous);
+
+  SyscallHook hook(SYS_getppid, Hook_getppid);
+  if (Attach())
+  {
+    pthread_t self = ::pthread_self();
+    pthread_t thread;
+    TS_ASSERT_EQUALS(0, ::pthread_create(&thread, NULL, ThreadSignal, &self));
+
+    // The signal arrives while this thread runs its own code, so the calls
+    // of the handler are routed, and it returns through the restorer of
+    // libc, which the dispatcher completes.
+    sm_isSpinning = true;
+    for (uint64_t count = 0; !sm_signals && count < 4000000000ull; ++count)
+    { }
+
+    TS_ASSERT_EQUALS(1, sm_signals);
+    TS_ASSERT_EQUALS(1, sm_calls);
+    TS_ASSERT_EQUALS(0, ::pthread_join(thread, NULL));
+    TS_ASSERT_EQUALS(k_hookedPid, RawGetParent());
+  }
+
+  SyscallHook::DetachThread();
+  ::sigaction(SIGUSR1, &previous, NULL);
+}
+
+/*****************************************************************************/
+void Test_SyscallHook::TestSigaction(void)
+{
+  if (!Attach())
+  {
+    return;
+  }
+
+  // The SIGSYS handler cannot be replaced while a thread is attached, but
+  // its action can be read.
+  struct sigaction action;
+  struct sigaction current;
+  ::memset(&action, 0, sizeof(action));
+  action.sa_handler = SIG_IGN;
+  TS_ASSERT_EQUALS(0, ::sigaction(SIGSYS, &action, &current));
+  TS_ASSERT(current.sa_flags & SA_SIGINFO);
+
+  TS_ASSERT_EQUALS(0, ::sigaction(SIGSYS, NULL, &current));
+  TS_ASSERT_DIFFERS((void*)SIG_IGN, (void*)current.sa_sigaction);
+
+  SyscallHook hook(SYS_getppid, Hook_getppid);
+  TS_ASSERT_EQUALS(k_hookedPid, RawGetParent());
+}
+
+#endif
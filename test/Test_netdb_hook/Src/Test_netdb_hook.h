@@ -0,0 +1,506 @@
+/** Test_netdb_hook
+ *
+ * @file Test_netdb_hook.h
+ *
+ * Verifies the name resolution hooks, which answer getaddrinfo, getnameinfo
+ * and gethostbyname from an in-memory zone table.
+ *
+ * Build:
+ *   cxxtestgen --template=../ForkServer.tpl -o Runner.cpp Src/Test_netdb_hook.h
+ *   g++ -I../cxxtest -I.. Runner.cpp ../../src/api/posix/netdb/netdb_hook.cpp ../../src/ApiHook.cpp ../../src/SlotMatcher.cpp -ldl -pthread
+ *
+ * The MIT License(MIT)
+ * @copyright 2014 Paul M Watt
+ *
+ */
+#ifndef Test_netdb_hook_H_INCLUDED
+#define Test_netdb_hook_H_INCLUDED
+
+#include <cxxtest/TestSuite.h>
+#include "../../../src/api/posix/netdb/netdb_hook.h"
+
+#include <cstdio>
+#include <cstring>
+
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+/** Test_netdb_hook
+ * @brief Test_netdb_hook Test Suite class.
+ *****************************************************************************/
+class Test_netdb_hook : public CxxTest::TestSuite
+{
+public:
+
+  Test_netdb_hook()
+    : m_pHook(NULL)
+  {
+    m_zonePath[0] = '\0';
+  }
+
+  /* Fixture Management ******************************************************/
+  // setUp will be called before each test case in order to setup common fixtures.
+  virtual void setUp()
+  {
+    ::strcpy(m_zonePath, "/tmp/Test_netdb_hook.XXXXXX");
+    const int file = ::mkstemp(m_zonePath);
+    TS_ASSERT_DIFFERS(-1, file);
+
+    const char k_zone[] =
+      "# Test zone\n"
+      "10.0.0.1     Server.Example.com   server www    # the web server\n"
+      "10.0.0.2     server.example.com\n"
+      "fd00::1      SERVER.example.com\n"
+      "\n"
+      "not-an-address\n"
+      "10.0.0.9     db.example.com       DB\n";
+    TS_ASSERT_EQUALS((ssize_t)(sizeof(k_zone) - 1), ::write(file, k_zone, sizeof(k_zone) - 1));
+    ::close(file);
+
+    m_pHook = new cxxhook::Netdb_hook;
+  }
+
+  // tearDown will be called after each test case to clean up common resources.
+  virtual void tearDown()
+  {
+    delete m_pHook;
+    m_pHook = NULL;
+
+    ::unlink(m_zonePath);
+  }
+
+protected:
+  /* Test Suite Data *********************************************************/
+  char                  m_zonePath[64];
+  cxxhook::Netdb_hook*  m_pHook;
+
+  /* Creator Methods *********************************************************/
+  /// Resolves a name with the given family, socket type and flags.
+  static int Resolve(const char* pNode, const char* pService, int family, int socktype, int flags, addrinfo** ppResult)
+  {
+    addrinfo hints;
+    ::memset(&hints, 0, sizeof(hints));
+    hints.ai_family   = family;
+    hints.ai_socktype = socktype;
+    hints.ai_flags    = flags;
+    return ::getaddrinfo(pNode, pService, &hints, ppResult);
+  }
+
+  /// Formats the address of a result, for comparisons.
+  static std::string ToString(const addrinfo* pInfo)
+  {
+    char text[INET6_ADDRSTRLEN] = "";
+    const void* pBytes = AF_INET == pInfo->ai_family
+                       ? (const void*)&((const sockaddr_in*)pInfo->ai_addr)->sin_addr
+                       : (const void*)&((const sockaddr_in6*)pInfo->ai_addr)->sin6_addr;
+    ::inet_ntop(pInfo->ai_family, pBytes, text, sizeof(text));
+    return text;
+  }
+
+  static size_t Count(const addrinfo* pInfo)
+  {
+    size_t count = 0;
+    for (; pInfo; pInfo = pInfo->ai_next)
+    {
+      ++count;
+    }
+
+    return count;
+  }
+
+  static double GetSeconds()
+  {
+    timespec now;
+    ::clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec * 1e-9;
+  }
+
+public:
+  /* Test Cases **************************************************************/
+  void TestLoadZoneFile(void);
+  void TestAddRecord(void);
+  void TestAliases(void);
+  void TestCaseFolding(void);
+  void TestCanonName(void);
+  void TestFamilies(void);
+  void TestPorts(void);
+  void TestNoName(void);
+  void TestGetNameInfo(void);
+  void TestGetHostByName(void);
+  void TestLatency(void);
+  void TestPoolReuse(void);
+  void TestPassThrough(void);
+
+};
+
+/*****************************************************************************/
+void Test_netdb_hook::TestLoadZoneFile(void)
+{
+  // The line without a name is reported, and the valid lines are added.
+  TS_ASSERT(!m_pHook->LoadZoneFile(m_zonePath));
+  TS_ASSERT(!m_pHook->LoadZoneFile("/nonexistent/zone"));
+
+  addrinfo* pResult = NULL;
+  TS_ASSERT_EQUALS(0, Resolve("db.example.com", NULL, AF_INET, SOCK_STREAM, 0, &pResult));
+  TS_ASSERT_EQUALS(1u, Count(pResult));
+  TS_ASSERT_EQUALS("10.0.0.9", ToString(pResult));
+  ::freeaddrinfo(pResult);
+
+  TS_ASSERT_EQUALS(EAI_NONAME, Resolve("not-an-address", NULL, AF_UNSPEC, 0, 0, &pResult));
+
+  m_pHook->Clear();
+  TS_ASSERT_EQUALS(EAI_NONAME, Resolve("db.example.com", NULL, AF_UNSPEC, 0, 0, &pResult));
+}
+
+/*****************************************************************************/
+void Test_netdb_hook::TestAddRecord(void)
+{
+  TS_ASSERT(m_pHook->AddRecord("cache", "192.168.1.20"));
+  TS_ASSERT(m_pHook->AddRecord("cache", "192.168.1.21"));
+  TS_ASSERT(!m_pHook->AddRecord("cache", "192.168.1"));
+  TS_ASSERT(!m_pHook->AddRecord("", "192.168.1.22"));
+  TS_ASSERT(!m_pHook->AddRecord(NULL, "192.168.1.22"));
+
+  // Addresses are reported in the order they were added.
+  addrinfo* pResult = NULL;
+  TS_ASSERT_EQUALS(0, Resolve("cache", NULL, AF_INET, SOCK_DGRAM, 0, &pResult));
+  TS_ASSERT_EQUALS(2u, Count(pResult));
+  if (2 == Count(pResult))
+  {
+    TS_ASSERT_EQUALS("192.168.1.20", ToString(pResult));
+    TS_ASSERT_EQUALS("192.168.1.21", ToString(pResult->ai_next));
+    TS_ASSERT_EQUALS(SOCK_DGRAM,  pResult->ai_socktype);
+    TS_ASSERT_EQUALS(IPPROTO_UDP, pResult->ai_protocol);
+  }
+
+  ::freeaddrinfo(pResult);
+}
+
+/*****************************************************************************/
+void Test_netdb_hook::TestAliases(void)
+{
+  m_pHook->LoadZoneFile(m_zonePath);
+
+  // Both aliases on the first line refer to every address of the host.
+  const char* k_names[] = { "server", "www", "Server.Example.com" };
+  for (size_t index = 0; index < sizeof(k_names) / sizeof(k_names[0]); ++index)
+  {
+    addrinfo* pResult = NULL;
+    TS_ASSERT_EQUALS(0, Resolve(k_names[index], NULL, AF_INET, SOCK_STREAM, 0, &pResult));
+    TS_ASSERT_EQUALS(2u, Count(pResult));
+    if (2 == Count(pResult))
+    {
+      TS_ASSERT_EQUALS("10.0.0.1", ToString(pResult));
+      TS_ASSERT_EQUALS("10.0.0.2", ToString(pResult->ai_next));
+    }
+
+    ::freeaddrinfo(pResult);
+  }
+
+  addrinfo* pResult = NULL;
+  TS_ASSERT_EQUALS(0, Resolve("db", NULL, AF_INET, SOCK_STREAM, 0, &pResult));
+  TS_ASSERT_EQUALS(1u, Count(pResult));
+  ::freeaddrinfo(pResult);
+}
+
+/*****************************************************************************/
+void Test_netdb_hook::TestCaseFolding(void)
+{
+  m_pHook->LoadZoneFile(m_zonePath);
+
+  addrinfo* pResult = NULL;
+  TS_ASSERT_EQUALS(0, Resolve("SERVER.EXAMPLE.COM", NULL, AF_UNSPEC, SOCK_STREAM, 0, &pResult));
+  TS_ASSERT_EQUALS(3u, Count(pResult));
+  ::freeaddrinfo(pResult);
+
+  TS_ASSERT_EQUALS(0, Resolve("WwW", NULL, AF_INET, SOCK_STREAM, 0, &pResult));
+  TS_ASSERT_EQUALS(2u, Count(pResult));
+  ::freeaddrinfo(pResult);
+}
+
+/*****************************************************************************/
+void Test_netdb_hook::TestCanonName(void)
+{
+  m_pHook->LoadZoneFile(m_zonePath);
+
+  // The canonical name keeps the case of the first record for the host.
+  addrinfo* pResult = NULL;
+  TS_ASSERT_EQUALS(0, Resolve("www", NULL, AF_INET, SOCK_STREAM, AI_CANONNAME, &pResult));
+  TS_ASSERT(pResult && pResult->ai_canonname);
+  if (pResult && pResult->ai_canonname)
+  {
+    TS_ASSERT_EQUALS(std::string("Server.Example.com"), pResult->ai_canonname);
+    TS_ASSERT(!pResult->ai_next->ai_canonname);
+  }
+
+  ::freeaddrinfo(pResult);
+
+  TS_ASSERT_EQUALS(0, Resolve("www", NULL, AF_INET, SOCK_STREAM, 0, &pResult));
+  TS_ASSERT(pResult && !pResult->ai_canonname);
+  ::freeaddrinfo(pResult);
+
+  // A numeric host is its own canonical name.
+  TS_ASSERT_EQUALS(0, Resolve("10.1.2.3", NULL, AF_INET, SOCK_STREAM, AI_CANONNAME, &pResult));
+  TS_ASSERT(pResult && pResult->ai_canonname);
+  if (pResult && pResult->ai_canonname)
+  {
+    TS_ASSERT_EQUALS(std::string("10.1.2.3"), pResult->ai_canonname);
+  }
+
+  ::freeaddrinfo(pResult);
+}
+
+/*****************************************************************************/
+void Test_netdb_hook::TestFamilies(void)
+{
+  m_pHook->LoadZoneFile(m_zonePath);
+
+  addrinfo* pResult = NULL;
+  TS_ASSERT_EQUALS(0, Resolve("server", NULL, AF_INET6, SOCK_STREAM, 0, &pResult));
+  TS_ASSERT_EQUALS(1u, Count(pResult));
+  if (pResult)
+  {
+    TS_ASSERT_EQUALS(AF_INET6, pResult->ai_family);
+    TS_ASSERT_EQUALS((socklen_t)sizeof(sockaddr_in6), pResult->ai_addrlen);
+    TS_ASSERT_EQUALS("fd00::1", ToString(pResult));
+  }
+
+  ::freeaddrinfo(pResult);
+
+  // Without a socket type, every address is reported for each type.
+  TS_ASSERT_EQUALS(0, Resolve("server", NULL, AF_UNSPEC, 0, 0, &pResult));
+  TS_ASSERT_EQUALS(9u, Count(pResult));
+  ::freeaddrinfo(pResult);
+
+  TS_ASSERT_EQUALS(EAI_NONAME, Resolve("db", NULL, AF_INET6, 0, 0, &pResult));
+  TS_ASSERT_EQUALS(EAI_FAMILY, Resolve("db", NULL, AF_UNIX,  0, 0, &pResult));
+
+  // Without a node, the loopback or wildcard addresses are reported.
+  TS_ASSERT_EQUALS(0, Resolve(NULL, "80", AF_INET, SOCK_STREAM, AI_PASSIVE, &pResult));
+  TS_ASSERT_EQUALS(1u, Count(pResult));
+  if (pResult)
+  {
+    TS_ASSERT_EQUALS("0.0.0.0", ToString(pResult));
+  }
+
+  ::freeaddrinfo(pResult);
+
+  TS_ASSERT_EQUALS(0, Resolve(NULL, "80", AF_INET6, SOCK_STREAM, 0, &pResult));
+  if (pResult)
+  {
+    TS_ASSERT_EQUALS("::1", ToString(pResult));
+  }
+
+  ::freeaddrinfo(pResult);
+}
+
+/*****************************************************************************/
+void Test_netdb_hook::TestPorts(void)
+{
+  m_pHook->LoadZoneFile(m_zonePath);
+
+  addrinfo* pResult = NULL;
+  TS_ASSERT_EQUALS(0, Resolve("server", "8080", AF_UNSPEC, SOCK_STREAM, 0, &pResult));
+  TS_ASSERT_EQUALS(3u, Count(pResult));
+  for (const addrinfo* pInfo = pResult; pInfo; pInfo = pInfo->ai_next)
+  {
+    const in_port_t port = AF_INET == pInfo->ai_family
+                         ? ((const sockaddr_in*)pInfo->ai_addr)->sin_port
+                         : ((const sockaddr_in6*)pInfo->ai_addr)->sin6_port;
+    TS_ASSERT_EQUALS(8080, ntohs(port));
+  }
+
+  ::freeaddrinfo(pResult);
+
+  // Named services are resolved through the services database.
+  const servent* pEntry = ::getservbyname("http", "tcp");
+  const int      error  = Resolve("server", "http", AF_INET, SOCK_STREAM, 0, &pResult);
+  if (pEntry)
+  {
+    TS_ASSERT_EQUALS(0, error);
+    TS_ASSERT_EQUALS(pEntry->s_port, ((const sockaddr_in*)pResult->ai_addr)->sin_port);
+    ::freeaddrinfo(pResult);
+  }
+  else
+  {
+    TS_ASSERT_EQUALS(EAI_SERVICE, error);
+  }
+
+  TS_ASSERT_EQUALS(EAI_NONAME,  Resolve("server", "http",   AF_INET, SOCK_STREAM, AI_NUMERICSERV, &pResult));
+  TS_ASSERT_EQUALS(EAI_SERVICE, Resolve("server", "70000",  AF_INET, SOCK_STREAM, 0, &pResult));
+  TS_ASSERT_EQUALS(EAI_SERVICE, Resolve("server", "no-such-service", AF_INET, SOCK_STREAM, 0, &pResult));
+}
+
+/*****************************************************************************/
+void Test_netdb_hook::TestNoName(void)
+{
+  m_pHook->LoadZoneFile(m_zonePath);
+
+  addrinfo* pResult = NULL;
+  TS_ASSERT_EQUALS(EAI_NONAME, Resolve("unknown.example.com", NULL, AF_UNSPEC, 0, 0, &pResult));
+  TS_ASSERT_EQUALS(EAI_NONAME, Resolve("server", NULL, AF_UNSPEC, 0, AI_NUMERICHOST, &pResult));
+  TS_ASSERT_EQUALS(EAI_NONAME, Resolve(NULL, NULL, AF_UNSPEC, 0, 0, &pResult));
+}
+
+/*****************************************************************************/
+void Test_netdb_hook::TestGetNameInfo(void)
+{
+  m_pHook->LoadZoneFile(m_zonePath);
+
+  sockaddr_in address;
+  ::memset(&address, 0, sizeof(address));
+  address.sin_family  = AF_INET;
+  address.sin_port    = htons(443);
+  ::inet_pton(AF_INET, "10.0.0.2", &address.sin_addr);
+
+  char host[NI_MAXHOST] = "";
+  char serv[NI_MAXSERV] = "";
+  TS_ASSERT_EQUALS(0, ::getnameinfo((sockaddr*)&address, sizeof(address), host, sizeof(host), serv, sizeof(serv), 0));
+  TS_ASSERT_EQUALS(std::string("Server.Example.com"), host);
+  TS_ASSERT_EQUALS(std::string("443"), serv);
+
+  TS_ASSERT_EQUALS(0, ::getnameinfo((sockaddr*)&address, sizeof(address), host, sizeof(host), NULL, 0, NI_NUMERICHOST));
+  TS_ASSERT_EQUALS(std::string("10.0.0.2"), host);
+
+  char small[8] = "";
+  TS_ASSERT_EQUALS(EAI_OVERFLOW, ::getnameinfo((sockaddr*)&address, sizeof(address), small, sizeof(small), NULL, 0, 0));
+
+  // An address that is not in the zone is reported numerically, unless a
+  // name is required.
+  ::inet_pton(AF_INET, "10.9.9.9", &address.sin_addr);
+  TS_ASSERT_EQUALS(0, ::getnameinfo((sockaddr*)&address, sizeof(address), host, sizeof(host), NULL, 0, 0));
+  TS_ASSERT_EQUALS(std::string("10.9.9.9"), host);
+  TS_ASSERT_EQUALS(EAI_NONAME, ::getnameinfo((sockaddr*)&address, sizeof(address), host, sizeof(host), NULL, 0, NI_NAMEREQD));
+
+  sockaddr_in6 address6;
+  ::memset(&address6, 0, sizeof(address6));
+  address6.sin6_family = AF_INET6;
+  ::inet_pton(AF_INET6, "fd00::1", &address6.sin6_addr);
+  TS_ASSERT_EQUALS(0, ::getnameinfo((sockaddr*)&address6, sizeof(address6), host, sizeof(host), NULL, 0, 0));
+  TS_ASSERT_EQUALS(std::string("Server.Example.com"), host);
+  TS_ASSERT_EQUALS(EAI_FAMILY, ::getnameinfo((sockaddr*)&address6, sizeof(address), host, sizeof(host), NULL, 0, 0));
+}
+
+/*****************************************************************************/
+void Test_netdb_hook::TestGetHostByName(void)
+{
+  m_pHook->LoadZoneFile(m_zonePath);
+
+  // Only the IPv4 addresses of a host are reported.
+  const hostent* pHost = ::gethostbyname("WWW");
+  TS_ASSERT(pHost);
+  if (pHost)
+  {
+    TS_ASSERT_EQUALS(std::string("Server.Example.com"), pHost->h_name);
+    TS_ASSERT_EQUALS(AF_INET, pHost->h_addrtype);
+    TS_ASSERT_EQUALS((int)sizeof(in_addr), pHost->h_length);
+    TS_ASSERT(pHost->h_addr_list[0] && pHost->h_addr_list[1] && !pHost->h_addr_list[2]);
+
+    in_addr expected;
+    ::inet_pton(AF_INET, "10.0.0.2", &expected);
+    TS_ASSERT_SAME_DATA(&expected, pHost->h_addr_list[1], sizeof(expected));
+  }
+
+  pHost = ::gethostbyname("10.4.5.6");
+  TS_ASSERT(pHost && pHost->h_addr_list[0] && !pHost->h_addr_list[1]);
+
+  TS_ASSERT(!::gethostbyname("unknown.example.com"));
+  TS_ASSERT_EQUALS(HOST_NOT_FOUND, h_errno);
+
+  m_pHook->AddRecord("v6only", "fd00::2");
+  TS_ASSERT(!::gethostbyname("v6only"));
+  TS_ASSERT_EQUALS(NO_ADDRESS, h_errno);
+}
+
+/*****************************************************************************/
+void Test_netdb_hook::TestLatency(void)
+{
+  m_pHook->LoadZoneFile(m_zonePath);
+  m_pHook->SetLatency(20000);
+
+  addrinfo* pResult = NULL;
+  double start = GetSeconds();
+  TS_ASSERT_EQUALS(0, Resolve("server", NULL, AF_INET, SOCK_STREAM, 0, &pResult));
+  TS_ASSERT_LESS_THAN_EQUALS(0.020, GetSeconds() - start);
+
+  char host[NI_MAXHOST] = "";
+  start = GetSeconds();
+  TS_ASSERT_EQUALS(0, ::getnameinfo(pResult->ai_addr, pResult->ai_addrlen, host, sizeof(host), NULL, 0, 0));
+  TS_ASSERT_LESS_THAN_EQUALS(0.020, GetSeconds() - start);
+  ::freeaddrinfo(pResult);
+
+  m_pHook->SetLatency(0);
+  start = GetSeconds();
+  TS_ASSERT_EQUALS(0, Resolve("server", NULL, AF_INET, SOCK_STREAM, 0, &pResult));
+  TS_ASSERT_LESS_THAN(GetSeconds() - start, 0.010);
+  ::freeaddrinfo(pResult);
+}
+
+/*****************************************************************************/
+void Test_netdb_hook::TestPoolReuse(void)
+{
+  m_pHook->LoadZoneFile(m_zonePath);
+
+  // A released result is taken again by the next resolution.
+  addrinfo* pFirst = NULL;
+  TS_ASSERT_EQUALS(0, Resolve("server", NULL, AF_UNSPEC, 0, 0, &pFirst));
+  ::freeaddrinfo(pFirst);
+
+  addrinfo* pSecond = NULL;
+  TS_ASSERT_EQUALS(0, Resolve("db", NULL, AF_INET, SOCK_STREAM, 0, &pSecond));
+  TS_ASSERT_EQUALS(pFirst, pSecond);
+
+  // Results larger than a slab span several of them.
+  for (int index = 0; index < 40; ++index)
+  {
+    char address[32];
+    ::snprintf(address, sizeof(address), "10.1.0.%d", index + 1);
+    m_pHook->AddRecord("many", address);
+  }
+
+  addrinfo* pMany = NULL;
+  TS_ASSERT_EQUALS(0, Resolve("many", NULL, AF_INET, 0, 0, &pMany));
+  TS_ASSERT_EQUALS(120u, Count(pMany));
+  ::freeaddrinfo(pMany);
+  ::freeaddrinfo(pSecond);
+}
+
+/*****************************************************************************/
+void Test_netdb_hook::TestPassThrough(void)
+{
+  delete m_pHook;
+  m_pHook = new cxxhook::Netdb_hook(true);
+  m_pHook->LoadZoneFile(m_zonePath);
+
+  addrinfo* pZone = NULL;
+  TS_ASSERT_EQUALS(0, Resolve("server", NULL, AF_INET, SOCK_STREAM, 0, &pZone));
+
+  // localhost is not in the zone, so the real resolver allocates the
+  // result, and freeaddrinfo must return it to the real resolver rather
+  // than to the pool.
+  addrinfo* pReal = NULL;
+  TS_ASSERT_EQUALS(0, Resolve("localhost", NULL, AF_INET, SOCK_STREAM, 0, &pReal));
+  TS_ASSERT(pReal);
+  ::freeaddrinfo(pReal);
+  ::freeaddrinfo(pZone);
+
+  addrinfo* pNext = NULL;
+  TS_ASSERT_EQUALS(0, Resolve("db", NULL, AF_INET, SOCK_STREAM, 0, &pNext));
+  TS_ASSERT_EQUALS(pZone, pNext);
+  TS_ASSERT_DIFFERS(pReal, pNext);
+  ::freeaddrinfo(pNext);
+
+  // The hooks remain in the path for names the zone does not hold.
+  char host[NI_MAXHOST] = "";
+  sockaddr_in address;
+  ::memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  ::inet_pton(AF_INET, "10.0.0.9", &address.sin_addr);
+  TS_ASSERT_EQUALS(0, ::getnameinfo((sockaddr*)&address, sizeof(address), host, sizeof(host), NULL, 0, 0));
+  TS_ASSERT_EQUALS(std::string("db.example.com"), host);
+}
+
+#endif
@@ -0,0 +1,783 @@
+/** Test_pthread_hook
+ *
+ * @file Test_pthread_hook.h
+ *
+ * Verifies the cooperative scheduler of PThread_hook: the threads created
+ * inside Run become fibers on the calling OS thread, run in a repeatable
+ * order, and block and wake through the hooked synchronization functions.
+ *
+ * The fibers only record what they observe; the checks are made after Run
+ * returns, on the stack of the test.
+ *
+ * Build:
+ *   cxxtestgen --template=../ForkServer.tpl -o Runner.cpp Src/Test_pthread_hook.h
+ *   g++ -I../cxxtest -I.. Runner.cpp ../../src/api/posix/pthread/pthread_hook.cpp ../../src/ApiHook.cpp ../../src/SlotMatcher.cpp -ldl -pthread
+ *
+ * The MIT License(MIT)
+ * @copyright 2014 Paul M Watt
+ *
+ */
+#ifndef Test_pthread_hook_H_INCLUDED
+#define Test_pthread_hook_H_INCLUDED
+
+#include <cxxtest/TestSuite.h>
+#include "../../../src/api/posix/pthread/pthread_hook.h"
+
+#include <cerrno>
+#include <string>
+
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <signal.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+/** Test_pthread_hook
+ * @brief Test_pthread_hook Test Suite class.
+ *****************************************************************************/
+class Test_pthread_hook : public CxxTest::TestSuite
+{
+public:
+
+  Test_pthread_hook()
+    : m_pHook(NULL)
+  { }
+
+  /* Fixture Management ******************************************************/
+  // setUp will be called before each test case in order to setup common fixtures.
+  virtual void setUp()
+  {
+    m_pHook = new cxxhook::PThread_hook;
+  }
+
+  // tearDown will be called after each test case to clean up common resources.
+  virtual void tearDown()
+  {
+    delete m_pHook;
+    m_pHook = NULL;
+  }
+
+protected:
+  /* Test Suite Data *********************************************************/
+  cxxhook::PThread_hook*  m_pHook;
+
+  static const size_t     k_fiberCount = 2000;
+
+  static volatile sig_atomic_t sm_signals;
+
+  /// The state shared by the fibers of a test.
+  struct Context
+  {
+    pthread_mutex_t   mutex;
+    pthread_mutex_t   other;
+    pthread_cond_t    cond;
+    pthread_rwlock_t  rwlock;
+    sem_t             sem;
+    pthread_barrier_t barrier;
+    std::string       order;
+    size_t            count;
+    size_t            value;
+    int               result[8];
+    pid_t             threadId;
+  };
+
+  /// The argument of a fiber that records its letter in the order.
+  struct Letter
+  {
+    Context*  pContext;
+    char      letter;
+  };
+
+  /* Creator Methods *********************************************************/
+  static pid_t GetThreadId()
+  {
+    return (pid_t)::syscall(SYS_gettid);
+  }
+
+  /// Returns an absolute time on a clock, a number of milliseconds from now.
+  static timespec GetDeadline(clockid_t clock, long ms)
+  {
+    timespec deadline;
+    ::clock_gettime(clock, &deadline);
+    deadline.tv_nsec += ms * 1000000;
+    deadline.tv_sec  += deadline.tv_nsec / 1000000000;
+    deadline.tv_nsec %= 1000000000;
+    return deadline;
+  }
+
+  static uint64_t GetElapsedMs(const timespec& start)
+  {
+    timespec now;
+    ::clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)(now.tv_sec - start.tv_sec) * 1000
+         + (uint64_t)((now.tv_nsec - start.tv_nsec) / 1000000);
+  }
+
+  /// Appends its letter to the order, yields, and appends it again.
+  static void* OrderFiber(void* pArg)
+  {
+    const Letter* pLetter = (const Letter*)pArg;
+
+    pLetter->pContext->order += pLetter->letter;
+    ::sched_yield();
+    pLetter->pContext->order += (char)(pLetter->letter - 'A' + 'a');
+    return NULL;
+  }
+
+  static void* OrderMain(void* pArg)
+  {
+    Letter letters[3] =
+    {
+      { (Context*)pArg, 'A' },
+      { (Context*)pArg, 'B' },
+      { (Context*)pArg, 'C' }
+    };
+
+    pthread_t threads[3];
+    for (size_t index = 0; index < 3; ++index)
+    {
+      ::pthread_create(&threads[index], NULL, OrderFiber, &letters[index]);
+    }
+
+    for (size_t index = 0; index < 3; ++index)
+    {
+      ::pthread_join(threads[index], NULL);
+    }
+
+    return NULL;
+  }
+
+  /// Increments the count under the mutex, yielding while it holds it.
+  static void* CountFiber(void* pArg)
+  {
+    Context* pContext = (Context*)pArg;
+
+    ::pthread_mutex_lock(&pContext->mutex);
+    const size_t count = pContext->count;
+    ::sched_yield();
+    pContext->count = count + 1;
+    ::pthread_mutex_unlock(&pContext->mutex);
+
+    if (GetThreadId() != pContext->threadId)
+    {
+      ++pContext->value;
+    }
+
+    return pArg;
+  }
+
+  static void* CountMain(void* pArg)
+  {
+    static pthread_t s_threads[k_fiberCount];
+
+    for (size_t index = 0; index < k_fiberCount; ++index)
+    {
+      ::pthread_create(&s_threads[index], NULL, CountFiber, pArg);
+    }
+
+    size_t joined = 0;
+    for (size_t index = 0; index < k_fiberCount; ++index)
+    {
+      void* pResult = NULL;
+      if ( 0 == ::pthread_join(s_threads[index], &pResult)
+        && pArg == pResult)
+      {
+        ++joined;
+      }
+    }
+
+    return (void*)joined;
+  }
+
+  static void* LockFiber(void* pArg)
+  {
+    Context* pContext = (Context*)pArg;
+    pContext->result[2] = ::pthread_mutex_trylock(&pContext->mutex);
+    pContext->result[3] = ::pthread_mutex_unlock(&pContext->mutex);
+
+    const timespec deadline = GetDeadline(CLOCK_REALTIME, 10);
+    pContext->result[4] = ::pthread_mutex_timedlock(&pContext->mutex, &deadline);
+    return NULL;
+  }
+
+  static void* MutexTypesMain(void* pArg)
+  {
+    Context* pContext = (Context*)pArg;
+
+    pthread_mutexattr_t attr;
+    ::pthread_mutexattr_init(&attr);
+    ::pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    ::pthread_mutex_init(&pContext->mutex, &attr);
+    ::pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_ERRORCHECK);
+    ::pthread_mutex_init(&pContext->other, &attr);
+    ::pthread_mutexattr_destroy(&attr);
+
+    ::pthread_mutex_lock(&pContext->mutex);
+    pContext->result[0] = ::pthread_mutex_lock(&pContext->mutex);
+
+    ::pthread_mutex_lock(&pContext->other);
+    pContext->result[1] = ::pthread_mutex_lock(&pContext->other);
+
+    // The other fiber can neither take nor release the recursive mutex.
+    pthread_t thread;
+    ::pthread_create(&thread, NULL, LockFiber, pArg);
+    ::pthread_join(thread, NULL);
+
+    pContext->result[5] = ::pthread_mutex_destroy(&pContext->mutex);
+    ::pthread_mutex_unlock(&pContext->mutex);
+    ::pthread_mutex_unlock(&pContext->mutex);
+    ::pthread_mutex_unlock(&pContext->other);
+    pContext->result[6] = ::pthread_mutex_destroy(&pContext->mutex);
+    ::pthread_mutex_destroy(&pContext->other);
+    return NULL;
+  }
+
+  static void* DeadlockFiber(void* pArg)
+  {
+    Context* pContext = (Context*)pArg;
+    ::pthread_mutex_lock(&pContext->other);
+    ::sched_yield();
+    ::pthread_mutex_lock(&pContext->mutex);
+    return NULL;
+  }
+
+  static void* DeadlockMain(void* pArg)
+  {
+    Context* pContext = (Context*)pArg;
+
+    pthread_t thread;
+    ::pthread_create(&thread, NULL, DeadlockFiber, pArg);
+
+    ::pthread_mutex_lock(&pContext->mutex);
+    ::sched_yield();
+    ::pthread_mutex_lock(&pContext->other);
+
+    ++pContext->count;
+    return NULL;
+  }
+
+  /// Waits for each value, and acknowledges it.
+  static void* ConsumerFiber(void* pArg)
+  {
+    Context* pContext = (Context*)pArg;
+
+    ::pthread_mutex_lock(&pContext->mutex);
+    for (size_t expected = 1; expected <= 100; ++expected)
+    {
+      while (pContext->value != expected)
+      {
+        ::pthread_cond_wait(&pContext->cond, &pContext->mutex);
+      }
+
+      ++pContext->count;
+      ::pthread_cond_broadcast(&pContext->cond);
+    }
+
+    ::pthread_mutex_unlock(&pContext->mutex);
+    return NULL;
+  }
+
+  static void* ConditionMain(void* pArg)
+  {
+    Context* pContext = (Context*)pArg;
+
+    pthread_t thread;
+    ::pthread_create(&thread, NULL, ConsumerFiber, pArg);
+
+    ::pthread_mutex_lock(&pContext->mutex);
+    for (size_t value = 1; value <= 100; ++value)
+    {
+      pContext->value = value;
+      ::pthread_cond_broadcast(&pContext->cond);
+      while (pContext->count != value)
+      {
+        ::pthread_cond_wait(&pContext->cond, &pContext->mutex);
+      }
+    }
+
+    ::pthread_mutex_unlock(&pContext->mutex);
+    ::pthread_join(thread, NULL);
+    return NULL;
+  }
+
+  static void* TimedWaitMain(void* pArg)
+  {
+    Context* pContext = (Context*)pArg;
+
+    pthread_condattr_t attr;
+    ::pthread_condattr_init(&attr);
+    ::pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    ::pthread_cond_init(&pContext->cond, &attr);
+    ::pthread_condattr_destroy(&attr);
+
+    // The deadline is on the clock of the condition variable.
+    timespec deadline = GetDeadline(CLOCK_MONOTONIC, 20);
+    ::pthread_mutex_lock(&pContext->mutex);
+    pContext->result[0] = ::pthread_cond_timedwait(&pContext->cond, &pContext->mutex, &deadline);
+    pContext->result[1] = ::pthread_mutex_trylock(&pContext->mutex);
+    ::pthread_mutex_unlock(&pContext->mutex);
+
+    deadline = GetDeadline(CLOCK_MONOTONIC, 20);
+    pContext->result[2] = ::sem_clockwait(&pContext->sem, CLOCK_MONOTONIC, &deadline) ? errno : 0;
+
+    ::pthread_cond_destroy(&pContext->cond);
+    return NULL;
+  }
+
+  static void* ReaderFiber(void* pArg)
+  {
+    Context* pContext = (Context*)pArg;
+    ::pthread_rwlock_rdlock(&pContext->rwlock);
+    pContext->order += 'r';
+    ::sched_yield();
+    pContext->order += 'R';
+    ::pthread_rwlock_unlock(&pContext->rwlock);
+    return NULL;
+  }
+
+  static void* WriterFiber(void* pArg)
+  {
+    Context* pContext = (Context*)pArg;
+    ::pthread_rwlock_wrlock(&pContext->rwlock);
+    pContext->order += 'w';
+    ::sched_yield();
+    pContext->order += 'W';
+    ::pthread_rwlock_unlock(&pContext->rwlock);
+    return NULL;
+  }
+
+  static void* RwLockMain(void* pArg)
+  {
+    Context* pContext = (Context*)pArg;
+
+    // Both readers hold the lock together, and the writer waits for them.
+    pthread_t threads[3];
+    ::pthread_create(&threads[0], NULL, ReaderFiber, pArg);
+    ::pthread_create(&threads[1], NULL, WriterFiber, pArg);
+    ::pthread_create(&threads[2], NULL, ReaderFiber, pArg);
+    for (size_t index = 0; index < 3; ++index)
+    {
+      ::pthread_join(threads[index], NULL);
+    }
+
+    pContext->result[0] = ::pthread_rwlock_wrlock(&pContext->rwlock);
+    pContext->result[1] = ::pthread_rwlock_tryrdlock(&pContext->rwlock);
+    pContext->result[2] = ::pthread_rwlock_wrlock(&pContext->rwlock);
+    ::pthread_rwlock_unlock(&pContext->rwlock);
+    return NULL;
+  }
+
+  static void* SemaphoreFiber(void* pArg)
+  {
+    Context* pContext = (Context*)pArg;
+    ::sem_wait(&pContext->sem);
+    ++pContext->count;
+    return NULL;
+  }
+
+  static void* BarrierFiber(void* pArg)
+  {
+    Context* pContext = (Context*)pArg;
+    pContext->order += 'b';
+    if (PTHREAD_BARRIER_SERIAL_THREAD == ::pthread_barrier_wait(&pContext->barrier))
+    {
+      ++pContext->value;
+    }
+
+    pContext->order += 'B';
+    return NULL;
+  }
+
+  static void* SemaphoreMain(void* pArg)
+  {
+    Context* pContext = (Context*)pArg;
+
+    pthread_t threads[3];
+    for (size_t index = 0; index < 3; ++index)
+    {
+      ::pthread_create(&threads[index], NULL, SemaphoreFiber, pArg);
+    }
+
+    // Every fiber waits until a post releases it.
+    ::sched_yield();
+    pContext->result[0] = (int)pContext->count;
+    ::sem_post(&pContext->sem);
+    ::sem_post(&pContext->sem);
+    ::sched_yield();
+    pContext->result[1] = (int)pContext->count;
+    ::sem_post(&pContext->sem);
+    for (size_t index = 0; index < 3; ++index)
+    {
+      ::pthread_join(threads[index], NULL);
+    }
+
+    ::pthread_barrier_init(&pContext->barrier, NULL, 3);
+    for (size_t index = 0; index < 3; ++index)
+    {
+      ::pthread_create(&threads[index], NULL, BarrierFiber, pArg);
+    }
+
+    for (size_t index = 0; index < 3; ++index)
+    {
+      ::pthread_join(threads[index], NULL);
+    }
+
+    ::pthread_barrier_destroy(&pContext->barrier);
+    return NULL;
+  }
+
+  static void* ExitFiber(void* pArg)
+  {
+    ::pthread_exit(pArg);
+    return NULL;
+  }
+
+  static void* DetachedFiber(void* pArg)
+  {
+    ++((Context*)pArg)->count;
+    return NULL;
+  }
+
+  static void* LifetimeMain(void* pArg)
+  {
+    Context* pContext = (Context*)pArg;
+
+    pthread_t thread;
+    void*     pResult = NULL;
+    ::pthread_create(&thread, NULL, ExitFiber, pArg);
+    pContext->result[0] = ::pthread_join(thread, &pResult);
+    pContext->result[1] = (pArg == pResult);
+
+    pthread_attr_t attr;
+    ::pthread_attr_init(&attr);
+    ::pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    ::pthread_create(&thread, &attr, DetachedFiber, pArg);
+    ::pthread_attr_destroy(&attr);
+    pContext->result[2] = ::pthread_join(thread, NULL);
+
+    ::pthread_create(&thread, NULL, DetachedFiber, pArg);
+    pContext->result[3] = ::pthread_detach(thread);
+    pContext->result[4] = ::pthread_join(::pthread_self(), NULL);
+    return NULL;
+  }
+
+  static void* NestedMain(void* pArg)
+  {
+    cxxhook::PThread_hook* pHook = (cxxhook::PThread_hook*)pArg;
+    return (void*)(intptr_t)pHook->Run(CountMain, NULL);
+  }
+
+  static void* ThreadIdMain(void* pArg)
+  {
+    ((Context*)pArg)->threadId = GetThreadId();
+    return pArg;
+  }
+
+  /// Names itself, and appends the name it reads back to the order.
+  static void* NameFiber(void* pArg)
+  {
+    Context* pContext = (Context*)pArg;
+
+    char name[16] = "";
+    ::pthread_setname_np(::pthread_self(), "child");
+    ::pthread_getname_np(::pthread_self(), name, sizeof(name));
+    pContext->order += name;
+    ::sched_yield();
+    return NULL;
+  }
+
+  static void* EmptyFiber(void*)
+  {
+    return NULL;
+  }
+
+  static void CountSignal(int)
+  {
+    ++sm_signals;
+  }
+
+  static void* ThreadFunctionsMain(void* pArg)
+  {
+    Context* pContext = (Context*)pArg;
+
+    pthread_t thread;
+    pthread_t finished;
+    ::pthread_create(&thread,   NULL, NameFiber,  pArg);
+    ::pthread_create(&finished, NULL, EmptyFiber, pArg);
+    ::sched_yield();
+
+    // The name the other fiber set is read through its pthread_t.
+    char name[16] = "";
+    pContext->result[0] = ::pthread_getname_np(thread, name, sizeof(name));
+    pContext->order    += '/';
+    pContext->order    += name;
+    pContext->result[1] = ::pthread_setname_np(thread, "a name that is too long");
+
+    // The attributes describe the stack of this fiber.
+    pthread_attr_t attr;
+    void*          pStack    = NULL;
+    size_t         stackSize = 0;
+    pContext->result[2] = ::pthread_getattr_np(::pthread_self(), &attr);
+    ::pthread_attr_getstack(&attr, &pStack, &stackSize);
+    ::pthread_attr_destroy(&attr);
+    pContext->value = stackSize;
+    pContext->count = (char*)pStack <= (char*)&attr
+                   && (char*)&attr  <  (char*)pStack + stackSize;
+
+    sched_param param = sched_param();
+    int         policy = -1;
+    ::pthread_setschedparam(thread, SCHED_BATCH, &param);
+    ::pthread_getschedparam(thread, &policy, &param);
+    pContext->result[3] = policy;
+
+    pContext->result[4] = ::pthread_kill(thread, 0);
+    pContext->result[5] = ::pthread_cancel(thread);
+    pContext->result[6] = ::pthread_kill(thread, SIGUSR1);
+    pContext->result[7] = ::pthread_kill(finished, 0);
+
+    ::pthread_join(thread,   NULL);
+    ::pthread_join(finished, NULL);
+    return NULL;
+  }
+
+public:
+  /* Test Cases **************************************************************/
+  void TestRun(void);
+  void TestOrder(void);
+  void TestManyFibers(void);
+  void TestMutexTypes(void);
+  void TestDeadlock(void);
+  void TestCondition(void);
+  void TestTimedWait(void);
+  void TestRwLock(void);
+  void TestSemaphoreAndBarrier(void);
+  void TestLifetime(void);
+  void TestNestedRun(void);
+  void TestPassThrough(void);
+  void TestThreadFunctions(void);
+
+};
+
+volatile sig_atomic_t Test_pthread_hook::sm_signals = 0;
+
+/*****************************************************************************/
+void Test_pthread_hook::TestRun(void)
+{
+  Context context = Context();
+  void*   pResult = NULL;
+
+  TS_ASSERT_EQUALS(0, m_pHook->Run(ThreadIdMain, &context, &pResult));
+  TS_ASSERT_EQUALS(GetThreadId(), context.threadId);
+  TS_ASSERT_EQUALS((void*)&context, pResult);
+}
+
+/*****************************************************************************/
+void Test_pthread_hook::TestOrder(void)
+{
+  // The fibers run in the order they were created, and a yield moves a
+  // fiber to the back of the queue.  Every run gives the same order.
+  for (size_t run = 0; run < 3; ++run)
+  {
+    Context context = Context();
+    TS_ASSERT_EQUALS(0, m_pHook->Run(OrderMain, &context));
+    TS_ASSERT_EQUALS(std::string("ABCabc"), context.order);
+  }
+}
+
+/*****************************************************************************/
+void Test_pthread_hook::TestManyFibers(void)
+{
+  Context context = Context();
+  ::pthread_mutex_init(&context.mutex, NULL);
+  context.threadId = GetThreadId();
+
+  void* pJoined = NULL;
+  TS_ASSERT_EQUALS(0, m_pHook->Run(CountMain, &context, &pJoined));
+  TS_ASSERT_EQUALS(k_fiberCount, (size_t)pJoined);
+  TS_ASSERT_EQUALS(k_fiberCount, context.count);
+
+  // No fiber ran on another OS thread.
+  TS_ASSERT_EQUALS(0u, context.value);
+
+  // The stacks of the finished fibers are reused by the next run.
+  TS_ASSERT_EQUALS(0, m_pHook->Run(CountMain, &context, &pJoined));
+  TS_ASSERT_EQUALS(2 * k_fiberCount, context.count);
+
+  ::pthread_mutex_destroy(&context.mutex);
+}
+
+/*****************************************************************************/
+void Test_pthread_hook::TestMutexTypes(void)
+{
+  Context context = Context();
+  TS_ASSERT_EQUALS(0, m_pHook->Run(MutexTypesMain, &context));
+
+  TS_ASSERT_EQUALS(0,         context.result[0]);
+  TS_ASSERT_EQUALS(EDEADLK,   context.result[1]);
+  TS_ASSERT_EQUALS(EBUSY,     context.result[2]);
+  TS_ASSERT_EQUALS(EPERM,     context.result[3]);
+  TS_ASSERT_EQUALS(ETIMEDOUT, context.result[4]);
+  TS_ASSERT_EQUALS(EBUSY,     context.result[5]);
+  TS_ASSERT_EQUALS(0,         context.result[6]);
+}
+
+/*****************************************************************************/
+void Test_pthread_hook::TestDeadlock(void)
+{
+  Context context = Context();
+  ::pthread_mutex_init(&context.mutex, NULL);
+  ::pthread_mutex_init(&context.other, NULL);
+
+  TS_ASSERT_EQUALS(EDEADLK, m_pHook->Run(DeadlockMain, &context));
+  TS_ASSERT_EQUALS(0u, context.count);
+
+  // The scheduler is released, and runs the next test.
+  Context next = Context();
+  TS_ASSERT_EQUALS(0, m_pHook->Run(OrderMain, &next));
+  TS_ASSERT_EQUALS(std::string("ABCabc"), next.order);
+}
+
+/*****************************************************************************/
+void Test_pthread_hook::TestCondition(void)
+{
+  Context context = Context();
+  ::pthread_mutex_init(&context.mutex, NULL);
+  ::pthread_cond_init(&context.cond, NULL);
+
+  TS_ASSERT_EQUALS(0, m_pHook->Run(ConditionMain, &context));
+  TS_ASSERT_EQUALS(100u, context.count);
+
+  ::pthread_cond_destroy(&context.cond);
+  ::pthread_mutex_destroy(&context.mutex);
+}
+
+/*****************************************************************************/
+void Test_pthread_hook::TestTimedWait(void)
+{
+  Context context = Context();
+  ::pthread_mutex_init(&context.mutex, NULL);
+  ::sem_init(&context.sem, 0, 0);
+
+  timespec start;
+  ::clock_gettime(CLOCK_MONOTONIC, &start);
+  TS_ASSERT_EQUALS(0, m_pHook->Run(TimedWaitMain, &context));
+  TS_ASSERT_LESS_THAN_EQUALS(40u, GetElapsedMs(start));
+
+  // The mutex is held again when the wait times out.
+  TS_ASSERT_EQUALS(ETIMEDOUT, context.result[0]);
+  TS_ASSERT_EQUALS(EBUSY,     context.result[1]);
+  TS_ASSERT_EQUALS(ETIMEDOUT, context.result[2]);
+
+  ::sem_destroy(&context.sem);
+  ::pthread_mutex_destroy(&context.mutex);
+}
+
+/*****************************************************************************/
+void Test_pthread_hook::TestRwLock(void)
+{
+  Context context = Context();
+  ::pthread_rwlock_init(&context.rwlock, NULL);
+
+  TS_ASSERT_EQUALS(0, m_pHook->Run(RwLockMain, &context));
+  TS_ASSERT_EQUALS(std::string("rrRRwW"), context.order);
+  TS_ASSERT_EQUALS(0,       context.result[0]);
+  TS_ASSERT_EQUALS(EBUSY,   context.result[1]);
+  TS_ASSERT_EQUALS(EDEADLK, context.result[2]);
+
+  ::pthread_rwlock_destroy(&context.rwlock);
+}
+
+/*****************************************************************************/
+void Test_pthread_hook::TestSemaphoreAndBarrier(void)
+{
+  Context context = Context();
+  ::sem_init(&context.sem, 0, 0);
+
+  TS_ASSERT_EQUALS(0, m_pHook->Run(SemaphoreMain, &context));
+  TS_ASSERT_EQUALS(0, context.result[0]);
+  TS_ASSERT_EQUALS(2, context.result[1]);
+  TS_ASSERT_EQUALS(3u, context.count);
+
+  // No fiber leaves the barrier before the last one arrives, and exactly
+  // one of them is told it was the last.
+  TS_ASSERT_EQUALS(std::string("bbbBBB"), context.order);
+  TS_ASSERT_EQUALS(1u, context.value);
+
+  ::sem_destroy(&context.sem);
+}
+
+/*****************************************************************************/
+void Test_pthread_hook::TestLifetime(void)
+{
+  Context context = Context();
+  TS_ASSERT_EQUALS(0, m_pHook->Run(LifetimeMain, &context));
+
+  TS_ASSERT_EQUALS(0,       context.result[0]);
+  TS_ASSERT_EQUALS(1,       context.result[1]);
+  TS_ASSERT_EQUALS(EINVAL,  context.result[2]);
+  TS_ASSERT_EQUALS(0,       context.result[3]);
+  TS_ASSERT_EQUALS(EDEADLK, context.result[4]);
+
+  // Both detached fibers still ran to the end.
+  TS_ASSERT_EQUALS(2u, context.count);
+}
+
+/*****************************************************************************/
+void Test_pthread_hook::TestNestedRun(void)
+{
+  void* pResult = NULL;
+  TS_ASSERT_EQUALS(0, m_pHook->Run(NestedMain, m_pHook, &pResult));
+  TS_ASSERT_EQUALS(EBUSY, (int)(intptr_t)pResult);
+}
+
+/*****************************************************************************/
+void Test_pthread_hook::TestPassThrough(void)
+{
+  // Outside of Run, a thread is a real OS thread.
+  Context   context = Context();
+  pthread_t thread;
+  TS_ASSERT_EQUALS(0, ::pthread_create(&thread, NULL, ThreadIdMain, &context));
+  TS_ASSERT_EQUALS(0, ::pthread_join(thread, NULL));
+  TS_ASSERT_DIFFERS(0, context.threadId);
+  TS_ASSERT_DIFFERS(GetThreadId(), context.threadId);
+
+  pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+  TS_ASSERT_EQUALS(0, ::pthread_mutex_lock(&mutex));
+  TS_ASSERT_EQUALS(EBUSY, ::pthread_mutex_trylock(&mutex));
+  TS_ASSERT_EQUALS(0, ::pthread_mutex_unlock(&mutex));
+}
+
+/*****************************************************************************/
+void Test_pthread_hook::TestThreadFunctions(void)
+{
+  struct sigaction action = {};
+  struct sigaction previous;
+  action.sa_handler = CountSignal;
+  ::sigaction(SIGUSR1, &action, &previous);
+  sm_signals = 0;
+
+  // pthread_self returns a fiber, and the functions that read a pthread_t
+  // answer for it instead of reading it as an OS thread.
+  Context context = Context();
+  TS_ASSERT_EQUALS(0, m_pHook->Run(ThreadFunctionsMain, &context));
+  ::sigaction(SIGUSR1, &previous, NULL);
+
+  TS_ASSERT_EQUALS(std::string("child/child"), context.order);
+  TS_ASSERT_EQUALS(0,           context.result[0]);
+  TS_ASSERT_EQUALS(ERANGE,      context.result[1]);
+  TS_ASSERT_EQUALS(0,           context.result[2]);
+  TS_ASSERT_EQUALS(cxxhook::PThread_hook::k_defaultStackSize, context.value);
+  TS_ASSERT_EQUALS(1u,          context.count);
+  TS_ASSERT_EQUALS(SCHED_BATCH, context.result[3]);
+  TS_ASSERT_EQUALS(0,           context.result[4]);
+  TS_ASSERT_EQUALS(ENOTSUP,     context.result[5]);
+  TS_ASSERT_EQUALS(0,           context.result[6]);
+  TS_ASSERT_EQUALS(ESRCH,       context.result[7]);
+
+  // The signal went to this OS thread.
+  TS_ASSERT_EQUALS(1, sm_signals);
+}
+
+#endif